@@ -191,6 +191,7 @@ int csync_update(CSYNC *ctx) {
     return -1;
   }
   ctx->status_code = CSYNC_STATUS_OK;
+  ZERO_STRUCT(ctx->stats);
 
   /* create/load statedb */
     rc = asprintf(&ctx->statedb.file, "%s/.csync_journal.db",
@@ -374,16 +375,11 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
 
     if (!other_node) {
         /* Check the renamed path as well. */
-        int len;
         uint64_t h = 0;
-        char *renamed_path = csync_rename_adjust_path(ctx, cur->path);
 
-        if (!c_streq(renamed_path, cur->path)) {
-            len = strlen( renamed_path );
-            h = c_jhash64((uint8_t *) renamed_path, len, 0);
+        if (csync_rename_adjust_phash(ctx, cur->path, &h)) {
             other_node = c_rbtree_find(other_tree, &h);
         }
-        SAFE_FREE(renamed_path);
     }
 
     if (obj == NULL || data == NULL) {
@@ -789,3 +785,12 @@ int csync_set_read_from_db(CSYNC* ctx, int enabled)
     return 0;
 }
 
+int csync_set_statedb_connection(CSYNC *ctx, struct sqlite3 *db)
+{
+    if (ctx == NULL) {
+        return -1;
+    }
+    ctx->statedb.shared_db = db;
+    return 0;
+}
+
@@ -553,6 +553,15 @@ int  csync_abort_requested(CSYNC *ctx);
  */
 int csync_set_read_from_db(CSYNC* ctx, int enabled);
 
+struct sqlite3;
+
+/**
+ * Use an already open connection to the statedb instead of opening (and checking)
+ * the statedb in each phase. The connection stays owned by the caller and must
+ * stay open until csync_commit. Set NULL to let csync open the statedb again.
+ */
+int csync_set_statedb_connection(CSYNC *ctx, struct sqlite3 *db);
+
 char *csync_normalize_etag(const char *);
 time_t oc_httpdate_parse( const char *date );
 
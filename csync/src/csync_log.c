@@ -85,13 +85,11 @@ static void csync_log_function(int verbosity,
 {
     csync_log_callback log_fn = csync_get_log_callback();
     if (log_fn) {
-        char buf[1024];
-
-        snprintf(buf, sizeof(buf), "%s: %s", function, buffer);
-
+        /* the callback gets the function separately, it is up to it to
+         * prefix the message with it */
         log_fn(verbosity,
                function,
-               buf,
+               buffer,
                csync_get_log_userdata());
         return;
     }
@@ -0,0 +1,112 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "csync_parallel.h"
+
+extern "C" {
+#include "csync.h"
+}
+
+#include <atomic>
+#include <cstdlib>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct parallel_job {
+    size_t count;
+    std::atomic<size_t> next;
+    void (*fn)(size_t, void *);
+    void *userdata;
+    // The log settings are thread local
+    int log_level;
+    csync_log_callback log_callback;
+    void *log_userdata;
+};
+
+void run_tasks(parallel_job *job)
+{
+    size_t i;
+    while ((i = job->next.fetch_add(1)) < job->count) {
+        job->fn(i, job->userdata);
+    }
+}
+
+void worker(parallel_job *job)
+{
+    csync_set_log_level(job->log_level);
+    csync_set_log_callback(job->log_callback);
+    csync_set_log_userdata(job->log_userdata);
+    run_tasks(job);
+}
+
+}
+
+extern "C" {
+
+int csync_parallel_thread_count(void)
+{
+    const char *env = getenv("CSYNC_RECONCILE_THREADS");
+    if (env) {
+        int threads = atoi(env);
+        return threads > 0 ? threads : 1;
+    }
+    int cores = std::thread::hardware_concurrency();
+    if (cores < 1) {
+        return 1;
+    }
+    return cores < 8 ? cores : 8;
+}
+
+void csync_parallel_for(size_t count, int threads,
+                        void (*fn)(size_t index, void *userdata), void *userdata)
+{
+    parallel_job job;
+    job.count = count;
+    job.next = 0;
+    job.fn = fn;
+    job.userdata = userdata;
+    job.log_level = csync_get_log_level();
+    job.log_callback = csync_get_log_callback();
+    job.log_userdata = csync_get_log_userdata();
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    if ((size_t) threads > count) {
+        threads = count;
+    }
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; ++i) {
+        try {
+            workers.push_back(std::thread(worker, &job));
+        } catch (const std::system_error &) {
+            // Out of threads, the ones we have do the rest
+            break;
+        }
+    }
+    run_tasks(&job);
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+}
+
+}
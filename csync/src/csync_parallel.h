@@ -0,0 +1,48 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief The number of threads csync_parallel_for() should use.
+ *
+ * That is the value of the CSYNC_RECONCILE_THREADS environment variable if
+ * it is set, otherwise the number of cores but at most 8.
+ */
+int csync_parallel_thread_count(void);
+
+/**
+ * @brief Calls fn(index, userdata) for each index in [0, count[ on up to
+ * threads threads, the calling one included.
+ *
+ * The tasks are handed out in order of their index. The workers log with the
+ * log level and callback of the calling thread. Returns once all the tasks
+ * are done.
+ */
+void csync_parallel_for(size_t count, int threads,
+                        void (*fn)(size_t index, void *userdata), void *userdata);
+
+#ifdef __cplusplus
+}
+#endif
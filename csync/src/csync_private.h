@@ -103,15 +103,24 @@ struct csync_s {
   struct {
     char *file;
     sqlite3 *db;
+    sqlite3 *shared_db; /* connection owned by the caller, see csync_set_statedb_connection */
     int exists;
 
     sqlite3_stmt* by_hash_stmt;
     sqlite3_stmt* by_fileid_stmt;
     sqlite3_stmt* by_inode_stmt;
+    sqlite3_stmt* below_path_stmt;
 
     int lastReturnValue;
   } statedb;
 
+  /* counters of the last update and reconcile, read by the sync statistics */
+  struct {
+    int64_t statedb_queries;
+    int64_t remote_dirs_fetched;
+    int64_t remote_dirs_from_db;
+  } stats;
+
   struct {
     char *uri;
     c_rbtree_t *tree;
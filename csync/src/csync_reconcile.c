@@ -25,6 +25,7 @@
 #include "csync_util.h"
 #include "csync_statedb.h"
 #include "csync_rename.h"
+#include "csync_parallel.h"
 #include "c_jhash.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.reconciler"
@@ -32,11 +33,49 @@
 
 #include "inttypes.h"
 
+/* Below that many entries, the threads cost more than they save */
+#define CSYNC_RECONCILE_PARALLEL_MIN 10000
+/* Buckets of top level subtrees per thread, so that the big ones even out */
+#define CSYNC_RECONCILE_BUCKETS_PER_THREAD 16
+
+/* The state of the reconciliation of a part of the tree */
+typedef struct csync_reconcile_worker_s {
+  CSYNC *ctx;
+  c_rbtree_t *other_tree;
+  /* the ancestor-ignore verdicts of the parent directories missing from other_tree */
+  c_rbtree_t *ignore_cache;
+  /* other threads reconcile the other subtrees at the same time */
+  bool parallel;
+} csync_reconcile_worker_t;
+
+typedef struct csync_ignore_verdict_s {
+  uint64_t phash; /* of the directory, first for the comparison functions */
+  c_rbnode_t *ignored; /* the node of the ignored ancestor, NULL if there is none */
+} csync_ignore_verdict_t;
+
+static int _ignore_key_cmp(const void *key, const void *data) {
+  uint64_t a = *(uint64_t *) key;
+  uint64_t b = ((csync_ignore_verdict_t *) data)->phash;
+
+  return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+static int _ignore_data_cmp(const void *key, const void *data) {
+  return _ignore_key_cmp(&((csync_ignore_verdict_t *) key)->phash, data);
+}
+
+static void _ignore_verdict_free(void *data) {
+  SAFE_FREE(data);
+}
+
 /* Check if a file is ignored because one parent is ignored.
- * return the node of the ignored directoy if it's the case, or NULL if it is not ignored */
-static c_rbnode_t *_csync_check_ignored(c_rbtree_t *tree, const char *path, int pathlen) {
+ * return the node of the ignored directoy if it's the case, or NULL if it is not ignored.
+ * The verdicts of the directories that are not in the tree are remembered in cache,
+ * so that the ancestors of their content is only hashed once. */
+static c_rbnode_t *_csync_check_ignored(c_rbtree_t *tree, c_rbtree_t *cache, const char *path, int pathlen) {
     uint64_t h = 0;
     c_rbnode_t *node = NULL;
+    csync_ignore_verdict_t *verdict = NULL;
 
     /* compute the size of the parent directory */
     int parentlen = pathlen - 1;
@@ -58,10 +97,29 @@ static c_rbnode_t *_csync_check_ignored(c_rbtree_t *tree, const char *path, int
             /* Not ignored */
             return NULL;
         }
-    } else {
-        /* Try if the parent itself is ignored */
-        return _csync_check_ignored(tree, path, parentlen);
     }
+
+    if (cache) {
+        node = c_rbtree_find(cache, &h);
+        if (node) {
+            return ((csync_ignore_verdict_t *) node->data)->ignored;
+        }
+    }
+
+    /* Try if the parent itself is ignored */
+    node = _csync_check_ignored(tree, cache, path, parentlen);
+
+    if (cache) {
+        verdict = c_malloc(sizeof(csync_ignore_verdict_t));
+        if (verdict) {
+            verdict->phash = h;
+            verdict->ignored = node;
+            if (c_rbtree_insert(cache, verdict) != 0) {
+                SAFE_FREE(verdict);
+            }
+        }
+    }
+    return node;
 }
 
 /*
@@ -76,48 +134,45 @@ static c_rbnode_t *_csync_check_ignored(c_rbtree_t *tree, const char *path, int
  * file with the the source file. If the destination file is newer
  * (timestamp is newer), it is not overwritten. If both files, on the
  * source and the destination, have been changed, the newer file wins.
+ *
+ * When other threads reconcile the other subtrees, the entries that would
+ * need to look beyond their subtree are left alone and 1 is returned.
  */
 static int _csync_merge_algorithm_visitor(void *obj, void *data) {
+    csync_reconcile_worker_t *worker = (csync_reconcile_worker_t *) data;
     csync_file_stat_t *cur = NULL;
     csync_file_stat_t *other = NULL;
     csync_file_stat_t *tmp = NULL;
     uint64_t h = 0;
     int len = 0;
 
-    CSYNC *ctx = NULL;
-    c_rbtree_t *tree = NULL;
+    CSYNC *ctx = worker->ctx;
+    /* we need the opposite tree! */
+    c_rbtree_t *tree = worker->other_tree;
     c_rbnode_t *node = NULL;
 
     cur = (csync_file_stat_t *) obj;
-    ctx = (CSYNC *) data;
 
-    /* we need the opposite tree! */
-    switch (ctx->current) {
-    case LOCAL_REPLICA:
-        tree = ctx->remote.tree;
-        break;
-    case REMOTE_REPLICA:
-        tree = ctx->local.tree;
-        break;
-    default:
-        break;
+    if (worker->parallel && cur->instruction == CSYNC_INSTRUCTION_EVAL_RENAME) {
+        /* Looks up the statedb and the other subtrees */
+        return 1;
     }
 
     node = c_rbtree_find(tree, &cur->phash);
 
-    if (!node) {
+    if (!node && !csync_rename_empty(ctx)) {
         /* Check the renamed path as well. */
-        char *renamed_path = csync_rename_adjust_path(ctx, cur->path);
-        if (!c_streq(renamed_path, cur->path)) {
-            len = strlen( renamed_path );
-            h = c_jhash64((uint8_t *) renamed_path, len, 0);
+        if (csync_rename_adjust_phash(ctx, cur->path, &h)) {
+            if (worker->parallel) {
+                /* The other node belongs to another subtree */
+                return 1;
+            }
             node = c_rbtree_find(tree, &h);
         }
-        SAFE_FREE(renamed_path);
     }
     if (!node) {
         /* Check if it is ignored */
-        node = _csync_check_ignored(tree, cur->path, cur->pathlen);
+        node = _csync_check_ignored(tree, worker->ignore_cache, cur->path, cur->pathlen);
         /* If it is ignored, other->instruction will be  IGNORE so this one will also be ignored */
     }
 
@@ -330,22 +385,136 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
     return 0;
 }
 
+/* The entries of the current tree, grouped by top level subtree */
+typedef struct csync_reconcile_partition_s {
+  csync_reconcile_worker_t worker;
+  csync_file_stat_t **entries; /* the buckets one after the other */
+  size_t *bucket_start; /* bucket i is [bucket_start[i], bucket_start[i+1][ */
+  char *deferred; /* by entry, to be reconciled after the parallel pass */
+} csync_reconcile_partition_t;
+
+static size_t _csync_subtree_bucket(const csync_file_stat_t *st, size_t nbuckets) {
+  size_t len = 0;
+
+  while (len < st->pathlen && st->path[len] != '/') {
+    len++;
+  }
+  return c_jhash64((uint8_t *) st->path, len, 0) % nbuckets;
+}
+
+/* Reconciles one bucket. All the entries of a subtree, and the parent
+ * directories they look up, are in the same bucket: no other thread
+ * touches them. */
+static void _csync_reconcile_bucket(size_t bucket, void *data) {
+  csync_reconcile_partition_t *partition = (csync_reconcile_partition_t *) data;
+  csync_reconcile_worker_t worker = partition->worker;
+  size_t i;
+
+  if (c_rbtree_create(&worker.ignore_cache, _ignore_key_cmp, _ignore_data_cmp) < 0) {
+    worker.ignore_cache = NULL;
+  }
+  for (i = partition->bucket_start[bucket]; i < partition->bucket_start[bucket + 1]; i++) {
+    if (_csync_merge_algorithm_visitor(partition->entries[i], &worker) > 0) {
+      partition->deferred[i] = 1;
+    }
+  }
+  c_rbtree_destroy(worker.ignore_cache, _ignore_verdict_free);
+}
+
+static int _csync_reconcile_parallel(csync_reconcile_worker_t *worker, c_rbtree_t *tree, int threads) {
+  csync_reconcile_partition_t partition;
+  size_t count = c_rbtree_size(tree);
+  size_t nbuckets = (size_t) threads * CSYNC_RECONCILE_BUCKETS_PER_THREAD;
+  size_t *bucket_of = NULL;
+  c_rbnode_t *node = NULL;
+  size_t i;
+
+  partition.worker = *worker;
+  partition.worker.parallel = true;
+  partition.entries = c_malloc(count * sizeof(csync_file_stat_t *));
+  partition.bucket_start = c_calloc(nbuckets + 1, sizeof(size_t));
+  partition.deferred = c_calloc(count, sizeof(char));
+  bucket_of = c_malloc(count * sizeof(size_t));
+  if (!partition.entries || !partition.bucket_start || !partition.deferred || !bucket_of) {
+    SAFE_FREE(partition.entries);
+    SAFE_FREE(partition.bucket_start);
+    SAFE_FREE(partition.deferred);
+    SAFE_FREE(bucket_of);
+    return -1;
+  }
+
+  /* Sort the entries by bucket, in the order of the tree within a bucket */
+  i = 0;
+  for (node = c_rbtree_head(tree); node; node = c_rbtree_node_next(node)) {
+    bucket_of[i] = _csync_subtree_bucket((csync_file_stat_t *) node->data, nbuckets);
+    partition.bucket_start[bucket_of[i] + 1]++;
+    i++;
+  }
+  for (i = 0; i < nbuckets; i++) {
+    partition.bucket_start[i + 1] += partition.bucket_start[i];
+  }
+  i = 0;
+  for (node = c_rbtree_head(tree); node; node = c_rbtree_node_next(node)) {
+    /* bucket_start[b] is the next free slot of bucket b until the end of the loop */
+    partition.entries[partition.bucket_start[bucket_of[i]]++] = (csync_file_stat_t *) node->data;
+    i++;
+  }
+  for (i = nbuckets; i > 0; i--) {
+    partition.bucket_start[i] = partition.bucket_start[i - 1];
+  }
+  partition.bucket_start[0] = 0;
+  SAFE_FREE(bucket_of);
+
+  csync_parallel_for(nbuckets, threads, _csync_reconcile_bucket, &partition);
+
+  /* The renames look up the statedb and other subtrees */
+  for (i = 0; i < count; i++) {
+    if (partition.deferred[i]) {
+      _csync_merge_algorithm_visitor(partition.entries[i], worker);
+    }
+  }
+
+  SAFE_FREE(partition.entries);
+  SAFE_FREE(partition.bucket_start);
+  SAFE_FREE(partition.deferred);
+  return 0;
+}
+
 int csync_reconcile_updates(CSYNC *ctx) {
   int rc;
+  int threads;
   c_rbtree_t *tree = NULL;
+  csync_reconcile_worker_t worker;
+
+  worker.ctx = ctx;
+  worker.other_tree = NULL;
+  worker.ignore_cache = NULL;
+  worker.parallel = false;
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
       tree = ctx->local.tree;
+      worker.other_tree = ctx->remote.tree;
       break;
     case REMOTE_REPLICA:
       tree = ctx->remote.tree;
+      worker.other_tree = ctx->local.tree;
       break;
     default:
       break;
   }
 
-  rc = c_rbtree_walk(tree, (void *) ctx, _csync_merge_algorithm_visitor);
+  threads = csync_parallel_thread_count();
+  if (threads > 1 && (c_rbtree_size(tree)) >= CSYNC_RECONCILE_PARALLEL_MIN
+      && _csync_reconcile_parallel(&worker, tree, threads) == 0) {
+    return 0;
+  }
+
+  if (c_rbtree_create(&worker.ignore_cache, _ignore_key_cmp, _ignore_data_cmp) < 0) {
+    worker.ignore_cache = NULL;
+  }
+  rc = c_rbtree_walk(tree, (void *) &worker, _csync_merge_algorithm_visitor);
+  c_rbtree_destroy(worker.ignore_cache, _ignore_verdict_free);
   if( rc < 0 ) {
     ctx->status_code = CSYNC_STATUS_RECONCILE_ERROR;
   }
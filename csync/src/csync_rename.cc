@@ -20,20 +20,14 @@
 
 extern "C" {
 #include "csync_private.h"
+#include "c_jhash.h"
 }
 
-#include <map>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <algorithm>
 
-static std::string _parentDir(const std::string &path) {
-    int len = path.length();
-    while(len > 0 && path[len-1]!='/') len--;
-    while(len > 0 && path[len-1]=='/') len--;
-    return path.substr(0, len);
-}
-
 struct csync_rename_s {
     static csync_rename_s *get(CSYNC *ctx) {
         if (!ctx->rename_info) {
@@ -42,7 +36,80 @@ struct csync_rename_s {
         return reinterpret_cast<csync_rename_s *>(ctx->rename_info);
     }
 
-    std::map<std::string, std::string> folder_renamed_to; // map from->to
+    // The renamed folders, by path component
+    struct folder {
+        folder() : renamed(false) {}
+        ~folder() {
+            for (size_t i = 0; i < children.size(); ++i) {
+                delete children[i];
+            }
+        }
+
+        std::string name;
+        bool renamed;
+        std::string renamed_to;
+        std::vector<folder *> children; // sorted by name
+
+        struct name_less {
+            bool operator()(const folder *f, const std::pair<const char *, size_t> &name) const {
+                return f->name.compare(0, std::string::npos, name.first, name.second) < 0;
+            }
+        };
+
+        folder *child(const char *name, size_t len) const {
+            std::vector<folder *>::const_iterator it = std::lower_bound(children.begin(), children.end(),
+                std::make_pair(name, len), name_less());
+            if (it != children.end() && (*it)->name.compare(0, std::string::npos, name, len) == 0) {
+                return *it;
+            }
+            return 0;
+        }
+
+        folder *add_child(const char *name, size_t len) {
+            std::vector<folder *>::iterator it = std::lower_bound(children.begin(), children.end(),
+                std::make_pair(name, len), name_less());
+            if (it != children.end() && (*it)->name.compare(0, std::string::npos, name, len) == 0) {
+                return *it;
+            }
+            folder *f = new folder;
+            f->name.assign(name, len);
+            children.insert(it, f);
+            return f;
+        }
+    };
+
+    csync_rename_s() : renamed_count(0) {}
+
+    folder root;
+    int renamed_count;
+
+    /* The deepest renamed folder that contains path, or 0. *prefixlen is
+     * set to the length of its path. */
+    const folder *find(const char *path, size_t *prefixlen) const {
+        const folder *f = &root;
+        const folder *found = 0;
+        const char *component = path;
+        while (true) {
+            while (*component == '/') {
+                ++component;
+            }
+            const char *end = strchr(component, '/');
+            if (!end) {
+                // the last component is the file itself, not a parent
+                break;
+            }
+            f = f->child(component, end - component);
+            if (!f) {
+                break;
+            }
+            if (f->renamed) {
+                found = f;
+                *prefixlen = end - path;
+            }
+            component = end;
+        }
+        return found;
+    }
 
     struct renameop {
         csync_file_stat_t *st;
@@ -62,18 +129,76 @@ void csync_rename_destroy(CSYNC* ctx)
 
 void csync_rename_record(CSYNC* ctx, const char* from, const char* to)
 {
-    csync_rename_s::get(ctx)->folder_renamed_to[from] = to;
+    csync_rename_s *d = csync_rename_s::get(ctx);
+    csync_rename_s::folder *f = &d->root;
+    const char *component = from;
+    while (*component) {
+        while (*component == '/') {
+            ++component;
+        }
+        const char *end = component + strcspn(component, "/");
+        if (end != component) {
+            f = f->add_child(component, end - component);
+        }
+        component = end;
+    }
+    if (f == &d->root) {
+        return;
+    }
+    if (!f->renamed) {
+        f->renamed = true;
+        d->renamed_count++;
+    }
+    f->renamed_to = to;
+}
+
+bool csync_rename_empty(CSYNC* ctx)
+{
+    // Do not create the rename info, the reconciler calls this from several threads
+    csync_rename_s* d = reinterpret_cast<csync_rename_s *>(ctx->rename_info);
+    return !d || d->renamed_count == 0;
+}
+
+const char* csync_rename_lookup(CSYNC* ctx, const char* path, size_t* prefixlen)
+{
+    csync_rename_s* d = reinterpret_cast<csync_rename_s *>(ctx->rename_info);
+    if (!d || d->renamed_count == 0) {
+        return 0;
+    }
+    const csync_rename_s::folder *f = d->find(path, prefixlen);
+    return f ? f->renamed_to.c_str() : 0;
+}
+
+bool csync_rename_adjust_phash(CSYNC* ctx, const char* path, uint64_t* phash)
+{
+    size_t prefixlen = 0;
+    const char *renamed_to = csync_rename_lookup(ctx, path, &prefixlen);
+    if (!renamed_to) {
+        return false;
+    }
+    const size_t tolen = strlen(renamed_to);
+    const size_t len = tolen + strlen(path + prefixlen);
+    char stackbuf[1024];
+    char *buf = len < sizeof(stackbuf) ? stackbuf : static_cast<char *>(c_malloc(len + 1));
+    if (!buf) {
+        return false;
+    }
+    memcpy(buf, renamed_to, tolen);
+    strcpy(buf + tolen, path + prefixlen);
+    *phash = c_jhash64(reinterpret_cast<uint8_t *>(buf), len, 0);
+    if (buf != stackbuf) {
+        free(buf);
+    }
+    return true;
 }
 
 char* csync_rename_adjust_path(CSYNC* ctx, const char* path)
 {
-    csync_rename_s* d = csync_rename_s::get(ctx);
-    for (std::string p = _parentDir(path); !p.empty(); p = _parentDir(p)) {
-        std::map< std::string, std::string >::iterator it = d->folder_renamed_to.find(p);
-        if (it != d->folder_renamed_to.end()) {
-            std::string rep = it->second + (path + p.length());
-            return c_strdup(rep.c_str());
-        }
+    size_t prefixlen = 0;
+    const char *renamed_to = csync_rename_lookup(ctx, path, &prefixlen);
+    if (renamed_to) {
+        std::string rep = renamed_to + std::string(path + prefixlen);
+        return c_strdup(rep.c_str());
     }
     return c_strdup(path);
 }
@@ -27,6 +27,17 @@ extern "C" {
 #endif
 
 char *csync_rename_adjust_path(CSYNC *ctx, const char *path);
+/* true if no folder rename was recorded, then csync_rename_adjust_path returns a copy of the path */
+bool csync_rename_empty(CSYNC *ctx);
+/* The new path of the deepest renamed folder that contains path, or NULL if there is none.
+ * *prefixlen is set to the length of the old path of that folder in path, so that the
+ * renamed path is the result followed by path + *prefixlen.
+ * Allocates nothing and can be called from several threads at once. The result is valid
+ * until the next csync_rename_record(). */
+const char *csync_rename_lookup(CSYNC *ctx, const char *path, size_t *prefixlen);
+/* Sets *phash to the hash of the renamed path and returns true if path is in a renamed
+ * folder. Like csync_rename_lookup, it does not allocate for the usual path lengths. */
+bool csync_rename_adjust_phash(CSYNC *ctx, const char *path, uint64_t *phash);
 void csync_rename_destroy(CSYNC *ctx);
 void csync_rename_record(CSYNC *ctx, const char *from, const char *to);
 
@@ -137,6 +137,12 @@ int csync_statedb_load(CSYNC *ctx, const char *statedb, sqlite3 **pdb) {
 
   ctx->statedb.lastReturnValue = SQLITE_OK;
 
+  if (ctx->statedb.shared_db) {
+      /* The owner of the connection is responsible for its integrity */
+      db = ctx->statedb.shared_db;
+      goto opened;
+  }
+
   /* Openthe database */
   if (sqlite_open(statedb, &db) != SQLITE_OK) {
     const char *errmsg= sqlite3_errmsg(ctx->statedb.db);
@@ -157,6 +163,7 @@ int csync_statedb_load(CSYNC *ctx, const char *statedb, sqlite3 **pdb) {
       goto out;
   }
 
+opened:
   if (_csync_statedb_is_empty(db)) {
     CSYNC_LOG(CSYNC_LOG_PRIORITY_NOTICE, "statedb contents doesn't exist");
     csync_set_statedb_exists(ctx, 0);
@@ -182,7 +189,9 @@ int csync_statedb_load(CSYNC *ctx, const char *statedb, sqlite3 **pdb) {
   sqlite3_busy_timeout(db, 5000);
 
 #ifndef NDEBUG
-  sqlite3_profile(db, sqlite_profile, 0 );
+  if (db != ctx->statedb.shared_db) {
+      sqlite3_profile(db, sqlite_profile, 0 );
+  }
 #endif
   *pdb = db;
 
@@ -214,11 +223,17 @@ int csync_statedb_close(CSYNC *ctx) {
       sqlite3_finalize(ctx->statedb.by_inode_stmt);
       ctx->statedb.by_inode_stmt = NULL;
   }
+  if( ctx->statedb.below_path_stmt) {
+      sqlite3_finalize(ctx->statedb.below_path_stmt);
+      ctx->statedb.below_path_stmt = NULL;
+  }
 
   ctx->statedb.lastReturnValue = SQLITE_OK;
 
-  int sr = sqlite3_close(ctx->statedb.db);
-  CSYNC_LOG(CSYNC_LOG_PRIORITY_NOTICE, "sqlite3_close=%d", sr);
+  if (ctx->statedb.db != ctx->statedb.shared_db) {
+      int sr = sqlite3_close(ctx->statedb.db);
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_NOTICE, "sqlite3_close=%d", sr);
+  }
 
   ctx->statedb.db = 0;
 
@@ -317,6 +332,7 @@ csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx,
     return NULL;
   }
 
+  ctx->stats.statedb_queries++;
   sqlite3_bind_int64(ctx->statedb.by_hash_stmt, 1, (long long signed int)phash);
 
   rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_hash_stmt);
@@ -357,6 +373,7 @@ csync_file_stat_t *csync_statedb_get_stat_by_file_id(CSYNC *ctx,
     }
 
     /* bind the query value */
+    ctx->stats.statedb_queries++;
     sqlite3_bind_text(ctx->statedb.by_fileid_stmt, 1, file_id, -1, SQLITE_STATIC);
 
     rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_fileid_stmt);
@@ -400,6 +417,7 @@ csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx,
     return NULL;
   }
 
+  ctx->stats.statedb_queries++;
   sqlite3_bind_int64(ctx->statedb.by_inode_stmt, 1, (long long signed int)inode);
 
   rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_inode_stmt);
@@ -434,15 +452,20 @@ char *csync_statedb_get_etag( CSYNC *ctx, uint64_t jHash ) {
     return ret;
 }
 
-#define BELOW_PATH_QUERY "SELECT phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize FROM metadata WHERE pathlen>? AND path LIKE(?)"
+/*
+ * Everything below "dir" sorts between "dir/" and "dir0" ('0' follows '/' in ASCII),
+ * so the query is a range scan of the metadata_path index. Unlike a LIKE pattern,
+ * this does not treat '_' or '%' in the directory name as wildcards.
+ */
+#define BELOW_PATH_QUERY "SELECT phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize FROM metadata WHERE path > ?1 AND path < ?2"
 
 int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
-    int rc;
+    int rc = SQLITE_OK;
     sqlite3_stmt *stmt = NULL;
     int64_t cnt = 0;
-    char *likepath;
-    int asp;
-    int min_path_len;
+    char *lower_bound;
+    char *upper_bound;
+    size_t len;
 
     if( !path ) {
         return -1;
@@ -452,26 +475,38 @@ int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
         return -1;
     }
 
-    SQLITE_BUSY_HANDLED(sqlite3_prepare_v2(ctx->statedb.db, BELOW_PATH_QUERY, -1, &stmt, NULL));
-    ctx->statedb.lastReturnValue = rc;
-    if( rc != SQLITE_OK ) {
-      CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Unable to create stmt for below path query.");
-      return -1;
+    if( ctx->statedb.below_path_stmt == NULL ) {
+        SQLITE_BUSY_HANDLED(sqlite3_prepare_v2(ctx->statedb.db, BELOW_PATH_QUERY, -1, &ctx->statedb.below_path_stmt, NULL));
+        ctx->statedb.lastReturnValue = rc;
+        if( rc != SQLITE_OK ) {
+          CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Unable to create stmt for below path query.");
+          return -1;
+        }
     }
 
+    stmt = ctx->statedb.below_path_stmt;
     if (stmt == NULL) {
       return -1;
     }
 
-    asp = asprintf( &likepath, "%s/%%%%", path);
-    if (asp < 0) {
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "asprintf failed!");
+    len = strlen(path);
+    lower_bound = c_malloc(len + 2);
+    upper_bound = c_malloc(len + 2);
+    if (lower_bound == NULL || upper_bound == NULL) {
+        SAFE_FREE(lower_bound);
+        SAFE_FREE(upper_bound);
         return -1;
     }
+    memcpy(lower_bound, path, len);
+    memcpy(upper_bound, path, len);
+    lower_bound[len] = '/';
+    upper_bound[len] = '/' + 1;
+    lower_bound[len + 1] = '\0';
+    upper_bound[len + 1] = '\0';
 
-    min_path_len = strlen(path);
-    sqlite3_bind_int(stmt, 1, min_path_len);
-    sqlite3_bind_text(stmt, 2, likepath, -1, SQLITE_STATIC);
+    ctx->stats.statedb_queries++;
+    sqlite3_bind_text(stmt, 1, lower_bound, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, upper_bound, -1, SQLITE_STATIC);
 
     cnt = 0;
 
@@ -497,8 +532,10 @@ int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
     } else {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "%" PRId64 " entries read below path %s from db.", cnt, path);
     }
-    sqlite3_finalize(stmt);
-    SAFE_FREE(likepath);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    SAFE_FREE(lower_bound);
+    SAFE_FREE(upper_bound);
 
     return 0;
 }
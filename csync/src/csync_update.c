@@ -586,6 +586,7 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
   // if the etag of this dir is still the same, its content is restored from the
   // database.
   if( do_read_from_db ) {
+      ctx->stats.remote_dirs_from_db++;
       if( ! fill_tree_from_db(ctx, uri) ) {
         errno = ENOENT;
         ctx->status_code = CSYNC_STATUS_OPENDIR_ERROR;
@@ -601,6 +602,7 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
           uri_for_vio++; // cut leading slash
       }
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "URI without fuzz for %s is \"%s\"", uri, uri_for_vio);
+      ctx->stats.remote_dirs_fetched++;
   }
 
   if ((dh = csync_vio_opendir(ctx, uri_for_vio)) == NULL) {
@@ -0,0 +1,276 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2015 by ownCloud, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Benchmark of the discovery of directories with an unchanged etag: csync reads
+ * everything below such a directory from the journal (csync_statedb_get_below_path).
+ *
+ * Creates a journal with the given number of rows (default 1000000), spread over
+ * 100 top level directories with 100 sub directories each, then reads:
+ *   - everything below each top level directory (unchanged top level directories)
+ *   - everything below each sub directory (only the top level directories changed)
+ * with csync_statedb_get_below_path. For comparison, the rows are also only stepped
+ * through with the range query and with the former LIKE query on the former
+ * schema (no path index).
+ *
+ * Not run by ctest. Usage: benchmark_statedb_below_path [rows] [directory]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include <sqlite3.h>
+
+#include "csync_private.h"
+#include "csync_statedb.h"
+#include "c_rbtree.h"
+#include "c_jhash.h"
+
+#define TOP_DIRS 100
+#define SUB_DIRS 100
+
+#define COLUMNS "phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize"
+
+/* The query used before, the journal had no path index then */
+#define LIKE_BELOW_PATH_QUERY "SELECT " COLUMNS " FROM metadata INDEXED BY metadata_pathlen WHERE pathlen>?1 AND path LIKE(?2)"
+/* The query of csync_statedb_get_below_path */
+#define RANGE_BELOW_PATH_QUERY "SELECT " COLUMNS " FROM metadata WHERE path > ?1 AND path < ?2"
+
+static double now_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static int64_t phash(const char *path)
+{
+    return (int64_t) c_jhash64((uint8_t *) path, strlen(path), 0);
+}
+
+static int insert_row(sqlite3_stmt *stmt, const char *path, int type)
+{
+    sqlite3_bind_int64(stmt, 1, phash(path));
+    sqlite3_bind_int(stmt, 2, strlen(path));
+    sqlite3_bind_text(stmt, 3, path, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 4, type);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        return -1;
+    }
+    sqlite3_reset(stmt);
+    return 0;
+}
+
+/* Same schema and indexes as the journal created by SyncJournalDb */
+static int create_journal(const char *file, int rows)
+{
+    sqlite3 *db = NULL;
+    sqlite3_stmt *stmt = NULL;
+    char path[256];
+    int files_per_dir = rows / (TOP_DIRS * SUB_DIRS);
+    int t, s, f;
+
+    if (files_per_dir < 1) {
+        files_per_dir = 1;
+    }
+
+    unlink(file);
+    if (sqlite3_open(file, &db) != SQLITE_OK) {
+        return -1;
+    }
+    sqlite3_exec(db, "PRAGMA synchronous = OFF;"
+                     "CREATE TABLE metadata("
+                     "phash INTEGER(8), pathlen INTEGER, path VARCHAR(4096), inode INTEGER,"
+                     "uid INTEGER, gid INTEGER, mode INTEGER, modtime INTEGER(8), type INTEGER,"
+                     "md5 VARCHAR(32), fileid VARCHAR(128), remotePerm VARCHAR(128), filesize BIGINT,"
+                     "PRIMARY KEY(phash));"
+                     "CREATE INDEX metadata_inode ON metadata(inode);"
+                     "CREATE INDEX metadata_pathlen ON metadata(pathlen);"
+                     "CREATE INDEX metadata_path ON metadata(path);"
+                     "BEGIN;", NULL, NULL, NULL);
+    sqlite3_prepare_v2(db, "INSERT INTO metadata (phash, pathlen, path, type, md5, fileid, inode, modtime) "
+                           "VALUES (?1, ?2, ?3, ?4, 'etag', 'fileid', 0, 0)", -1, &stmt, NULL);
+
+    for (t = 0; t < TOP_DIRS; t++) {
+        snprintf(path, sizeof(path), "top%d", t);
+        insert_row(stmt, path, CSYNC_FTW_TYPE_DIR);
+        for (s = 0; s < SUB_DIRS; s++) {
+            snprintf(path, sizeof(path), "top%d/sub%d", t, s);
+            insert_row(stmt, path, CSYNC_FTW_TYPE_DIR);
+            for (f = 0; f < files_per_dir; f++) {
+                snprintf(path, sizeof(path), "top%d/sub%d/file%d.txt", t, s, f);
+                if (insert_row(stmt, path, CSYNC_FTW_TYPE_FILE) < 0) {
+                    fprintf(stderr, "insert failed: %s\n", sqlite3_errmsg(db));
+                    sqlite3_finalize(stmt);
+                    sqlite3_close(db);
+                    return -1;
+                }
+            }
+        }
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_exec(db, "COMMIT; ANALYZE;", NULL, NULL, NULL);
+    sqlite3_close(db);
+    return 0;
+}
+
+/* Steps through the rows below dir, without building the tree */
+static int64_t query_below_path(sqlite3_stmt *stmt, const char *dir, int like)
+{
+    char first[256];
+    char second[256];
+    int64_t cnt = 0;
+
+    if (like) {
+        snprintf(second, sizeof(second), "%s/%%", dir);
+        sqlite3_bind_int(stmt, 1, strlen(dir));
+    } else {
+        snprintf(first, sizeof(first), "%s/", dir);
+        snprintf(second, sizeof(second), "%s0", dir);
+        sqlite3_bind_text(stmt, 1, first, -1, SQLITE_STATIC);
+    }
+    sqlite3_bind_text(stmt, 2, second, -1, SQLITE_STATIC);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        cnt++;
+    }
+    sqlite3_reset(stmt);
+    return cnt;
+}
+
+static void bench_query(sqlite3 *db, int depth, int like)
+{
+    sqlite3_stmt *stmt = NULL;
+    char dir[128];
+    int64_t cnt = 0;
+    int t, s;
+    /* The LIKE query scans most of the table each time: only run the sub directories
+     * of the first top level directory and extrapolate */
+    int top_dirs = (like && depth == 2) ? 1 : TOP_DIRS;
+    double start = now_ms();
+
+    if (sqlite3_prepare_v2(db, like ? LIKE_BELOW_PATH_QUERY : RANGE_BELOW_PATH_QUERY,
+                           -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "prepare failed: %s\n", sqlite3_errmsg(db));
+        return;
+    }
+
+    for (t = 0; t < top_dirs; t++) {
+        if (depth == 1) {
+            snprintf(dir, sizeof(dir), "top%d", t);
+            cnt += query_below_path(stmt, dir, like);
+            continue;
+        }
+        for (s = 0; s < SUB_DIRS; s++) {
+            snprintf(dir, sizeof(dir), "top%d/sub%d", t, s);
+            cnt += query_below_path(stmt, dir, like);
+        }
+    }
+    sqlite3_finalize(stmt);
+    printf("  %-34s %10.1f ms, %" PRId64 " rows%s\n",
+           like ? "LIKE query, former schema:" : "range query:",
+           (now_ms() - start) * TOP_DIRS / top_dirs, cnt * TOP_DIRS / top_dirs,
+           top_dirs != TOP_DIRS ? " (extrapolated)" : "");
+}
+
+static int bench_csync(CSYNC *ctx, const char *journal, int depth)
+{
+    char dir[128];
+    int t, s;
+    double start;
+    unsigned long size;
+
+    /* fresh trees and statement */
+    csync_commit(ctx);
+    if (csync_statedb_load(ctx, journal, &ctx->statedb.db) < 0) {
+        fprintf(stderr, "could not load %s\n", journal);
+        return -1;
+    }
+
+    start = now_ms();
+    for (t = 0; t < TOP_DIRS; t++) {
+        if (depth == 1) {
+            snprintf(dir, sizeof(dir), "top%d", t);
+            if (csync_statedb_get_below_path(ctx, dir) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        for (s = 0; s < SUB_DIRS; s++) {
+            snprintf(dir, sizeof(dir), "top%d/sub%d", t, s);
+            if (csync_statedb_get_below_path(ctx, dir) < 0) {
+                return -1;
+            }
+        }
+    }
+    size = c_rbtree_size(ctx->remote.tree);
+    printf("  %-34s %10.1f ms, %lu rows\n", "csync_statedb_get_below_path:", now_ms() - start, size);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    CSYNC *ctx = NULL;
+    int rows = argc > 1 ? atoi(argv[1]) : 1000000;
+    const char *base = argc > 2 ? argv[2] : "/tmp/csync_benchmark";
+    char journal[1024];
+    char cmd[1100];
+    double start;
+    int depth;
+    int rc = 0;
+
+    snprintf(cmd, sizeof(cmd), "mkdir -p %s/local %s/remote", base, base);
+    if (system(cmd) != 0) {
+        return 1;
+    }
+    snprintf(journal, sizeof(journal), "%s/.csync_journal.db", base);
+
+    start = now_ms();
+    if (create_journal(journal, rows) < 0) {
+        fprintf(stderr, "could not create %s\n", journal);
+        return 1;
+    }
+    printf("journal with %d rows created in %.1f ms\n", rows, now_ms() - start);
+
+    snprintf(cmd, sizeof(cmd), "%s/local", base);
+    if (csync_create(&ctx, cmd, "/remote") < 0 || csync_init(ctx) < 0) {
+        fprintf(stderr, "could not create the csync context\n");
+        return 1;
+    }
+
+    for (depth = 1; depth <= 2; depth++) {
+        printf("%s unchanged (%d below path queries):\n",
+               depth == 1 ? "top level directories" : "sub directories",
+               depth == 1 ? TOP_DIRS : TOP_DIRS * SUB_DIRS);
+        if (bench_csync(ctx, journal, depth) < 0) {
+            fprintf(stderr, "csync_statedb_get_below_path failed\n");
+            rc = 1;
+            break;
+        }
+        bench_query(ctx->statedb.db, depth, 0);
+        bench_query(ctx->statedb.db, depth, 1);
+    }
+
+    csync_destroy(ctx);
+    return rc;
+}
@@ -0,0 +1,403 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2015 by ownCloud, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Microbenchmarks of the primitives csync runs for every file of every sync:
+ *   - c_rbtree insert, find and walk
+ *   - c_jhash64 by path length
+ *   - c_dirname and c_basename
+ *   - csync_excluded_no_ctx with the shipped sync-exclude.lst
+ *   - csync_rename_adjust_path and csync_rename_adjust_phash
+ *
+ * Prints the time and the number of heap allocations per operation. The
+ * allocations are counted by wrapping malloc, which is only done with glibc;
+ * elsewhere they are reported as n/a.
+ *
+ * Not run by ctest. Usage: benchmark_std [nodes] [exclude list]
+ * (default 1000000 nodes and the sync-exclude.lst of the source tree)
+ */
+
+#include "config_csync.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "csync_private.h"
+#include "csync_exclude.h"
+#include "csync_rename.h"
+#include "std/c_alloc.h"
+#include "std/c_jhash.h"
+#include "std/c_path.h"
+#include "std/c_rbtree.h"
+#include "std/c_string.h"
+
+#define EXCLUDE_LIST_FILE SOURCEDIR"/../sync-exclude.lst"
+
+#define CORPUS_SIZE 100000
+#define RENAMED_DIRS 1000
+
+#ifdef __GLIBC__
+/* Count the allocations by wrapping malloc: the libraries of the benchmark
+ * resolve malloc to these, including operator new of libstdc++. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static uint64_t allocations = 0;
+
+void *malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+#define ALLOCATIONS_COUNTED 1
+#else
+static uint64_t allocations = 0;
+#define ALLOCATIONS_COUNTED 0
+#endif
+
+typedef struct bench_s {
+    struct timespec start;
+    uint64_t allocations;
+} bench_t;
+
+static void bench_start(bench_t *b)
+{
+    b->allocations = allocations;
+    clock_gettime(CLOCK_MONOTONIC, &b->start);
+}
+
+static void bench_stop(bench_t *b, const char *name, uint64_t ops)
+{
+    struct timespec end;
+    double ns;
+    uint64_t allocs = allocations - b->allocations;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns = (end.tv_sec - b->start.tv_sec) * 1e9 + (end.tv_nsec - b->start.tv_nsec);
+    if (ops == 0) {
+        ops = 1;
+    }
+    if (ALLOCATIONS_COUNTED) {
+        printf("  %-44s %10.1f ns/op %8.2f allocs/op\n", name, ns / ops, (double) allocs / ops);
+    } else {
+        printf("  %-44s %10.1f ns/op      n/a allocs/op\n", name, ns / ops);
+    }
+}
+
+/* Keeps the compiler from dropping the results */
+static volatile uint64_t sink;
+
+/*
+ * c_rbtree
+ */
+
+typedef struct node_s {
+    int64_t key;
+} node_t;
+
+static int key_cmp(const void *key, const void *data)
+{
+    int64_t a = *(const int64_t *) key;
+    int64_t b = ((const node_t *) data)->key;
+    return a < b ? -1 : (a > b);
+}
+
+static int data_cmp(const void *key, const void *data)
+{
+    return key_cmp(&((const node_t *) key)->key, data);
+}
+
+static int visitor(void *obj, void *data)
+{
+    *(int64_t *) data += ((node_t *) obj)->key;
+    return 0;
+}
+
+static void bench_rbtree(int nodes)
+{
+    c_rbtree_t *tree = NULL;
+    node_t *data = c_malloc(nodes * sizeof(node_t));
+    c_rbnode_t *node;
+    int64_t sum = 0;
+    bench_t b;
+    int i;
+
+    printf("c_rbtree, %d nodes:\n", nodes);
+    /* keys as csync uses them, hashes of the paths */
+    for (i = 0; i < nodes; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "dir%d/file%d.txt", i / 100, i);
+        data[i].key = (int64_t) c_jhash64((uint8_t *) path, strlen(path), 0);
+    }
+
+    c_rbtree_create(&tree, key_cmp, data_cmp);
+    bench_start(&b);
+    for (i = 0; i < nodes; i++) {
+        c_rbtree_insert(tree, &data[i]);
+    }
+    bench_stop(&b, "c_rbtree_insert", nodes);
+
+    bench_start(&b);
+    for (i = 0; i < nodes; i++) {
+        /* in a different order than the insertion */
+        node = c_rbtree_find(tree, &data[(int) ((i * 7919LL) % nodes)].key);
+        sink += node != NULL;
+    }
+    bench_stop(&b, "c_rbtree_find", nodes);
+
+    bench_start(&b);
+    c_rbtree_walk(tree, &sum, visitor);
+    sink += sum;
+    bench_stop(&b, "c_rbtree_walk (per node)", nodes);
+
+    bench_start(&b);
+    for (node = c_rbtree_head(tree); node; node = c_rbtree_node_next(node)) {
+        sink += ((node_t *) c_rbtree_node_data(node))->key;
+    }
+    bench_stop(&b, "c_rbtree_node_next (per node)", nodes);
+
+    bench_start(&b);
+    c_rbtree_free(tree);
+    bench_stop(&b, "c_rbtree_free (per node)", nodes);
+    SAFE_FREE(data);
+}
+
+/*
+ * Path corpus, looks like the content of a user's sync folder
+ */
+
+static const char *corpus_dirs[] = {
+    "Documents", "Documents/Projects/2015/Reports", "Photos/2014/Holidays",
+    "Music/Artist/Album", "src/owncloud/client/src/libsync/propagator",
+    "src/app/node_modules/lodash/fp", "src/app/.git/objects/4f", "Shared/Team Folder/Meeting Notes",
+    "Desktop", "Mac/.TemporaryItems", "Windows/AppData/Roaming/Thunderbird/Profiles/x.default"
+};
+
+static const char *corpus_files[] = {
+    "report.pdf", "IMG_2014.JPG", "01 - Track.mp3", "main.cpp", "index.js", "notes.txt",
+    "Budget 2015.xlsx", "a1b2c3d4e5f6", "README", "archive.tar.gz", "Makefile", "photo (1).png"
+};
+
+/* Files matching the exclude list, one path in eight is one of these */
+static const char *corpus_excluded_files[] = {
+    "~$Budget 2015.xlsx", ".DS_Store", "Thumbs.db", "draft.docx~", "download.part",
+    ".main.cpp.swp", "presentation_conflict-20150101-101010.odp", "desktop.ini",
+    ".~lock.notes.odt#", "file.filepart"
+};
+
+static char **create_corpus(int size)
+{
+    char **corpus = c_malloc(size * sizeof(char *));
+    size_t ndirs = sizeof(corpus_dirs) / sizeof(corpus_dirs[0]);
+    size_t nfiles = sizeof(corpus_files) / sizeof(corpus_files[0]);
+    size_t nexcluded = sizeof(corpus_excluded_files) / sizeof(corpus_excluded_files[0]);
+    char path[512];
+    int i;
+
+    for (i = 0; i < size; i++) {
+        /* a number in the directory name keeps the paths distinct */
+        snprintf(path, sizeof(path), "%s/sub%d/%s",
+                 corpus_dirs[i % ndirs], (i / 7) % 50,
+                 i % 8 == 0 ? corpus_excluded_files[(i / 8) % nexcluded] : corpus_files[(i / 3) % nfiles]);
+        corpus[i] = c_strdup(path);
+    }
+    return corpus;
+}
+
+static void free_corpus(char **corpus, int size)
+{
+    int i;
+    for (i = 0; i < size; i++) {
+        SAFE_FREE(corpus[i]);
+    }
+    SAFE_FREE(corpus);
+}
+
+static void bench_jhash(void)
+{
+    static const int lengths[] = { 16, 64, 256, 1024, 4096 };
+    char *buffer = c_malloc(4096);
+    int i, l, rounds;
+    bench_t b;
+
+    printf("c_jhash64:\n");
+    for (i = 0; i < 4096; i++) {
+        buffer[i] = 'a' + i % 26;
+    }
+    for (l = 0; l < (int) (sizeof(lengths) / sizeof(lengths[0])); l++) {
+        char name[64];
+        double mb;
+        rounds = 64 * 1024 * 1024 / lengths[l];
+        bench_start(&b);
+        for (i = 0; i < rounds; i++) {
+            sink += c_jhash64((uint8_t *) buffer, lengths[l], 0);
+        }
+        mb = (double) rounds * lengths[l] / (1024 * 1024);
+        snprintf(name, sizeof(name), "%4d bytes (%.0f MiB hashed)", lengths[l], mb);
+        bench_stop(&b, name, rounds);
+    }
+    SAFE_FREE(buffer);
+}
+
+static void bench_path(char **corpus, int size)
+{
+    bench_t b;
+    char *p;
+    int i;
+
+    printf("c_path, %d paths:\n", size);
+    bench_start(&b);
+    for (i = 0; i < size; i++) {
+        p = c_dirname(corpus[i]);
+        sink += p != NULL;
+        SAFE_FREE(p);
+    }
+    bench_stop(&b, "c_dirname", size);
+
+    bench_start(&b);
+    for (i = 0; i < size; i++) {
+        p = c_basename(corpus[i]);
+        sink += p != NULL;
+        SAFE_FREE(p);
+    }
+    bench_stop(&b, "c_basename", size);
+}
+
+static int bench_exclude(char **corpus, int size, const char *exclude_file)
+{
+    c_strlist_t *excludes = NULL;
+    int excluded = 0;
+    bench_t b;
+    char name[64];
+    int i;
+
+    if (csync_exclude_load(exclude_file, &excludes) < 0) {
+        fprintf(stderr, "could not load %s\n", exclude_file);
+        return -1;
+    }
+    printf("csync_excluded_no_ctx, %d paths, %zu patterns:\n", size, excludes->count);
+
+    bench_start(&b);
+    for (i = 0; i < size; i++) {
+        excluded += csync_excluded_no_ctx(excludes, corpus[i], CSYNC_FTW_TYPE_FILE) != CSYNC_NOT_EXCLUDED;
+    }
+    snprintf(name, sizeof(name), "files (%d%% excluded)", excluded * 100 / size);
+    bench_stop(&b, name, size);
+
+    bench_start(&b);
+    for (i = 0; i < size; i++) {
+        sink += csync_excluded_no_ctx(excludes, corpus[i], CSYNC_FTW_TYPE_DIR);
+    }
+    bench_stop(&b, "directories", size);
+
+    c_strlist_destroy(excludes);
+    return 0;
+}
+
+static void bench_rename(char **corpus, int size)
+{
+    CSYNC ctx;
+    char from[128];
+    char to[128];
+    bench_t b;
+    char *p;
+    int i;
+
+    printf("csync_rename_adjust_path, %d paths:\n", size);
+    ZERO_STRUCT(ctx);
+
+    bench_start(&b);
+    for (i = 0; i < size; i++) {
+        p = csync_rename_adjust_path(&ctx, corpus[i]);
+        sink += p != NULL;
+        SAFE_FREE(p);
+    }
+    bench_stop(&b, "no renamed directory", size);
+
+    for (i = 0; i < RENAMED_DIRS; i++) {
+        snprintf(from, sizeof(from), "Renamed/dir%d", i);
+        snprintf(to, sizeof(to), "Renamed/new%d", i);
+        csync_rename_record(&ctx, from, to);
+    }
+    /* one of the directories of the corpus, to also adjust some paths */
+    csync_rename_record(&ctx, corpus_dirs[0], "Documents renamed");
+
+    bench_start(&b);
+    for (i = 0; i < size; i++) {
+        p = csync_rename_adjust_path(&ctx, corpus[i]);
+        sink += p != NULL;
+        SAFE_FREE(p);
+    }
+    snprintf(from, sizeof(from), "%d renamed directories", RENAMED_DIRS + 1);
+    bench_stop(&b, from, size);
+
+    printf("csync_rename_adjust_phash, %d paths:\n", size);
+    bench_start(&b);
+    for (i = 0; i < size; i++) {
+        uint64_t h = 0;
+        sink += csync_rename_adjust_phash(&ctx, corpus[i], &h) ? h : 0;
+    }
+    snprintf(from, sizeof(from), "%d renamed directories", RENAMED_DIRS + 1);
+    bench_stop(&b, from, size);
+
+    csync_rename_destroy(&ctx);
+}
+
+int main(int argc, char **argv)
+{
+    int nodes = argc > 1 ? atoi(argv[1]) : 1000000;
+    const char *exclude_file = argc > 2 ? argv[2] : EXCLUDE_LIST_FILE;
+    char **corpus;
+    int rc = 0;
+
+    if (nodes <= 0) {
+        fprintf(stderr, "usage: %s [nodes] [exclude list]\n", argv[0]);
+        return 1;
+    }
+
+    bench_rbtree(nodes);
+    bench_jhash();
+
+    corpus = create_corpus(CORPUS_SIZE);
+    bench_path(corpus, CORPUS_SIZE);
+    if (bench_exclude(corpus, CORPUS_SIZE, exclude_file) < 0) {
+        rc = 1;
+    }
+    bench_rename(corpus, CORPUS_SIZE);
+    free_corpus(corpus, CORPUS_SIZE);
+
+    return rc;
+}
@@ -0,0 +1,214 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include "torture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "csync_private.h"
+#include "csync_reconcile.h"
+#include "csync_rename.h"
+#include "c_jhash.h"
+
+static void setup(void **state)
+{
+    CSYNC *csync;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync1");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_init(csync);
+    assert_int_equal(rc, 0);
+
+    *state = csync;
+}
+
+static void teardown(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+    rc = system("rm -rf /tmp/check_csync1");
+    assert_int_equal(rc, 0);
+    rc = system("rm -rf /tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    unsetenv("CSYNC_RECONCILE_THREADS");
+
+    *state = NULL;
+}
+
+static void add_stat(c_rbtree_t *tree, const char *path, int type,
+                     enum csync_instructions_e instruction, time_t mtime)
+{
+    size_t len = strlen(path);
+    csync_file_stat_t *st = c_malloc(sizeof(csync_file_stat_t) + len + 1);
+    int rc;
+
+    memset(st, 0, sizeof(csync_file_stat_t));
+    st->phash = c_jhash64((uint8_t *) path, len, 0);
+    st->pathlen = len;
+    memcpy(st->path, path, len + 1);
+    st->type = type;
+    st->instruction = instruction;
+    st->modtime = mtime;
+    st->size = 42;
+
+    rc = c_rbtree_insert(tree, st);
+    assert_int_equal(rc, 0);
+}
+
+/* A bit more than 20000 entries, enough for the parallel reconcile */
+static void fill_trees(CSYNC *csync)
+{
+    char path[64];
+    int d, s, f;
+
+    for (d = 0; d < 40; d++) {
+        snprintf(path, sizeof(path), "d%d", d);
+        add_stat(csync->local.tree, path, CSYNC_FTW_TYPE_DIR, CSYNC_INSTRUCTION_NONE, 1);
+        if (d % 7 == 3) {
+            add_stat(csync->remote.tree, path, CSYNC_FTW_TYPE_DIR, CSYNC_INSTRUCTION_IGNORE, 1);
+        } else if (d % 5 != 0) {
+            add_stat(csync->remote.tree, path, CSYNC_FTW_TYPE_DIR, CSYNC_INSTRUCTION_NONE, 1);
+        }
+        for (s = 0; s < 10; s++) {
+            snprintf(path, sizeof(path), "d%d/s%d", d, s);
+            if (s % 3 != 0) {
+                add_stat(csync->local.tree, path, CSYNC_FTW_TYPE_DIR, CSYNC_INSTRUCTION_NONE, 1);
+            }
+            if (s % 4 != 0) {
+                add_stat(csync->remote.tree, path, CSYNC_FTW_TYPE_DIR,
+                         s == 5 ? CSYNC_INSTRUCTION_IGNORE : CSYNC_INSTRUCTION_EVAL, 1);
+            }
+            for (f = 0; f < 60; f++) {
+                int kind = (d * 31 + s * 7 + f) % 6;
+                snprintf(path, sizeof(path), "d%d/s%d/f%d", d, s, f);
+                if (kind != 0) {
+                    add_stat(csync->local.tree, path, CSYNC_FTW_TYPE_FILE,
+                             kind == 1 ? CSYNC_INSTRUCTION_EVAL : CSYNC_INSTRUCTION_NONE, f % 3);
+                }
+                if (kind != 2) {
+                    add_stat(csync->remote.tree, path, CSYNC_FTW_TYPE_FILE,
+                             kind == 3 ? CSYNC_INSTRUCTION_EVAL : CSYNC_INSTRUCTION_NONE, f % 2);
+                }
+            }
+        }
+    }
+}
+
+static void reconcile(CSYNC *csync, const char *threads)
+{
+    int rc;
+
+    setenv("CSYNC_RECONCILE_THREADS", threads, 1);
+    csync->current = LOCAL_REPLICA;
+    rc = csync_reconcile_updates(csync);
+    assert_int_equal(rc, 0);
+    csync->current = REMOTE_REPLICA;
+    rc = csync_reconcile_updates(csync);
+    assert_int_equal(rc, 0);
+}
+
+static void assert_same_instructions(c_rbtree_t *expected, c_rbtree_t *actual)
+{
+    c_rbnode_t *a = c_rbtree_head(expected);
+    c_rbnode_t *b = c_rbtree_head(actual);
+
+    while (a && b) {
+        csync_file_stat_t *sa = (csync_file_stat_t *) a->data;
+        csync_file_stat_t *sb = (csync_file_stat_t *) b->data;
+        assert_string_equal(sa->path, sb->path);
+        assert_int_equal(sa->instruction, sb->instruction);
+        a = c_rbtree_node_next(a);
+        b = c_rbtree_node_next(b);
+    }
+    assert_null(a);
+    assert_null(b);
+}
+
+static csync_file_stat_t *find_stat(c_rbtree_t *tree, const char *path)
+{
+    uint64_t h = c_jhash64((uint8_t *) path, strlen(path), 0);
+    c_rbnode_t *node = c_rbtree_find(tree, &h);
+
+    assert_non_null(node);
+    return (csync_file_stat_t *) node->data;
+}
+
+static void check_csync_reconcile_ignored_parent(void **state)
+{
+    CSYNC *csync = *state;
+
+    add_stat(csync->remote.tree, "ign", CSYNC_FTW_TYPE_DIR, CSYNC_INSTRUCTION_IGNORE, 1);
+    add_stat(csync->local.tree, "ign", CSYNC_FTW_TYPE_DIR, CSYNC_INSTRUCTION_NONE, 1);
+    add_stat(csync->local.tree, "ign/sub", CSYNC_FTW_TYPE_DIR, CSYNC_INSTRUCTION_NEW, 1);
+    add_stat(csync->local.tree, "ign/sub/deep", CSYNC_FTW_TYPE_DIR, CSYNC_INSTRUCTION_NEW, 1);
+    add_stat(csync->local.tree, "ign/sub/deep/a", CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_EVAL, 1);
+    add_stat(csync->local.tree, "ign/sub/deep/b", CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_EVAL, 1);
+    add_stat(csync->local.tree, "new/a", CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_EVAL, 1);
+
+    reconcile(csync, "1");
+
+    assert_int_equal(find_stat(csync->local.tree, "ign/sub")->instruction, CSYNC_INSTRUCTION_IGNORE);
+    assert_int_equal(find_stat(csync->local.tree, "ign/sub/deep/a")->instruction, CSYNC_INSTRUCTION_IGNORE);
+    assert_int_equal(find_stat(csync->local.tree, "ign/sub/deep/b")->instruction, CSYNC_INSTRUCTION_IGNORE);
+    assert_int_equal(find_stat(csync->local.tree, "new/a")->instruction, CSYNC_INSTRUCTION_NEW);
+}
+
+static void check_csync_reconcile_parallel(void **state)
+{
+    CSYNC *csync = *state;
+    CSYNC *sequential;
+    int rc;
+
+    rc = csync_create(&sequential, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_init(sequential);
+    assert_int_equal(rc, 0);
+
+    fill_trees(sequential);
+    fill_trees(csync);
+    /* the entries below the renamed folder are reconciled after the others */
+    csync_rename_record(sequential, "d1", "d2");
+    csync_rename_record(csync, "d1", "d2");
+
+    reconcile(sequential, "1");
+    reconcile(csync, "4");
+
+    assert_same_instructions(sequential->local.tree, csync->local.tree);
+    assert_same_instructions(sequential->remote.tree, csync->remote.tree);
+
+    rc = csync_destroy(sequential);
+    assert_int_equal(rc, 0);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_reconcile_ignored_parent, setup, teardown),
+        unit_test_setup_teardown(check_csync_reconcile_parallel, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
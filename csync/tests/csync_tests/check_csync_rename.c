@@ -0,0 +1,278 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include "torture.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "csync_private.h"
+#include "csync_rename.h"
+#include "c_jhash.h"
+
+static void setup(void **state)
+{
+    CSYNC *csync;
+    int rc;
+
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+
+    *state = csync;
+}
+
+static void teardown(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+
+    *state = NULL;
+}
+
+/* The renamed path as csync_rename_lookup describes it, or NULL */
+static char *lookup_path(CSYNC *csync, const char *path)
+{
+    size_t prefixlen = 0;
+    const char *renamed_to;
+    char *result;
+
+    renamed_to = csync_rename_lookup(csync, path, &prefixlen);
+    if (renamed_to == NULL) {
+        return NULL;
+    }
+    assert_true(prefixlen <= strlen(path));
+    result = malloc(strlen(renamed_to) + strlen(path + prefixlen) + 1);
+    strcpy(result, renamed_to);
+    strcat(result, path + prefixlen);
+    return result;
+}
+
+#define CHECK_LOOKUP(PATH, EXPECT) \
+    str = lookup_path(csync, PATH); \
+    assert_non_null(str); \
+    assert_string_equal(str, EXPECT); \
+    free(str);
+
+#define CHECK_NOT_RENAMED(PATH) \
+    str = lookup_path(csync, PATH); \
+    assert_null(str);
+
+static void check_csync_rename_empty(void **state)
+{
+    CSYNC *csync = *state;
+    size_t prefixlen = 42;
+    uint64_t phash = 42;
+    char *str;
+
+    /* Nothing was recorded: no rename info is created */
+    assert_true(csync_rename_empty(csync));
+    assert_null(csync_rename_lookup(csync, "a/b", &prefixlen));
+    assert_int_equal(prefixlen, 42);
+    assert_false(csync_rename_adjust_phash(csync, "a/b", &phash));
+    assert_int_equal(phash, 42);
+    assert_null(csync->rename_info);
+
+    str = csync_rename_adjust_path(csync, "a/b");
+    assert_string_equal(str, "a/b");
+    free(str);
+}
+
+static void check_csync_rename_deepest(void **state)
+{
+    CSYNC *csync = *state;
+    char *str;
+
+    csync_rename_record(csync, "a", "x");
+    csync_rename_record(csync, "a/b/c", "y/z");
+    assert_false(csync_rename_empty(csync));
+
+    CHECK_LOOKUP("a/file", "x/file");
+    CHECK_LOOKUP("a/b/file", "x/b/file");
+    CHECK_LOOKUP("a/b/c/file", "y/z/file");
+    CHECK_LOOKUP("a/b/c/d/file", "y/z/d/file");
+    CHECK_LOOKUP("a/b/cd/file", "x/b/cd/file");
+
+    /* A folder is not in itself */
+    CHECK_NOT_RENAMED("a");
+    CHECK_LOOKUP("a/b/c", "x/b/c");
+
+    /* Recording again replaces the destination */
+    csync_rename_record(csync, "a/b/c", "w");
+    CHECK_LOOKUP("a/b/c/file", "w/file");
+}
+
+static void check_csync_rename_sibling_prefix(void **state)
+{
+    CSYNC *csync = *state;
+    char *str;
+
+    csync_rename_record(csync, "a", "x");
+
+    CHECK_NOT_RENAMED("ab/file");
+    CHECK_NOT_RENAMED("ab");
+    CHECK_NOT_RENAMED("b/a/file");
+    CHECK_LOOKUP("a/ab/file", "x/ab/file");
+
+    csync_rename_record(csync, "ab", "y");
+    CHECK_LOOKUP("ab/file", "y/file");
+    CHECK_LOOKUP("a/file", "x/file");
+    CHECK_NOT_RENAMED("abc/file");
+}
+
+static void check_csync_rename_slashes(void **state)
+{
+    CSYNC *csync = *state;
+    char *str;
+
+    csync_rename_record(csync, "a/b", "x");
+
+    CHECK_LOOKUP("a/b/file", "x/file");
+    CHECK_LOOKUP("a//b/file", "x/file");
+    CHECK_LOOKUP("a/b//file", "x//file");
+    CHECK_LOOKUP("/a/b/file", "x/file");
+    CHECK_LOOKUP("//a/b/file", "x/file");
+    CHECK_NOT_RENAMED("a/b");
+    CHECK_LOOKUP("a/b/", "x/");
+
+    /* The slashes of the recorded folder do not matter either */
+    csync_rename_record(csync, "/c//d/", "y");
+    CHECK_LOOKUP("c/d/file", "y/file");
+
+    /* The root is never renamed */
+    csync_rename_record(csync, "/", "z");
+    csync_rename_record(csync, "", "z");
+    CHECK_NOT_RENAMED("file");
+    CHECK_NOT_RENAMED("/file");
+}
+
+/* The folder renames as the map of full paths that was used before */
+struct old_rename {
+    const char *from;
+    const char *to;
+};
+
+static const struct old_rename old_renames[] = {
+    { "a", "x" },
+    { "a/b", "x/y" },
+    { "a/b/c/d", "z" },
+    { "ab", "w" },
+    { "e/f", "a" },
+    { "g", "g2" },
+    { NULL, NULL }
+};
+
+static size_t old_parent_dir(const char *path, size_t len)
+{
+    while (len > 0 && path[len - 1] != '/') {
+        len--;
+    }
+    while (len > 0 && path[len - 1] == '/') {
+        len--;
+    }
+    return len;
+}
+
+static char *old_adjust_path(const char *path)
+{
+    size_t len;
+    int i;
+    char *result;
+
+    for (len = old_parent_dir(path, strlen(path)); len > 0; len = old_parent_dir(path, len)) {
+        for (i = 0; old_renames[i].from != NULL; i++) {
+            if (strlen(old_renames[i].from) == len && strncmp(old_renames[i].from, path, len) == 0) {
+                result = malloc(strlen(old_renames[i].to) + strlen(path + len) + 1);
+                strcpy(result, old_renames[i].to);
+                strcat(result, path + len);
+                return result;
+            }
+        }
+    }
+    return strdup(path);
+}
+
+static void check_csync_rename_adjust_phash(void **state)
+{
+    CSYNC *csync = *state;
+    const char *paths[] = {
+        "a/file", "a/b/file", "a/b/c/file", "a/b/c/d/file", "a/b/c/d/e/f/file",
+        "ab/file", "abc/file", "e/f/g/file", "e/file", "g/file", "file", "a", "a/b",
+        NULL
+    };
+    uint64_t phash;
+    char *old_path;
+    char *path;
+    int i;
+
+    for (i = 0; old_renames[i].from != NULL; i++) {
+        csync_rename_record(csync, old_renames[i].from, old_renames[i].to);
+    }
+
+    for (i = 0; paths[i] != NULL; i++) {
+        old_path = old_adjust_path(paths[i]);
+        path = csync_rename_adjust_path(csync, paths[i]);
+        assert_string_equal(path, old_path);
+
+        phash = 0;
+        if (strcmp(old_path, paths[i]) == 0) {
+            assert_false(csync_rename_adjust_phash(csync, paths[i], &phash));
+        } else {
+            assert_true(csync_rename_adjust_phash(csync, paths[i], &phash));
+            assert_int_equal(phash, c_jhash64((uint8_t *) old_path, strlen(old_path), 0));
+        }
+
+        free(path);
+        free(old_path);
+    }
+}
+
+static void check_csync_rename_adjust_phash_long(void **state)
+{
+    CSYNC *csync = *state;
+    char path[3000];
+    char expected[3000];
+    uint64_t phash = 0;
+
+    /* Longer than the stack buffer of csync_rename_adjust_phash */
+    memset(path, 'p', sizeof(path));
+    memcpy(path, "a/", 2);
+    path[sizeof(path) - 1] = '\0';
+    memset(expected, 'p', sizeof(expected));
+    memcpy(expected, "x/", 2);
+    expected[sizeof(expected) - 1] = '\0';
+
+    csync_rename_record(csync, "a", "x");
+    assert_true(csync_rename_adjust_phash(csync, path, &phash));
+    assert_int_equal(phash, c_jhash64((uint8_t *) expected, strlen(expected), 0));
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_rename_empty, setup, teardown),
+        unit_test_setup_teardown(check_csync_rename_deepest, setup, teardown),
+        unit_test_setup_teardown(check_csync_rename_sibling_prefix, setup, teardown),
+        unit_test_setup_teardown(check_csync_rename_slashes, setup, teardown),
+        unit_test_setup_teardown(check_csync_rename_adjust_phash, setup, teardown),
+        unit_test_setup_teardown(check_csync_rename_adjust_phash_long, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
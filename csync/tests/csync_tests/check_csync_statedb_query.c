@@ -98,6 +98,52 @@ static void setup_db(void **state)
 
 }
 
+static void setup_below_path_db(void **state)
+{
+    char *errmsg;
+    int rc = 0;
+    sqlite3 *db = NULL;
+
+    const char *sql = "CREATE TABLE IF NOT EXISTS metadata ("
+        "phash INTEGER(8),"
+        "pathlen INTEGER,"
+        "path VARCHAR(4096),"
+        "inode INTEGER,"
+        "uid INTEGER,"
+        "gid INTEGER,"
+        "mode INTEGER,"
+        "modtime INTEGER(8),"
+        "type INTEGER,"
+        "md5 VARCHAR(32),"
+        "fileid VARCHAR(128),"
+        "remotePerm VARCHAR(128),"
+        "filesize BIGINT,"
+        "PRIMARY KEY(phash)"
+        ");"
+        "CREATE INDEX metadata_path ON metadata(path);";
+
+    const char *sql2 = "INSERT INTO metadata (phash, pathlen, path, type) VALUES"
+                       "(1, 3, 'dir', 2),"
+                       "(2, 5, 'dir/a', 0),"
+                       "(3, 9, 'dir/sub/b', 0),"
+                       "(4, 4, 'dir0', 0),"
+                       "(5, 7, 'dir_x/c', 0),"
+                       "(6, 6, 'dirx/d', 0),"
+                       "(7, 7, 'dirxx/e', 0);";
+
+    setup(state);
+    rc = sqlite3_open( TESTDB, &db);
+    assert_int_equal(rc, SQLITE_OK);
+
+    rc = sqlite3_exec( db, sql, NULL, NULL, &errmsg );
+    assert_int_equal(rc, SQLITE_OK);
+
+    rc = sqlite3_exec( db, sql2, NULL, NULL, &errmsg );
+    assert_int_equal(rc, SQLITE_OK);
+
+    sqlite3_close(db);
+}
+
 static void teardown(void **state) {
     CSYNC *csync = *state;
     int rc = 0;
@@ -210,6 +256,22 @@ static void check_csync_statedb_get_stat_by_inode_not_found(void **state)
     assert_null(tmp);
 }
 
+static void check_csync_statedb_get_below_path(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_statedb_get_below_path(csync, "dir");
+    assert_int_equal(rc, 0);
+    /* only dir/a and dir/sub/b, not dir itself nor dir0 */
+    assert_int_equal(c_rbtree_size(csync->remote.tree), 2);
+
+    /* '_' is not a wildcard */
+    rc = csync_statedb_get_below_path(csync, "dir_x");
+    assert_int_equal(rc, 0);
+    assert_int_equal(c_rbtree_size(csync->remote.tree), 3);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
@@ -219,6 +281,7 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_csync_statedb_write, setup, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_hash_not_found, setup_db, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_inode_not_found, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_get_below_path, setup_below_path_db, teardown),
     };
 
     return run_tests(tests);
@@ -58,6 +58,7 @@ struct CmdOptions {
     bool interactive;
     QString exclude;
     QString unsyncedfolders;
+    QString perfReport; // format of the performance report printed after the sync, or empty
 };
 
 // we can't use csync_set_userdata because the SyncEngine sets it already.
@@ -155,6 +156,8 @@ void help()
     std::cout << "  --password, -p [pass]  Use [pass] as password" << std::endl;
     std::cout << "  -n                     Use netrc (5) for login" << std::endl;
     std::cout << "  --non-interactive      Do not block execution with interaction" << std::endl;
+    std::cout << "  --perf-report [format] Print the statistics of the sync run to stdout," << std::endl;
+    std::cout << "                         as json (default) or prometheus" << std::endl;
     std::cout << "  --version, -v          Display version and exit" << std::endl;
     std::cout << "" << std::endl;
     exit(1);
@@ -224,6 +227,14 @@ void parseOptions( const QStringList& app_args, CmdOptions *options )
                 options->exclude = it.next();
         } else if( option == "--unsyncedfolders" && !it.peekNext().startsWith("-") ) {
             options->unsyncedfolders = it.next();
+        } else if( option == "--perf-report" ) {
+            options->perfReport = QLatin1String("json");
+            if( it.hasNext() && !it.peekNext().startsWith("-") ) {
+                options->perfReport = it.next();
+            }
+            if( options->perfReport != "json" && options->perfReport != "prometheus" ) {
+                help();
+            }
         } else {
             help();
         }
@@ -477,6 +488,11 @@ restart_sync:
 
     csync_destroy(_csync_ctx);
 
+    if (!options.perfReport.isEmpty()) {
+        const SyncPerformanceReport &report = engine.performanceReport();
+        std::cout << (options.perfReport == "json" ? report.toJson() : report.toPrometheus()).constData() << std::flush;
+    }
+
     if (engine.isAnotherSyncNeeded()) {
         qDebug() << "Restarting Sync, because another sync is needed";
         goto restart_sync;
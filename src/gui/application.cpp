@@ -62,6 +62,8 @@ static const char optionsC[] =
         "  --logexpire <hours>  : removes logs older than <hours> hours.\n"
         "                         (to be used with --logdir)\n"
         "  --logflush           : flush the log file after every write.\n"
+        "  --loglevel <level>   : only log the messages up to <level>, from 1 (fatal)\n"
+        "                         to 9 (trace). The default is 8 (debug).\n"
         "  --confdir <dirname>  : Use the given configuration directory.\n"
         ;
 
@@ -88,6 +90,7 @@ Application::Application(int &argc, char **argv) :
     _showLogWindow(false),
     _logExpire(0),
     _logFlush(false),
+    _logLevel(Logger::DebugLevel),
     _userTriggeredConnect(false),
     _debugMode(false)
 {
@@ -328,6 +331,7 @@ void Application::setupLogging()
     Logger::instance()->setLogDir(_logDir);
     Logger::instance()->setLogExpire(_logExpire);
     Logger::instance()->setLogFlush(_logFlush);
+    Logger::instance()->setLogLevel(_logLevel);
 
     Logger::instance()->enterNextLogFile();
 
@@ -390,6 +394,12 @@ void Application::parseOptions(const QStringList &options)
             }
         } else if (option == QLatin1String("--logflush")) {
             _logFlush = true;
+        } else if (option == QLatin1String("--loglevel")) {
+            if (it.hasNext() && !it.peekNext().startsWith(QLatin1String("--"))) {
+                _logLevel = it.next().toInt();
+            } else {
+                setHelp();
+            }
         } else if (option == QLatin1String("--confdir")) {
             if (it.hasNext() && !it.peekNext().startsWith(QLatin1String("--"))) {
                 QString confDir = it.next();
@@ -102,6 +102,7 @@ private:
     QString _logDir;
     int     _logExpire;
     bool    _logFlush;
+    int     _logLevel;
     bool    _userTriggeredConnect;
     bool    _debugMode;
 
@@ -43,12 +43,18 @@
 
 namespace OCC {
 
-static void csyncLogCatcher(int /*verbosity*/,
-                        const char */*function*/,
+static void csyncLogCatcher(int verbosity,
+                        const char *function,
                         const char *buffer,
                         void */*userdata*/)
 {
-    Logger::instance()->csyncLog( QString::fromUtf8(buffer) );
+    Logger::csyncLog( verbosity, function, buffer );
+}
+
+// Don't let csync format messages nobody will see
+static int csyncLogLevel()
+{
+    return Logger::instance()->logLevel();
 }
 
 
@@ -108,7 +114,7 @@ bool Folder::init()
         _csync_ctx = 0;
     } else {
         csync_set_log_callback( csyncLogCatcher );
-        csync_set_log_level( 11 );
+        csync_set_log_level( csyncLogLevel() );
 
         _accountState->account()->credentials()->syncContextPreInit(_csync_ctx);
 
@@ -345,6 +351,9 @@ void Folder::bubbleUpSyncResult()
     SyncRunFileLog syncFileLog;
 
     syncFileLog.start(path(), _engine ? _engine->stopWatch() : Utility::StopWatch() );
+    if (_engine) {
+        SyncRunFileLog::writePerformanceReport(path(), _engine->performanceReport());
+    }
 
     QElapsedTimer timer;
     timer.start();
@@ -783,6 +792,9 @@ void Folder::startSync(const QStringList &pathList)
         return;
     }
 
+    // the log file or window may have been opened or closed since the last sync
+    csync_set_log_level( csyncLogLevel() );
+
     _engine.reset(new SyncEngine( _accountState->account(), _csync_ctx, path(), remoteUrl().path(), _remotePath, &_journal));
 
     qRegisterMetaType<SyncFileItemVector>("SyncFileItemVector");
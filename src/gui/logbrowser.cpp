@@ -112,6 +112,7 @@ LogBrowser::LogBrowser(QWidget *parent) :
 
     // Direct connection for log comming from this thread, and queued for the one in a different thread
     connect(Logger::instance(), SIGNAL(newLog(QString)),this,SLOT(slotNewLog(QString)), Qt::AutoConnection);
+    Logger::instance()->setLogWindowActivated(true);
 
     QAction *showLogWindow = new QAction(this);
     showLogWindow->setShortcut(QKeySequence("F12"));
@@ -128,6 +129,7 @@ LogBrowser::LogBrowser(QWidget *parent) :
 
 LogBrowser::~LogBrowser()
 {
+    Logger::instance()->setLogWindowActivated(false);
 }
 
 void LogBrowser::closeEvent(QCloseEvent *)
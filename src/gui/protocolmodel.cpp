@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "protocolmodel.h"
+#include "progressdispatcher.h"
+#include "syncresult.h"
+#include "syncrunfilelog.h"
+#include "theme.h"
+#include "utility.h"
+
+#include <QCoreApplication>
+#include <QLocale>
+
+namespace OCC {
+
+// Number of items loaded from the logs at once
+static const int historyPageSize = 200;
+
+static QString timeString(qint64 msecs, QLocale::FormatType format)
+{
+    if (msecs == 0) {
+        return QString(); // the log has no valid time for the run
+    }
+    return QLocale::system().toString(QDateTime::fromMSecsSinceEpoch(msecs), format);
+}
+
+static QString fixupFilename(const QString &name)
+{
+    if (Utility::isMac()) {
+        QString n(name);
+        return n.replace(QChar(':'), QChar('/'));
+    }
+    return name;
+}
+
+ProtocolModel::ProtocolModel(int retention, QObject *parent)
+    : QAbstractTableModel(parent),
+      _retention(qMax(1, retention)),
+      _newest(-1),
+      _count(0),
+      _historyStarted(false),
+      _historyDone(false)
+{
+}
+
+ProtocolModel::~ProtocolModel()
+{
+    clearHistorySources();
+}
+
+void ProtocolModel::setFolderPaths(const QHash<QString, QString> &paths)
+{
+    _folderPaths = paths;
+}
+
+ProtocolModel::Entry ProtocolModel::makeEntry(const QString &folder, const SyncFileItem &item, const QDateTime &time)
+{
+    Entry entry;
+    entry.time = time.isValid() ? time.toMSecsSinceEpoch() : 0;
+    entry.file = item._file;
+    entry.status = item._status;
+
+    int folderIndex = _folders.indexOf(folder);
+    if (folderIndex < 0) {
+        folderIndex = _folders.size();
+        _folders.append(folder);
+    }
+    entry.folder = folderIndex;
+
+    if (Progress::isWarningKind(item._status)) {
+        entry.message = item._errorString;
+    } else {
+        // if the error string is set, it's prefered because it is a usefull user message.
+        entry.message = item._errorString.isEmpty() ? Progress::asResultString(item) : item._errorString;
+        if (Progress::isSizeDependent(item._instruction)) {
+            entry.size = item._size;
+        }
+    }
+    return entry;
+}
+
+const ProtocolModel::Entry &ProtocolModel::entry(int row) const
+{
+    if (row < _count) {
+        return _ring.at((_newest - row + _retention) % _retention);
+    }
+    return _history.at(row - _count);
+}
+
+void ProtocolModel::addItem(const QString &folder, const SyncFileItem &item)
+{
+    const Entry newEntry = makeEntry(folder, item, QDateTime::currentDateTime());
+
+    if (_count == _retention) {
+        // The oldest entry makes room, its slot is reused below
+        beginRemoveRows(QModelIndex(), _count - 1, _count - 1);
+        --_count;
+        endRemoveRows();
+    }
+
+    beginInsertRows(QModelIndex(), 0, 0);
+    _newest = (_newest + 1) % _retention;
+    if (_newest == _ring.size()) {
+        _ring.append(newEntry);
+    } else {
+        _ring[_newest] = newEntry;
+    }
+    ++_count;
+    endInsertRows();
+}
+
+void ProtocolModel::removeIgnoredItems(const QString &folder)
+{
+    const int folderIndex = _folders.indexOf(folder);
+    if (folderIndex < 0) {
+        return;
+    }
+
+    // Compact the ring, the oldest entry first
+    QVector<Entry> kept;
+    kept.reserve(_count);
+    for (int row = _count - 1; row >= 0; --row) {
+        const Entry &e = entry(row);
+        if (e.folder != folderIndex || e.status != SyncFileItem::FileIgnored) {
+            kept.append(e);
+        }
+    }
+    if (kept.size() == _count) {
+        return;
+    }
+
+    beginResetModel();
+    _ring = kept;
+    _count = kept.size();
+    _newest = _count - 1;
+    endResetModel();
+}
+
+void ProtocolModel::resetHistory()
+{
+    if (!_history.isEmpty()) {
+        beginRemoveRows(QModelIndex(), _count, _count + _history.size() - 1);
+        _history.clear();
+        endRemoveRows();
+    }
+    clearHistorySources();
+    _historyStarted = false;
+    _historyDone = false;
+}
+
+void ProtocolModel::clearHistorySources()
+{
+    foreach (HistorySource *source, _historySources) {
+        delete source->reader;
+        delete source;
+    }
+    _historySources.clear();
+}
+
+void ProtocolModel::readNext(HistorySource *source)
+{
+    do {
+        source->hasNext = source->reader->readItem(&source->next, &source->nextRunEnd);
+        // Every sync lists the ignored items again, only the latest ones are of interest
+    } while (source->hasNext && source->next._status == SyncFileItem::FileIgnored);
+}
+
+int ProtocolModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid()) {
+        return 0;
+    }
+    return _count + _history.size();
+}
+
+int ProtocolModel::columnCount(const QModelIndex &parent) const
+{
+    if (parent.isValid()) {
+        return 0;
+    }
+    return ColumnCount;
+}
+
+QVariant ProtocolModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= rowCount()) {
+        return QVariant();
+    }
+    const Entry &e = entry(index.row());
+
+    switch (role) {
+    case Qt::DisplayRole:
+        switch (index.column()) {
+        case TimeColumn:
+            return timeString(e.time, QLocale::NarrowFormat);
+        case FileColumn:
+            return fixupFilename(e.file);
+        case FolderColumn:
+            return _folders.at(e.folder);
+        case ActionColumn:
+            return e.message;
+        case SizeColumn:
+            if (e.size >= 0) {
+                return Utility::octetsToString(e.size);
+            }
+            break;
+        }
+        break;
+    case Qt::DecorationRole:
+        if (index.column() == TimeColumn && Progress::isWarningKind(SyncFileItem::Status(e.status))) {
+            if (e.status == SyncFileItem::NormalError || e.status == SyncFileItem::FatalError) {
+                return Theme::instance()->syncStateIcon(SyncResult::Error);
+            }
+            return Theme::instance()->syncStateIcon(SyncResult::Problem);
+        }
+        break;
+    case Qt::ToolTipRole:
+        switch (index.column()) {
+        case TimeColumn:
+            return timeString(e.time, QLocale::LongFormat);
+        case FileColumn:
+            return e.file;
+        case ActionColumn:
+            return e.message;
+        }
+        break;
+    case IgnoredIndicatorRole:
+        return e.status == SyncFileItem::FileIgnored;
+    }
+    return QVariant();
+}
+
+QVariant ProtocolModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+        return QVariant();
+    }
+    // Keep the context the ProtocolWidget had for these
+    switch (section) {
+    case TimeColumn:
+        return QCoreApplication::translate("OCC::ProtocolWidget", "Time");
+    case FileColumn:
+        return QCoreApplication::translate("OCC::ProtocolWidget", "File");
+    case FolderColumn:
+        return QCoreApplication::translate("OCC::ProtocolWidget", "Folder");
+    case ActionColumn:
+        return QCoreApplication::translate("OCC::ProtocolWidget", "Action");
+    case SizeColumn:
+        return QCoreApplication::translate("OCC::ProtocolWidget", "Size");
+    }
+    return QVariant();
+}
+
+bool ProtocolModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && !_historyDone;
+}
+
+void ProtocolModel::fetchMore(const QModelIndex &parent)
+{
+    if (parent.isValid() || _historyDone) {
+        return;
+    }
+
+    if (!_historyStarted) {
+        _historyStarted = true;
+        // The runs that ended after the oldest entry of the ring have their items in it.
+        // Those evicted from the ring after this point are listed after the next resetHistory().
+        const QDateTime endedBefore = _count > 0
+                ? QDateTime::fromMSecsSinceEpoch(entry(_count - 1).time)
+                : QDateTime::currentDateTime();
+        QHash<QString, QString>::const_iterator it;
+        for (it = _folderPaths.constBegin(); it != _folderPaths.constEnd(); ++it) {
+            HistorySource *source = new HistorySource;
+            source->folder = it.key();
+            source->reader = new SyncRunFileLogReader(it.value(), endedBefore);
+            readNext(source);
+            _historySources.append(source);
+        }
+    }
+
+    // Merge the logs of the folders, the newest run first
+    QVector<Entry> page;
+    while (page.size() < historyPageSize) {
+        HistorySource *newest = 0;
+        foreach (HistorySource *source, _historySources) {
+            if (source->hasNext && (!newest || source->nextRunEnd > newest->nextRunEnd)) {
+                newest = source;
+            }
+        }
+        if (!newest) {
+            _historyDone = true;
+            clearHistorySources();
+            break;
+        }
+        page.append(makeEntry(newest->folder, newest->next, newest->nextRunEnd));
+        readNext(newest);
+    }
+
+    if (page.isEmpty()) {
+        return;
+    }
+    const int first = rowCount();
+    beginInsertRows(QModelIndex(), first, first + page.size() - 1);
+    _history += page;
+    endInsertRows();
+}
+
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef PROTOCOLMODEL_H
+#define PROTOCOLMODEL_H
+
+#include <QAbstractTableModel>
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QVector>
+
+#include "syncfileitem.h"
+
+namespace OCC {
+
+class SyncRunFileLogReader;
+
+/**
+ * @brief The sync activity listed by the ProtocolWidget, the newest first
+ *
+ * The items completed since the client started are kept in a ring buffer of
+ * at most \a retention entries. When the view scrolls past them, the items
+ * of the earlier sync runs are loaded page by page from the sync logs of the
+ * folders (see SyncRunFileLogReader). So neither the memory nor the time to
+ * show the list depend on the size of the syncs.
+ */
+class ProtocolModel : public QAbstractTableModel
+{
+    Q_OBJECT
+public:
+    enum Column {
+        TimeColumn,
+        FileColumn,
+        FolderColumn,
+        ActionColumn,
+        SizeColumn,
+        ColumnCount
+    };
+
+    enum {
+        IgnoredIndicatorRole = Qt::UserRole + 1
+    };
+
+    explicit ProtocolModel(int retention, QObject *parent = 0);
+    ~ProtocolModel();
+
+    /** The paths of the folders whose logs are read, by alias */
+    void setFolderPaths(const QHash<QString, QString> &paths);
+
+    void addItem(const QString &folder, const SyncFileItem &item);
+    /** The ignored items are listed again by the next sync of the folder */
+    void removeIgnoredItems(const QString &folder);
+    /** Drops the items loaded from the logs, they are loaded again when the view needs them */
+    void resetHistory();
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
+    QVariant data(const QModelIndex &index, int role) const Q_DECL_OVERRIDE;
+    QVariant headerData(int section, Qt::Orientation orientation, int role) const Q_DECL_OVERRIDE;
+    bool canFetchMore(const QModelIndex &parent) const Q_DECL_OVERRIDE;
+    void fetchMore(const QModelIndex &parent) Q_DECL_OVERRIDE;
+
+private:
+    struct Entry {
+        Entry() : time(0), size(-1), folder(0), status(SyncFileItem::NoStatus) {}
+        qint64 time; // msecs since epoch, 0 if unknown
+        QString file;
+        QString message;
+        qint64 size; // -1 when no size is shown
+        quint16 folder; // index in _folders
+        quint8 status; // SyncFileItem::Status
+    };
+
+    // A folder log the older items are read from
+    struct HistorySource {
+        HistorySource() : reader(0), hasNext(false) {}
+        QString folder;
+        SyncRunFileLogReader *reader;
+        bool hasNext;
+        SyncFileItem next;
+        QDateTime nextRunEnd;
+    };
+
+    Entry makeEntry(const QString &folder, const SyncFileItem &item, const QDateTime &time);
+    const Entry &entry(int row) const;
+    void readNext(HistorySource *source);
+    void clearHistorySources();
+
+    QStringList _folders; // the aliases the entries refer to
+    QHash<QString, QString> _folderPaths;
+
+    QVector<Entry> _ring;
+    int _retention;
+    int _newest; // index in _ring
+    int _count; // number of entries of _ring in use
+
+    QVector<Entry> _history; // loaded from the logs, listed below the ring
+    QList<HistorySource *> _historySources;
+    bool _historyStarted;
+    bool _historyDone;
+};
+
+}
+
+#endif // PROTOCOLMODEL_H
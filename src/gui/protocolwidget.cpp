@@ -17,6 +17,7 @@
 #endif
 
 #include "protocolwidget.h"
+#include "protocolmodel.h"
 #include "configfile.h"
 #include "syncresult.h"
 #include "logger.h"
@@ -35,32 +36,26 @@ namespace OCC {
 
 ProtocolWidget::ProtocolWidget(QWidget *parent) :
     QWidget(parent),
-    IgnoredIndicatorRole( Qt::UserRole +1 ),
     _ui(new Ui::ProtocolWidget)
 {
     _ui->setupUi(this);
 
+    ConfigFile cfg;
+    _model = new ProtocolModel(cfg.maxActivityItems(), this);
+    updateFolderPaths();
+    _ui->_treeView->setModel(_model);
+
     connect(ProgressDispatcher::instance(), SIGNAL(progressInfo(QString,Progress::Info)),
             this, SLOT(slotProgressInfo(QString,Progress::Info)));
 
-    connect(_ui->_treeWidget, SIGNAL(itemActivated(QTreeWidgetItem*,int)), SLOT(slotOpenFile(QTreeWidgetItem*,int)));
-
-    // Adjust copyToClipboard() when making changes here!
-    QStringList header;
-    header << tr("Time");
-    header << tr("File");
-    header << tr("Folder");
-    header << tr("Action");
-    header << tr("Size");
-
-    _ui->_treeWidget->setHeaderLabels( header );
-    _ui->_treeWidget->setColumnWidth(1, 180);
-    _ui->_treeWidget->setColumnCount(5);
-    _ui->_treeWidget->setRootIsDecorated(false);
-    _ui->_treeWidget->setTextElideMode(Qt::ElideMiddle);
-    _ui->_treeWidget->header()->setObjectName("ActivityListHeader");
+    connect(_ui->_treeView, SIGNAL(activated(QModelIndex)), SLOT(slotOpenFile(QModelIndex)));
+
+    _ui->_treeView->setColumnWidth(ProtocolModel::FileColumn, 180);
+    _ui->_treeView->setRootIsDecorated(false);
+    _ui->_treeView->setTextElideMode(Qt::ElideMiddle);
+    _ui->_treeView->header()->setObjectName("ActivityListHeader");
 #if defined(Q_OS_MAC)
-    _ui->_treeWidget->setMinimumWidth(400);
+    _ui->_treeView->setMinimumWidth(400);
 #endif
 
     connect(this, SIGNAL(guiLog(QString,QString)), Logger::instance(), SIGNAL(guiLog(QString,QString)));
@@ -73,15 +68,15 @@ ProtocolWidget::ProtocolWidget(QWidget *parent) :
     _copyBtn->setToolTip( tr("Copy the activity list to the clipboard."));
     _copyBtn->setEnabled(false);
     connect(_copyBtn, SIGNAL(clicked()), SLOT(copyToClipboard()));
+    connect(_model, SIGNAL(rowsInserted(QModelIndex,int,int)), SLOT(slotRowsInserted()));
 
-    ConfigFile cfg;
-    cfg.restoreGeometryHeader(_ui->_treeWidget->header());
+    cfg.restoreGeometryHeader(_ui->_treeView->header());
 }
 
 ProtocolWidget::~ProtocolWidget()
 {
     ConfigFile cfg;
-    cfg.saveGeometryHeader(_ui->_treeWidget->header() );
+    cfg.saveGeometryHeader(_ui->_treeView->header() );
 
     delete _ui;
 }
@@ -91,25 +86,25 @@ void ProtocolWidget::copyToClipboard()
     QString text;
     QTextStream ts(&text);
 
-    int topLevelItems = _ui->_treeWidget->topLevelItemCount();
-    for (int i = 0; i < topLevelItems; i++) {
-        QTreeWidgetItem *child = _ui->_treeWidget->topLevelItem(i);
+    // The items listed so far, those not yet loaded from the logs are left out
+    int rows = _model->rowCount();
+    for (int i = 0; i < rows; i++) {
         ts << left
                 // time stamp
             << qSetFieldWidth(10)
-            << child->data(0,Qt::DisplayRole).toString()
+            << _model->index(i, ProtocolModel::TimeColumn).data().toString()
                 // file name
             << qSetFieldWidth(64)
-            << child->data(1,Qt::DisplayRole).toString()
+            << _model->index(i, ProtocolModel::FileColumn).data().toString()
                 // folder
             << qSetFieldWidth(15)
-            << child->data(2, Qt::DisplayRole).toString()
+            << _model->index(i, ProtocolModel::FolderColumn).data().toString()
                 // action
             << qSetFieldWidth(15)
-            << child->data(3, Qt::DisplayRole).toString()
+            << _model->index(i, ProtocolModel::ActionColumn).data().toString()
                 // size
             << qSetFieldWidth(10)
-            << child->data(4, Qt::DisplayRole).toString()
+            << _model->index(i, ProtocolModel::SizeColumn).data().toString()
             << qSetFieldWidth(0)
             << endl;
     }
@@ -137,44 +132,26 @@ void ProtocolWidget::slotRetrySync()
     folderMan->slotScheduleAllFolders();
 }
 
-void ProtocolWidget::cleanIgnoreItems(const QString& folder)
+void ProtocolWidget::updateFolderPaths()
 {
-    int itemCnt = _ui->_treeWidget->topLevelItemCount();
-
-    // Limit the number of items
-    while(itemCnt > 2000) {
-        delete _ui->_treeWidget->takeTopLevelItem(itemCnt - 1);
-        itemCnt--;
-    }
-
-    for( int cnt = itemCnt-1; cnt >=0 ; cnt-- ) {
-        QTreeWidgetItem *item = _ui->_treeWidget->topLevelItem(cnt);
-        bool isErrorItem = item->data(0, IgnoredIndicatorRole).toBool();
-        QString itemFolder = item->data(2, Qt::DisplayRole).toString();
-        if( isErrorItem && itemFolder == folder ) {
-            delete item;
-        }
+    QHash<QString, QString> paths;
+    foreach (Folder *f, FolderMan::instance()->map()) {
+        paths.insert(f->alias(), f->path());
     }
+    _model->setFolderPaths(paths);
 }
 
-QString ProtocolWidget::timeString(QDateTime dt, QLocale::FormatType format) const
+void ProtocolWidget::slotRowsInserted()
 {
-    QLocale loc = QLocale::system();
-    QString timeStr;
-
-    if( format == QLocale::NarrowFormat ) {
-        timeStr = loc.toString(dt, QLocale::NarrowFormat);
-    } else {
-        timeStr = loc.toString(dt, format);
+    if (!_copyBtn->isEnabled()) {
+        _copyBtn->setEnabled(true);
     }
-
-    return timeStr;
 }
 
-void ProtocolWidget::slotOpenFile( QTreeWidgetItem *item, int )
+void ProtocolWidget::slotOpenFile( const QModelIndex& index )
 {
-    QString folderName = item->text(2);
-    QString fileName = item->text(1);
+    QString folderName = index.sibling(index.row(), ProtocolModel::FolderColumn).data().toString();
+    QString fileName = index.sibling(index.row(), ProtocolModel::FileColumn).data().toString();
 
     Folder *folder = FolderMan::instance()->folder(folderName);
     if (folder) {
@@ -186,63 +163,6 @@ void ProtocolWidget::slotOpenFile( QTreeWidgetItem *item, int )
     }
 }
 
-QString ProtocolWidget::fixupFilename( const QString& name )
-{
-    if( Utility::isMac() ) {
-        QString n(name);
-        return n.replace(QChar(':'), QChar('/'));
-    }
-    return name;
-}
-
-QTreeWidgetItem* ProtocolWidget::createCompletedTreewidgetItem(const QString& folder, const SyncFileItem& item)
-{
-    QStringList columns;
-    QDateTime timestamp = QDateTime::currentDateTime();
-    const QString timeStr = timeString(timestamp);
-    const QString longTimeStr = timeString(timestamp, QLocale::LongFormat);
-    QIcon icon;
-    QString message;
-
-    columns << timeStr;
-    columns << fixupFilename(item._file);
-    columns << folder;
-    if (Progress::isWarningKind(item._status)) {
-        message= item._errorString;
-        columns << message;
-        if (item._status == SyncFileItem::NormalError || item._status == SyncFileItem::FatalError) {
-            icon = Theme::instance()->syncStateIcon(SyncResult::Error);
-        } else {
-            icon = Theme::instance()->syncStateIcon(SyncResult::Problem);
-        }
-
-    } else {
-        // if the error string is set, it's prefered because it is a usefull user message.
-        // at least should be...
-        if(item._errorString.isEmpty()) {
-            message = Progress::asResultString(item);
-        } else {
-            message = item._errorString;
-        }
-        columns << message;
-        if (Progress::isSizeDependent(item._instruction)) {
-            columns <<  Utility::octetsToString( item._size );
-        }
-    }
-
-    QTreeWidgetItem *twitem = new QTreeWidgetItem(columns);
-    if (item._status == SyncFileItem::FileIgnored) {
-        // Tell that we want to remove it on the next sync.
-        twitem->setData(0, IgnoredIndicatorRole, true);
-    }
-
-    twitem->setIcon(0, icon);
-    twitem->setToolTip(0, longTimeStr);
-    twitem->setToolTip(1, item._file);
-    twitem->setToolTip(3, message );
-    return twitem;
-}
-
 void ProtocolWidget::computeResyncButtonEnabled()
 {
     FolderMan *folderMan = FolderMan::instance();
@@ -272,22 +192,19 @@ void ProtocolWidget::slotProgressInfo( const QString& folder, const Progress::In
 {
     if( progress._completedFileCount == ULLONG_MAX ) {
         // The sync is restarting, clean the old items
-        cleanIgnoreItems(folder);
+        _model->removeIgnoredItems(folder);
+        // and reload the older items from the logs, with what left the ring meanwhile
+        updateFolderPaths();
+        _model->resetHistory();
         computeResyncButtonEnabled();
     } else if (progress._completedFileCount >= progress._totalFileCount) {
         //Sync completed
         computeResyncButtonEnabled();
     }
-    SyncFileItem last = progress._lastCompletedItem;
+    const SyncFileItem &last = progress._lastCompletedItem;
     if (last.isEmpty()) return;
 
-    QTreeWidgetItem *item = createCompletedTreewidgetItem(folder, last);
-    if(item) {
-        _ui->_treeWidget->insertTopLevelItem(0, item);
-        if (!_copyBtn->isEnabled()) {
-            _copyBtn->setEnabled(true);
-        }
-    }
+    _model->addItem(folder, last);
 }
 
 
@@ -15,17 +15,17 @@
 #define PROTOCOLWIDGET_H
 
 #include <QDialog>
-#include <QDateTime>
-#include <QLocale>
 
 #include "progressdispatcher.h"
 
 #include "ui_protocolwidget.h"
 
 class QPushButton;
+class QModelIndex;
 
 namespace OCC {
 class SyncResult;
+class ProtocolModel;
 
 namespace Ui {
   class ProtocolWidget;
@@ -43,28 +43,23 @@ signals:
 
 public slots:
     void slotProgressInfo( const QString& folder, const Progress::Info& progress );
-    void slotOpenFile( QTreeWidgetItem* item, int );
+    void slotOpenFile( const QModelIndex& index );
 
 protected slots:
     void copyToClipboard();
     void slotRetrySync();
+    void slotRowsInserted();
 
 signals:
     void guiLog(const QString&, const QString&);
 
 private:
     void setSyncResultStatus(const SyncResult& result );
-    void cleanIgnoreItems( const QString& folder );
     void computeResyncButtonEnabled();
-    QString fixupFilename( const QString& name );
+    void updateFolderPaths();
 
-
-    QTreeWidgetItem* createCompletedTreewidgetItem(const QString &folder, const SyncFileItem &item );
-
-    QString timeString(QDateTime dt, QLocale::FormatType format = QLocale::NarrowFormat) const;
-
-    const int IgnoredIndicatorRole;
     Ui::ProtocolWidget *_ui;
+    ProtocolModel *_model;
     QPushButton *_retrySyncBtn;
     QPushButton *_copyBtn;
 };
@@ -129,6 +129,13 @@ SocketApi::SocketApi(QObject* parent)
             SLOT(slotJobCompleted(QString,SyncFileItem)));
     connect(ProgressDispatcher::instance(), SIGNAL(syncItemDiscovered(QString,SyncFileItem)),
             this, SLOT(slotSyncItemDiscovered(QString,SyncFileItem)));
+
+    // An open journal connection keeps the -wal file of the journal, which makes the
+    // journal check its integrity the next time it is opened: only keep them while in use.
+    // The file managers ask in bursts, while a folder is browsed.
+    _dbIdleTimer.setSingleShot(true);
+    _dbIdleTimer.setInterval(10 * 1000);
+    connect(&_dbIdleTimer, SIGNAL(timeout()), this, SLOT(slotReleaseDbConnections()));
 }
 
 SocketApi::~SocketApi()
@@ -235,21 +242,30 @@ void SocketApi::slotUnregisterPath( const QString& alias )
     if (f) {
         broadcastMessage(QLatin1String("UNREGISTER_PATH"), f->path(), QString::null, true );
 
-        if( _dbQueries.contains(f)) {
-            SqlQuery *h = _dbQueries[f];
-            if( h ) {
-                h->finish();
-            }
-            _dbQueries.remove(f);
-        }
-        if( _openDbs.contains(f) ) {
-            SqlDatabase *db = _openDbs[f];
-            if( db ) {
-                db->close();
-            }
-            _openDbs.remove(f);
+        releaseDbConnection(f);
+    }
+}
+
+void SocketApi::releaseDbConnection(Folder *folder)
+{
+    if( _dbQueries.contains(folder)) {
+        SqlQuery *h = _dbQueries.take(folder);
+        if( h ) {
+            h->finish();
+            delete h;
         }
     }
+    if( _openDbs.contains(folder) ) {
+        // Give the connection back to the journal
+        folder->journalDb()->releaseReadConnection(_openDbs.take(folder));
+    }
+}
+
+void SocketApi::slotReleaseDbConnections()
+{
+    foreach (Folder *folder, _openDbs.keys()) {
+        releaseDbConnection(folder);
+    }
 }
 
 void SocketApi::slotUpdateFolderView(const QString& alias)
@@ -439,6 +455,7 @@ SqlQuery* SocketApi::getSqlQuery( Folder *folder )
         return 0;
     }
 
+    _dbIdleTimer.start();
     if( _dbQueries.contains(folder) ) {
         return _dbQueries[folder];
     }
@@ -451,9 +468,10 @@ SqlQuery* SocketApi::getSqlQuery( Folder *folder )
 
     QFileInfo fi(dbFileName);
     if( fi.exists() ) {
-        SqlDatabase *db = new SqlDatabase;
+        // Use a connection of the journal rather than opening the file again
+        SqlDatabase *db = folder->journalDb()->acquireReadConnection();
 
-        if( db && db->openReadOnly(dbFileName) ) {
+        if( db ) {
             _openDbs.insert(folder, db);
 
             SqlQuery *query = new SqlQuery(*db);
@@ -26,6 +26,7 @@ extern "C" {
 #include <QTcpSocket>
 #include <QTcpServer>
 #include <QLocalServer>
+#include <QTimer>
 
 #include "syncfileitem.h"
 #include "syncjournalfilerecord.h"
@@ -66,12 +67,14 @@ private slots:
     void slotReadSocket();
     void slotJobCompleted(const QString &, const SyncFileItem &);
     void slotSyncItemDiscovered(const QString &, const SyncFileItem &);
+    void slotReleaseDbConnections();
 
 private:
     SyncFileStatus fileStatus(Folder *folder, const QString& systemFileName, c_strlist_t *excludes );
     SyncJournalFileRecord dbFileRecord_capi( Folder *folder, QString fileName );
     SyncFileStatus recursiveFolderStatus(Folder *folder, const QString& fileName, c_strlist_t *excludes  );
     SqlQuery *getSqlQuery( Folder *folder );
+    void releaseDbConnection( Folder *folder );
 
     void sendMessage(SocketType* socket, const QString& message, bool doWait = false);
     void broadcastMessage(const QString& verb, const QString &path, const QString &status = QString::null, bool doWait = false);
@@ -93,6 +96,7 @@ private:
     c_strlist_t *_excludes;
     QHash<Folder*, SqlQuery*> _dbQueries;
     QHash<Folder*, SqlDatabase*> _openDbs;
+    QTimer _dbIdleTimer; // the connections are given back to the journals when it fires
 };
 
 }
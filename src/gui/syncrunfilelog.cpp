@@ -20,7 +20,14 @@
 
 namespace OCC {
 
+// Written by SyncRunFileLog::start() before the items of each run
+static const char runHeaderC[] = "#=#=#=# Syncrun started ";
+// Written by SyncRunFileLog::close() after them
+static const char runEndC[] = "#=#=#=# Syncrun ended ";
+static const char runStartedAtC[] = " started at ";
+
 SyncRunFileLog::SyncRunFileLog()
+    : _runStart(0)
 {
 }
 
@@ -119,7 +126,10 @@ void SyncRunFileLog::start(const QString &folderPath,  const Utility::StopWatch
     }
 
 
-    _out << "#=#=#=# Syncrun started " << dateTimeStr(dt) << " until " << dateTimeStr(de) << " ("
+    _out.flush();
+    _runStart = _file->size();
+    _runEnd = de;
+    _out << runHeaderC << dateTimeStr(dt) << " until " << dateTimeStr(de) << " ("
             << stopWatch.durationOfLap(QLatin1String("Sync Finished")) << " msec)" << endl;
 }
 
@@ -161,7 +171,250 @@ void SyncRunFileLog::logItem( const SyncFileItem& item )
 
 void SyncRunFileLog::close()
 {
+    // SyncRunFileLogReader reads the logs backwards and meets this line first
+    _out << runEndC << dateTimeStr(_runEnd) << runStartedAtC << _runStart << endl;
     _file->close();
 }
 
+void SyncRunFileLog::writePerformanceReport( const QString& folderPath, const SyncPerformanceReport& report )
+{
+    // Note; these names are ignored in csync_exclude.c, like the log
+    const QString baseName = folderPath + QLatin1String(".owncloudsync.log.perf");
+    const QString json = baseName + QLatin1String(".json");
+    const QString prometheus = baseName + QLatin1String(".prom");
+
+    QFile file(json);
+    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        file.write(report.toJson());
+        file.close();
+        FileSystem::setFileHidden(json, true);
+    }
+    file.setFileName(prometheus);
+    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        file.write(report.toPrometheus());
+        file.close();
+        FileSystem::setFileHidden(prometheus, true);
+    }
+}
+
+static const qint64 readChunkSize = 64 * 1024;
+
+SyncRunFileLogReader::SyncRunFileLogReader( const QString& folderPath, const QDateTime& endedBefore )
+    : _pos(0),
+      _inRun(false),
+      _endedBefore(endedBefore)
+{
+    const QString filename = folderPath + QLatin1String(".owncloudsync.log");
+    _fileNames << filename << filename + QLatin1String(".1");
+}
+
+bool SyncRunFileLogReader::openNextFile()
+{
+    _file.close();
+    _pos = 0;
+    _rest.clear();
+    _lines.clear();
+    _inRun = false;
+    while (!_fileNames.isEmpty()) {
+        _file.setFileName(_fileNames.takeFirst());
+        if (_file.open(QIODevice::ReadOnly)) {
+            _pos = _file.size();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SyncRunFileLogReader::previousLine( QByteArray *line )
+{
+    while (_lines.isEmpty()) {
+        if (_pos == 0) {
+            return false;
+        }
+        const qint64 chunk = qMin(_pos, readChunkSize);
+        _pos -= chunk;
+        if (!_file.seek(_pos)) {
+            return false;
+        }
+        QByteArray data = _file.read(chunk);
+        if (data.size() != chunk) {
+            return false;
+        }
+        data += _rest;
+        _lines = data.split('\n');
+        // The first line is only complete at the start of the file
+        _rest = _pos > 0 ? _lines.takeFirst() : QByteArray();
+    }
+    *line = _lines.takeLast();
+    if (line->endsWith('\r')) {
+        line->chop(1);
+    }
+    return true;
+}
+
+bool SyncRunFileLogReader::startPreviousRun()
+{
+    QByteArray line;
+    forever {
+        // where the reading was before the line
+        const qint64 pos = _pos;
+        const QByteArray rest = _rest;
+        const QList<QByteArray> lines = _lines;
+        if (!previousLine(&line)) {
+            return false;
+        }
+        if (line.isEmpty()) {
+            continue;
+        }
+        // "#=#=#=# Syncrun ended <end> started at <offset of the header>"
+        const int startedAt = line.indexOf(runStartedAtC);
+        if (!line.startsWith(runEndC) || startedAt < 0) {
+            // Logged without the end line, or the client stopped while logging the run
+            _pos = pos;
+            _rest = rest;
+            _lines = lines;
+            return startPreviousUnindexedRun();
+        }
+        const int endStart = sizeof(runEndC) - 1;
+        const QDateTime runEnd = QDateTime::fromString(
+                    QString::fromLatin1(line.mid(endStart, startedAt - endStart)), Qt::ISODate);
+        // The time has no msecs: be on the safe side for the runs that ended in the last second
+        if (runEnd.isValid() && runEnd.addSecs(1) >= _endedBefore) {
+            bool ok = false;
+            const qint64 headerPos = line.mid(startedAt + sizeof(runStartedAtC) - 1).toLongLong(&ok);
+            skipRun(ok ? headerPos : -1);
+            continue;
+        }
+        _runEnd = runEnd;
+        return true;
+    }
+}
+
+void SyncRunFileLogReader::skipRun( qint64 headerPos )
+{
+    // Jump to the header when it was not read yet, and it is where the end line says
+    if (headerPos >= 0 && headerPos < _pos && _file.seek(headerPos)
+            && _file.read(sizeof(runHeaderC) - 1) == runHeaderC) {
+        _pos = headerPos;
+        _rest.clear();
+        _lines.clear();
+        return;
+    }
+    QByteArray line;
+    while (previousLine(&line) && !line.startsWith(runHeaderC)) {
+    }
+}
+
+bool SyncRunFileLogReader::startPreviousUnindexedRun()
+{
+    // The header of a run is written before its items: look for it, then
+    // read the items from where the search started.
+    qint64 pos = _pos;
+    QByteArray rest = _rest;
+    QList<QByteArray> lines = _lines;
+
+    QByteArray line;
+    while (previousLine(&line)) {
+        if (!line.startsWith(runHeaderC)) {
+            continue;
+        }
+        // "#=#=#=# Syncrun started <start> until <end> (<duration> msec)"
+        const int until = line.indexOf(" until ");
+        const int duration = line.indexOf(" (", until);
+        QDateTime runEnd;
+        if (until >= 0 && duration > until) {
+            runEnd = QDateTime::fromString(QString::fromLatin1(line.mid(until + 7, duration - until - 7)),
+                                           Qt::ISODate);
+        }
+        // The time has no msecs: be on the safe side for the runs that ended in the last second
+        if (runEnd.isValid() && runEnd.addSecs(1) >= _endedBefore) {
+            pos = _pos;
+            rest = _rest;
+            lines = _lines;
+            continue;
+        }
+        _runEnd = runEnd;
+        _pos = pos;
+        _rest = rest;
+        _lines = lines;
+        return true;
+    }
+    return false;
+}
+
+bool SyncRunFileLogReader::parseItem( const QByteArray& line, SyncFileItem *item ) const
+{
+    // See SyncRunFileLog::logItem, each field is followed by a '|'. The file
+    // name may contain some too.
+    const QStringList fields = QString::fromLocal8Bit(line).split(QLatin1Char('|'));
+    const int fieldsAfterFile = 15;
+    if (fields.size() < 3 + fieldsAfterFile) {
+        return false;
+    }
+    const int i = fields.size() - fieldsAfterFile;
+
+    static const csync_instructions_e instructions[] = {
+        CSYNC_INSTRUCTION_NONE, CSYNC_INSTRUCTION_EVAL, CSYNC_INSTRUCTION_REMOVE,
+        CSYNC_INSTRUCTION_RENAME, CSYNC_INSTRUCTION_EVAL_RENAME, CSYNC_INSTRUCTION_NEW,
+        CSYNC_INSTRUCTION_CONFLICT, CSYNC_INSTRUCTION_IGNORE, CSYNC_INSTRUCTION_SYNC,
+        CSYNC_INSTRUCTION_STAT_ERROR, CSYNC_INSTRUCTION_ERROR
+    };
+    size_t j = 0;
+    const size_t instructionCount = sizeof(instructions) / sizeof(instructions[0]);
+    while (j < instructionCount && fields.at(i) != SyncRunFileLog::instructionToStr(instructions[j])) {
+        ++j;
+    }
+    if (j == instructionCount) {
+        return false;
+    }
+
+    *item = SyncFileItem();
+    item->_instruction = instructions[j];
+    item->_responseTimeStamp = fields.at(0);
+    item->_requestDuration = fields.at(1).toULongLong();
+    item->_file = QStringList(fields.mid(2, i - 2)).join(QLatin1String("|"));
+    if (fields.at(i + 1) == SyncRunFileLog::directionToStr(SyncFileItem::Up)) {
+        item->_direction = SyncFileItem::Up;
+    } else if (fields.at(i + 1) == SyncRunFileLog::directionToStr(SyncFileItem::Down)) {
+        item->_direction = SyncFileItem::Down;
+    }
+    item->_size = fields.at(i + 4).toLongLong();
+    item->_status = static_cast<SyncFileItem::Status>(fields.at(i + 6).toInt());
+    item->_errorString = fields.at(i + 7);
+    item->_httpErrorCode = fields.at(i + 8).toInt();
+    return true;
+}
+
+bool SyncRunFileLogReader::readItem( SyncFileItem *item, QDateTime *runEnd )
+{
+    forever {
+        if (!_inRun) {
+            if (!_file.isOpen() && !openNextFile()) {
+                return false;
+            }
+            if (!startPreviousRun()) {
+                // No more runs in that file
+                if (!openNextFile()) {
+                    return false;
+                }
+                continue;
+            }
+            _inRun = true;
+        }
+
+        QByteArray line;
+        if (!previousLine(&line) || line.startsWith(runHeaderC)) {
+            _inRun = false;
+            continue;
+        }
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+        if (parseItem(line, item)) {
+            *runEnd = _runEnd;
+            return true;
+        }
+    }
+}
+
 }
@@ -17,9 +17,11 @@
 #include <QFile>
 #include <QTextStream>
 #include <QScopedPointer>
+#include <QStringList>
 
 #include "syncfileitem.h"
 #include "utility.h"
+#include "syncperformancereport.h"
 
 namespace OCC {
 class SyncFileItem;
@@ -32,16 +34,67 @@ public:
     void logItem( const SyncFileItem& item );
     void close();
 
+    /** Replaces the .owncloudsync.log.perf.json and .prom files of the folder */
+    static void writePerformanceReport( const QString& folderPath, const SyncPerformanceReport& report );
+
 protected:
 
 private:
-    QString dateTimeStr( const QDateTime& dt );
-    QString instructionToStr( csync_instructions_e inst );
-    QString directionToStr( SyncFileItem::Direction dir );
+    friend class SyncRunFileLogReader;
+
+    static QString dateTimeStr( const QDateTime& dt );
+    static QString instructionToStr( csync_instructions_e inst );
+    static QString directionToStr( SyncFileItem::Direction dir );
 
     QScopedPointer<QFile> _file;
     QTextStream _out;
+    qint64 _runStart; // offset of the header of the run in the file
+    QDateTime _runEnd;
+
+};
+
+/**
+ * @brief Reads back the items of the sync runs logged by SyncRunFileLog
+ *
+ * The newest items come first: the .owncloudsync.log of the folder is read
+ * backwards from its end, then the rotated .owncloudsync.log.1. Only what is
+ * needed for the next items is read, whatever the size of the logs.
+ *
+ * The line that ends each run tells when it ended and where its header is,
+ * so the runs that are too recent are skipped without reading them. The runs
+ * logged without that line are found by looking back for their header.
+ *
+ * The items only carry what the log has: the file, the instruction, the
+ * direction, the size, the status and the error string.
+ */
+class SyncRunFileLogReader
+{
+public:
+    /** Only the runs that finished before \a endedBefore are read */
+    SyncRunFileLogReader( const QString& folderPath, const QDateTime& endedBefore );
+
+    /**
+     * Reads the next older item and the time its run finished.
+     * Returns false once the logs are exhausted.
+     */
+    bool readItem( SyncFileItem *item, QDateTime *runEnd );
+
+private:
+    bool openNextFile();
+    bool startPreviousRun();
+    bool startPreviousUnindexedRun();
+    void skipRun( qint64 headerPos );
+    bool previousLine( QByteArray *line );
+    bool parseItem( const QByteArray& line, SyncFileItem *item ) const;
 
+    QStringList _fileNames; // still to read, the newest first
+    QFile _file;
+    qint64 _pos; // everything before it is still to read
+    QByteArray _rest; // start of the line that ends at _pos
+    QList<QByteArray> _lines; // complete lines read after _pos, the newest last
+    bool _inRun; // between the end of a run and its header
+    QDateTime _runEnd;
+    QDateTime _endedBefore;
 };
 }
 
@@ -25,6 +25,7 @@
 
 #include "cookiejar.h"
 #include "accessmanager.h"
+#include "networkconditioner.h"
 #include "utility.h"
 
 namespace OCC
@@ -75,6 +76,9 @@ QNetworkReply* AccessManager::createRequest(QNetworkAccessManager::Operation op,
     if (verb == "PROPFIND") {
         newRequest.setHeader( QNetworkRequest::ContentTypeHeader, QLatin1String("text/xml; charset=utf-8"));
     }
+    if (NetworkConditioner::isEnabled()) {
+        return new ConditionedNetworkReply(this, op, newRequest, outgoingData);
+    }
     return QNetworkAccessManager::createRequest(op, newRequest, outgoingData);
 }
 
@@ -38,6 +38,11 @@ protected slots:
     void slotProxyAuthenticationRequired(const QNetworkProxy &proxy, QAuthenticator *authenticator);
     void slotAuthenticationRequired(QNetworkReply *reply, QAuthenticator *authenticator);
 
+private:
+    friend class ConditionedNetworkReply;
+    /** Sends the request for a reply under the network conditions */
+    QNetworkReply* createUnconditionedRequest(QNetworkAccessManager::Operation op, const QNetworkRequest& request, QIODevice* outgoingData)
+    { return QNetworkAccessManager::createRequest(op, request, outgoingData); }
 };
 
 } // namespace OCC
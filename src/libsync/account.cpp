@@ -32,6 +32,7 @@
 #include <QDir>
 #include <QDebug>
 #include <QSslKey>
+#include <QThread>
 
 namespace OCC {
 
@@ -77,6 +78,8 @@ Account::Account(QObject *parent)
     , _wasMigrated(false)
 {
     qRegisterMetaType<AccountPtr>("AccountPtr");
+    qRegisterMetaType<QNetworkReply*>("QNetworkReply*");
+    qRegisterMetaType<QList<QSslError> >("QList<QSslError>");
 }
 
 AccountPtr Account::create()
@@ -232,6 +235,9 @@ AbstractCredentials *Account::credentials() const
 
 void Account::setCredentials(AbstractCredentials *cred)
 {
+    // The QNAMs of the other threads do not refer to the credentials, they keep
+    // sending the ones they were created with until their thread is done.
+
     // set active credential manager
     QNetworkCookieJar *jar = 0;
     if (_am) {
@@ -276,6 +282,60 @@ QNetworkAccessManager *Account::networkAccessManager()
     return _am;
 }
 
+bool Account::createThreadNetworkAccessManager(QThread *thread)
+{
+    Q_ASSERT(QThread::currentThread() == this->thread());
+    QNetworkAccessManager *am = _credentials ? _credentials->createThreadQNAM() : 0;
+    if (!am) {
+        return false;
+    }
+    // The CookieJar is tied to its file, the copy only lives as long as the thread's requests
+    QNetworkCookieJar *jar = new QNetworkCookieJar;
+    jar->setCookiesFromUrl(_am->cookieJar()->cookiesForUrl(_url), _url);
+    am->setCookieJar(jar);
+    connect(am, SIGNAL(sslErrors(QNetworkReply*,QList<QSslError>)),
+            SLOT(slotHandleThreadErrors(QNetworkReply*,QList<QSslError>)), Qt::DirectConnection);
+    am->moveToThread(thread);
+
+    QMutexLocker locker(&_threadAmsMutex);
+    QNetworkAccessManager *old = _threadAms.value(thread);
+    if (old) {
+        old->deleteLater();
+    }
+    _threadAms.insert(thread, am);
+    return true;
+}
+
+void Account::releaseThreadNetworkAccessManager(QThread *thread)
+{
+    QMutexLocker locker(&_threadAmsMutex);
+    QNetworkAccessManager *am = _threadAms.take(thread);
+    if (am) {
+        am->deleteLater();
+    }
+
+    // Do not keep the thread waiting: the caller may be about to wait for it
+    QMutableListIterator<QSharedPointer<ThreadSslErrors> > it(_threadSslErrors);
+    while (it.hasNext()) {
+        const QSharedPointer<ThreadSslErrors> &pending = it.next();
+        if (pending->thread == thread) {
+            pending->answered = true;
+            pending->accepted = false;
+            it.remove();
+        }
+    }
+    _threadSslErrorsAnswered.wakeAll();
+}
+
+QNetworkAccessManager *Account::currentNetworkAccessManager()
+{
+    QMutexLocker locker(&_threadAmsMutex);
+    if (_threadAms.isEmpty()) {
+        return _am;
+    }
+    return _threadAms.value(QThread::currentThread(), _am);
+}
+
 QNetworkReply *Account::headRequest(const QString &relPath)
 {
     return headRequest(concatUrlPath(url(), relPath));
@@ -284,7 +344,7 @@ QNetworkReply *Account::headRequest(const QString &relPath)
 QNetworkReply *Account::headRequest(const QUrl &url)
 {
     QNetworkRequest request(url);
-    return _am->head(request);
+    return currentNetworkAccessManager()->head(request);
 }
 
 QNetworkReply *Account::getRequest(const QString &relPath)
@@ -296,7 +356,7 @@ QNetworkReply *Account::getRequest(const QUrl &url)
 {
     QNetworkRequest request(url);
     request.setSslConfiguration(this->createSslConfig());
-    return _am->get(request);
+    return currentNetworkAccessManager()->get(request);
 }
 
 QNetworkReply *Account::davRequest(const QByteArray &verb, const QString &relPath, QNetworkRequest req, QIODevice *data)
@@ -308,11 +368,12 @@ QNetworkReply *Account::davRequest(const QByteArray &verb, const QUrl &url, QNet
 {
     req.setUrl(url);
     req.setSslConfiguration(this->createSslConfig());
-    return _am->sendCustomRequest(req, verb, data);
+    return currentNetworkAccessManager()->sendCustomRequest(req, verb, data);
 }
 
 void Account::setCertificate(const QByteArray certficate, const QString privateKey)
 {
+    QMutexLocker locker(&_certificateMutex);
     _pemCertificate=certficate;
     _pemPrivateKey=privateKey;
 }
@@ -339,6 +400,7 @@ QSslConfiguration Account::createSslConfig()
         QByteArray ba = s.toLocal8Bit();
         this->setCertificate(ba, QString::fromStdString(certif.PrivateKey));
     }
+    QMutexLocker locker(&_certificateMutex);
     if((!_pemCertificate.isEmpty())&&(!_pemPrivateKey.isEmpty())) {
         // Read certificates
         QList<QSslCertificate> sslCertificateList = QSslCertificate::fromData(_pemCertificate, QSsl::Pem);
@@ -441,8 +503,74 @@ void Account::setCredentialSetting(const QString &key, const QVariant &value)
 void Account::slotHandleErrors(QNetworkReply *reply , QList<QSslError> errors)
 {
     NetworkJobTimeoutPauser pauser(reply);
+    if (acceptSslErrors(reply->url(), errors)) {
+        reply->ignoreSslErrors();
+    }
+}
+
+void Account::slotHandleThreadErrors(QNetworkReply *reply, QList<QSslError> errors)
+{
+    // The timer of the job lives in this thread, pause it here.
+    // The reply must be ignored before the signal returns, so wait for the answer
+    // of the thread of the account.
+    NetworkJobTimeoutPauser pauser(reply);
+    QSharedPointer<ThreadSslErrors> pending(new ThreadSslErrors);
+    pending->thread = QThread::currentThread();
+    pending->url = reply->url();
+    pending->errors = errors;
+    pending->asked = false;
+    pending->answered = false;
+    pending->accepted = false;
+
+    QMutexLocker locker(&_threadAmsMutex);
+    if (!_threadAms.contains(pending->thread)) {
+        return; // released, the requests of the thread are being aborted
+    }
+    _threadSslErrors.append(pending);
+    QMetaObject::invokeMethod(this, "slotAnswerThreadSslErrors", Qt::QueuedConnection);
+    while (!pending->answered) {
+        _threadSslErrorsAnswered.wait(&_threadAmsMutex);
+    }
+    if (pending->accepted) {
+        reply->ignoreSslErrors();
+    }
+}
+
+void Account::slotAnswerThreadSslErrors()
+{
+    while (true) {
+        QSharedPointer<ThreadSslErrors> pending;
+        {
+            QMutexLocker locker(&_threadAmsMutex);
+            foreach (const QSharedPointer<ThreadSslErrors> &p, _threadSslErrors) {
+                if (!p->asked) {
+                    pending = p;
+                    break;
+                }
+            }
+            if (!pending) {
+                return;
+            }
+            pending->asked = true;
+        }
+
+        // Without the lock, this may show a dialog
+        const bool accepted = acceptSslErrors(pending->url, pending->errors);
+
+        QMutexLocker locker(&_threadAmsMutex);
+        if (!pending->answered) { // else the thread was released meanwhile
+            pending->accepted = accepted;
+            pending->answered = true;
+            _threadSslErrors.removeAll(pending);
+            _threadSslErrorsAnswered.wakeAll();
+        }
+    }
+}
+
+bool Account::acceptSslErrors(const QUrl &replyUrl, const QList<QSslError> &errors)
+{
     QString out;
-    QDebug(&out) << "SSL-Errors happened for url " << reply->url().toString();
+    QDebug(&out) << "SSL-Errors happened for url " << replyUrl.toString();
     foreach(const QSslError &error, errors) {
         QDebug(&out) << "\tError in " << error.certificate() << ":"
                      << error.errorString() << "("<< error.error() << ")" << "\n";
@@ -451,13 +579,13 @@ void Account::slotHandleErrors(QNetworkReply *reply , QList<QSslError> errors)
     if( _treatSslErrorsAsFailure ) {
         // User decided once not to trust. Honor this decision.
         qDebug() << out << "Certs not trusted by user decision, returning.";
-        return;
+        return false;
     }
 
     QList<QSslCertificate> approvedCerts;
     if (_sslErrorHandler.isNull() ) {
         qDebug() << out << Q_FUNC_INFO << "called without valid SSL error handler for account" << url();
-        return;
+        return false;
     }
 
     if (_sslErrorHandler->handleErrors(errors, &approvedCerts, sharedFromThis())) {
@@ -465,10 +593,10 @@ void Account::slotHandleErrors(QNetworkReply *reply , QList<QSslError> errors)
         addApprovedCerts(approvedCerts);
         // all ssl certs are known and accepted. We can ignore the problems right away.
 //         qDebug() << out << "Certs are known and trusted! This is not an actual error.";
-        reply->ignoreSslErrors();
+        return true;
     } else {
         _treatSslErrorsAsFailure = true;
-        return;
+        return false;
     }
 }
 
@@ -479,6 +607,12 @@ void Account::slotCredentialsFetched()
 
 void Account::handleInvalidCredentials()
 {
+    if (QThread::currentThread() != thread()) {
+        // The credentials live in this thread
+        QMetaObject::invokeMethod(this, "handleInvalidCredentials", Qt::QueuedConnection);
+        return;
+    }
+
     // invalidate & forget token/password
     // but try to re-sign in.
     if (_credentials->ready()) {
@@ -24,12 +24,16 @@
 #include <QSslConfiguration>
 #include <QSslError>
 #include <QSharedPointer>
+#include <QHash>
+#include <QMutex>
+#include <QWaitCondition>
 #include "utility.h"
 
 class QSettings;
 class QNetworkReply;
 class QUrl;
 class QNetworkAccessManager;
+class QThread;
 
 namespace OCC {
 
@@ -67,6 +71,11 @@ public:
 
 /**
  * @brief This class represents an account on an ownCloud Server
+ *
+ * The account lives in the GUI thread. The requests can also be sent from
+ * another thread once it has its own QNAM, see createThreadNetworkAccessManager():
+ * the head/get/davRequest functions use the QNAM of the calling thread.
+ * The rest of the account must not be changed while such a thread runs.
  */
 class OWNCLOUDSYNC_EXPORT Account : public QObject {
     Q_OBJECT
@@ -158,8 +167,25 @@ public:
 
     QNetworkAccessManager* networkAccessManager();
 
-    /// Called by network jobs on credential errors.
-    void handleInvalidCredentials();
+    /**
+     * Creates the QNAM used by the requests sent from \a thread.
+     *
+     * Must be called from the thread of the account. Returns false if the
+     * credentials can not give a QNAM for another thread, see
+     * AbstractCredentials::createThreadQNAM(). The QNAM starts with the
+     * cookies of the account. Its SSL errors are handled by the account,
+     * its thread waits meanwhile.
+     */
+    bool createThreadNetworkAccessManager(QThread *thread);
+    /**
+     * Deletes the QNAM of \a thread, the requests of that thread are done or
+     * aborted. If the thread waits for the SSL errors of a request to be
+     * handled, the errors are not ignored and the thread goes on.
+     */
+    void releaseThreadNetworkAccessManager(QThread *thread);
+
+    /// Called by network jobs on credential errors, from any thread.
+    Q_INVOKABLE void handleInvalidCredentials();
 
 signals:
     void propagatorNetworkActivity();
@@ -170,9 +196,29 @@ protected Q_SLOTS:
     void slotHandleErrors(QNetworkReply*,QList<QSslError>);
     void slotCredentialsFetched();
 
+private Q_SLOTS:
+    // Called in the thread of the QNAM
+    void slotHandleThreadErrors(QNetworkReply*,QList<QSslError>);
+    void slotAnswerThreadSslErrors();
+
 private:
     Account(QObject *parent = 0);
 
+    // The QNAM of the calling thread, _am unless it has its own
+    QNetworkAccessManager *currentNetworkAccessManager();
+    // Whether the SSL errors of a request to \a replyUrl can be ignored, may ask the user
+    bool acceptSslErrors(const QUrl &replyUrl, const QList<QSslError> &errors);
+
+    // The SSL errors of a request of another thread, the thread waits for the answer
+    struct ThreadSslErrors {
+        QThread *thread;
+        QUrl url;
+        QList<QSslError> errors;
+        bool asked;
+        bool answered;
+        bool accepted;
+    };
+
     QWeakPointer<Account> _sharedThis;
     QMap<QString, QVariant> _settingsMap;
     QUrl _url;
@@ -183,10 +229,15 @@ private:
     QScopedPointer<AbstractSslErrorHandler> _sslErrorHandler;
     QuotaInfo *_quotaInfo;
     QNetworkAccessManager *_am;
+    QHash<QThread*, QNetworkAccessManager*> _threadAms;
+    QList<QSharedPointer<ThreadSslErrors> > _threadSslErrors; // not answered yet
+    QMutex _threadAmsMutex; // also for _threadSslErrors
+    QWaitCondition _threadSslErrorsAnswered;
     AbstractCredentials* _credentials;
     bool _treatSslErrorsAsFailure;
     int _state;
     static QString _configFileName;
+    QMutex _certificateMutex; // the requests of all the threads create the ssl configuration
     QByteArray _pemCertificate; 
     QString _pemPrivateKey;  
     QString _davPath; // default "remote.php/webdav/";
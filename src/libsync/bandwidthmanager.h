@@ -16,9 +16,7 @@
 #define BANDWIDTHMANAGER_H
 
 #include <QObject>
-#include <QLinkedList>
-#include <QTimer>
-#include <QIODevice>
+#include <QHash>
 
 namespace OCC {
 
@@ -26,18 +24,19 @@ class UploadDevice;
 class GETFileJob;
 class OwncloudPropagator;
 
+/**
+ * @brief Connects the transfers of a propagator to the BandwidthScheduler
+ *
+ * Each propagator (so each folder) is a group of the scheduler, its uploads
+ * and downloads share the bandwidth of the group. The transfers ask the
+ * scheduler for tokens themselves before they read.
+ */
 class BandwidthManager : public QObject {
     Q_OBJECT
 public:
     BandwidthManager(OwncloudPropagator *p);
     ~BandwidthManager();
 
-    bool usingAbsoluteUploadLimit() { return _currentUploadLimit > 0; }
-    bool usingRelativeUploadLimit() { return _currentUploadLimit < 0; }
-    bool usingAbsoluteDownloadLimit() { return _currentDownloadLimit > 0; }
-    bool usingRelativeDownloadLimit() { return _currentDownloadLimit < 0; }
-
-
 public slots:
     void registerUploadDevice(UploadDevice*);
     void unregisterUploadDevice(UploadDevice*);
@@ -47,36 +46,11 @@ public slots:
     void unregisterDownloadJob(GETFileJob*);
     void unregisterDownloadJob(QObject*);
 
-    void absoluteLimitTimerExpired();
-    void switchingTimerExpired();
-
-    void relativeUploadMeasuringTimerExpired();
-    void relativeUploadDelayTimerExpired();
-
-    void relativeDownloadMeasuringTimerExpired();
-    void relativeDownloadDelayTimerExpired();
-
 private:
-    QTimer _switchingTimer; // for switching between absolute and relative bw limiting
-    OwncloudPropagator *_propagator; // FIXME this timer and this variable should be replaced
-    // by the propagator emitting the changed limit values to us as signal
-
-    QTimer _absoluteLimitTimer; // for absolute up/down bw limiting
-
-    QLinkedList<UploadDevice*> _absoluteUploadDeviceList;
-    QLinkedList<UploadDevice*> _relativeUploadDeviceList; // FIXME merge with list above ^^
-    QTimer _relativeUploadMeasuringTimer;
-    QTimer _relativeUploadDelayTimer; // for relative bw limiting, we need to wait this amount before measuring again
-    UploadDevice *_relativeLimitCurrentMeasuredDevice; // the device measured
-    qint64 _relativeUploadLimitProgressAtMeasuringRestart; // for measuring how much progress we made at start
-    qint64 _currentUploadLimit;
+    void unregisterTransfer(QObject *o);
 
-    QLinkedList<GETFileJob*> _downloadJobList;
-    QTimer _relativeDownloadMeasuringTimer;
-    QTimer _relativeDownloadDelayTimer; // for relative bw limiting, we need to wait this amount before measuring again
-    GETFileJob *_relativeLimitCurrentMeasuredJob; // the device measured
-    qint64 _relativeDownloadLimitProgressAtMeasuringRestart; // for measuring how much progress we made at start
-    qint64 _currentDownloadLimit;
+    int _group; // in the BandwidthScheduler
+    QHash<QObject*, int> _transfers; // the id in the scheduler of the registered devices and jobs
 };
 
 }
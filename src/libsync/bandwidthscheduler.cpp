@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "bandwidthscheduler.h"
+#include "synctracer.h"
+
+#include <QDebug>
+
+#include <cmath>
+
+namespace OCC {
+
+// A bucket holds at most that many msecs of its rate, so that the transfers stay smooth
+static const qint64 burstMsec = 100;
+// A transfer waiting for tokens asks again after that long at most
+static const int maxWaitMsec = 100;
+// The smallest piece worth a read: that many msecs of the rate of the transfer, or minPiece
+static const qint64 pieceMsec = 20;
+static const qint64 minPiece = 1024;
+
+// Relative limits: the transfers run unlimited for probeMsec every probeIntervalMsec to
+// measure the throughput. A probe that moved less than minProbeBytes is done again soon.
+static const qint64 probeMsec = 2000;
+static const qint64 probeIntervalMsec = 20000;
+static const qint64 probeRetryMsec = 2000;
+static const qint64 minProbeBytes = 64 * 1024;
+
+static QString traceName(BandwidthScheduler::Direction direction, const char *what)
+{
+    return QLatin1String(direction == BandwidthScheduler::Upload ? "upload " : "download ") + QLatin1String(what);
+}
+
+static double bucketCap(double rate)
+{
+    return qMax(rate * burstMsec, double(minPiece));
+}
+
+BandwidthScheduler *BandwidthScheduler::instance()
+{
+    static BandwidthScheduler scheduler;
+    return &scheduler;
+}
+
+BandwidthScheduler::BandwidthScheduler()
+    : _nextId(1)
+{
+    _lastRefill[Upload] = _lastRefill[Download] = 0;
+    _clock.start();
+}
+
+void BandwidthScheduler::setLimit(Direction direction, qint64 limit)
+{
+    QMutexLocker lock(&_mutex);
+    Bucket &bucket = _global[direction];
+    if (bucket.limit == limit) {
+        return;
+    }
+    qDebug() << Q_FUNC_INFO << (direction == Upload ? "upload" : "download") << bucket.limit << "->" << limit;
+    const double tokens = bucket.tokens;
+    bucket = Bucket();
+    bucket.limit = limit;
+    bucket.tokens = tokens;
+    updateLimitedLocked();
+}
+
+qint64 BandwidthScheduler::limit(Direction direction) const
+{
+    QMutexLocker lock(&_mutex);
+    return _global[direction].limit;
+}
+
+bool BandwidthScheduler::isLimited(Direction direction) const
+{
+    return const_cast<QAtomicInt &>(_limited[direction]).fetchAndAddRelaxed(0);
+}
+
+int BandwidthScheduler::addGroup(int weight)
+{
+    QMutexLocker lock(&_mutex);
+    const int id = _nextId++;
+    Group &group = _groups[id];
+    group.weight = qMax(1, weight);
+    return id;
+}
+
+void BandwidthScheduler::removeGroup(int group)
+{
+    QMutexLocker lock(&_mutex);
+    QHash<int, Transfer>::iterator it = _transfers.begin();
+    while (it != _transfers.end()) {
+        if (it->group == group) {
+            it = _transfers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    _groups.remove(group);
+    updateLimitedLocked();
+}
+
+void BandwidthScheduler::setGroupLimit(int group, Direction direction, qint64 limit)
+{
+    QMutexLocker lock(&_mutex);
+    QHash<int, Group>::iterator it = _groups.find(group);
+    if (it == _groups.end() || it->buckets[direction].limit == limit) {
+        return;
+    }
+    Bucket &bucket = it->buckets[direction];
+    const double tokens = bucket.tokens;
+    bucket = Bucket();
+    bucket.limit = limit;
+    bucket.tokens = tokens;
+    updateLimitedLocked();
+}
+
+int BandwidthScheduler::addTransfer(int group, Direction direction, int weight)
+{
+    QMutexLocker lock(&_mutex);
+    QHash<int, Group>::iterator groupIt = _groups.find(group);
+    if (groupIt == _groups.end()) {
+        return 0;
+    }
+    const int id = _nextId++;
+    Transfer &transfer = _transfers[id];
+    transfer.group = group;
+    transfer.direction = direction;
+    transfer.weight = qMax(1, weight);
+    groupIt->transferWeights[direction] += transfer.weight;
+    return id;
+}
+
+void BandwidthScheduler::removeTransfer(int transfer)
+{
+    QMutexLocker lock(&_mutex);
+    QHash<int, Transfer>::iterator it = _transfers.find(transfer);
+    if (it == _transfers.end()) {
+        return;
+    }
+    const Direction direction = it->direction;
+    QHash<int, Group>::iterator groupIt = _groups.find(it->group);
+    if (groupIt != _groups.end()) {
+        groupIt->transferWeights[direction] -= it->weight;
+        // Its tokens are for the others
+        groupIt->buckets[direction].tokens += it->tokens;
+    }
+    _transfers.erase(it);
+}
+
+qint64 BandwidthScheduler::acquire(int transfer, qint64 bytes, int *waitMsec)
+{
+    return acquire(transfer, bytes, waitMsec, _clock.elapsed());
+}
+
+qint64 BandwidthScheduler::acquire(int transfer, qint64 bytes, int *waitMsec, qint64 now)
+{
+    *waitMsec = 0;
+    if (bytes <= 0) {
+        return 0;
+    }
+
+    QMutexLocker lock(&_mutex);
+    QHash<int, Transfer>::iterator it = _transfers.find(transfer);
+    if (it == _transfers.end()) {
+        return bytes;
+    }
+    Transfer &t = *it;
+    const Direction direction = t.direction;
+    refillLocked(direction, now);
+    Group &group = _groups[t.group];
+    Bucket &groupBucket = group.buckets[direction];
+    Bucket &globalBucket = _global[direction];
+
+    if (t.rate < 0) {
+        countProbeLocked(&group, direction, bytes);
+        return bytes;
+    }
+
+    // A group with its own limit must not borrow beyond it
+    const bool borrowGlobal = groupBucket.limit == 0;
+    const double available = t.tokens + groupBucket.tokens + (borrowGlobal ? globalBucket.tokens : 0);
+    const double piece = qMin(double(bytes), qMax(double(minPiece), t.rate * pieceMsec));
+    if (available < piece) {
+        *waitMsec = t.rate > 0 ? int(qBound(1., std::ceil((piece - available) / t.rate), double(maxWaitMsec)))
+                               : maxWaitMsec;
+        if (SyncTracer::isEnabled()) {
+            const qint64 start = SyncTracer::now();
+            SyncTracer::instance()->addAsyncSpan("bandwidth", traceName(direction, "limit wait"), quintptr(transfer),
+                                                 start, start + *waitMsec * 1000LL);
+        }
+        return 0;
+    }
+
+    const qint64 granted = qMin(bytes, qint64(available));
+    double needed = granted;
+    double *sources[] = { &t.tokens, &groupBucket.tokens, &globalBucket.tokens };
+    for (int i = 0; i < (borrowGlobal ? 3 : 2) && needed > 0; ++i) {
+        const double taken = qMin(needed, *sources[i]);
+        *sources[i] -= taken;
+        needed -= taken;
+    }
+    countProbeLocked(&group, direction, granted);
+    return granted;
+}
+
+qint64 BandwidthScheduler::transferRate(int transfer, qint64 now)
+{
+    QMutexLocker lock(&_mutex);
+    QHash<int, Transfer>::const_iterator it = _transfers.constFind(transfer);
+    if (it == _transfers.constEnd()) {
+        return -1;
+    }
+    refillLocked(it->direction, now);
+    return it->rate < 0 ? -1 : qint64(it->rate * 1000);
+}
+
+void BandwidthScheduler::countProbeLocked(Group *group, Direction direction, qint64 bytes)
+{
+    // Only the levels that are probing right now use probeBytes
+    _global[direction].probeBytes += bytes;
+    group->buckets[direction].probeBytes += bytes;
+}
+
+double BandwidthScheduler::levelRateLocked(Bucket *bucket, Direction direction, qint64 now)
+{
+    if (bucket->limit == 0) {
+        return -1;
+    }
+    if (bucket->limit > 0) {
+        return bucket->limit / 1000.;
+    }
+
+    if (bucket->probeEnd > 0) {
+        if (now < bucket->probeEnd) {
+            return -1;
+        }
+        // The probe is over
+        if (bucket->probeBytes >= minProbeBytes) {
+            bucket->measuredRate = double(bucket->probeBytes) / probeMsec;
+            bucket->nextProbe = bucket->probeEnd + probeIntervalMsec;
+            qDebug() << Q_FUNC_INFO << "Measured" << qint64(bucket->measuredRate * 1000) << "bytes per second";
+            if (SyncTracer::isEnabled()) {
+                SyncTracer::instance()->addCounter("bandwidth", traceName(direction, "measured rate"),
+                                                   qint64(bucket->measuredRate * 1000));
+            }
+        } else {
+            bucket->nextProbe = now + probeRetryMsec;
+        }
+        bucket->probeEnd = 0;
+    }
+    if (now >= bucket->nextProbe) {
+        bucket->probeEnd = now + probeMsec;
+        bucket->probeBytes = 0;
+        if (SyncTracer::isEnabled()) {
+            // The transfers of the level run unlimited until then
+            const qint64 start = SyncTracer::now();
+            SyncTracer::instance()->addAsyncSpan("bandwidth", traceName(direction, "relative limit probe"),
+                                                 quintptr(bucket), start, start + probeMsec * 1000);
+        }
+        return -1;
+    }
+    if (bucket->measuredRate <= 0) {
+        return -1;
+    }
+    // don't use too extreme values
+    const qint64 percent = qBound(qint64(10), -bucket->limit, qint64(90));
+    return bucket->measuredRate * percent / 100;
+}
+
+void BandwidthScheduler::updateRatesLocked(Direction direction, qint64 now)
+{
+    const double globalRate = levelRateLocked(&_global[direction], direction, now);
+    _global[direction].rate = globalRate;
+
+    int groupWeights = 0;
+    for (QHash<int, Group>::const_iterator it = _groups.constBegin(); it != _groups.constEnd(); ++it) {
+        if (it->transferWeights[direction] > 0) {
+            groupWeights += it->weight;
+        }
+    }
+
+    for (QHash<int, Group>::iterator it = _groups.begin(); it != _groups.end(); ++it) {
+        Bucket &bucket = it->buckets[direction];
+        if (it->transferWeights[direction] <= 0) {
+            bucket.share = bucket.rate = -1;
+            continue;
+        }
+        bucket.share = globalRate < 0 ? -1 : globalRate * it->weight / groupWeights;
+        const double own = levelRateLocked(&bucket, direction, now);
+        if (own < 0) {
+            bucket.rate = bucket.share;
+        } else {
+            bucket.rate = bucket.share < 0 ? own : qMin(own, bucket.share);
+        }
+    }
+
+    for (QHash<int, Transfer>::iterator it = _transfers.begin(); it != _transfers.end(); ++it) {
+        if (it->direction != direction) {
+            continue;
+        }
+        const Group &group = _groups[it->group];
+        const double groupRate = group.buckets[direction].rate;
+        it->rate = groupRate < 0 ? -1 : groupRate * it->weight / group.transferWeights[direction];
+    }
+}
+
+void BandwidthScheduler::refillLocked(Direction direction, qint64 now)
+{
+    // The rates change with the transfers even when no time elapsed
+    updateRatesLocked(direction, now);
+    const qint64 elapsed = now - _lastRefill[direction];
+    if (elapsed == 0) {
+        return;
+    }
+    _lastRefill[direction] = now;
+    if (elapsed < 0) {
+        return; // another clock, start over from now
+    }
+
+    Bucket &global = _global[direction];
+    for (QHash<int, Transfer>::iterator it = _transfers.begin(); it != _transfers.end(); ++it) {
+        if (it->direction != direction || it->rate < 0) {
+            continue;
+        }
+        it->tokens += it->rate * elapsed;
+        const double cap = bucketCap(it->rate);
+        if (it->tokens > cap) {
+            // Not used by the transfer, for the others of the group
+            _groups[it->group].buckets[direction].tokens += it->tokens - cap;
+            it->tokens = cap;
+        }
+    }
+
+    for (QHash<int, Group>::iterator it = _groups.begin(); it != _groups.end(); ++it) {
+        Bucket &bucket = it->buckets[direction];
+        if (bucket.rate < 0) {
+            bucket.tokens = 0;
+            continue;
+        }
+        double overflow = 0;
+        const double cap = bucketCap(bucket.rate);
+        if (bucket.tokens > cap) {
+            overflow = bucket.tokens - cap;
+            bucket.tokens = cap;
+        }
+        if (bucket.limit == 0) {
+            global.tokens += overflow;
+        } else if (bucket.share >= 0) {
+            // The part of its share the group may not use because of its own limit
+            global.tokens += (bucket.share - bucket.rate) * elapsed;
+        }
+    }
+
+    if (global.rate < 0) {
+        global.tokens = 0;
+    } else {
+        global.tokens = qMin(global.tokens, bucketCap(global.rate));
+    }
+}
+
+void BandwidthScheduler::updateLimitedLocked()
+{
+    for (int direction = Upload; direction <= Download; ++direction) {
+        bool limited = _global[direction].limit != 0;
+        for (QHash<int, Group>::const_iterator it = _groups.constBegin(); it != _groups.constEnd(); ++it) {
+            limited = limited || it->buckets[direction].limit != 0;
+        }
+        _limited[direction].fetchAndStoreRelaxed(limited);
+    }
+}
+
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef BANDWIDTHSCHEDULER_H
+#define BANDWIDTHSCHEDULER_H
+
+#include "owncloudlib.h"
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+
+namespace OCC {
+
+/**
+ * @brief Process-wide token buckets for the bandwidth of the transfers
+ *
+ * The buckets form a hierarchy: the global limit, then a group per folder
+ * (see BandwidthManager), then the transfers of the group. The rate of a
+ * level is shared by the active entries of the level below in proportion to
+ * their weight, so two folders syncing at the same time get half of the
+ * global limit each, and so do the transfers of a folder.
+ *
+ * The tokens are refilled from the elapsed time whenever a transfer asks for
+ * some, there are no timers. The tokens a transfer can not use (it is waiting
+ * for the server) go to its group, then to the global level, where the other
+ * transfers take them: the limit is reached as long as anybody has data.
+ *
+ * A limit is 0 for unlimited, a number of bytes per second when positive,
+ * and when negative a percentage of the throughput measured by letting the
+ * transfers run unlimited for a moment every now and then.
+ *
+ * The waits of the transfers and the probes of the relative limits are
+ * recorded in the SyncTracer.
+ *
+ * All the methods are thread-safe. The ones taking \a now use that time in
+ * msecs instead of the clock of the scheduler, for the tests.
+ */
+class OWNCLOUDSYNC_EXPORT BandwidthScheduler
+{
+public:
+    enum Direction {
+        Upload = 0,
+        Download = 1
+    };
+
+    static BandwidthScheduler *instance();
+
+    /** The limit of all the transfers of the process */
+    void setLimit(Direction direction, qint64 limit);
+    qint64 limit(Direction direction) const;
+
+    /** Cheap, checked by the transfers before they ask for tokens */
+    bool isLimited(Direction direction) const;
+
+    int addGroup(int weight = 1);
+    void removeGroup(int group);
+    /** The limit of one group, on top of the global one */
+    void setGroupLimit(int group, Direction direction, qint64 limit);
+
+    int addTransfer(int group, Direction direction, int weight = 1);
+    void removeTransfer(int transfer);
+
+    /**
+     * Takes up to \a bytes from the buckets of the transfer and returns how
+     * many it got. Small grants are avoided: when less than a useful piece is
+     * available, 0 is returned and \a waitMsec is set to the time after
+     * which to ask again. Unknown transfers are not limited.
+     */
+    qint64 acquire(int transfer, qint64 bytes, int *waitMsec);
+    qint64 acquire(int transfer, qint64 bytes, int *waitMsec, qint64 now);
+
+    /** Bytes per second the transfer currently gets, -1 when unlimited */
+    qint64 transferRate(int transfer, qint64 now);
+
+private:
+    BandwidthScheduler();
+
+    // The rate of a level is in bytes per msec, < 0 when unlimited
+    struct Bucket {
+        Bucket() : limit(0), rate(-1), share(-1), tokens(0), measuredRate(0), probeEnd(0), nextProbe(0), probeBytes(0) {}
+        qint64 limit;
+        double rate;
+        double share; // of the level above, the rate is lower if the limit of the level is
+        double tokens; // left over by the levels below
+        // for the relative limits
+        double measuredRate;
+        qint64 probeEnd; // the level is unlimited until then
+        qint64 nextProbe;
+        qint64 probeBytes; // transferred during the probe
+    };
+
+    struct Group {
+        Group() : weight(1) { transferWeights[0] = transferWeights[1] = 0; }
+        int weight;
+        Bucket buckets[2];
+        int transferWeights[2]; // of the transfers of each direction
+    };
+
+    struct Transfer {
+        Transfer() : group(0), direction(Upload), weight(1), rate(-1), tokens(0) {}
+        int group;
+        Direction direction;
+        int weight;
+        double rate;
+        double tokens;
+    };
+
+    // Must be called with the mutex locked
+    void refillLocked(Direction direction, qint64 now);
+    void updateRatesLocked(Direction direction, qint64 now);
+    double levelRateLocked(Bucket *bucket, Direction direction, qint64 now);
+    void countProbeLocked(Group *group, Direction direction, qint64 bytes);
+    void updateLimitedLocked();
+
+    mutable QMutex _mutex;
+    QHash<int, Group> _groups;
+    QHash<int, Transfer> _transfers;
+    Bucket _global[2];
+    qint64 _lastRefill[2];
+    int _nextId;
+    QElapsedTimer _clock;
+    QAtomicInt _limited[2];
+};
+
+}
+
+#endif // BANDWIDTHSCHEDULER_H
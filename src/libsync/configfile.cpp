@@ -37,6 +37,7 @@
 
 #define DEFAULT_REMOTE_POLL_INTERVAL 30000 // default remote poll time in milliseconds
 #define DEFAULT_MAX_LOG_LINES 20000
+#define DEFAULT_MAX_ACTIVITY_ITEMS 2000
 
 namespace OCC {
 
@@ -49,6 +50,7 @@ static const char optionalDesktopNoficationsC[] = "optionalDesktopNotifications"
 static const char skipUpdateCheckC[] = "skipUpdateCheck";
 static const char geometryC[] = "geometry";
 static const char timeoutC[] = "timeout";
+static const char downloadDurabilityC[] = "downloadDurability";
 
 static const char proxyHostC[] = "Proxy/host";
 static const char proxyTypeC[] = "Proxy/type";
@@ -63,6 +65,7 @@ static const char uploadLimitC[]      = "BWLimit/uploadLimit";
 static const char downloadLimitC[]    = "BWLimit/downloadLimit";
 
 static const char maxLogLinesC[] = "Logging/maxLogLines";
+static const char maxActivityItemsC[] = "Logging/maxActivityItems";
 
 const char certPath[] = "http_certificatePath";
 const char certPasswd[] = "http_certificatePasswd";
@@ -116,6 +119,12 @@ int ConfigFile::timeout() const
     return settings.value(QLatin1String(timeoutC), 300).toInt(); // default to 5 min
 }
 
+QString ConfigFile::downloadDurability() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(downloadDurabilityC), QLatin1String("batched")).toString();
+}
+
 void ConfigFile::setOptionalDesktopNotifications(bool show)
 {
     QSettings settings(configFile(), QSettings::IniFormat);
@@ -416,6 +425,12 @@ void ConfigFile::setMaxLogLines( int lines )
     settings.sync();
 }
 
+int ConfigFile::maxActivityItems() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value( QLatin1String(maxActivityItemsC), DEFAULT_MAX_ACTIVITY_ITEMS ).toInt();
+}
+
 void ConfigFile::setProxyType(int proxyType,
                   const QString& host,
                   int port, bool needsAuth,
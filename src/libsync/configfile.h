@@ -57,6 +57,9 @@ public:
     int  maxLogLines() const;
     void setMaxLogLines(int);
 
+    // max count of the sync activity items kept in memory, the older ones are read from the sync logs
+    int  maxActivityItems() const;
+
     /* Server poll interval in milliseconds */
     int remotePollInterval( const QString& connection = QString() ) const;
     /* Set poll interval. Value in microseconds has to be larger than 5000 */
@@ -102,6 +105,8 @@ public:
     void setOptionalDesktopNotifications(bool show);
 
     int timeout() const;
+    /** How downloaded files are synced to the disk: none, file or batched (the default) */
+    QString downloadDurability() const;
 
     void saveGeometry(QWidget *w);
     void restoreGeometry(QWidget *w);
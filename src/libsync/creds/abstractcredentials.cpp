@@ -14,12 +14,15 @@
 
 #include <QString>
 #include <QDebug>
+#include <QNetworkReply>
 
 #include "creds/abstractcredentials.h"
 
 namespace OCC
 {
 
+static const char authenticationFailedC[] = "owncloud-authentication-failed";
+
 AbstractCredentials::AbstractCredentials()
     : _account(0)
 {
@@ -50,4 +53,17 @@ QString AbstractCredentials::keychainKey(const QString &url, const QString &user
     QString key = user+QLatin1Char(':')+u;
     return key;
 }
+
+void AbstractCredentials::setAuthenticationFailed(QNetworkReply *reply)
+{
+    reply->setProperty(authenticationFailedC, true);
+}
+
+bool AbstractCredentials::authenticationFailed(QNetworkReply *reply)
+{
+    return reply->error() == QNetworkReply::AuthenticationRequiredError
+            // returned if user/password or token are incorrect
+            || (reply->error() == QNetworkReply::OperationCanceledError
+                && reply->property(authenticationFailedC).toBool());
+}
 } // namespace OCC
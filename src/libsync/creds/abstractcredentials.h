@@ -47,6 +47,16 @@ public:
     virtual QString authType() const = 0;
     virtual QString user() const = 0;
     virtual QNetworkAccessManager* getQNAM() const = 0;
+    /**
+     * A QNAM for the requests of another thread, see
+     * Account::createThreadNetworkAccessManager(), or 0 if not supported.
+     * It must not refer to the credentials: they may be replaced and deleted
+     * while the thread still sends requests. The jobs of that thread tell
+     * whether the credentials were refused with authenticationFailed(). It keeps a copy of what the
+     * requests need instead, and must not need the thread of the credentials
+     * to answer its signals.
+     */
+    virtual QNetworkAccessManager* createThreadQNAM() const { return 0; }
     virtual bool ready() const = 0;
     virtual void fetch() = 0;
     virtual bool stillValid(QNetworkReply *reply) = 0;
@@ -61,6 +71,14 @@ public:
 
     static QString keychainKey(const QString &url, const QString &user);
 
+    /** Marks a reply that was stopped because the server refused the credentials */
+    static void setAuthenticationFailed(QNetworkReply *reply);
+    /**
+     * Whether the server refused the credentials of the reply. Unlike stillValid(),
+     * it only looks at the reply, so it can be called from any thread.
+     */
+    static bool authenticationFailed(QNetworkReply *reply);
+
 Q_SIGNALS:
     void fetched();
 
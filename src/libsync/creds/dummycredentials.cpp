@@ -45,6 +45,11 @@ QNetworkAccessManager* DummyCredentials::getQNAM() const
     return new AccessManager;
 }
 
+QNetworkAccessManager* DummyCredentials::createThreadQNAM() const
+{
+    return new AccessManager;
+}
+
 bool DummyCredentials::ready() const
 {
     return true;
@@ -19,7 +19,7 @@
 namespace OCC
 {
 
-class DummyCredentials : public AbstractCredentials
+class OWNCLOUDSYNC_EXPORT DummyCredentials : public AbstractCredentials
 {
     Q_OBJECT
 
@@ -33,6 +33,7 @@ public:
     QString authType() const Q_DECL_OVERRIDE;
     QString user() const Q_DECL_OVERRIDE;
     QNetworkAccessManager* getQNAM() const Q_DECL_OVERRIDE;
+    QNetworkAccessManager* createThreadQNAM() const Q_DECL_OVERRIDE;
     bool ready() const Q_DECL_OVERRIDE;
     bool stillValid(QNetworkReply *reply) Q_DECL_OVERRIDE;
     void fetch() Q_DECL_OVERRIDE;
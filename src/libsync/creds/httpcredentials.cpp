@@ -77,24 +77,44 @@ namespace
 const char userC[] = "user";
 const char certifPathC[] = "certificatePath";
 const char certifPasswdC[] = "certificatePasswd";
-const char authenticationFailedC[] = "owncloud-authentication-failed";
 } // ns
 
-class HttpCredentialsAccessManager : public AccessManager {
-public:
-    HttpCredentialsAccessManager(const HttpCredentials *cred, QObject* parent = 0)
-        : AccessManager(parent), _cred(cred) {}
-protected:
-    QNetworkReply *createRequest(Operation op, const QNetworkRequest &request, QIODevice *outgoingData) Q_DECL_OVERRIDE {
-        QByteArray credHash = QByteArray(_cred->user().toUtf8()+":"+_cred->password().toUtf8()).toBase64();
-        QNetworkRequest req(request);
-        req.setRawHeader(QByteArray("Authorization"), QByteArray("Basic ") + credHash);
-        //qDebug() << "Request for " << req.url() << "with authorization" << QByteArray::fromBase64(credHash);
-        return AccessManager::createRequest(op, req, outgoingData);
-    }
-private:
-    const HttpCredentials *_cred;
-};
+HttpCredentialsAccessManager::HttpCredentialsAccessManager(const HttpCredentials *cred, QObject* parent)
+    : AccessManager(parent), _cred(cred)
+{
+    // Direct, the QNAM may live in the propagation thread
+    connect(this, SIGNAL(authenticationRequired(QNetworkReply*, QAuthenticator*)),
+            this, SLOT(slotAuthentication(QNetworkReply*,QAuthenticator*)), Qt::DirectConnection);
+}
+
+HttpCredentialsAccessManager::HttpCredentialsAccessManager(const QString& user, const QString& password, QObject* parent)
+    : AccessManager(parent), _cred(0), _user(user), _password(password)
+{
+    connect(this, SIGNAL(authenticationRequired(QNetworkReply*, QAuthenticator*)),
+            this, SLOT(slotAuthentication(QNetworkReply*,QAuthenticator*)), Qt::DirectConnection);
+}
+
+QNetworkReply *HttpCredentialsAccessManager::createRequest(Operation op, const QNetworkRequest &request, QIODevice *outgoingData)
+{
+    const QString user = _cred ? _cred->user() : _user;
+    const QString password = _cred ? _cred->password() : _password;
+    QByteArray credHash = QByteArray(user.toUtf8()+":"+password.toUtf8()).toBase64();
+    QNetworkRequest req(request);
+    req.setRawHeader(QByteArray("Authorization"), QByteArray("Basic ") + credHash);
+    //qDebug() << "Request for " << req.url() << "with authorization" << QByteArray::fromBase64(credHash);
+    return AccessManager::createRequest(op, req, outgoingData);
+}
+
+void HttpCredentialsAccessManager::slotAuthentication(QNetworkReply* reply, QAuthenticator* authenticator)
+{
+    Q_UNUSED(authenticator)
+    // we cannot use QAuthenticator, because it sends username and passwords with latin1
+    // instead of utf8 encoding. Instead, we send it manually. Thus, if we reach this signal,
+    // those credentials were invalid and we terminate.
+    qDebug() << "Stop request: Authentication failed for " << reply->url().toString();
+    AbstractCredentials::setAuthenticationFailed(reply);
+    reply->close();
+}
 
 HttpCredentials::HttpCredentials()
     : _user(),
@@ -168,11 +188,13 @@ QString HttpCredentials::authType() const
 
 QString HttpCredentials::user() const
 {
+    QMutexLocker locker(&_mutex);
     return _user;
 }
 
 QString HttpCredentials::password() const
 {
+    QMutexLocker locker(&_mutex);
     return _password;
 }
 
@@ -188,12 +210,13 @@ QString HttpCredentials::certificatePasswd() const
 
 QNetworkAccessManager* HttpCredentials::getQNAM() const
 {
-    AccessManager* qnam = new HttpCredentialsAccessManager(this);
-
-    connect( qnam, SIGNAL(authenticationRequired(QNetworkReply*, QAuthenticator*)),
-             this, SLOT(slotAuthentication(QNetworkReply*,QAuthenticator*)));
+    return new HttpCredentialsAccessManager(this);
+}
 
-    return qnam;
+QNetworkAccessManager* HttpCredentials::createThreadQNAM() const
+{
+    // A copy, the account may replace and delete the credentials during the sync
+    return new HttpCredentialsAccessManager(user(), password());
 }
 
 bool HttpCredentials::ready() const
@@ -203,6 +226,7 @@ bool HttpCredentials::ready() const
 
 QString HttpCredentials::fetchUser()
 {
+    QMutexLocker locker(&_mutex);
     _user = _account->credentialSetting(QLatin1String(userC)).toString();
     return _user;
 }
@@ -249,16 +273,16 @@ void HttpCredentials::fetch()
 }
 bool HttpCredentials::stillValid(QNetworkReply *reply)
 {
-    return ((reply->error() != QNetworkReply::AuthenticationRequiredError)
-            // returned if user or password is incorrect
-            && (reply->error() != QNetworkReply::OperationCanceledError
-                || !reply->property(authenticationFailedC).toBool()));
+    return !authenticationFailed(reply);
 }
 
 void HttpCredentials::slotReadJobDone(QKeychain::Job *job)
 {
     ReadPasswordJob *readJob = static_cast<ReadPasswordJob*>(job);
-    _password = readJob->textData();
+    {
+        QMutexLocker locker(&_mutex);
+        _password = readJob->textData();
+    }
 
     if( _user.isEmpty()) {
         qDebug() << "Strange: User is empty!";
@@ -299,11 +323,15 @@ void HttpCredentials::slotReadJobDone(QKeychain::Job *job)
             QString pwd = queryPassword(&ok);
             _fetchJobInProgress = false;
             if (ok) {
+                _mutex.lock();
                 _password = pwd;
+                _mutex.unlock();
                 _ready = true;
                 persist();
             } else {
+                _mutex.lock();
                 _password = QString::null;
+                _mutex.unlock();
                 _ready = false;
             }
             emit fetched();
@@ -313,7 +341,9 @@ void HttpCredentials::slotReadJobDone(QKeychain::Job *job)
 
 void HttpCredentials::invalidateToken()
 {
+    _mutex.lock();
     _password = QString();
+    _mutex.unlock();
     _ready = false;
 
     // User must be fetched from config file to generate a valid key
@@ -370,17 +400,6 @@ void HttpCredentials::slotWriteJobDone(QKeychain::Job *job)
     wjob->deleteLater();
 }
 
-void HttpCredentials::slotAuthentication(QNetworkReply* reply, QAuthenticator* authenticator)
-{
-    Q_UNUSED(authenticator)
-    // we cannot use QAuthenticator, because it sends username and passwords with latin1
-    // instead of utf8 encoding. Instead, we send it manually. Thus, if we reach this signal,
-    // those credentials were invalid and we terminate.
-    qDebug() << "Stop request: Authentication failed for " << reply->url().toString();
-    reply->setProperty(authenticationFailedC, true);
-    reply->close();
-}
-
 QString HttpCredentialsGui::queryPassword(bool *ok)
 {
     if (ok) {
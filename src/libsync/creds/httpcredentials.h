@@ -17,8 +17,10 @@
 #define MIRALL_CREDS_HTTP_CREDENTIALS_H
 
 #include <QMap>
+#include <QMutex>
 
 #include "creds/abstractcredentials.h"
+#include "accessmanager.h"
 
 class QNetworkReply;
 class QAuthenticator;
@@ -43,10 +45,12 @@ public:
     bool changed(AbstractCredentials* credentials) const Q_DECL_OVERRIDE;
     QString authType() const Q_DECL_OVERRIDE;
     QNetworkAccessManager* getQNAM() const Q_DECL_OVERRIDE;
+    QNetworkAccessManager* createThreadQNAM() const Q_DECL_OVERRIDE;
     bool ready() const Q_DECL_OVERRIDE;
     void fetch() Q_DECL_OVERRIDE;
     bool stillValid(QNetworkReply *reply) Q_DECL_OVERRIDE;
     void persist() Q_DECL_OVERRIDE;
+    /** Thread-safe */
     QString user() const Q_DECL_OVERRIDE;
     QString password() const;
     virtual QString queryPassword(bool *ok) = 0;
@@ -57,13 +61,14 @@ public:
     QString certificatePasswd() const;
 
 private Q_SLOTS:
-    void slotAuthentication(QNetworkReply*, QAuthenticator*);
     void slotReadJobDone(QKeychain::Job*);
     void slotWriteJobDone(QKeychain::Job*);
 
 protected:
+    // Written with _mutex locked, in the thread of the credentials only
     QString _user;
     QString _password;
+    mutable QMutex _mutex;
 
 private:
     QString _certificatePath;
@@ -73,6 +78,31 @@ private:
     bool _readPwdFromDeprecatedPlace;
 };
 
+/**
+ * @brief The QNAM of the http credentials, sends the user and password with each request
+ *
+ * The QNAM of the account reads them from the credentials for each request,
+ * the ones of the other threads send the copy they were created with.
+ */
+class HttpCredentialsAccessManager : public AccessManager
+{
+    Q_OBJECT
+public:
+    explicit HttpCredentialsAccessManager(const HttpCredentials *cred, QObject* parent = 0);
+    HttpCredentialsAccessManager(const QString& user, const QString& password, QObject* parent = 0);
+
+protected:
+    QNetworkReply *createRequest(Operation op, const QNetworkRequest &request, QIODevice *outgoingData) Q_DECL_OVERRIDE;
+
+private Q_SLOTS:
+    void slotAuthentication(QNetworkReply*, QAuthenticator*);
+
+private:
+    const HttpCredentials *_cred; // 0 for the copies
+    QString _user;
+    QString _password;
+};
+
 class OWNCLOUDSYNC_EXPORT HttpCredentialsGui : public HttpCredentials {
 public:
     explicit HttpCredentialsGui() : HttpCredentials() {}
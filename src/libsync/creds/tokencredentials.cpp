@@ -69,7 +69,6 @@ int getauth(const char *prompt,
 }
 
 const char userC[] = "user";
-const char authenticationFailedC[] = "owncloud-authentication-failed";
 
 } // ns
 
@@ -172,10 +171,7 @@ void TokenCredentials::fetch()
 
 bool TokenCredentials::stillValid(QNetworkReply *reply)
 {
-    return ((reply->error() != QNetworkReply::AuthenticationRequiredError)
-            // returned if user/password or token are incorrect
-            && (reply->error() != QNetworkReply::OperationCanceledError
-                || !reply->property(authenticationFailedC).toBool()));
+    return !authenticationFailed(reply);
 }
 
 void TokenCredentials::invalidateToken()
@@ -200,7 +196,7 @@ void TokenCredentials::slotAuthentication(QNetworkReply* reply, QAuthenticator*
     // instead of utf8 encoding. Instead, we send it manually. Thus, if we reach this signal,
     // those credentials were invalid and we terminate.
     qDebug() << "Stop request: Authentication failed for " << reply->url().toString();
-    reply->setProperty(authenticationFailedC, true);
+    setAuthenticationFailed(reply);
     reply->close();
 }
 
@@ -18,6 +18,7 @@
 
 #include <QUrl>
 #include "account.h"
+#include "synctracer.h"
 #include <QFileInfo>
 
 namespace OCC {
@@ -475,7 +476,11 @@ void DiscoveryJob::start() {
     csync_set_log_level(_log_level);
     csync_set_log_userdata(_log_userdata);
     _lastUpdateProgressCallbackCall.invalidate();
-    int ret = csync_update(_csync_ctx);
+    int ret;
+    {
+        SyncTraceSpan span("csync", "csync_update");
+        ret = csync_update(_csync_ctx);
+    }
 
     _csync_ctx->checkSelectiveSyncBlackListHook = 0;
     _csync_ctx->checkSelectiveSyncBlackListData = 0;
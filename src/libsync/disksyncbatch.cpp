@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "disksyncbatch.h"
+#include "filesystem.h"
+#include "owncloudpropagator.h"
+#include "synctracer.h"
+
+#include <QDebug>
+#include <QRunnable>
+#include <QThreadPool>
+
+namespace OCC {
+
+// The files of a batch, at most
+static const int maximumBatchSize = 100;
+// msec, how long the first file of a batch waits for the others
+static const int batchDelay = 100;
+
+/* Syncs the files of a batch in the pool, and posts the result back to the batch */
+class DiskSyncRunnable : public QRunnable
+{
+public:
+    DiskSyncRunnable(DiskSyncBatch *batch, const QString &root, const QStringList &files)
+        : _batch(batch), _root(root), _files(files) {}
+    void run() Q_DECL_OVERRIDE {
+        SyncTraceSpan span("propagator", "diskSyncBatch");
+        span.setArg(QLatin1String("files"), _files.count());
+        QString error;
+        FileSystem::syncFiles(_root, _files, &error);
+        // The pool is waited for before the batch is deleted
+        QMetaObject::invokeMethod(_batch, "slotBatchSynced", Qt::QueuedConnection, Q_ARG(QString, error));
+    }
+private:
+    DiskSyncBatch *_batch;
+    QString _root;
+    QStringList _files;
+};
+
+// The propagator is the parent so that we move to the propagation thread together
+DiskSyncBatch::DiskSyncBatch(OwncloudPropagator *propagator)
+    : QObject(propagator), _propagator(propagator), _running(false)
+{
+    _timer.setParent(this);
+    _timer.setSingleShot(true);
+    _timer.setInterval(batchDelay);
+    connect(&_timer, SIGNAL(timeout()), this, SLOT(startSync()));
+}
+
+void DiskSyncBatch::add(const QString &file, QObject *receiver, const char *member)
+{
+    Entry entry;
+    entry.file = file;
+    entry.receiver = receiver;
+    entry.member = member;
+    _pending.append(entry);
+
+    if (_pending.count() >= maximumBatchSize) {
+        startSync();
+    } else if (!_timer.isActive()) {
+        _timer.start();
+    }
+}
+
+void DiskSyncBatch::startSync()
+{
+    if (_running || _pending.isEmpty()) {
+        return; // started again when the running batch is synced
+    }
+    _timer.stop();
+    _running = true;
+    _syncing.swap(_pending);
+
+    QStringList files;
+    files.reserve(_syncing.count());
+    foreach (const Entry &entry, _syncing) {
+        files.append(entry.file);
+    }
+    _propagator->diskSyncPool()->start(new DiskSyncRunnable(this, _propagator->_localDir, files));
+}
+
+void DiskSyncBatch::slotBatchSynced(const QString &error)
+{
+    if (!error.isEmpty()) {
+        qDebug() << Q_FUNC_INFO << "Could not sync" << _syncing.count() << "files to the disk:" << error;
+    }
+    const QVector<Entry> synced = _syncing;
+    _syncing.clear();
+    _running = false;
+
+    foreach (const Entry &entry, synced) {
+        if (entry.receiver) {
+            QMetaObject::invokeMethod(entry.receiver, entry.member, Qt::DirectConnection, Q_ARG(QString, error));
+        }
+    }
+
+    // The files added meanwhile
+    if (_pending.count() >= maximumBatchSize) {
+        startSync();
+    } else if (!_pending.isEmpty() && !_timer.isActive()) {
+        _timer.start();
+    }
+}
+
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef DISKSYNCBATCH_H
+#define DISKSYNCBATCH_H
+
+#include <QObject>
+#include <QPointer>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+
+namespace OCC {
+
+class OwncloudPropagator;
+
+/**
+ * @brief Writes the files of the propagator to the disk in batches
+ *
+ * The files added are gathered until there are enough of them or a short
+ * while passed, then synced to the disk at once in the disk sync pool of the
+ * propagator (see FileSystem::syncFiles), where the local jobs cannot hold
+ * them up. Once the batch is durable, the
+ * receivers of its files are told, in the propagation thread.
+ *
+ * Syncing many files at once costs about as much as syncing one, so this
+ * keeps most of the throughput of not syncing at all.
+ */
+class DiskSyncBatch : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DiskSyncBatch(OwncloudPropagator *propagator);
+
+    /**
+     * Adds the file at the absolute path \a file to the next batch. The slot
+     * \a member of \a receiver is invoked with the error message, empty on
+     * success, once the batch was synced.
+     */
+    void add(const QString &file, QObject *receiver, const char *member);
+
+private slots:
+    void startSync();
+    void slotBatchSynced(const QString &error);
+
+private:
+    struct Entry {
+        QString file;
+        QPointer<QObject> receiver;
+        const char *member;
+    };
+
+    OwncloudPropagator *_propagator;
+    QVector<Entry> _pending; // for the next batch
+    QVector<Entry> _syncing; // in the batch being synced, only one at a time
+    bool _running;
+    QTimer _timer;
+};
+
+}
+
+#endif // DISKSYNCBATCH_H
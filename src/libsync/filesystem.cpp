@@ -17,6 +17,7 @@
 #include <QFile>
 #include <QFileInfo>
 #include <QDebug>
+#include <QSet>
 
 #if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
 #include <qabstractfileengine.h>
@@ -26,6 +27,11 @@
 #include <windef.h>
 #include <winbase.h>
 #include <fcntl.h>
+#include <io.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 // We use some internals of csync:
@@ -234,6 +240,129 @@ qint64 FileSystem::getSize(const QString& filename)
     return QFileInfo(filename).size();
 }
 
+#ifdef Q_OS_WIN
+static bool flushHandle(HANDLE handle, QString *error)
+{
+    if (!FlushFileBuffers(handle)) {
+        *error = qt_error_string();
+        return false;
+    }
+    return true;
+}
+#else
+static bool syncFd(int fd, QString *error)
+{
+#ifdef Q_OS_LINUX
+    int result = fdatasync(fd);
+#else
+    int result = fsync(fd);
+#endif
+    if (result != 0) {
+        *error = qt_error_string(errno);
+        return false;
+    }
+    return true;
+}
+#endif
+
+bool FileSystem::syncFileData(QFile *file, QString *error)
+{
+    if (!file->flush()) {
+        *error = file->errorString();
+        return false;
+    }
+#ifdef Q_OS_WIN
+    return flushHandle((HANDLE)_get_osfhandle(file->handle()), error);
+#else
+    return syncFd(file->handle(), error);
+#endif
+}
+
+// Syncs the file or directory at \a path, without following a symlink on POSIX
+static bool syncPath(const QString &path, QString *error)
+{
+#ifdef Q_OS_WIN
+    HANDLE handle = CreateFileW((const wchar_t *)path.utf16(), GENERIC_WRITE,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        *error = qt_error_string();
+        return false;
+    }
+    const bool ok = flushHandle(handle, error);
+    CloseHandle(handle);
+    return ok;
+#else
+    const int fd = open(QFile::encodeName(path).constData(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        *error = qt_error_string(errno);
+        return false;
+    }
+    const bool ok = syncFd(fd, error);
+    close(fd);
+    return ok;
+#endif
+}
+
+bool FileSystem::syncFiles(const QString &root, const QStringList &files, QString *error)
+{
+#ifdef Q_OS_LINUX
+    const int fd = open(QFile::encodeName(root).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        const int result = syncfs(fd);
+        const int syncErrno = errno;
+        close(fd);
+        if (result == 0) {
+            return true;
+        }
+        qDebug() << Q_FUNC_INFO << "syncfs failed, syncing the files one by one:" << qt_error_string(syncErrno);
+    }
+#else
+    Q_UNUSED(root);
+#endif
+
+    bool success = true;
+    QSet<QString> directories;
+    foreach (const QString &file, files) {
+        if (!syncPath(file, error)) {
+            success = false;
+        }
+        directories.insert(QFileInfo(file).path());
+    }
+#ifndef Q_OS_WIN
+    // The new names of the files are in their directories
+    foreach (const QString &directory, directories) {
+        if (!syncPath(directory, error)) {
+            success = false;
+        }
+    }
+#endif
+    return success;
+}
+
+bool FileSystem::syncFileName(const QString &file, QString *error)
+{
+#ifdef Q_OS_WIN
+    // renameReplace() already moves with MOVEFILE_WRITE_THROUGH
+    return syncPath(file, error);
+#else
+    // Not syncPath(): fdatasync() may skip the modification time
+    const int fd = open(QFile::encodeName(file).constData(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        *error = qt_error_string(errno);
+        return false;
+    }
+    const int result = fsync(fd);
+    const int syncErrno = errno;
+    close(fd);
+    if (result != 0) {
+        *error = qt_error_string(syncErrno);
+        return false;
+    }
+    return syncPath(QFileInfo(file).path(), error);
+#endif
+}
+
 #ifdef Q_OS_WIN
 QString FileSystem::fileSystemForPath(const QString & path)
 {
@@ -15,6 +15,7 @@
 
 #include <QString>
 #include <QFile>
+#include <QStringList>
 #include <ctime>
 
 #include <owncloudlib.h>
@@ -66,6 +67,26 @@ bool renameReplace(const QString &originFileName, const QString &destinationFile
  */
 bool openFileSharedRead(QFile* file, QString* error);
 
+/**
+ * Writes the data of the open \a file to the disk, so that it survives a
+ * power loss.
+ */
+bool syncFileData(QFile *file, QString *error);
+
+/**
+ * Writes the \a files to the disk, their data and their names. On Linux the
+ * whole file system of \a root is synced at once, which is much cheaper than
+ * syncing the files one by one as is done elsewhere.
+ */
+bool syncFiles(const QString &root, const QStringList &files, QString *error);
+
+/**
+ * Writes the metadata of \a file to the disk, such as its modification time,
+ * and its name in its directory, so that a rename that replaced it survives a
+ * power loss. Sync the data of the file before renaming it, see syncFileData().
+ */
+bool syncFileName(const QString &file, QString *error);
+
 #ifdef Q_OS_WIN
 /**
  * Returns the file system used at the given path.
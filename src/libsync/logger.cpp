@@ -17,14 +17,204 @@
 #include <QDir>
 #include <QStringList>
 #include <QThread>
+#include <QWaitCondition>
 
 namespace OCC {
 
+/* A message waiting in the log queue. Formatting is left to the log writer:
+ * csync messages keep their UTF-8 bytes and function name, other messages
+ * are either complete (formatted) or only lack the time and thread prefix. */
+struct LogEntry {
+    LogEntry() : msecs(0), thread(0), function(0), formatted(false) {}
+
+    qint64 msecs;
+    Qt::HANDLE thread;
+    const char *function; // static string, only set for csync messages
+    QByteArray rawMessage;
+    QString message;
+    bool formatted;
+};
+
+/*
+ * Writes the log messages on its own thread.
+ *
+ * The messages are queued in a bounded lock-free ring buffer with one slot
+ * per message, any thread can push while the writer thread pops. Each slot
+ * has a sequence number telling whether it is free for the producer at that
+ * position or filled for the consumer. If the ring is full the message is
+ * dropped and counted, the writer then logs how many messages it missed.
+ */
+class LogWriter : public QThread
+{
+public:
+    explicit LogWriter(Logger *logger)
+        : _logger(logger), _dequeuePos(0)
+    {
+        for (int i = 0; i < Capacity; ++i) {
+            _slots[i].sequence.fetchAndStoreRelaxed(i);
+        }
+    }
+
+    bool push(const LogEntry &entry)
+    {
+        int pos = _enqueuePos.fetchAndAddRelaxed(0);
+        Slot *slot;
+        forever {
+            slot = &_slots[pos & (Capacity - 1)];
+            int diff = int(uint(slot->sequence.fetchAndAddAcquire(0)) - uint(pos));
+            if (diff == 0) {
+                if (_enqueuePos.testAndSetRelaxed(pos, int(uint(pos) + 1))) {
+                    break;
+                }
+                pos = _enqueuePos.fetchAndAddRelaxed(0);
+            } else if (diff < 0) {
+                // the writer did not yet free this slot: the ring is full
+                _dropped.fetchAndAddRelaxed(1);
+                _droppedTotal.fetchAndAddRelaxed(1);
+                return false;
+            } else {
+                pos = _enqueuePos.fetchAndAddRelaxed(0);
+            }
+        }
+        slot->entry = entry;
+        slot->sequence.fetchAndStoreRelease(int(uint(pos) + 1));
+
+        // The writer polls, only wake it early if the ring fills up
+        if (int(uint(pos) - uint(_dequeuePos.fetchAndAddRelaxed(0))) == Capacity / 2) {
+            wake();
+        }
+        return true;
+    }
+
+    void stop()
+    {
+        _stop.fetchAndStoreRelaxed(1);
+        wake();
+        wait();
+    }
+
+    void waitForDrained()
+    {
+        if (!isRunning() || QThread::currentThread() == this) {
+            return;
+        }
+        const int target = _enqueuePos.fetchAndAddRelaxed(0);
+        wake();
+        while (int(uint(_written.fetchAndAddAcquire(0)) - uint(target)) < 0) {
+            QThread::msleep(1);
+        }
+    }
+
+    int droppedTotal() const
+    {
+        return const_cast<QAtomicInt&>(_droppedTotal).fetchAndAddRelaxed(0);
+    }
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        QStringList lines;
+        LogEntry entry;
+        forever {
+            while (lines.size() < BatchSize && pop(&entry)) {
+                lines.append(format(entry));
+            }
+            if (int dropped = _dropped.fetchAndStoreRelaxed(0)) {
+                lines.append(QString::fromLatin1("%1 log messages were dropped because the log could not be written fast enough")
+                             .arg(dropped));
+            }
+            if (!lines.isEmpty()) {
+                _logger->writeLines(lines, false);
+                lines.clear();
+                _written.fetchAndStoreRelease(_dequeuePos.fetchAndAddRelaxed(0));
+                continue;
+            }
+            _logger->writeLines(lines, true);
+            if (_stop.fetchAndAddRelaxed(0)) {
+                return;
+            }
+            QMutexLocker locker(&_wakeMutex);
+            _wakeCondition.wait(&_wakeMutex, IdleWaitMsecs);
+        }
+    }
+
+private:
+    enum { Capacity = 8192, BatchSize = 512, IdleWaitMsecs = 100 };
+
+    struct Slot {
+        QAtomicInt sequence;
+        LogEntry entry;
+    };
+
+    // Only called by the writer thread
+    bool pop(LogEntry *entry)
+    {
+        const int pos = _dequeuePos.fetchAndAddRelaxed(0);
+        Slot *slot = &_slots[pos & (Capacity - 1)];
+        if (slot->sequence.fetchAndAddAcquire(0) != int(uint(pos) + 1)) {
+            return false;
+        }
+        *entry = slot->entry;
+        slot->entry = LogEntry();
+        slot->sequence.fetchAndStoreRelease(int(uint(pos) + Capacity));
+        _dequeuePos.fetchAndStoreRelaxed(int(uint(pos) + 1));
+        return true;
+    }
+
+    static QString format(const LogEntry &entry)
+    {
+        if (entry.formatted) {
+            return entry.message;
+        }
+        QString msg = QDateTime::fromMSecsSinceEpoch(entry.msecs).toString(QLatin1String("MM-dd hh:mm:ss:zzz"))
+                + QString().sprintf(" %p ", (void*)entry.thread);
+        if (entry.function) {
+            msg += QString::fromUtf8(entry.function) + QLatin1String(": ") + QString::fromUtf8(entry.rawMessage);
+        } else {
+            msg += entry.message;
+        }
+        return msg;
+    }
+
+    void wake()
+    {
+        QMutexLocker locker(&_wakeMutex);
+        _wakeCondition.wakeOne();
+    }
+
+    Logger *_logger;
+    Slot _slots[Capacity];
+    QAtomicInt _enqueuePos;
+    QAtomicInt _dequeuePos; // only written by the writer thread
+    QAtomicInt _written; // _dequeuePos once the messages are written
+    QAtomicInt _dropped; // since the last message about dropped messages
+    QAtomicInt _droppedTotal;
+    QAtomicInt _stop;
+    QMutex _wakeMutex;
+    QWaitCondition _wakeCondition;
+};
+
+static int messageLevel(QtMsgType type)
+{
+    switch (type) {
+    case QtDebugMsg: return Logger::DebugLevel;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+    case QtInfoMsg: return Logger::InfoLevel;
+#endif
+    case QtWarningMsg: return Logger::WarningLevel;
+    case QtCriticalMsg: return Logger::CriticalLevel;
+    case QtFatalMsg: return Logger::FatalLevel;
+    }
+    return Logger::DebugLevel;
+}
+
 #if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
 // logging handler.
 static void mirallLogCatcher(QtMsgType type, const char *msg)
 {
-  Q_UNUSED(type)
+  if (messageLevel(type) > Logger::instance()->logLevel()) {
+      return;
+  }
   // qDebug() exports to local8Bit, which is not always UTF-8
   Logger::instance()->mirallLog( QString::fromLocal8Bit(msg) );
 }
@@ -32,7 +222,10 @@ static void qInstallMessageHandler(QtMsgHandler h) {
     qInstallMsgHandler(h);
 }
 #elif QT_VERSION < QT_VERSION_CHECK(5, 4, 0)
-static void mirallLogCatcher(QtMsgType, const QMessageLogContext &ctx, const QString &message) {
+static void mirallLogCatcher(QtMsgType type, const QMessageLogContext &ctx, const QString &message) {
+    if (messageLevel(type) > Logger::instance()->logLevel()) {
+        return;
+    }
     QByteArray file = ctx.file;
     file = file.mid(file.lastIndexOf('/') + 1);
     Logger::instance()->mirallLog( QString::fromLocal8Bit(file) + QLatin1Char(':') + QString::number(ctx.line)
@@ -40,7 +233,15 @@ static void mirallLogCatcher(QtMsgType, const QMessageLogContext &ctx, const QSt
 }
 #else
 static void mirallLogCatcher(QtMsgType type, const QMessageLogContext &ctx, const QString &message) {
-    Logger::instance()->doLog( qFormatLogMessage(type, ctx, message) ) ;
+    Logger *logger = Logger::instance();
+    if (messageLevel(type) > logger->logLevel()) {
+        return;
+    }
+    logger->doLog( qFormatLogMessage(type, ctx, message) ) ;
+    if (type == QtFatalMsg) {
+        // we abort right after this
+        logger->flush();
+    }
 }
 #endif
 
@@ -51,8 +252,10 @@ Logger *Logger::instance()
 }
 
 Logger::Logger( QObject* parent) : QObject(parent),
-  _showTime(true), _doLogging(false), _doFileFlush(false), _logExpire(0)
+  _showTime(true), _doLogging(false), _doFileFlush(false), _logExpire(0),
+  _logLevel(DebugLevel), _writer(new LogWriter(this))
 {
+    _writer->start();
 #ifndef NO_MSG_HANDLER
 #if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
     qSetMessagePattern("%{time MM-dd hh:mm:ss:zzz} %{threadid} %{function}: %{message}");
@@ -67,6 +270,7 @@ Logger::~Logger() {
 #ifndef NO_MSG_HANDLER
     qInstallMessageHandler(0);
 #endif
+    _writer->stop();
 }
 
 
@@ -87,34 +291,42 @@ void Logger::postGuiMessage(const QString &title, const QString &message)
 
 void Logger::log(Log log)
 {
-    QString msg;
-    if( _showTime ) {
-        msg = log.timeStamp.toString(QLatin1String("MM-dd hh:mm:ss:zzz")) + QLatin1Char(' ');
+    if (isNoop()) {
+        return;
     }
+    LogEntry entry;
+    entry.msecs = log.timeStamp.toMSecsSinceEpoch();
+    entry.thread = QThread::currentThreadId();
+    entry.message = log.message;
+    entry.formatted = !_showTime;
+    _writer->push(entry);
+}
 
-    if( log.source == Log::CSync ) {
-        // msg += "csync - ";
-    } else {
-        // msg += "ownCloud - ";
+void Logger::doLog(const QString& msg)
+{
+    if (isNoop()) {
+        return;
     }
-    msg += QString().sprintf("%p ", (void*)QThread::currentThread());
-    msg += log.message;
-    // _logs.append(log);
-    // std::cout << qPrintable(log.message) << std::endl;
-
-    doLog(msg);
+    LogEntry entry;
+    entry.message = msg;
+    entry.formatted = true;
+    _writer->push(entry);
 }
 
-void Logger::doLog(const QString& msg)
+void Logger::writeLines(const QStringList &lines, bool idle)
 {
     {
         QMutexLocker lock(&_mutex);
         if( _logstream ) {
-            (*_logstream) << msg << endl;
-            if( _doFileFlush ) _logstream->flush();
+            foreach (const QString &line, lines) {
+                (*_logstream) << line << QLatin1Char('\n');
+            }
+            if( idle || _doFileFlush ) _logstream->flush();
         }
     }
-    emit newLog(msg);
+    if (!lines.isEmpty() && _logWindowActive.fetchAndAddRelaxed(0)) {
+        emit newLog(lines.join(QLatin1String("\n")));
+    }
 }
 
 void Logger::csyncLog( const QString& message )
@@ -127,6 +339,21 @@ void Logger::csyncLog( const QString& message )
     Logger::instance()->log(log);
 }
 
+void Logger::csyncLog( int verbosity, const char *function, const char *buffer )
+{
+    Logger *logger = Logger::instance();
+    // csync already filters with the level it was given, which may be out of date
+    if (verbosity > logger->logLevel()) {
+        return;
+    }
+    LogEntry entry;
+    entry.msecs = QDateTime::currentMSecsSinceEpoch();
+    entry.thread = QThread::currentThreadId();
+    entry.function = function;
+    entry.rawMessage = QByteArray(buffer);
+    logger->_writer->push(entry);
+}
+
 void Logger::mirallLog( const QString& message )
 {
     Log log_;
@@ -137,6 +364,40 @@ void Logger::mirallLog( const QString& message )
     Logger::instance()->log( log_ );
 }
 
+bool Logger::isNoop() const
+{
+    return !const_cast<QAtomicInt&>(_logFileActive).fetchAndAddRelaxed(0)
+            && !const_cast<QAtomicInt&>(_logWindowActive).fetchAndAddRelaxed(0);
+}
+
+void Logger::setLogWindowActivated(bool activated)
+{
+    _logWindowActive.fetchAndStoreRelaxed(activated);
+}
+
+void Logger::setLogLevel(int level)
+{
+    _logLevel.fetchAndStoreRelaxed(qBound(0, level, int(AllLevels)));
+}
+
+int Logger::logLevel() const
+{
+    if (isNoop()) {
+        return 0;
+    }
+    return const_cast<QAtomicInt&>(_logLevel).fetchAndAddRelaxed(0);
+}
+
+int Logger::droppedMessages() const
+{
+    return _writer->droppedTotal();
+}
+
+void Logger::flush()
+{
+    _writer->waitForDrained();
+}
+
 void Logger::setLogFile(const QString & name)
 {
     QMutexLocker locker(&_mutex);
@@ -144,6 +405,7 @@ void Logger::setLogFile(const QString & name)
     if( _logstream ) {
         _logstream.reset(0);
         _logFile.close();
+        _logFileActive.fetchAndStoreRelaxed(0);
     }
 
     if( name.isEmpty() ) {
@@ -168,6 +430,7 @@ void Logger::setLogFile(const QString & name)
     }
 
     _logstream.reset(new QTextStream( &_logFile ));
+    _logFileActive.fetchAndStoreRelaxed(1);
 }
 
 void Logger::setLogExpire( int expire )
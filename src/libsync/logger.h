@@ -17,15 +17,19 @@
 
 #include <QObject>
 #include <QList>
+#include <QStringList>
 #include <QDateTime>
 #include <QFile>
 #include <QTextStream>
 #include <qmutex.h>
+#include <QAtomicInt>
 
 #include "utility.h"
 
 namespace OCC {
 
+class LogWriter;
+
 struct Log{
   typedef enum{
     Occ,
@@ -41,6 +45,16 @@ class OWNCLOUDSYNC_EXPORT Logger : public QObject
 {
   Q_OBJECT
 public:
+  /** The levels of the messages, those of csync */
+  enum Level {
+    FatalLevel = 1,
+    CriticalLevel = 3,
+    WarningLevel = 5,
+    InfoLevel = 7,
+    DebugLevel = 8,
+    TraceLevel = 9,
+    AllLevels = 11
+  };
 
   void log(Log log);
   void doLog(const QString &log);
@@ -48,6 +62,35 @@ public:
   static void csyncLog( const QString& message );
   static void mirallLog( const QString& message );
 
+  /** Log callback for csync.
+   *
+   * Only stores the raw message, the time and the thread: the message is
+   * formatted and written by the log writer thread.
+   */
+  static void csyncLog( int verbosity, const char *function, const char *buffer );
+
+  /** True if the log messages go nowhere: no log file and no log window.
+   *
+   * Callers can use it to avoid formatting messages at all, csync is set
+   * to a log level of 0 in that case.
+   */
+  bool isNoop() const;
+  void setLogWindowActivated( bool activated );
+
+  /** The messages above \a level are dropped before they are formatted,
+   * DebugLevel by default: no csync trace messages. */
+  void setLogLevel( int level );
+  /** The level messages are kept up to, 0 if they go nowhere (isNoop()).
+   * This is the log level csync is set to. */
+  int logLevel() const;
+
+  /** Number of messages dropped since the start because the log writer
+   * could not keep up. */
+  int droppedMessages() const;
+
+  /** Blocks until the log writer wrote all queued messages. */
+  void flush();
+
   const QList<Log>& logs() const {return _logs;}
 
   static Logger* instance();
@@ -73,6 +116,7 @@ public slots:
 private:
   Logger(QObject* parent=0);
   ~Logger();
+  void writeLines(const QStringList &lines, bool idle);
   QList<Log> _logs;
   bool       _showTime;
   bool       _doLogging;
@@ -82,6 +126,12 @@ private:
   QScopedPointer<QTextStream> _logstream;
   QMutex      _mutex;
   QString     _logDirectory;
+  QAtomicInt  _logFileActive;
+  QAtomicInt  _logWindowActive;
+  QAtomicInt  _logLevel;
+  QScopedPointer<LogWriter> _writer;
+
+  friend class LogWriter;
 
 };
 
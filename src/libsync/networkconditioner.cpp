@@ -0,0 +1,533 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "networkconditioner.h"
+#include "accessmanager.h"
+
+#include <QDebug>
+#include <QNetworkRequest>
+#include <QStringList>
+
+#include <cmath>
+#include <string.h>
+
+namespace OCC {
+
+// A request to a host that was idle for that long starts a new slow start (msec)
+static const qint64 slowStartIdleRestart = 1000;
+// The bodies are handed out in pieces of that size at most
+static const qint64 deliveryPieceSize = 16 * 1024;
+
+NetworkConditions::NetworkConditions()
+    : rtt(0)
+    , jitter(0)
+    , downloadBandwidth(0)
+    , uploadBandwidth(0)
+    , resetProbability(0)
+    , errorProbability(0)
+    , errorCode(503)
+    , stormPeriod(0)
+    , stormDuration(0)
+    , slowStart(false)
+{
+}
+
+bool NetworkConditions::isActive() const
+{
+    return rtt > 0 || jitter > 0 || downloadBandwidth > 0 || uploadBandwidth > 0
+            || resetProbability > 0 || errorProbability > 0
+            || (stormPeriod > 0 && stormDuration > 0) || slowStart;
+}
+
+NetworkConditions NetworkConditions::parse(const QString &spec, bool *ok)
+{
+    NetworkConditions conditions;
+    bool allOk = true;
+    foreach (const QString &entry, spec.split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        const QString key = entry.section(QLatin1Char('='), 0, 0).trimmed();
+        const QString value = entry.section(QLatin1Char('='), 1).trimmed();
+        bool valueOk = true;
+        if (key == QLatin1String("rtt")) {
+            conditions.rtt = value.toInt(&valueOk);
+        } else if (key == QLatin1String("jitter")) {
+            conditions.jitter = value.toInt(&valueOk);
+        } else if (key == QLatin1String("down")) {
+            conditions.downloadBandwidth = value.toLongLong(&valueOk) * 1024;
+        } else if (key == QLatin1String("up")) {
+            conditions.uploadBandwidth = value.toLongLong(&valueOk) * 1024;
+        } else if (key == QLatin1String("reset")) {
+            conditions.resetProbability = value.toDouble(&valueOk);
+        } else if (key == QLatin1String("error")) {
+            conditions.errorProbability = value.toDouble(&valueOk);
+        } else if (key == QLatin1String("errorcode")) {
+            conditions.errorCode = value.toInt(&valueOk);
+        } else if (key == QLatin1String("storm")) {
+            bool durationOk = false;
+            conditions.stormPeriod = value.section(QLatin1Char('/'), 0, 0).toInt(&valueOk);
+            conditions.stormDuration = value.section(QLatin1Char('/'), 1).toInt(&durationOk);
+            valueOk = valueOk && durationOk && conditions.stormDuration <= conditions.stormPeriod;
+        } else if (key == QLatin1String("slowstart")) {
+            conditions.slowStart = value.isEmpty() || value.toInt(&valueOk) != 0;
+        } else if (key == QLatin1String("host") || key == QLatin1String("seed")) {
+            // handled by the NetworkConditioner
+        } else {
+            valueOk = false;
+        }
+        if (!valueOk) {
+            qWarning() << "Invalid network condition" << entry;
+            allOk = false;
+        }
+    }
+    if (ok) {
+        *ok = allOk;
+    }
+    return conditions;
+}
+
+NetworkConditioner *NetworkConditioner::instance()
+{
+    static NetworkConditioner conditioner;
+    return &conditioner;
+}
+
+NetworkConditioner::NetworkConditioner()
+    : _random(1)
+    , _enabled(0)
+{
+    _clock.start();
+
+    const QString env = QString::fromLocal8Bit(qgetenv("OWNCLOUD_NETWORK_CONDITIONS"));
+    foreach (const QString &group, env.split(QLatin1Char(';'), QString::SkipEmptyParts)) {
+        QString host;
+        foreach (const QString &entry, group.split(QLatin1Char(','), QString::SkipEmptyParts)) {
+            if (entry.startsWith(QLatin1String("host="))) {
+                host = entry.mid(5).trimmed();
+            } else if (entry.startsWith(QLatin1String("seed="))) {
+                setSeed(entry.mid(5).toUInt());
+            }
+        }
+        setConditions(NetworkConditions::parse(group), host);
+        qDebug() << "Network conditions for" << (host.isEmpty() ? QString("all hosts") : host) << ":" << group;
+    }
+}
+
+bool NetworkConditioner::isEnabled()
+{
+    return instance()->_enabled.fetchAndAddRelaxed(0);
+}
+
+void NetworkConditioner::setConditions(const NetworkConditions &conditions, const QString &host)
+{
+    QMutexLocker lock(&_mutex);
+    _conditions.insert(host, conditions);
+    bool enabled = false;
+    foreach (const NetworkConditions &c, _conditions) {
+        enabled = enabled || c.isActive();
+    }
+    _enabled.fetchAndStoreRelaxed(enabled);
+}
+
+NetworkConditions NetworkConditioner::conditions(const QString &host) const
+{
+    QMutexLocker lock(&_mutex);
+    return conditionsLocked(host);
+}
+
+void NetworkConditioner::clear()
+{
+    QMutexLocker lock(&_mutex);
+    _conditions.clear();
+    _hosts.clear();
+    _enabled.fetchAndStoreRelaxed(0);
+}
+
+void NetworkConditioner::setSeed(quint32 seed)
+{
+    QMutexLocker lock(&_mutex);
+    _random = seed;
+}
+
+const NetworkConditions &NetworkConditioner::conditionsLocked(const QString &host) const
+{
+    static const NetworkConditions none;
+    QHash<QString, NetworkConditions>::const_iterator it = _conditions.constFind(host);
+    if (it == _conditions.constEnd()) {
+        it = _conditions.constFind(QString());
+    }
+    return it == _conditions.constEnd() ? none : *it;
+}
+
+double NetworkConditioner::randomLocked()
+{
+    // Our own generator so that a seed gives the same decisions on every platform
+    _random = _random * 1103515245u + 12345u;
+    return (_random >> 8) / double(1 << 24);
+}
+
+qint64 NetworkConditioner::rateLocked(const NetworkConditions &conditions, const HostState &state,
+                                      qint64 bandwidth, qint64 now) const
+{
+    if (!conditions.slowStart || conditions.rtt <= 0) {
+        return bandwidth;
+    }
+    // Ten segments of 1460 bytes in the first round trip, doubled every round trip
+    const int roundTrips = int(qMin(qint64(30), (now - state.rampStart) / conditions.rtt));
+    const double rate = std::ldexp(14600. * 1000 / conditions.rtt, roundTrips);
+    return bandwidth > 0 ? qMin(qint64(rate), bandwidth) : qint64(rate);
+}
+
+NetworkConditioner::Decision NetworkConditioner::startRequest(const QString &host, qint64 uploadSize)
+{
+    QMutexLocker lock(&_mutex);
+    const NetworkConditions &c = conditionsLocked(host);
+    HostState &state = _hosts[host];
+    const qint64 now = _clock.elapsed();
+
+    if (state.activeRequests == 0 && (state.lastActivity < 0 || now - state.lastActivity > slowStartIdleRestart)) {
+        state.rampStart = now;
+    }
+    ++state.activeRequests;
+
+    Decision decision;
+    decision.delay = qMax(0, c.rtt + (c.jitter > 0 ? int((randomLocked() * 2 - 1) * c.jitter) : 0));
+    decision.errorCode = 0;
+    decision.reset = c.resetProbability > 0 && randomLocked() < c.resetProbability;
+    decision.resetFraction = decision.reset ? randomLocked() : 0;
+
+    const bool inStorm = c.stormPeriod > 0 && c.stormDuration > 0
+            && (now / 1000) % c.stormPeriod >= c.stormPeriod - c.stormDuration;
+    if (inStorm || (c.errorProbability > 0 && randomLocked() < c.errorProbability)) {
+        decision.errorCode = c.errorCode;
+        decision.reset = false;
+        return decision;
+    }
+
+    // The upload shares the bandwidth with the other uploads to the host
+    const qint64 rate = rateLocked(c, state, c.uploadBandwidth, now);
+    if (rate > 0 && uploadSize > 0) {
+        state.uploadFreeAt = qMax(now, state.uploadFreeAt) + uploadSize * 1000 / rate;
+        decision.delay += int(state.uploadFreeAt - now);
+    }
+    return decision;
+}
+
+void NetworkConditioner::finishRequest(const QString &host)
+{
+    QMutexLocker lock(&_mutex);
+    HostState &state = _hosts[host];
+    state.activeRequests = qMax(0, state.activeRequests - 1);
+    state.lastActivity = _clock.elapsed();
+}
+
+qint64 NetworkConditioner::reserveDownload(const QString &host, qint64 bytes)
+{
+    QMutexLocker lock(&_mutex);
+    const NetworkConditions &c = conditionsLocked(host);
+    HostState &state = _hosts[host];
+    const qint64 now = _clock.elapsed();
+    state.lastActivity = now;
+
+    const qint64 rate = rateLocked(c, state, c.downloadBandwidth, now);
+    if (rate <= 0) {
+        return 0;
+    }
+    state.downloadFreeAt = qMax(now, state.downloadFreeAt) + bytes * 1000 / rate;
+    return state.downloadFreeAt - now;
+}
+
+static QNetworkReply::NetworkError errorForHttpStatus(int code)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 3, 0)
+    switch (code) {
+    case 500: return QNetworkReply::InternalServerError;
+    case 501: return QNetworkReply::OperationNotImplementedError;
+    case 503: return QNetworkReply::ServiceUnavailableError;
+    default: break;
+    }
+    if (code >= 500) {
+        return QNetworkReply::UnknownServerError;
+    }
+#else
+    Q_UNUSED(code);
+#endif
+    return QNetworkReply::UnknownContentError;
+}
+
+ConditionedNetworkReply::ConditionedNetworkReply(AccessManager *am, QNetworkAccessManager::Operation op,
+                                                 const QNetworkRequest &request, QIODevice *outgoingData)
+    : QNetworkReply(am)
+    , _am(am)
+    , _outgoingData(outgoingData)
+    , _host(request.url().host())
+    , _ignoreSslErrors(false)
+    , _realFinished(false)
+    , _done(false)
+    , _resetAfter(-1)
+    , _delivered(0)
+{
+    setOperation(op);
+    setRequest(request);
+    setUrl(request.url());
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+
+    _deliverTimer.setSingleShot(true);
+    connect(&_deliverTimer, SIGNAL(timeout()), this, SLOT(slotDeliver()));
+
+    qint64 uploadSize = request.header(QNetworkRequest::ContentLengthHeader).toLongLong();
+    if (outgoingData && !outgoingData->isSequential()) {
+        uploadSize = outgoingData->size();
+    }
+    _decision = NetworkConditioner::instance()->startRequest(_host, uploadSize);
+    QTimer::singleShot(_decision.delay, this, _decision.errorCode ? SLOT(slotInjectError()) : SLOT(slotStart()));
+}
+
+ConditionedNetworkReply::~ConditionedNetworkReply()
+{
+    if (!_done) {
+        NetworkConditioner::instance()->finishRequest(_host);
+    }
+}
+
+void ConditionedNetworkReply::slotStart()
+{
+    if (_done) {
+        return;
+    }
+    if (!_am) {
+        setError(OperationCanceledError, tr("Operation canceled"));
+        finishReply();
+        return;
+    }
+    _real = _am->createUnconditionedRequest(operation(), request(), _outgoingData);
+    _real->setParent(this);
+    // The jobs set their properties on this reply, the authentication handler
+    // of the AccessManager looks at the real one
+    foreach (const QByteArray &name, dynamicPropertyNames()) {
+        _real->setProperty(name.constData(), property(name.constData()));
+    }
+    if (readBufferSize() > 0) {
+        _real->setReadBufferSize(readBufferSize());
+    }
+    if (_ignoreSslErrors) {
+        _real->ignoreSslErrors();
+    }
+    connect(_real, SIGNAL(metaDataChanged()), this, SLOT(slotMetaDataChanged()));
+    connect(_real, SIGNAL(readyRead()), this, SLOT(slotReadyRead()));
+    connect(_real, SIGNAL(finished()), this, SLOT(slotRealFinished()));
+    connect(_real, SIGNAL(uploadProgress(qint64,qint64)), this, SIGNAL(uploadProgress(qint64,qint64)));
+#ifndef QT_NO_SSL
+    connect(_real, SIGNAL(sslErrors(QList<QSslError>)), this, SIGNAL(sslErrors(QList<QSslError>)));
+#endif
+}
+
+void ConditionedNetworkReply::slotInjectError()
+{
+    if (_done) {
+        return;
+    }
+    const int code = _decision.errorCode;
+    qDebug() << "Network conditions: injecting" << code << "for" << url().toString();
+    setAttribute(QNetworkRequest::HttpStatusCodeAttribute, code);
+    setAttribute(QNetworkRequest::HttpReasonPhraseAttribute,
+                 code == 503 ? QByteArray("Service Unavailable") : QByteArray("Internal Server Error"));
+    setError(errorForHttpStatus(code), tr("Server replied with error %1 (injected by the network conditions)").arg(code));
+    emit metaDataChanged();
+    finishReply();
+}
+
+void ConditionedNetworkReply::copyMetaData()
+{
+    foreach (const RawHeaderPair &header, _real->rawHeaderPairs()) {
+        setRawHeader(header.first, header.second);
+    }
+    static const QNetworkRequest::Attribute attributes[] = {
+        QNetworkRequest::HttpStatusCodeAttribute,
+        QNetworkRequest::HttpReasonPhraseAttribute,
+        QNetworkRequest::RedirectionTargetAttribute,
+        QNetworkRequest::ConnectionEncryptedAttribute,
+        QNetworkRequest::SourceIsFromCacheAttribute,
+        QNetworkRequest::HttpPipeliningWasUsedAttribute
+    };
+    for (size_t i = 0; i < sizeof(attributes) / sizeof(attributes[0]); ++i) {
+        setAttribute(attributes[i], _real->attribute(attributes[i]));
+    }
+}
+
+void ConditionedNetworkReply::slotMetaDataChanged()
+{
+    copyMetaData();
+    if (_decision.reset && _resetAfter < 0) {
+        const qint64 size = header(QNetworkRequest::ContentLengthHeader).toLongLong();
+        _resetAfter = qint64(_decision.resetFraction * size);
+    }
+    emit metaDataChanged();
+}
+
+void ConditionedNetworkReply::slotReadyRead()
+{
+    forever {
+        if (_done || !_pending.isEmpty() || _deliverTimer.isActive() || !_real) {
+            return; // one piece at a time, the rest stays in the real reply
+        }
+        if (readBufferSize() > 0 && _buffer.size() >= readBufferSize()) {
+            return; // readData() continues
+        }
+        if (_real->bytesAvailable() == 0) {
+            if (_realFinished) {
+                finishFromReal();
+            }
+            return;
+        }
+        _pending = _real->read(deliveryPieceSize);
+        const qint64 delay = NetworkConditioner::instance()->reserveDownload(_host, _pending.size());
+        if (delay > 0) {
+            _deliverTimer.start(int(delay));
+            return;
+        }
+        deliverPending();
+    }
+}
+
+void ConditionedNetworkReply::slotDeliver()
+{
+    deliverPending();
+    slotReadyRead();
+}
+
+void ConditionedNetworkReply::deliverPending()
+{
+    if (_done || _pending.isEmpty()) {
+        return;
+    }
+    if (_decision.reset && _resetAfter >= 0 && _delivered + _pending.size() > _resetAfter) {
+        _buffer += _pending.left(int(_resetAfter - _delivered));
+        _pending.clear();
+        injectReset();
+        return;
+    }
+
+    _buffer += _pending;
+    _delivered += _pending.size();
+    _pending.clear();
+    emit readyRead();
+    if (_done) {
+        return; // aborted by a slot
+    }
+    const QVariant size = header(QNetworkRequest::ContentLengthHeader);
+    emit downloadProgress(_delivered, size.isValid() ? size.toLongLong() : -1);
+}
+
+void ConditionedNetworkReply::slotRealFinished()
+{
+    _realFinished = true;
+    slotReadyRead();
+}
+
+void ConditionedNetworkReply::finishFromReal()
+{
+    copyMetaData();
+    if (_decision.reset) {
+        injectReset();
+        return;
+    }
+    setError(_real->error(), _real->errorString());
+    finishReply();
+}
+
+void ConditionedNetworkReply::injectReset()
+{
+    qDebug() << "Network conditions: resetting the connection of" << url().toString() << "after" << _delivered << "bytes";
+    if (_real) {
+        _real->disconnect(this);
+        _real->abort();
+    }
+    setError(RemoteHostClosedError, tr("Connection closed (injected by the network conditions)"));
+    finishReply();
+}
+
+void ConditionedNetworkReply::finishReply()
+{
+    if (_done) {
+        return;
+    }
+    _done = true;
+    _deliverTimer.stop();
+    NetworkConditioner::instance()->finishRequest(_host);
+    setFinished(true);
+    if (error() != NoError) {
+        emit error(error());
+    }
+    emit finished();
+}
+
+void ConditionedNetworkReply::abort()
+{
+    if (_done) {
+        return;
+    }
+    if (_real) {
+        _real->disconnect(this);
+        _real->abort();
+    }
+    _pending.clear();
+    setError(OperationCanceledError, tr("Operation canceled"));
+    finishReply();
+}
+
+qint64 ConditionedNetworkReply::bytesAvailable() const
+{
+    return _buffer.size() + QNetworkReply::bytesAvailable();
+}
+
+void ConditionedNetworkReply::setReadBufferSize(qint64 size)
+{
+    QNetworkReply::setReadBufferSize(size);
+    if (_real) {
+        _real->setReadBufferSize(size);
+    }
+}
+
+void ConditionedNetworkReply::ignoreSslErrors()
+{
+    _ignoreSslErrors = true;
+    if (_real) {
+        _real->ignoreSslErrors();
+    }
+}
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0) && !defined(QT_NO_SSL)
+void ConditionedNetworkReply::sslConfigurationImplementation(QSslConfiguration &configuration) const
+{
+    if (_real) {
+        configuration = _real->sslConfiguration();
+    }
+}
+#endif
+
+qint64 ConditionedNetworkReply::readData(char *data, qint64 maxSize)
+{
+    const qint64 size = qMin(maxSize, qint64(_buffer.size()));
+    if (size == 0) {
+        return _done ? -1 : 0;
+    }
+    memcpy(data, _buffer.constData(), size);
+    _buffer.remove(0, int(size));
+    if (readBufferSize() > 0 && _buffer.size() < readBufferSize()) {
+        // Was stopped by the read buffer limit, not from within the read
+        QMetaObject::invokeMethod(this, "slotReadyRead", Qt::QueuedConnection);
+    }
+    return size;
+}
+
+}
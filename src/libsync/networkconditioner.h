@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef NETWORKCONDITIONER_H
+#define NETWORKCONDITIONER_H
+
+#include "owncloudlib.h"
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QNetworkReply>
+#include <QPointer>
+#include <QString>
+#include <QTimer>
+
+class QNetworkRequest;
+
+namespace OCC {
+
+class AccessManager;
+
+/**
+ * @brief The conditions of a simulated network link
+ */
+struct OWNCLOUDSYNC_EXPORT NetworkConditions
+{
+    NetworkConditions();
+
+    int rtt; // msec added before each request is sent
+    int jitter; // msec, the rtt varies by up to that much in both directions
+    qint64 downloadBandwidth; // bytes per second shared by the requests to a host, 0 for unlimited
+    qint64 uploadBandwidth;
+    double resetProbability; // of a request to lose its connection during the transfer
+    double errorProbability; // of a request to get errorCode instead of reaching the server
+    int errorCode;
+    int stormPeriod; // seconds; at the end of each period, all the requests fail
+    int stormDuration; // with errorCode for that many seconds
+    bool slowStart; // the bandwidth to a host ramps up from ten segments per round trip
+
+    bool isActive() const;
+
+    /**
+     * Parses a comma separated list of conditions, e.g.
+     * "rtt=100,jitter=20,down=1024,up=256,reset=0.01,error=0.05,errorcode=503,storm=60/10,slowstart".
+     * down and up are in KiB/s. Keys it does not know make \a ok false.
+     */
+    static NetworkConditions parse(const QString &spec, bool *ok = 0);
+};
+
+/**
+ * @brief Simulates WAN conditions for the requests of the AccessManager
+ *
+ * Disabled unless the OWNCLOUD_NETWORK_CONDITIONS environment variable is set
+ * or setConditions() is called. The variable holds groups of conditions (see
+ * NetworkConditions::parse) separated by ';'. A group with a "host=name"
+ * entry only applies to that host, the other groups to all the hosts, e.g.
+ * "rtt=50,down=2048;host=slow.example.com,rtt=300,down=128". A "seed=n"
+ * entry makes the random decisions repeat from run to run.
+ *
+ * Then every request of an AccessManager is answered by a
+ * ConditionedNetworkReply that delays the request, paces the bodies and
+ * injects the errors.
+ *
+ * All the methods are thread-safe.
+ */
+class OWNCLOUDSYNC_EXPORT NetworkConditioner
+{
+public:
+    static NetworkConditioner *instance();
+
+    /** Cheap, checked for each request */
+    static bool isEnabled();
+
+    /** An empty host sets the conditions of the hosts without their own */
+    void setConditions(const NetworkConditions &conditions, const QString &host = QString());
+    NetworkConditions conditions(const QString &host) const;
+    /** Back to no conditions at all */
+    void clear();
+    void setSeed(quint32 seed);
+
+    struct Decision {
+        int delay; // msec before the request is sent, or answered with errorCode
+        int errorCode; // 0 unless the request must fail without reaching the server
+        bool reset;
+        double resetFraction; // of the body delivered before the reset
+    };
+
+    /** Decides what happens to a new request, \a uploadSize bytes are sent with it */
+    Decision startRequest(const QString &host, qint64 uploadSize);
+    void finishRequest(const QString &host);
+    /** Msecs from now at which a piece of a body can be delivered */
+    qint64 reserveDownload(const QString &host, qint64 bytes);
+
+private:
+    NetworkConditioner();
+
+    struct HostState {
+        HostState() : uploadFreeAt(0), downloadFreeAt(0), activeRequests(0), lastActivity(-1), rampStart(0) {}
+        qint64 uploadFreeAt; // msec on _clock at which the link is free again
+        qint64 downloadFreeAt;
+        int activeRequests;
+        qint64 lastActivity;
+        qint64 rampStart; // start of the slow start
+    };
+
+    // Must be called with the mutex locked
+    const NetworkConditions &conditionsLocked(const QString &host) const;
+    qint64 rateLocked(const NetworkConditions &conditions, const HostState &state, qint64 bandwidth, qint64 now) const;
+    double randomLocked();
+
+    mutable QMutex _mutex;
+    QHash<QString, NetworkConditions> _conditions; // by host, "" for the others
+    QHash<QString, HostState> _hosts;
+    QElapsedTimer _clock;
+    quint32 _random;
+    QAtomicInt _enabled;
+};
+
+/**
+ * @brief A reply that forwards the reply of the server under the network conditions
+ *
+ * The real request is only sent once the round trip (and the time the upload
+ * takes at the bandwidth) is over. The body of the real reply is then handed
+ * out in pieces at the download bandwidth. The connection resets and the
+ * server errors are injected on the way.
+ *
+ * With Qt4 the reply has no SSL configuration.
+ */
+class ConditionedNetworkReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    ConditionedNetworkReply(AccessManager *am, QNetworkAccessManager::Operation op,
+                            const QNetworkRequest &request, QIODevice *outgoingData);
+    ~ConditionedNetworkReply();
+
+    void abort() Q_DECL_OVERRIDE;
+    bool isSequential() const Q_DECL_OVERRIDE { return true; }
+    qint64 bytesAvailable() const Q_DECL_OVERRIDE;
+    void setReadBufferSize(qint64 size) Q_DECL_OVERRIDE;
+
+public slots:
+    void ignoreSslErrors() Q_DECL_OVERRIDE;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) Q_DECL_OVERRIDE;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0) && !defined(QT_NO_SSL)
+    void sslConfigurationImplementation(QSslConfiguration &configuration) const Q_DECL_OVERRIDE;
+#endif
+
+private slots:
+    void slotStart();
+    void slotInjectError();
+    void slotMetaDataChanged();
+    void slotReadyRead();
+    void slotDeliver();
+    void slotRealFinished();
+
+private:
+    void copyMetaData();
+    void deliverPending();
+    void finishFromReal();
+    void injectReset();
+    void finishReply();
+
+    QPointer<AccessManager> _am;
+    QIODevice *_outgoingData;
+    QPointer<QNetworkReply> _real;
+    QString _host;
+    NetworkConditioner::Decision _decision;
+    bool _ignoreSslErrors;
+    bool _realFinished;
+    bool _done;
+    qint64 _resetAfter; // bytes delivered before the reset, -1 until the size is known
+    qint64 _delivered;
+    QByteArray _buffer; // delivered, can be read
+    QByteArray _pending; // read from the real reply, delivered when _deliverTimer fires
+    QTimer _deliverTimer;
+};
+
+}
+
+#endif // NETWORKCONDITIONER_H
@@ -24,6 +24,7 @@
 #include <QStack>
 #include <QTimer>
 #include <QMutex>
+#include <QThread>
 #include <QDebug>
 #include <QCoreApplication>
 
@@ -32,6 +33,8 @@
 #include "networkjobs.h"
 #include "account.h"
 #include "owncloudpropagator.h"
+#include "synctracer.h"
+#include "syncperformancereport.h"
 
 #include "creds/credentialsfactory.h"
 #include "creds/abstractcredentials.h"
@@ -51,6 +54,7 @@ AbstractNetworkJob::AbstractNetworkJob(AccountPtr account, const QString &path,
     , _account(account)
     , _path(path)
     , _redirectCount(0)
+    , _inFlight(false)
 {
     _timer.setSingleShot(true);
     _timer.setInterval(OwncloudPropagator::httpTimeout() * 1000); // default to 5 minutes.
@@ -190,9 +194,40 @@ void AbstractNetworkJob::slotFinished()
         }
     }
 
-    AbstractCredentials *creds = _account->credentials();
-    if (!creds->stillValid(_reply) && ! _ignoreCredentialFailure) {
-        _account->handleInvalidCredentials();
+    if (SyncTracer::isEnabled()) {
+        QVariantMap args;
+        args.insert(QLatin1String("path"), path());
+        args.insert(QLatin1String("http_status"), _reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt());
+        args.insert(QLatin1String("error"), int(_reply->error()));
+        args.insert(QLatin1String("timed_out"), _timedout);
+        const qint64 end = SyncTracer::now();
+        SyncTracer::instance()->addAsyncSpan("network", SyncTracer::className(this), quintptr(this), end - _durationTimer.nsecsElapsed() / 1000, end, args);
+    }
+
+    if (_inFlight) {
+        _inFlight = false;
+        QByteArray verb;
+        switch (_reply->operation()) {
+        case QNetworkAccessManager::HeadOperation: verb = "HEAD"; break;
+        case QNetworkAccessManager::GetOperation: verb = "GET"; break;
+        case QNetworkAccessManager::PutOperation: verb = "PUT"; break;
+        case QNetworkAccessManager::PostOperation: verb = "POST"; break;
+        case QNetworkAccessManager::DeleteOperation: verb = "DELETE"; break;
+        default:
+            verb = _reply->request().attribute(QNetworkRequest::CustomVerbAttribute).toByteArray();
+        }
+        SyncPerformanceRecorder::instance()->requestFinished(verb, _duration);
+    }
+
+    if (!_ignoreCredentialFailure) {
+        // The credentials belong to the thread of the account, which may replace
+        // and delete them meanwhile: the jobs of the other threads only ask the reply
+        const bool stillValid = QThread::currentThread() == _account->thread()
+                ? _account->credentials()->stillValid(_reply)
+                : !AbstractCredentials::authenticationFailed(_reply);
+        if (!stillValid) {
+            _account->handleInvalidCredentials();
+        }
     }
 
     bool discard = finished();
@@ -213,6 +248,9 @@ QString AbstractNetworkJob::responseTimestamp()
 
 AbstractNetworkJob::~AbstractNetworkJob()
 {
+    if (_inFlight) {
+        SyncPerformanceRecorder::instance()->requestFinished(QByteArray(), 0);
+    }
     if (_reply) {
         _reply->deleteLater();
     }
@@ -223,6 +261,10 @@ void AbstractNetworkJob::start()
     _timer.start();
     _durationTimer.start();
     _duration = 0;
+    if (!_inFlight) {
+        _inFlight = true;
+        SyncPerformanceRecorder::instance()->requestStarted();
+    }
 
     qDebug() << "!!!" << metaObject()->className() << "created for" << account()->url() << "querying" << path();
 }
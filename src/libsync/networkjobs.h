@@ -108,6 +108,7 @@ private:
     QString _path;
     QTimer _timer;
     int _redirectCount;
+    bool _inFlight; // counted by the SyncPerformanceRecorder
 };
 
 /**
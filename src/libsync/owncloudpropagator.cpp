@@ -27,6 +27,7 @@
 #endif
 #include "configfile.h"
 #include "utility.h"
+#include "synctracer.h"
 #include <json.h>
 
 #ifdef Q_OS_WIN
@@ -43,6 +44,9 @@
 
 namespace OCC {
 
+// msec, the progress of the transfers is sent to the GUI thread at most that often
+static const int progressInterval = 100;
+
 /* The maximum number of active job in parallel  */
 int OwncloudPropagator::maximumActiveJob()
 {
@@ -53,6 +57,27 @@ int OwncloudPropagator::maximumActiveJob()
     return max;
 }
 
+static OwncloudPropagator::DownloadDurability readDownloadDurability()
+{
+    QString mode = QString::fromLatin1(qgetenv("OWNCLOUD_DOWNLOAD_DURABILITY"));
+    if (mode.isEmpty()) {
+        ConfigFile cfg;
+        mode = cfg.downloadDurability();
+    }
+    if (mode == QLatin1String("none")) {
+        return OwncloudPropagator::NoDurability;
+    } else if (mode == QLatin1String("file")) {
+        return OwncloudPropagator::FileDurability;
+    }
+    return OwncloudPropagator::BatchedDurability;
+}
+
+OwncloudPropagator::DownloadDurability OwncloudPropagator::downloadDurability()
+{
+    static DownloadDurability durability = readDownloadDurability();
+    return durability;
+}
+
 /** Updates or creates a blacklist entry for the given item.
  *
  * Returns whether the file is in the blacklist now.
@@ -124,6 +149,21 @@ void PropagateItemJob::done(SyncFileItem::Status status, const QString &errorStr
 
     _item._status = status;
 
+    if (SyncTracer::isEnabled()) {
+        // restoration jobs are created and started on the spot
+        const qint64 startedAt = _startedAt ? _startedAt : _queuedAt;
+        QVariantMap args;
+        args.insert(QLatin1String("file"), _item._file);
+        args.insert(QLatin1String("instruction"), int(_item._instruction));
+        args.insert(QLatin1String("direction"), int(_item._direction));
+        args.insert(QLatin1String("size"), _item._size);
+        args.insert(QLatin1String("http_status"), _item._httpErrorCode);
+        args.insert(QLatin1String("status"), int(status));
+        SyncTracer *tracer = SyncTracer::instance();
+        tracer->addAsyncSpan("job", QLatin1String("queued"), quintptr(this), _queuedAt, startedAt);
+        tracer->addAsyncSpan("job", SyncTracer::className(this), quintptr(this), startedAt, SyncTracer::now(), args);
+    }
+
     emit completed(_item);
     emit finished(status);
 }
@@ -328,8 +368,11 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
         _rootJob->append(it);
     }
 
-    connect(_rootJob.data(), SIGNAL(completed(SyncFileItem)), this, SIGNAL(completed(SyncFileItem)));
-    connect(_rootJob.data(), SIGNAL(progress(SyncFileItem,quint64)), this, SIGNAL(progress(SyncFileItem,quint64)));
+    connect(_rootJob.data(), SIGNAL(completed(SyncFileItem)), this, SLOT(slotJobCompleted(SyncFileItem)));
+    connect(_rootJob.data(), SIGNAL(progress(SyncFileItem,quint64)), this, SLOT(slotJobProgress(SyncFileItem,quint64)));
+    _progressTimer.setSingleShot(true);
+    _progressTimer.setInterval(progressInterval);
+    connect(&_progressTimer, SIGNAL(timeout()), this, SLOT(slotEmitProgress()));
     connect(_rootJob.data(), SIGNAL(finished(SyncFileItem::Status)), this, SLOT(emitFinished()));
     connect(_rootJob.data(), SIGNAL(ready()), this, SLOT(scheduleNextJob()), Qt::QueuedConnection);
 
@@ -470,6 +513,31 @@ QString OwncloudPropagator::getFilePath(const QString& tmp_file_name) const
     return _localDir + tmp_file_name;
 }
 
+void OwncloudPropagator::slotJobProgress(const SyncFileItem &item, quint64 bytes)
+{
+    _pendingProgress.insert(item._file, qMakePair(item, bytes));
+    if (!_progressTimer.isActive()) {
+        _progressTimer.start();
+    }
+}
+
+void OwncloudPropagator::slotJobCompleted(const SyncFileItem &item)
+{
+    // The completion supersedes the progress of the item
+    _pendingProgress.remove(item._file);
+    emit completed(item);
+}
+
+void OwncloudPropagator::slotEmitProgress()
+{
+    QHash<QString, QPair<SyncFileItem, quint64> > pending;
+    pending.swap(_pendingProgress);
+    QHash<QString, QPair<SyncFileItem, quint64> >::const_iterator it;
+    for (it = pending.constBegin(); it != pending.constEnd(); ++it) {
+        emit progress(it->first, it->second);
+    }
+}
+
 void OwncloudPropagator::scheduleNextJob()
 {
     if (this->_activeJobs < maximumActiveJob()) {
@@ -510,23 +578,51 @@ AccountPtr OwncloudPropagator::account() const
 PropagatorJob::JobParallelism PropagateDirectory::parallelism()
 {
     // If any of the non-finished sub jobs is not parallel, we have to wait
-
-    // FIXME!  we should probably cache this result
-
-    if (_firstJob && _firstJob->_state != Finished) {
-        if (_firstJob->parallelism() != FullParallelism)
-            return WaitForFinished;
+    if (_blockingSubJobs < 0) {
+        countBlockingSubJobs();
     }
+    return _blocking ? WaitForFinished : FullParallelism;
+}
 
-    // FIXME: use the cached value of finished job
-    for (int i = 0; i < _subJobs.count(); ++i) {
+bool PropagateDirectory::firstJobBlocking() const
+{
+    return _firstJob && _firstJob->_state != Finished && _firstJob->parallelism() != FullParallelism;
+}
+
+void PropagateDirectory::countBlockingSubJobs()
+{
+    _blockingSubJobs = 0;
+    for (int i = _firstUnfinished; i < _subJobs.count(); ++i) {
         if (_subJobs.at(i)->_state != Finished && _subJobs.at(i)->parallelism() != FullParallelism) {
-            return WaitForFinished;
+            _blockingSubJobs++;
         }
     }
-    return FullParallelism;
+    _blocking = _state != Finished && (firstJobBlocking() || _blockingSubJobs > 0);
 }
 
+void PropagateDirectory::invalidateParallelism()
+{
+    // The parents have counted us with the parallelism we had
+    for (PropagateDirectory *dir = this; dir && dir->_blockingSubJobs >= 0; dir = dir->_parentDirectory) {
+        dir->_blockingSubJobs = -1;
+    }
+}
+
+void PropagateDirectory::updateBlocking()
+{
+    if (_blockingSubJobs < 0) {
+        return; // not counted yet, so neither by the parent
+    }
+    const bool blocking = _state != Finished && (firstJobBlocking() || _blockingSubJobs > 0);
+    if (_blocking && !blocking) {
+        // The sub jobs only ever stop blocking, so the parent counted us if it counted
+        if (_parentDirectory && _parentDirectory->_blockingSubJobs > 0) {
+            _parentDirectory->_blockingSubJobs--;
+            _parentDirectory->updateBlocking();
+        }
+    }
+    _blocking = blocking;
+}
 
 bool PropagateDirectory::scheduleNextJob()
 {
@@ -551,9 +647,12 @@ bool PropagateDirectory::scheduleNextJob()
         return false;
     }
 
+    while (_firstUnfinished < _subJobs.count() && _subJobs.at(_firstUnfinished)->_state == Finished) {
+        _firstUnfinished++;
+    }
+
     bool stopAtDirectory = false;
-    // FIXME: use the cached value of finished job
-    for (int i = 0; i < _subJobs.count(); ++i) {
+    for (int i = _firstUnfinished; i < _subJobs.count(); ++i) {
         if (_subJobs.at(i)->_state == Finished) {
             continue;
         }
@@ -585,6 +684,7 @@ void PropagateDirectory::slotSubJobFinished(SyncFileItem::Status status)
             (sender() == _firstJob.data() && status != SyncFileItem::Success && status != SyncFileItem::Restoration)) {
         abort();
         _state = Finished;
+        updateBlocking();
         emit finished(status);
         return;
     } else if (status == SyncFileItem::NormalError || status == SyncFileItem::SoftError) {
@@ -592,6 +692,14 @@ void PropagateDirectory::slotSubJobFinished(SyncFileItem::Status status)
     }
     _runningNow--;
 
+    // The sub directories tell us themselves when they stop blocking
+    PropagatorJob *subJob = qobject_cast<PropagatorJob *>(sender());
+    if (subJob && subJob != _firstJob.data() && !qobject_cast<PropagateDirectory *>(subJob)
+            && _blockingSubJobs > 0 && subJob->parallelism() != FullParallelism) {
+        _blockingSubJobs--;
+    }
+    updateBlocking();
+
     int total = _subJobs.count();
     if (!_firstJob) {
         total--;
@@ -623,11 +731,15 @@ void PropagateDirectory::finalize()
                     _item._fileId = mkdir->_item._fileId;
                 }
             }
+            // Make sure the records of everything inside the directory are in the database
+            // before its etag is, so an interrupted sync does not skip them next time.
+            _propagator->_journal->flush();
             SyncJournalFileRecord record(_item,  _propagator->_localDir + _item._file);
             _propagator->_journal->setFileRecord(record);
         }
     }
     _state = Finished;
+    updateBlocking();
     emit finished(_hasError == SyncFileItem::NoStatus ? SyncFileItem::Success : _hasError);
 }
 
@@ -24,10 +24,13 @@
 #include <QPointer>
 #include <QIODevice>
 #include <QMutex>
+#include <QThreadPool>
 
 #include "syncfileitem.h"
 #include "syncjournaldb.h"
 #include "bandwidthmanager.h"
+#include "disksyncbatch.h"
+#include "synctracer.h"
 #include "accountfwd.h"
 
 struct hbf_transfer_s;
@@ -138,15 +141,23 @@ protected slots:
 private:
     QScopedPointer<PropagateItemJob> _restoreJob;
 
+    // for the SyncTracer: when the job was created and when it was started
+    qint64 _queuedAt;
+    qint64 _startedAt;
+
 public:
     PropagateItemJob(OwncloudPropagator* propagator, const SyncFileItem &item)
-        : PropagatorJob(propagator), _item(item) {}
+        : PropagatorJob(propagator), _queuedAt(SyncTracer::isEnabled() ? SyncTracer::now() : 0),
+          _startedAt(0), _item(item) {}
 
     bool scheduleNextJob() Q_DECL_OVERRIDE {
         if (_state != NotYetStarted) {
             return false;
         }
         _state = Running;
+        if (SyncTracer::isEnabled()) {
+            _startedAt = SyncTracer::now();
+        }
         QMetaObject::invokeMethod(this, "start"); // We could be in a different thread (neon jobs)
         return true;
     }
@@ -179,6 +190,7 @@ public:
     explicit PropagateDirectory(OwncloudPropagator *propagator, const SyncFileItem &item = SyncFileItem())
         : PropagatorJob(propagator)
         , _firstJob(0), _item(item),  _current(-1), _runningNow(0), _hasError(SyncFileItem::NoStatus)
+        , _parentDirectory(0), _firstUnfinished(0), _blockingSubJobs(-1), _blocking(false)
     { }
 
     virtual ~PropagateDirectory() {
@@ -186,7 +198,11 @@ public:
     }
 
     void append(PropagatorJob *subJob) {
+        if (PropagateDirectory *dir = qobject_cast<PropagateDirectory *>(subJob)) {
+            dir->_parentDirectory = this;
+        }
         _subJobs.append(subJob);
+        invalidateParallelism();
     }
 
     virtual bool scheduleNextJob() Q_DECL_OVERRIDE;
@@ -217,6 +233,23 @@ private slots:
     }
 
     void slotSubJobFinished(SyncFileItem::Status status);
+
+private:
+    /*
+     * The parallelism of the directory is kept up to date as the sub jobs finish, instead
+     * of asking all the sub jobs every time. It is computed when first asked for, after
+     * the jobs were appended.
+     */
+    bool firstJobBlocking() const;
+    void countBlockingSubJobs();
+    void invalidateParallelism();
+    // To be called when the directory may have stopped blocking, tells the parent
+    void updateBlocking();
+
+    PropagateDirectory *_parentDirectory;
+    int _firstUnfinished; // index in _subJobs, the jobs before it are finished
+    int _blockingSubJobs; // unfinished sub jobs that are not FullParallelism, -1 until counted
+    bool _blocking; // what parallelism() returns is not FullParallelism, once counted
 };
 
 
@@ -265,16 +298,28 @@ public:
             , _journal(progressDb)
             , _finishedEmited(false)
             , _bandwidthManager(this)
+            , _diskSyncBatch(this)
             , _activeJobs(0)
             , _anotherSyncNeeded(false)
+            , _identicalConflictCount(0)
+            , _identicalConflictStreamedCount(0)
             , _account(account)
-    { }
+    {
+        // moves to the propagation thread with the propagator
+        _progressTimer.setParent(this);
+        // The local jobs count in _activeJobs, so they use at most maximumActiveJob() threads
+        _localJobPool.setMaxThreadCount(maximumActiveJob());
+        // DiskSyncBatch syncs one batch at a time, without waiting for the local jobs
+        _diskSyncPool.setMaxThreadCount(1);
+    }
 
-    void start(const SyncFileItemVector &_syncedItems);
+    /** Invoked queued by the SyncEngine once the propagator is in its thread */
+    Q_INVOKABLE void start(const SyncFileItemVector &_syncedItems);
 
     QAtomicInt _downloadLimit;
     QAtomicInt _uploadLimit;
     BandwidthManager _bandwidthManager;
+    DiskSyncBatch _diskSyncBatch;
 
     QAtomicInt _abortRequested; // boolean set by the main thread to abort.
 
@@ -284,14 +329,28 @@ public:
     /** We detected that another sync is required after this one */
     bool _anotherSyncNeeded;
 
+    /** Number of conflicts for which both sides turned out to have the same content */
+    int _identicalConflictCount;
+    /** Of those, the ones detected while downloading, without reading the files again */
+    int _identicalConflictStreamedCount;
+
     /* The maximum number of active job in parallel  */
     int maximumActiveJob();
 
+    enum DownloadDurability {
+        NoDurability, // the operating system writes the downloaded files when it wants
+        FileDurability, // each file is synced to the disk before it replaces the local one, then its name
+        BatchedDurability // the files are synced in batches, see DiskSyncBatch
+    };
+    /* From OWNCLOUD_DOWNLOAD_DURABILITY, or else the downloadDurability of the config file:
+     * none, file or batched (the default) */
+    DownloadDurability downloadDurability();
+
     bool isInSharedDirectory(const QString& file);
     bool localFileNameClash(const QString& relfile);
     QString getFilePath(const QString& tmp_file_name) const;
 
-    void abort() {
+    Q_INVOKABLE void abort() {
         _abortRequested.fetchAndStoreOrdered(true);
         if (_rootJob) {
             _rootJob->abort();
@@ -316,11 +375,18 @@ public:
 
     AccountPtr account() const;
 
+    /** Runs the filesystem work of the local jobs, see PropagateLocalJob */
+    QThreadPool *localJobPool() { return &_localJobPool; }
+    /** Runs the syncs of DiskSyncBatch */
+    QThreadPool *diskSyncPool() { return &_diskSyncPool; }
+
 
 private slots:
 
     /** Emit the finished signal and make sure it is only emit once */
     void emitFinished() {
+        _progressTimer.stop();
+        _pendingProgress.clear();
         if (!_finishedEmited)
             emit finished();
         _finishedEmited = true;
@@ -328,6 +394,10 @@ private slots:
 
     void scheduleNextJob();
 
+    void slotJobProgress(const SyncFileItem &item, quint64 bytes);
+    void slotJobCompleted(const SyncFileItem &item);
+    void slotEmitProgress();
+
 signals:
     void completed(const SyncFileItem &);
     void progress(const SyncFileItem&, quint64 bytes);
@@ -342,9 +412,20 @@ private:
 
     AccountPtr _account;
 
+    /**
+     * The latest progress of each transfer not emitted yet. The receivers are in
+     * another thread, the progress is only emitted every progressInterval msec.
+     */
+    QHash<QString, QPair<SyncFileItem, quint64> > _pendingProgress;
+    QTimer _progressTimer;
+
     /** Stores the time since a job touched a file. */
     QHash<QString, QElapsedTimer> _touchedFiles;
     mutable QMutex _touchedFilesMutex;
+
+    // Destroyed first: wait for the work of the jobs and of the batch before they are deleted
+    QThreadPool _localJobPool;
+    QThreadPool _diskSyncPool;
 };
 
 // Job that wait for all the poll jobs to be completed
@@ -16,6 +16,7 @@
 #include <QString>
 #include <QDebug>
 #include <QFile>
+#include <QAtomicInt>
 
 #include "ownsql.h"
 #include "utility.h"
@@ -36,6 +37,11 @@ SqlDatabase::SqlDatabase()
 
 }
 
+SqlDatabase::~SqlDatabase()
+{
+    close();
+}
+
 bool SqlDatabase::isOpen()
 {
     return _db != 0;
@@ -85,7 +91,7 @@ bool SqlDatabase::checkDb()
     return true;
 }
 
-bool SqlDatabase::openOrCreateReadWrite( const QString& filename )
+bool SqlDatabase::openOrCreateReadWrite( const QString& filename, bool checkIntegrity )
 {
     if( isOpen() ) {
         return true;
@@ -95,7 +101,7 @@ bool SqlDatabase::openOrCreateReadWrite( const QString& filename )
         return false;
     }
 
-    if( !checkDb() ) {
+    if( checkIntegrity && !checkDb() ) {
         qDebug() << "Consistency check failed, removing broken db" << filename;
         close();
         QFile::remove(filename);
@@ -106,7 +112,7 @@ bool SqlDatabase::openOrCreateReadWrite( const QString& filename )
     return true;
 }
 
-bool SqlDatabase::openReadOnly( const QString& filename )
+bool SqlDatabase::openReadOnly( const QString& filename, bool checkIntegrity )
 {
     if( isOpen() ) {
         return true;
@@ -116,7 +122,7 @@ bool SqlDatabase::openReadOnly( const QString& filename )
         return false;
     }
 
-    if( !checkDb() ) {
+    if( checkIntegrity && !checkDb() ) {
         qDebug() << "Consistency check failed in readonly mode, giving up" << filename;
         close();
         return false;
@@ -223,8 +229,16 @@ bool SqlQuery::isPragma()
     return (!_sql.isEmpty() && _sql.startsWith("PRAGMA", Qt::CaseInsensitive));
 }
 
+static QAtomicInt execCounter;
+
+int SqlQuery::execCount()
+{
+    return execCounter.fetchAndAddRelaxed(0);
+}
+
 bool SqlQuery::exec()
 {
+    execCounter.fetchAndAddRelaxed(1);
     // Don't do anything for selects, that is how we use the lib :-|
     if(_stmt && !isSelect() && !isPragma() ) {
         int rc, n = 0;
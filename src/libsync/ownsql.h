@@ -28,10 +28,12 @@ class OWNCLOUDSYNC_EXPORT SqlDatabase
     Q_DISABLE_COPY(SqlDatabase)
 public:
     explicit SqlDatabase();
+    ~SqlDatabase();
 
     bool isOpen();
-    bool openOrCreateReadWrite( const QString& filename );
-    bool openReadOnly( const QString& filename );
+    /* The quick_check is skipped if checkIntegrity is false */
+    bool openOrCreateReadWrite( const QString& filename, bool checkIntegrity = true );
+    bool openReadOnly( const QString& filename, bool checkIntegrity = true );
     bool transaction();
     bool commit();
     void close();
@@ -75,6 +77,10 @@ public:
     void reset();
     void finish();
 
+    /** Number of statements executed by all the queries of the process,
+     * wraps around. Thread-safe. */
+    static int execCount();
+
 private:
     sqlite3 *_db;
     sqlite3_stmt *_stmt;
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "pathhashset.h"
+
+#include <algorithm>
+
+#include "../../csync/src/std/c_jhash.h"
+
+namespace OCC {
+
+PathHashSet::PathHashSet(const SyncFileItemVector &items)
+    : _items(items), _sorted(true)
+{
+}
+
+void PathHashSet::insert(int index)
+{
+    Entry entry;
+    entry.hash = hash(_items.at(index)._file);
+    entry.index = index;
+    _entries.append(entry);
+    _sorted = false;
+}
+
+void PathHashSet::squeeze()
+{
+    std::sort(_entries.begin(), _entries.end());
+    _entries.squeeze();
+    _sorted = true;
+}
+
+bool PathHashSet::contains(const QString &path) const
+{
+    Q_ASSERT(_sorted);
+    Entry key;
+    key.hash = hash(path);
+    key.index = -1;
+    // The paths only need to be compared when two of them have the same hash
+    for (auto it = std::lower_bound(_entries.constBegin(), _entries.constEnd(), key);
+         it != _entries.constEnd() && it->hash == key.hash; ++it) {
+        if (_items.at(it->index)._file == path) {
+            return true;
+        }
+    }
+    return false;
+}
+
+qint64 PathHashSet::memoryUsage() const
+{
+    return sizeof(PathHashSet) + qint64(_entries.capacity()) * sizeof(Entry);
+}
+
+// Of the UTF-16 data, which saves converting the paths to UTF-8 for the phash of the journal
+quint64 PathHashSet::hash(const QString &path)
+{
+    return c_jhash64((uint8_t *) path.constData(), path.size() * sizeof(QChar), 0);
+}
+
+}
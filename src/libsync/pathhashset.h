@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef PATHHASHSET_H
+#define PATHHASHSET_H
+
+#include "owncloudlib.h"
+#include "syncfileitem.h"
+
+#include <QVector>
+
+namespace OCC {
+
+/**
+ * @brief A set of the paths of some items of a sync, by 64 bit hash
+ *
+ * Only the hash of each path and the index of its item are kept, in a sorted
+ * array: 16 bytes per path, where a QSet<QString> needs a node, a bucket and
+ * often a copy of the path. The paths are read from the items, which must
+ * outlive the set, only to tell the paths apart when their hashes are equal.
+ *
+ * Insert the items, call squeeze(), then look up.
+ */
+class OWNCLOUDSYNC_EXPORT PathHashSet
+{
+public:
+    explicit PathHashSet(const SyncFileItemVector &items);
+
+    /** Adds the path of the item at \a index of the items */
+    void insert(int index);
+    /** Sorts the hashes, before contains() */
+    void squeeze();
+
+    bool contains(const QString &path) const;
+    int count() const { return _entries.count(); }
+    /** Bytes used by the set, not counting the items */
+    qint64 memoryUsage() const;
+
+    static quint64 hash(const QString &path);
+
+private:
+    struct Entry {
+        quint64 hash;
+        int index;
+        bool operator<(const Entry &other) const { return hash < other.hash; }
+    };
+
+    const SyncFileItemVector &_items;
+    QVector<Entry> _entries;
+    bool _sorted;
+};
+
+}
+
+#endif // PATHHASHSET_H
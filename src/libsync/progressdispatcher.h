@@ -39,7 +39,7 @@ namespace Progress
 
 
     struct Info {
-        Info() : _totalFileCount(0), _totalSize(0), _completedFileCount(0), _completedSize(0) {}
+        Info() : _totalFileCount(0), _totalSize(0), _completedFileCount(0), _completedSize(0), _currentItemsCompletedSize(0) {}
 
         // Used during local and remote update phase
         QString _currentDiscoveredFolder;
@@ -111,9 +111,16 @@ namespace Progress
         };
         QHash<QString, ProgressItem> _currentItems;
         SyncFileItem _lastCompletedItem;
+        quint64 _currentItemsCompletedSize; // sum of the _completedSize of the _currentItems that are files
 
         void setProgressComplete(const SyncFileItem &item) {
-            _currentItems.remove(item._file);
+            QHash<QString, ProgressItem>::iterator it = _currentItems.find(item._file);
+            if (it != _currentItems.end()) {
+                if (!it->_item._isDirectory) {
+                    _currentItemsCompletedSize -= it->_completedSize;
+                }
+                _currentItems.erase(it);
+            }
             _completedFileCount += item._affectedItems;
             if (!item._isDirectory) {
                 if (Progress::isSizeDependent(item._instruction)) {
@@ -124,11 +131,18 @@ namespace Progress
             this->updateEstimation();
         }
         void setProgressItem(const SyncFileItem &item, quint64 size) {
-            _currentItems[item._file]._item = item;
-            _currentItems[item._file]._completedSize = size;
-            _lastCompletedItem = SyncFileItem();
+            // Called for every progress callback of every transfer, keep it cheap
+            ProgressItem &progressItem = _currentItems[item._file];
+            progressItem._item = item;
+            if (!item._isDirectory) {
+                _currentItemsCompletedSize += size - progressItem._completedSize;
+            }
+            progressItem._completedSize = size;
+            if (!_lastCompletedItem.isEmpty()) {
+                _lastCompletedItem = SyncFileItem();
+            }
             this->updateEstimation();
-            _currentItems[item._file]._etaEstimate.updateTime(size,item._size);
+            progressItem._etaEstimate.updateTime(size,item._size);
         }
         
         void updateEstimation() {
@@ -140,12 +154,7 @@ namespace Progress
         }
 
         quint64 completedSize() const {
-            quint64 r = _completedSize;
-            foreach(const ProgressItem &i, _currentItems) {
-                if (!i._item._isDirectory)
-                    r += i._completedSize;
-            }
-            return r;
+            return _completedSize + _currentItemsCompletedSize;
         }
         /**
          * Get the total completion estimate structure 
@@ -21,6 +21,8 @@
 #include "utility.h"
 #include "filesystem.h"
 #include "propagatorjobs.h"
+#include "syncperformancereport.h"
+#include "bandwidthscheduler.h"
 #include <json.h>
 #include <QNetworkAccessManager>
 #include <QFileInfo>
@@ -36,9 +38,12 @@ GETFileJob::GETFileJob(AccountPtr account, const QString& path, QFile *device,
 : AbstractNetworkJob(account, path, parent),
   _device(device), _headers(headers), _expectedEtagForResume(expectedEtagForResume)
 , _resumeStart(resumeStart) , _errorStatus(SyncFileItem::NoStatus)
-, _bandwidthLimited(false), _bandwidthChoked(false), _bandwidthQuota(0), _bandwidthManager(0)
+, _bandwidthManager(0), _bandwidthTransfer(0)
 , _hasEmittedFinishedSignal(false), _lastModified()
+, _compareDevice(0), _comparedBytes(0), _compareMismatch(false)
 {
+    _bandwidthTimer.setSingleShot(true);
+    connect(&_bandwidthTimer, SIGNAL(timeout()), this, SLOT(slotReadyRead()));
 }
 
 GETFileJob::GETFileJob(AccountPtr account, const QUrl& url, QFile *device,
@@ -48,9 +53,12 @@ GETFileJob::GETFileJob(AccountPtr account, const QUrl& url, QFile *device,
 : AbstractNetworkJob(account, url.toEncoded(), parent),
   _device(device), _headers(headers), _expectedEtagForResume(expectedEtagForResume)
 , _resumeStart(resumeStart), _errorStatus(SyncFileItem::NoStatus), _directDownloadUrl(url)
-, _bandwidthLimited(false), _bandwidthChoked(false), _bandwidthQuota(0), _bandwidthManager(0)
+, _bandwidthManager(0), _bandwidthTransfer(0)
 , _hasEmittedFinishedSignal(false), _lastModified()
+, _compareDevice(0), _comparedBytes(0), _compareMismatch(false)
 {
+    _bandwidthTimer.setSingleShot(true);
+    connect(&_bandwidthTimer, SIGNAL(timeout()), this, SLOT(slotReadyRead()));
 }
 
 
@@ -76,7 +84,7 @@ void GETFileJob::start() {
     setupConnections(reply());
 
     reply()->setReadBufferSize(16 * 1024); // keep low so we can easier limit the bandwidth
-    qDebug() << Q_FUNC_INFO << _bandwidthManager << _bandwidthChoked << _bandwidthLimited;
+    qDebug() << Q_FUNC_INFO << _bandwidthManager;
     if (_bandwidthManager) {
         _bandwidthManager->registerDownloadJob(this);
     }
@@ -166,60 +174,69 @@ void GETFileJob::slotMetaDataChanged()
     }
 }
 
-void GETFileJob::setBandwidthManager(BandwidthManager *bwm)
-{
-    _bandwidthManager = bwm;
-}
-
-void GETFileJob::setChoked(bool c)
+void GETFileJob::setCompareDevice(QFile *device)
 {
-    _bandwidthChoked = c;
-    QMetaObject::invokeMethod(this, "slotReadyRead", Qt::QueuedConnection);
+    if (_resumeStart != 0) {
+        // We would only see the tail of the file
+        return;
+    }
+    _compareDevice = device;
+    _comparedBytes = 0;
+    _compareMismatch = false;
 }
 
-void GETFileJob::setBandwidthLimited(bool b)
+GETFileJob::CompareResult GETFileJob::compareResult() const
 {
-    _bandwidthLimited = b;
-    QMetaObject::invokeMethod(this, "slotReadyRead", Qt::QueuedConnection);
+    if (!_compareDevice) {
+        return NotCompared;
+    }
+    if (_compareMismatch) {
+        return ContentDiffers;
+    }
+    // Every received byte matched, it is only equal if the local file has nothing more
+    return _comparedBytes == _compareDevice->size() ? ContentEqual : ContentDiffers;
 }
 
-void GETFileJob::giveBandwidthQuota(qint64 q)
+void GETFileJob::setBandwidthManager(BandwidthManager *bwm)
 {
-    _bandwidthQuota = q;
-    qDebug() << Q_FUNC_INFO << "Got" << q << "bytes";
-    QMetaObject::invokeMethod(this, "slotReadyRead", Qt::QueuedConnection);
+    _bandwidthManager = bwm;
 }
 
-qint64 GETFileJob::currentDownloadPosition()
+void GETFileJob::endLimited()
 {
-    if (_device && _device->pos() > 0 && _device->pos() > qint64(_resumeStart)) {
-        return _device->pos();
+    if (_limitedSince.isValid()) {
+        SyncPerformanceRecorder::instance()->addLimitedDuration(false, _limitedSince.elapsed());
+        _limitedSince.invalidate();
     }
-    return _resumeStart;
 }
 
 void GETFileJob::slotReadyRead()
 {
     int bufferSize = qMin(1024*8ll , reply()->bytesAvailable());
     QByteArray buffer(bufferSize, Qt::Uninitialized);
+    QByteArray compareBuffer;
+    if (_compareDevice && !_compareMismatch) {
+        compareBuffer.resize(bufferSize);
+    }
 
     //qDebug() << Q_FUNC_INFO << reply()->bytesAvailable() << reply()->isOpen() << reply()->isFinished();
 
     while(reply()->bytesAvailable() > 0) {
-        if (_bandwidthChoked) {
-            qDebug() << Q_FUNC_INFO << "Download choked";
-            break;
-        }
         qint64 toRead = bufferSize;
-        if (_bandwidthLimited) {
-            toRead = qMin(qint64(bufferSize), _bandwidthQuota);
+        if (_bandwidthTransfer && BandwidthScheduler::instance()->isLimited(BandwidthScheduler::Download)) {
+            int waitMsec = 0;
+            toRead = BandwidthScheduler::instance()->acquire(_bandwidthTransfer,
+                                                             qMin(qint64(bufferSize), reply()->bytesAvailable()),
+                                                             &waitMsec);
             if (toRead == 0) {
-                qDebug() << Q_FUNC_INFO << "Out of quota";
+                if (!_limitedSince.isValid()) {
+                    _limitedSince.start();
+                }
+                _bandwidthTimer.start(waitMsec);
                 break;
             }
-            _bandwidthQuota -= toRead;
-            //qDebug() << Q_FUNC_INFO << "Reading" << toRead << "remaining" << _bandwidthQuota;
         }
+        endLimited();
 
         qint64 r = reply()->read(buffer.data(), toRead);
         if (r < 0) {
@@ -229,6 +246,7 @@ void GETFileJob::slotReadyRead()
             reply()->abort();
             return;
         }
+        SyncPerformanceRecorder::instance()->addTransferredBytes(false, r);
 
         if (_device->isOpen()) {
             qint64 w = _device->write(buffer.constData(), r);
@@ -239,6 +257,16 @@ void GETFileJob::slotReadyRead()
                 reply()->abort();
                 return;
             }
+
+            if (_compareDevice && !_compareMismatch) {
+                qint64 c = _compareDevice->read(compareBuffer.data(), r);
+                if (c != r || memcmp(compareBuffer.constData(), buffer.constData(), r) != 0) {
+                    qDebug() << Q_FUNC_INFO << "Content differs from the local file at offset" << _comparedBytes;
+                    _compareMismatch = true;
+                } else {
+                    _comparedBytes += r;
+                }
+            }
         }
     }
 
@@ -350,6 +378,7 @@ void PropagateDownloadFileQNAM::start()
                               url,
                               &_tmpFile, headers, expectedEtagForResume, startSize);
     }
+    setupConflictCompare();
     _job->setBandwidthManager(&_propagator->_bandwidthManager);
     connect(_job, SIGNAL(finishedSignal()), this, SLOT(slotGetFinished()));
     connect(_job, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(slotDownloadProgress(qint64,qint64)));
@@ -357,6 +386,34 @@ void PropagateDownloadFileQNAM::start()
     _job->start();
 }
 
+/**
+ * For conflicts, let the GETFileJob compare the download with the local file while
+ * the data arrives, so that downloadFinished() does not need to read both files again.
+ */
+void PropagateDownloadFileQNAM::setupConflictCompare()
+{
+    _compareResult = GETFileJob::NotCompared;
+    _conflictCompareFile.close();
+
+    if (_item._instruction != CSYNC_INSTRUCTION_CONFLICT || _job->resumeStart() != 0) {
+        return;
+    }
+
+    const QString fn = _propagator->getFilePath(_item._file);
+    if (FileSystem::getSize(fn) != qint64(_item._size)) {
+        // The sizes differ: it is a real conflict, there is nothing to compare.
+        return;
+    }
+
+    _conflictCompareFile.setFileName(fn);
+    QString error;
+    if (!FileSystem::openFileSharedRead(&_conflictCompareFile, &error)) {
+        qDebug() << Q_FUNC_INFO << "Could not open" << fn << "for comparison:" << error;
+        return;
+    }
+    _job->setCompareDevice(&_conflictCompareFile);
+}
+
 void PropagateDownloadFileQNAM::slotGetFinished()
 {
     _propagator->_activeJobs--;
@@ -364,6 +421,9 @@ void PropagateDownloadFileQNAM::slotGetFinished()
     GETFileJob *job = qobject_cast<GETFileJob *>(sender());
     Q_ASSERT(job);
 
+    _compareResult = job->compareResult();
+    _conflictCompareFile.close();
+
     qDebug() << Q_FUNC_INFO << job->reply()->request().url() << "FINISHED WITH STATUS"
              << job->reply()->error()
              << (job->reply()->error() == QNetworkReply::NoError ? QLatin1String("") : job->reply()->errorString());
@@ -422,8 +482,15 @@ void PropagateDownloadFileQNAM::slotGetFinished()
     _item._requestDuration = job->duration();
     _item._responseTimeStamp = job->responseTimestamp();
 
+    if (_propagator->downloadDurability() == OwncloudPropagator::FileDurability) {
+        QString error;
+        if (!FileSystem::syncFileData(&_tmpFile, &error)) {
+            _tmpFile.close();
+            done(SyncFileItem::SoftError, error);
+            return;
+        }
+    }
     _tmpFile.close();
-    _tmpFile.flush();
 
     /* Check that the size of the GET reply matches the file size. There have been cases
      * reported that if a server breaks behind a proxy, the GET is still a 200 but is
@@ -478,9 +545,23 @@ void PropagateDownloadFileQNAM::downloadFinished()
 
     // In case of conflict, make a backup of the old file
     // Ignore conflicts where both files are binary equal
-    bool isConflict = _item._instruction == CSYNC_INSTRUCTION_CONFLICT
-            && !FileSystem::fileEquals(fn, _tmpFile.fileName());
-    if (isConflict) {
+    _isConflict = false;
+    bool sameContent = false; // the local file already has the downloaded content
+    if (_item._instruction == CSYNC_INSTRUCTION_CONFLICT) {
+        if (_compareResult == GETFileJob::ContentEqual) {
+            // Already compared during the download, and there is no need to replace the file
+            sameContent = true;
+            _propagator->_identicalConflictStreamedCount++;
+        } else if (_compareResult == GETFileJob::ContentDiffers) {
+            _isConflict = true;
+        } else {
+            _isConflict = !FileSystem::fileEquals(fn, _tmpFile.fileName());
+        }
+        if (!_isConflict) {
+            _propagator->_identicalConflictCount++;
+        }
+    }
+    if (_isConflict) {
         QFile f(fn);
         QString conflictFileName = makeConflictFileName(fn, Utility::qDateTimeFromTime_t(_item._modtime));
         if (!f.rename(conflictFileName)) {
@@ -490,31 +571,37 @@ void PropagateDownloadFileQNAM::downloadFinished()
         }
     }
 
-    QFileInfo existingFile(fn);
-    if(existingFile.exists() && existingFile.permissions() != _tmpFile.permissions()) {
-        _tmpFile.setPermissions(existingFile.permissions());
-    }
-
-    FileSystem::setFileHidden(_tmpFile.fileName(), false);
+    if (sameContent) {
+        qDebug() << Q_FUNC_INFO << "Keeping" << fn << "since it has the same content as the server";
+        _tmpFile.remove();
+        _propagator->addTouchedFile(fn);
+    } else {
+        QFileInfo existingFile(fn);
+        if(existingFile.exists() && existingFile.permissions() != _tmpFile.permissions()) {
+            _tmpFile.setPermissions(existingFile.permissions());
+        }
 
-    QString error;
-    _propagator->addTouchedFile(fn);
-    if (!FileSystem::renameReplace(_tmpFile.fileName(), fn, &error)) {
-        qDebug() << Q_FUNC_INFO << QString("Rename failed: %1 => %2").arg(_tmpFile.fileName()).arg(fn);
-        // If we moved away the original file due to a conflict but can't
-        // put the downloaded file in its place, we are in a bad spot:
-        // If we do nothing the next sync run will assume the user deleted
-        // the file!
-        // To avoid that, the file is removed from the metadata table entirely
-        // which makes it look like we're just about to initially download
-        // it.
-        if (isConflict) {
-            _propagator->_journal->deleteFileRecord(fn);
-            _propagator->_journal->commit("download finished");
+        FileSystem::setFileHidden(_tmpFile.fileName(), false);
+
+        QString error;
+        _propagator->addTouchedFile(fn);
+        if (!FileSystem::renameReplace(_tmpFile.fileName(), fn, &error)) {
+            qDebug() << Q_FUNC_INFO << QString("Rename failed: %1 => %2").arg(_tmpFile.fileName()).arg(fn);
+            // If we moved away the original file due to a conflict but can't
+            // put the downloaded file in its place, we are in a bad spot:
+            // If we do nothing the next sync run will assume the user deleted
+            // the file!
+            // To avoid that, the file is removed from the metadata table entirely
+            // which makes it look like we're just about to initially download
+            // it.
+            if (_isConflict) {
+                _propagator->_journal->deleteFileRecord(fn);
+                _propagator->_journal->commit("download finished");
+            }
+            _propagator->_anotherSyncNeeded = true;
+            done(SyncFileItem::SoftError, error);
+            return;
         }
-        _propagator->_anotherSyncNeeded = true;
-        done(SyncFileItem::SoftError, error);
-        return;
     }
 
     // Maybe we downloaded a newer version of the file than we thought we would...
@@ -522,10 +609,45 @@ void PropagateDownloadFileQNAM::downloadFinished()
     FileSystem::setModTime(fn, _item._modtime);
     _item._size = FileSystem::getSize(fn);
 
+    if (_propagator->downloadDurability() == OwncloudPropagator::FileDurability) {
+        // Otherwise a power loss could undo the rename after the journal recorded it,
+        // and the next sync would upload the old file as a local edit
+        QString error;
+        if (!FileSystem::syncFileName(fn, &error)) {
+            _propagator->_anotherSyncNeeded = true;
+            done(SyncFileItem::SoftError, error);
+            return;
+        }
+    }
+
+    if (!sameContent && _propagator->downloadDurability() == OwncloudPropagator::BatchedDurability) {
+        // The journal must not tell the file is synced before it is on the disk.
+        // Meanwhile this job does not count as active.
+        _propagator->_diskSyncBatch.add(fn, this, "slotFileSynced");
+        emit ready();
+        return;
+    }
+    commitDownload();
+}
+
+void PropagateDownloadFileQNAM::slotFileSynced(const QString &error)
+{
+    if (!error.isEmpty()) {
+        // Without a record, the next sync compares the file with the server again
+        _propagator->_anotherSyncNeeded = true;
+        done(SyncFileItem::SoftError, error);
+        return;
+    }
+    commitDownload();
+}
+
+void PropagateDownloadFileQNAM::commitDownload()
+{
+    const QString fn = _propagator->getFilePath(_item._file);
     _propagator->_journal->setFileRecord(SyncJournalFileRecord(_item, fn));
     _propagator->_journal->setDownloadInfo(_item._file, SyncJournalDb::DownloadInfo());
     _propagator->_journal->commit("download file start2");
-    done(isConflict ? SyncFileItem::Conflict : SyncFileItem::Success);
+    done(_isConflict ? SyncFileItem::Conflict : SyncFileItem::Success);
 }
 
 void PropagateDownloadFileQNAM::slotDownloadProgress(qint64 received, qint64)
@@ -31,13 +31,22 @@ class GETFileJob : public AbstractNetworkJob {
     SyncFileItem::Status _errorStatus;
     QUrl _directDownloadUrl;
     QByteArray _etag;
-    bool _bandwidthLimited; // if _bandwidthQuota will be used
-    bool _bandwidthChoked; // if download is paused (won't read on readyRead())
-    qint64 _bandwidthQuota;
     QPointer<BandwidthManager> _bandwidthManager;
+    int _bandwidthTransfer; // in the BandwidthScheduler, 0 when not registered
+    QTimer _bandwidthTimer; // to read again once the scheduler has tokens for us
+    QElapsedTimer _limitedSince; // valid while the reading is held back by the bandwidth limit
+    void endLimited();
     bool _hasEmittedFinishedSignal;
     time_t _lastModified;
+    QFile* _compareDevice; // local file the body is compared against, or 0
+    qint64 _comparedBytes;
+    bool _compareMismatch;
 public:
+    enum CompareResult {
+        NotCompared,
+        ContentEqual,
+        ContentDiffers
+    };
 
     // DOES NOT take owncership of the device.
     explicit GETFileJob(AccountPtr account, const QString& path, QFile *device,
@@ -51,6 +60,7 @@ public:
         if (_bandwidthManager) {
             _bandwidthManager->unregisterDownloadJob(this);
         }
+        endLimited();
     }
 
     virtual void start() Q_DECL_OVERRIDE;
@@ -71,11 +81,17 @@ public:
         }
     }
 
+    /**
+     * Compare the body against \a device while it is downloaded.
+     *
+     * Used for conflicts: once the download is finished, compareResult() tells
+     * whether the remote content equals the local file without reading both files again.
+     * DOES NOT take ownership of the device. Only used when the download starts at offset 0.
+     */
+    void setCompareDevice(QFile *device);
+    CompareResult compareResult() const;
+
     void setBandwidthManager(BandwidthManager *bwm);
-    void setChoked(bool c);
-    void setBandwidthLimited(bool b);
-    void giveBandwidthQuota(qint64 q);
-    qint64 currentDownloadPosition();
 
     QString errorString() {
         return _errorString.isEmpty() ? reply()->errorString() : _errorString;
@@ -96,6 +112,8 @@ signals:
 private slots:
     void slotReadyRead();
     void slotMetaDataChanged();
+private:
+    friend class BandwidthManager;
 };
 
 
@@ -105,14 +123,22 @@ class PropagateDownloadFileQNAM : public PropagateItemJob {
 
 //  QFile *_file;
     QFile _tmpFile;
+    QFile _conflictCompareFile; // the local file, compared against the download for conflicts
+    GETFileJob::CompareResult _compareResult;
+    bool _isConflict; // the local file was moved away
 public:
     PropagateDownloadFileQNAM(OwncloudPropagator* propagator,const SyncFileItem& item)
-        : PropagateItemJob(propagator, item) {}
+        : PropagateItemJob(propagator, item), _compareResult(GETFileJob::NotCompared), _isConflict(false) {}
     void start() Q_DECL_OVERRIDE;
+private:
+    void setupConflictCompare();
+    // Writes the journal records of the downloaded file
+    void commitDownload();
 private slots:
     void slotGetFinished();
     void abort() Q_DECL_OVERRIDE;
     void downloadFinished();
+    void slotFileSynced(const QString &error);
     void slotDownloadProgress(qint64,qint64);
 };
 
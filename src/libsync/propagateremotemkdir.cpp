@@ -33,6 +33,12 @@ void PropagateRemoteMkdir::start()
     connect(_job, SIGNAL(finished(QNetworkReply::NetworkError)), this, SLOT(slotMkcolJobFinished()));
     _propagator->_activeJobs++;
     _job->start();
+
+    if (_propagator->_activeJobs < _propagator->maximumActiveJob()) {
+        // The MKCOL of the sibling directories can be sent meanwhile, the content
+        // of this one only waits for this one.
+        emit ready();
+    }
 }
 
 void PropagateRemoteMkdir::abort()
@@ -21,6 +21,8 @@
 #include "utility.h"
 #include "filesystem.h"
 #include "propagatorjobs.h"
+#include "syncperformancereport.h"
+#include "bandwidthscheduler.h"
 #include <json.h>
 #include <QNetworkAccessManager>
 #include <QFileInfo>
@@ -194,10 +196,10 @@ void PropagateUploadFileQNAM::start()
 UploadDevice::UploadDevice(BandwidthManager *bwm)
     : _read(0),
       _bandwidthManager(bwm),
-      _bandwidthQuota(0),
-      _readWithProgress(0),
-      _bandwidthLimited(false), _choked(false)
+      _bandwidthTransfer(0)
 {
+    _bandwidthTimer.setSingleShot(true);
+    connect(&_bandwidthTimer, SIGNAL(timeout()), this, SLOT(slotBandwidthTimeout()));
     _bandwidthManager->registerUploadDevice(this);
 }
 
@@ -206,6 +208,7 @@ UploadDevice::~UploadDevice() {
     if (_bandwidthManager) {
         _bandwidthManager->unregisterUploadDevice(this);
     }
+    endLimited();
 }
 
 bool UploadDevice::prepareAndOpen(const QString& fileName, qint64 start, qint64 size)
@@ -254,29 +257,39 @@ qint64 UploadDevice::readData(char* data, qint64 maxlen) {
     if (maxlen == 0) {
         return 0;
     }
-    if (isChoked()) {
-        return 0;
-    }
-    if (isBandwidthLimited()) {
-        maxlen = qMin(maxlen, _bandwidthQuota);
-        if (maxlen <= 0) {  // no quota
-            qDebug() << "no quota";
+    if (_bandwidthTransfer && BandwidthScheduler::instance()->isLimited(BandwidthScheduler::Upload)) {
+        int waitMsec = 0;
+        maxlen = BandwidthScheduler::instance()->acquire(_bandwidthTransfer, maxlen, &waitMsec);
+        if (maxlen == 0) {
+            if (!_limitedSince.isValid()) {
+                _limitedSince.start();
+            }
+            // QNAM may read from its HTTP thread, the timer lives in ours
+            QMetaObject::invokeMethod(&_bandwidthTimer, "start", Qt::QueuedConnection, Q_ARG(int, waitMsec));
             return 0;
         }
-        _bandwidthQuota -= maxlen;
     }
+    endLimited();
     std::memcpy(data, _data.data()+_read, maxlen);
     _read += maxlen;
+    // counted again when QNAM sends the request again
+    SyncPerformanceRecorder::instance()->addTransferredBytes(true, maxlen);
     return maxlen;
 }
 
-void UploadDevice::slotJobUploadProgress(qint64 sent, qint64 t)
+void UploadDevice::endLimited()
 {
-    //qDebug() << Q_FUNC_INFO << sent << _read << t << _size << _bandwidthQuota;
-    if (sent == 0 || t == 0) {
-        return;
+    if (_limitedSince.isValid()) {
+        SyncPerformanceRecorder::instance()->addLimitedDuration(true, _limitedSince.elapsed());
+        _limitedSince.invalidate();
+    }
+}
+
+void UploadDevice::slotBandwidthTimeout()
+{
+    if (!atEnd()) {
+        emit readyRead(); // tell QNAM that we may have tokens
     }
-    _readWithProgress = sent;
 }
 
 bool UploadDevice::atEnd() const {
@@ -311,25 +324,6 @@ bool UploadDevice::seek ( qint64 pos ) {
     return true;
 }
 
-void UploadDevice::giveBandwidthQuota(qint64 bwq) {
-    if (!atEnd()) {
-        _bandwidthQuota = bwq;
-        QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection); // tell QNAM that we have quota
-    }
-}
-
-void UploadDevice::setBandwidthLimited(bool b) {
-    _bandwidthLimited = b;
-    QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
-}
-
-void UploadDevice::setChoked(bool b) {
-    _choked = b;
-    if (!_choked) {
-        QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
-    }
-}
-
 void PropagateUploadFileQNAM::startNextChunk()
 {
     if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
@@ -391,7 +385,6 @@ void PropagateUploadFileQNAM::startNextChunk()
     _jobs.append(job);
     connect(job, SIGNAL(finishedSignal()), this, SLOT(slotPutFinished()));
     connect(job, SIGNAL(uploadProgress(qint64,qint64)), this, SLOT(slotUploadProgress(qint64,qint64)));
-    connect(job, SIGNAL(uploadProgress(qint64,qint64)), device, SLOT(slotJobUploadProgress(qint64,qint64)));
     connect(job, SIGNAL(destroyed(QObject*)), this, SLOT(slotJobDestroyed(QObject*)));
     job->start();
     _propagator->_activeJobs++;
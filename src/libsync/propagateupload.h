@@ -40,11 +40,8 @@ public:
     bool isSequential() const Q_DECL_OVERRIDE;
     bool seek ( qint64 pos ) Q_DECL_OVERRIDE;
 
-    void setBandwidthLimited(bool);
-    bool isBandwidthLimited() { return _bandwidthLimited; }
-    void setChoked(bool);
-    bool isChoked() { return _choked; }
-    void giveBandwidthQuota(qint64 bwq);
+private slots:
+    void slotBandwidthTimeout();
 private:
 
     // The file data
@@ -54,13 +51,11 @@ private:
 
     // Bandwidth manager related
     QPointer<BandwidthManager> _bandwidthManager;
-    qint64 _bandwidthQuota;
-    qint64 _readWithProgress;
-    bool _bandwidthLimited; // if _bandwidthQuota will be used
-    bool _choked; // if upload is paused (readData() will return 0)
+    int _bandwidthTransfer; // in the BandwidthScheduler, 0 when not registered
+    QTimer _bandwidthTimer; // to read again once the scheduler has tokens for us
+    QElapsedTimer _limitedSince; // valid while readData() is held back by the bandwidth limit
+    void endLimited();
     friend class BandwidthManager;
-protected slots:
-    void slotJobUploadProgress(qint64 sent, qint64 t);
 };
 
 class PUTFileJob : public AbstractNetworkJob {
@@ -32,12 +32,83 @@
 #include <QDateTime>
 #include <qstack.h>
 #include <QCoreApplication>
+#include <QRunnable>
 
 #include <time.h>
 
+#ifndef Q_OS_WIN
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 
 namespace OCC {
 
+#ifndef Q_OS_WIN
+bool isDirectoryEntry(int dirFd, const char *name, unsigned char type)
+{
+    if (type != DT_UNKNOWN) {
+        return type == DT_DIR;
+    }
+    // Some filesystems do not fill d_type
+    struct stat st;
+    return fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Removes the directory \a name of the directory open as \a parentFd, and what it contains.
+// Works with the file descriptors of the directories, so that no path is resolved again.
+static bool removeDirectoryAt(int parentFd, const QByteArray &name, const QString &path, QString &error)
+{
+    const int fd = openat(parentFd, name.constData(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR *dir = fd < 0 ? 0 : fdopendir(fd);
+    if (!dir) {
+        error += PropagateLocalRemove::tr("Could not remove directory '%1';")
+            .arg(QDir::toNativeSeparators(path)) + " ";
+        qDebug() << "Error opening directory" << path << ':' << qt_error_string(errno);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    bool success = true;
+    while (struct dirent *entry = readdir(dir)) {
+        const char *entryName = entry->d_name;
+        if (qstrcmp(entryName, ".") == 0 || qstrcmp(entryName, "..") == 0) {
+            continue;
+        }
+        const QString entryPath = path + QLatin1Char('/') + QFile::decodeName(entryName);
+        if (isDirectoryEntry(fd, entryName, entry->d_type)) {
+            if (!removeDirectoryAt(fd, QByteArray(entryName), entryPath, error)) {
+                success = false;
+            }
+        } else if (unlinkat(fd, entryName, 0) != 0) {
+            const QString errorString = qt_error_string(errno);
+            error += PropagateLocalRemove::tr("Error removing '%1': %2;").
+                arg(QDir::toNativeSeparators(entryPath), errorString) + " ";
+            qDebug() << "Error removing " << entryPath << ':' << errorString;
+            success = false;
+        }
+    }
+    closedir(dir); // closes fd
+
+    if (success && unlinkat(parentFd, name.constData(), AT_REMOVEDIR) != 0) {
+        error += PropagateLocalRemove::tr("Could not remove directory '%1';")
+            .arg(QDir::toNativeSeparators(path)) + " ";
+        qDebug() << "Error removing directory" << path << ':' << qt_error_string(errno);
+        success = false;
+    }
+    return success;
+}
+
+static bool removeRecursively(const QString &path, QString &error)
+{
+    return removeDirectoryAt(AT_FDCWD, QFile::encodeName(path), path, error);
+}
+#else
 // Code copied from Qt5's QDir::removeRecursively
 // (and modified to report the error)
 static bool removeRecursively(const QString &path, QString &error)
@@ -74,6 +145,37 @@ static bool removeRecursively(const QString &path, QString &error)
     }
     return success;
 }
+#endif
+
+/* Runs the local work of a job in the pool, and posts the result back to the job */
+class LocalWorkRunnable : public QRunnable
+{
+public:
+    explicit LocalWorkRunnable(PropagateLocalJob *job) : _job(job) {}
+    void run() Q_DECL_OVERRIDE {
+        // The pool is waited for before the jobs are deleted
+        const QString error = _job->localWork();
+        QMetaObject::invokeMethod(_job, "slotLocalWorkDone", Qt::QueuedConnection, Q_ARG(QString, error));
+    }
+private:
+    PropagateLocalJob *_job;
+};
+
+void PropagateLocalJob::runLocalWork()
+{
+    _propagator->_activeJobs++;
+    _propagator->localJobPool()->start(new LocalWorkRunnable(this));
+    if (_propagator->_activeJobs < _propagator->maximumActiveJob()) {
+        // The next jobs can start while we wait
+        emit ready();
+    }
+}
+
+void PropagateLocalJob::slotLocalWorkDone(const QString &error)
+{
+    _propagator->_activeJobs--;
+    localWorkDone(error);
+}
 
 void PropagateLocalRemove::start()
 {
@@ -87,19 +189,32 @@ void PropagateLocalRemove::start()
         return;
     }
 
+    runLocalWork();
+}
+
+QString PropagateLocalRemove::localWork()
+{
+    QString filename = _propagator->_localDir +  _item._file;
     if (_item._isDirectory) {
         QString error;
         if (QDir(filename).exists() && !removeRecursively(filename, error)) {
-            done(SyncFileItem::NormalError, error);
-            return;
+            return error;
         }
     } else {
         QFile file(filename);
         if (file.exists() && !file.remove()) {
-            done(SyncFileItem::NormalError, file.errorString());
-            return;
+            return file.errorString();
         }
     }
+    return QString();
+}
+
+void PropagateLocalRemove::localWorkDone(const QString &error)
+{
+    if (!error.isEmpty()) {
+        done(SyncFileItem::NormalError, error);
+        return;
+    }
     emit progress(_item, 0);
     _propagator->_journal->deleteFileRecord(_item._originalFile, _item._isDirectory);
     _propagator->_journal->commit("Local remove");
@@ -118,9 +233,22 @@ void PropagateLocalMkdir::start()
         done( SyncFileItem::NormalError, tr("Attention, possible case sensitivity clash with %1").arg(newDirStr) );
         return;
     }
+    runLocalWork();
+}
+
+QString PropagateLocalMkdir::localWork()
+{
     QDir localDir(_propagator->_localDir);
     if (!localDir.mkpath(_item._file)) {
-        done( SyncFileItem::NormalError, tr("could not create directory %1").arg(newDirStr) );
+        return tr("could not create directory %1").arg(QDir::toNativeSeparators(localDir.filePath(_item._file)));
+    }
+    return QString();
+}
+
+void PropagateLocalMkdir::localWorkDone(const QString &error)
+{
+    if (!error.isEmpty()) {
+        done( SyncFileItem::NormalError, error );
         return;
     }
     done(SyncFileItem::Success);
@@ -154,13 +282,29 @@ void PropagateLocalRename::start()
 
         _propagator->addTouchedFile(existingFile);
         _propagator->addTouchedFile(targetFile);
-        QFile file(existingFile);
-        if (!file.rename(targetFile)) {
-            done(SyncFileItem::NormalError, file.errorString());
-            return;
-        }
+        runLocalWork();
+        return;
+    }
+    localWorkDone(QString());
+}
+
+QString PropagateLocalRename::localWork()
+{
+    QFile file(_propagator->getFilePath(_item._file));
+    if (!file.rename(_propagator->getFilePath(_item._renameTarget))) {
+        return file.errorString();
+    }
+    return QString();
+}
+
+void PropagateLocalRename::localWorkDone(const QString &error)
+{
+    if (!error.isEmpty()) {
+        done(SyncFileItem::NormalError, error);
+        return;
     }
 
+    QString targetFile = _propagator->getFilePath(_item._renameTarget);
     _propagator->_journal->deleteFileRecord(_item._originalFile);
 
     // store the rename file name in the item.
@@ -21,25 +21,68 @@
 
 namespace OCC {
 
-class PropagateLocalRemove : public PropagateItemJob {
+#ifndef Q_OS_WIN
+/**
+ * Whether the entry \a name of the directory open as \a dirFd is a directory.
+ * \a type is the d_type of its dirent; when it is DT_UNKNOWN, the entry is
+ * looked up. Symlinks are not followed.
+ */
+bool isDirectoryEntry(int dirFd, const char *name, unsigned char type);
+#endif
+
+/**
+ * @brief A job whose filesystem work runs in the local job pool of the propagator
+ *
+ * start() does the checks, then calls runLocalWork(). localWork() runs in a
+ * thread of the pool, so that large removals don't hold up the network jobs,
+ * and several local jobs can run at the same time. localWorkDone() is then
+ * called in the propagation thread with the error of localWork(), if any.
+ */
+class PropagateLocalJob : public PropagateItemJob {
+    Q_OBJECT
+public:
+    PropagateLocalJob (OwncloudPropagator* propagator,const SyncFileItem& item)  : PropagateItemJob(propagator, item) {}
+
+protected:
+    void runLocalWork();
+    /** Called in a thread of the pool. Returns the error message, empty on success */
+    virtual QString localWork() = 0;
+    virtual void localWorkDone(const QString &error) = 0;
+
+private slots:
+    void slotLocalWorkDone(const QString &error);
+
+private:
+    friend class LocalWorkRunnable;
+};
+
+class PropagateLocalRemove : public PropagateLocalJob {
     Q_OBJECT
 public:
-    PropagateLocalRemove (OwncloudPropagator* propagator,const SyncFileItem& item)  : PropagateItemJob(propagator, item) {}
+    PropagateLocalRemove (OwncloudPropagator* propagator,const SyncFileItem& item)  : PropagateLocalJob(propagator, item) {}
     void start() Q_DECL_OVERRIDE;
+protected:
+    QString localWork() Q_DECL_OVERRIDE;
+    void localWorkDone(const QString &error) Q_DECL_OVERRIDE;
 };
-class PropagateLocalMkdir : public PropagateItemJob {
+class PropagateLocalMkdir : public PropagateLocalJob {
     Q_OBJECT
 public:
-    PropagateLocalMkdir (OwncloudPropagator* propagator,const SyncFileItem& item)  : PropagateItemJob(propagator, item) {}
+    PropagateLocalMkdir (OwncloudPropagator* propagator,const SyncFileItem& item)  : PropagateLocalJob(propagator, item) {}
     void start() Q_DECL_OVERRIDE;
-
+protected:
+    QString localWork() Q_DECL_OVERRIDE;
+    void localWorkDone(const QString &error) Q_DECL_OVERRIDE;
 };
-class PropagateLocalRename : public PropagateItemJob {
+class PropagateLocalRename : public PropagateLocalJob {
     Q_OBJECT
 public:
-    PropagateLocalRename (OwncloudPropagator* propagator,const SyncFileItem& item)  : PropagateItemJob(propagator, item) {}
+    PropagateLocalRename (OwncloudPropagator* propagator,const SyncFileItem& item)  : PropagateLocalJob(propagator, item) {}
     void start() Q_DECL_OVERRIDE;
     JobParallelism parallelism() Q_DECL_OVERRIDE { return WaitForFinishedInParentDirectory; }
+protected:
+    QString localWork() Q_DECL_OVERRIDE;
+    void localWorkDone(const QString &error) Q_DECL_OVERRIDE;
 };
 
 
@@ -17,12 +17,16 @@
 #include "account.h"
 #include "theme.h"
 #include "owncloudpropagator.h"
+#include "bandwidthscheduler.h"
 #include "syncjournaldb.h"
 #include "syncjournalfilerecord.h"
+#include "pathhashset.h"
 #include "discoveryphase.h"
 #include "creds/abstractcredentials.h"
 #include "csync_util.h"
 #include "syncfilestatus.h"
+#include "synctracer.h"
+#include "ownsql.h"
 #include "csync_private.h"
 
 #ifdef Q_OS_WIN
@@ -52,6 +56,9 @@ namespace OCC {
 
 bool SyncEngine::_syncRunning = false;
 
+// msec, the byte progress of the transfers is published at most that often (4 Hz)
+static const qint64 progressPublishInterval = 250;
+
 SyncEngine::SyncEngine(AccountPtr account, CSYNC *ctx, const QString& localPath,
                        const QString& remoteURL, const QString& remotePath, OCC::SyncJournalDb* journal)
   : _account(account)
@@ -61,22 +68,43 @@ SyncEngine::SyncEngine(AccountPtr account, CSYNC *ctx, const QString& localPath,
   , _remoteUrl(remoteURL)
   , _remotePath(remotePath)
   , _journal(journal)
+  , _csyncDb(0)
   , _hasNoneFiles(false)
   , _hasRemoveFile(false)
   , _uploadLimit(0)
   , _downloadLimit(0)
   , _anotherSyncNeeded(false)
+  , _identicalConflictCount(0)
+  , _identicalConflictStreamedCount(0)
+  , _phaseTraceStart(0)
+  , _journalQueriesAtStart(0)
 {
     qRegisterMetaType<SyncFileItem>("SyncFileItem");
     qRegisterMetaType<SyncFileItem::Status>("SyncFileItem::Status");
     qRegisterMetaType<Progress::Info>("Progress::Info");
+    qRegisterMetaType<SyncFileItemVector>("SyncFileItemVector");
+
+    _progressTimer.setSingleShot(true);
+    connect(&_progressTimer, SIGNAL(timeout()), this, SLOT(slotPublishProgress()));
 
     _thread.setObjectName("CSync_Neon_Thread");
     _thread.start();
+    _propagationThread.setObjectName("Sync_Propagation_Thread");
+    _propagationThread.start();
 }
 
 SyncEngine::~SyncEngine()
 {
+    // The propagation thread may be waiting for this thread, for SSL errors:
+    // abort its jobs and let it go on before waiting for it
+    if (_propagator) {
+        _propagator->_abortRequested.fetchAndStoreOrdered(true);
+        QMetaObject::invokeMethod(_propagator.data(), "abort", Qt::QueuedConnection);
+    }
+    _propagator.clear();
+    _account->releaseThreadNetworkAccessManager(&_propagationThread);
+    _propagationThread.quit();
+    _propagationThread.wait();
     _thread.quit();
     _thread.wait();
 }
@@ -219,21 +247,32 @@ bool SyncEngine::checkErrorBlacklisting( SyncFileItem *item )
     return true;
 }
 
-void SyncEngine::deleteStaleDownloadInfos()
+void SyncEngine::deleteStaleJournalEntries()
 {
-    // Find all downloadinfo paths that we want to preserve.
-    QSet<QString> download_file_paths;
-    foreach(const SyncFileItem& it, _syncedItems) {
-        if (it._direction == SyncFileItem::Down
-                && it._type == SyncFileItem::File)
-        {
-            download_file_paths.insert(it._file);
+    // Find the entries that we want to preserve: those of the files of this sync,
+    // including the ones written during the propagation. By hash, the paths are
+    // those of the items.
+    PathHashSet download_file_paths(_syncedItems);
+    PathHashSet upload_file_paths(_syncedItems);
+    PathHashSet blacklist_file_paths(_syncedItems);
+    for (int i = 0; i < _syncedItems.count(); ++i) {
+        const SyncFileItem &it = _syncedItems.at(i);
+        blacklist_file_paths.insert(i);
+        if (it._type == SyncFileItem::File) {
+            if (it._direction == SyncFileItem::Down) {
+                download_file_paths.insert(i);
+            } else if (it._direction == SyncFileItem::Up) {
+                upload_file_paths.insert(i);
+            }
         }
     }
+    download_file_paths.squeeze();
+    upload_file_paths.squeeze();
+    blacklist_file_paths.squeeze();
 
-    // Delete from journal and from filesystem.
+    // Delete from journal and the temporary files from filesystem.
     const QVector<SyncJournalDb::DownloadInfo> deleted_infos =
-            _journal->getAndDeleteStaleDownloadInfos(download_file_paths);
+            _journal->deleteStaleEntries(download_file_paths, upload_file_paths, blacklist_file_paths);
     foreach (const SyncJournalDb::DownloadInfo & deleted_info, deleted_infos) {
         const QString tmppath = _propagator->getFilePath(deleted_info._tmpfile);
         qDebug() << "Deleting stale temporary file: " << tmppath;
@@ -241,35 +280,6 @@ void SyncEngine::deleteStaleDownloadInfos()
     }
 }
 
-void SyncEngine::deleteStaleUploadInfos()
-{
-    // Find all blacklisted paths that we want to preserve.
-    QSet<QString> upload_file_paths;
-    foreach(const SyncFileItem& it, _syncedItems) {
-        if (it._direction == SyncFileItem::Up
-                && it._type == SyncFileItem::File)
-        {
-            upload_file_paths.insert(it._file);
-        }
-    }
-
-    // Delete from journal.
-    _journal->deleteStaleUploadInfos(upload_file_paths);
-}
-
-void SyncEngine::deleteStaleErrorBlacklistEntries()
-{
-    // Find all blacklisted paths that we want to preserve.
-    QSet<QString> blacklist_file_paths;
-    foreach(const SyncFileItem& it, _syncedItems) {
-        if (it._hasBlacklistEntry)
-            blacklist_file_paths.insert(it._file);
-    }
-
-    // Delete from journal.
-    _journal->deleteStaleErrorBlacklistEntries(blacklist_file_paths);
-}
-
 int SyncEngine::treewalkLocal( TREE_WALK_FILE* file, void *data )
 {
     return static_cast<SyncEngine*>(data)->treewalkFile( file, false );
@@ -280,24 +290,50 @@ int SyncEngine::treewalkRemote( TREE_WALK_FILE* file, void *data )
     return static_cast<SyncEngine*>(data)->treewalkFile( file, true );
 }
 
+// Sets \a out to the UTF-8 \a path, returns false if it is not valid UTF-8
+static bool pathFromUtf8(const char *path, QString *out)
+{
+    // Most paths are plain ASCII, they need no decoder
+    const char *end = path;
+    while (*end && uchar(*end) < 0x80) {
+        ++end;
+    }
+    if (!*end) {
+        *out = QString::fromLatin1(path, end - path);
+        return true;
+    }
+
+    static QTextCodec *codec = QTextCodec::codecForName("UTF-8");
+    Q_ASSERT(codec);
+    QTextCodec::ConverterState utf8State;
+    *out = codec->toUnicode(path, qstrlen(path), &utf8State);
+    return utf8State.invalidChars == 0 && utf8State.remainingChars == 0;
+}
+
 int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
 {
     if( ! file ) return -1;
 
-    QTextCodec::ConverterState utf8State;
-    QTextCodec *codec = QTextCodec::codecForName("UTF-8");
-    Q_ASSERT(codec);
-    QString fileUtf8 = codec->toUnicode(file->path, qstrlen(file->path), &utf8State);
+    if (remote) {
+        _performanceReport.remoteFiles++;
+    } else {
+        _performanceReport.localFiles++;
+    }
+
+    QString fileUtf8;
     QString renameTarget;
+    bool validUtf8 = pathFromUtf8(file->path, &fileUtf8);
     QString key = fileUtf8;
 
     auto instruction = file->instruction;
-    if (utf8State.invalidChars > 0 || utf8State.remainingChars > 0) {
+    if (!validUtf8) {
         qWarning() << "File ignored because of invalid utf-8 sequence: " << file->path;
         instruction = CSYNC_INSTRUCTION_IGNORE;
     } else {
-        renameTarget = codec->toUnicode(file->rename_path, qstrlen(file->rename_path), &utf8State);
-        if (utf8State.invalidChars > 0 || utf8State.remainingChars > 0) {
+        if (file->rename_path && file->rename_path[0]) {
+            validUtf8 = pathFromUtf8(file->rename_path, &renameTarget);
+        }
+        if (!validUtf8) {
             qWarning() << "File ignored because of invalid utf-8 sequence in the rename_path: " << file->path << file->rename_path;
             instruction = CSYNC_INSTRUCTION_IGNORE;
         }
@@ -307,7 +343,13 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
     }
 
     // Gets a default-contructed SyncFileItem or the one from the first walk (=local walk)
-    SyncFileItem item = _syncItemMap.value(key);
+    const int index = _syncItemIndex.value(key, -1);
+    SyncFileItem item;
+    if (index >= 0) {
+        item = _syncedItems.at(index);
+    }
+    // Each path is decoded once per item: _file, _originalFile and the key of
+    // _syncItemIndex share its data, and the second walk keeps the one of the first
     if (item._file.isEmpty() || instruction == CSYNC_INSTRUCTION_RENAME) {
         item._file = fileUtf8;
     }
@@ -339,11 +381,11 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
     }
     item._should_update_etag = item._should_update_etag || file->should_update_etag;
 
-    // record the seen files to be able to clean the journal later
-    _seenFiles.insert(item._file);
+    // confirm the seen files so the journal cleanup keeps them
+    _journal->confirmFileRecord(item._file);
     if (!renameTarget.isEmpty()) {
-        // Yes, this record both the rename renameTarget and the original so we keep both in case of a rename
-        _seenFiles.insert(renameTarget);
+        // Yes, this confirms both the rename renameTarget and the original so we keep both in case of a rename
+        _journal->confirmFileRecord(renameTarget);
     }
 
     if (remote && file->remotePerm && file->remotePerm[0]) {
@@ -371,13 +413,15 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
     case CSYNC_STATUS_SERVICE_UNAVAILABLE:
         item._errorString = QLatin1String("Directory temporarily not available on server.");
         item._status = SyncFileItem::SoftError;
+        // Its content was not discovered, the journal must keep it
+        _incompleteDiscoveryDirs.insert(item._file);
         break;
     default:
         Q_ASSERT("Non handled error-status");
         /* No error string */
     }
 
-    if (item._instruction == CSYNC_INSTRUCTION_IGNORE && (utf8State.invalidChars > 0 || utf8State.remainingChars > 0)) {
+    if (item._instruction == CSYNC_INSTRUCTION_IGNORE && !validUtf8) {
         item._status = SyncFileItem::NormalError;
         //item._instruction = CSYNC_INSTRUCTION_ERROR;
         item._errorString = tr("Filename encoding is not valid");
@@ -498,9 +542,16 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
     item.log._other_modtime     = file->other.modtime;
     item.log._other_size        = file->other.size;
 
-    _syncItemMap.insert(key, item);
-
     emit syncItemDiscovered(item);
+
+    // Store the merged item, without copying it again
+    if (index >= 0) {
+        std::swap(_syncedItems[index], item);
+    } else {
+        _syncItemIndex.insert(key, _syncedItems.size());
+        _syncedItems.append(SyncFileItem());
+        std::swap(_syncedItems.last(), item);
+    }
     return re;
 }
 
@@ -560,8 +611,10 @@ void SyncEngine::startSync()
     }
 
     _syncedItems.clear();
-    _syncItemMap.clear();
+    _syncItemIndex.clear();
     _needsUpdate = false;
+    _identicalConflictCount = 0;
+    _identicalConflictStreamedCount = 0;
 
     csync_resume(_csync_ctx);
 
@@ -597,6 +650,11 @@ void SyncEngine::startSync()
         csync_set_read_from_db(_csync_ctx, true);
     }
 
+    // csync reads the journal through a connection of the journal instead of
+    // opening and checking the file in each phase
+    _csyncDb = _journal->acquireReadConnection();
+    csync_set_statedb_connection(_csync_ctx, _csyncDb ? _csyncDb->sqliteDb() : 0);
+
     bool usingSelectiveSync = (!_selectiveSyncBlackList.isEmpty());
     qDebug() << (usingSelectiveSync ? "====Using Selective Sync" : "====NOT Using Selective Sync");
     if (fileRecordCount >= 0 && fileRecordCount < 50 && !usingSelectiveSync) {
@@ -617,6 +675,13 @@ void SyncEngine::startSync()
     csync_set_module_property(_csync_ctx, "timeout", &timeout);
 
     _stopWatch.start();
+    _performanceReport = SyncPerformanceReport();
+    _performanceReport.folder = _localPath;
+    _performanceReport.startTime = _stopWatch.startTime();
+    _journalQueriesAtStart = SqlQuery::execCount();
+    SyncPerformanceRecorder::instance()->startRun();
+    SyncTracer::instance()->startRun(_localPath);
+    _phaseTraceStart = SyncTracer::now();
 
     qDebug() << "#### Discovery start #################################################### >>";
 
@@ -659,6 +724,8 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
         handleSyncError(_csync_ctx, "csync_update");
         return;
     }
+    SyncTracer::instance()->addAsyncSpan("sync", QLatin1String("discovery"), quintptr(this),
+                                         _phaseTraceStart, SyncTracer::now());
     qDebug() << "<<#### Discovery end #################################################### " << _stopWatch.addLapTime(QLatin1String("Discovery Finished"));
 
     // Sanity check
@@ -672,26 +739,39 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
         _journal->commitIfNeededAndStartNewTransaction("Post discovery");
     }
 
-    if( csync_reconcile(_csync_ctx) < 0 ) {
-        handleSyncError(_csync_ctx, "csync_reconcile");
-        return;
+    {
+        SyncTraceSpan span("csync", "csync_reconcile");
+        if( csync_reconcile(_csync_ctx) < 0 ) {
+            handleSyncError(_csync_ctx, "csync_reconcile");
+            return;
+        }
     }
 
     _stopWatch.addLapTime(QLatin1String("Reconcile Finished"));
+    _performanceReport.remoteDirsFetched = _csync_ctx->stats.remote_dirs_fetched;
+    _performanceReport.remoteDirsFromDb = _csync_ctx->stats.remote_dirs_from_db;
+    _performanceReport.csyncJournalQueries = _csync_ctx->stats.statedb_queries;
 
     _progressInfo = Progress::Info();
 
     _hasNoneFiles = false;
     _hasRemoveFile = false;
     bool walkOk = true;
-    _seenFiles.clear();
-
-    if( csync_walk_local_tree(_csync_ctx, &treewalkLocal, 0) < 0 ) {
-        qDebug() << "Error in local treewalk.";
-        walkOk = false;
-    }
-    if( walkOk && csync_walk_remote_tree(_csync_ctx, &treewalkRemote, 0) < 0 ) {
-        qDebug() << "Error in remote treewalk.";
+    _incompleteDiscoveryDirs.clear();
+    _journal->startSyncGeneration();
+    // The blacklist is looked up for every item, and the transfers look up their infos
+    _journal->loadTransferCache();
+
+    {
+        SyncTraceSpan span("csync", "csync_walk_tree");
+        if( csync_walk_local_tree(_csync_ctx, &treewalkLocal, 0) < 0 ) {
+            qDebug() << "Error in local treewalk.";
+            walkOk = false;
+        }
+        if( walkOk && csync_walk_remote_tree(_csync_ctx, &treewalkRemote, 0) < 0 ) {
+            qDebug() << "Error in remote treewalk.";
+        }
+        span.setArg(QLatin1String("items"), _syncedItems.count());
     }
 
     if (_csync_ctx->remote.root_perms) {
@@ -699,17 +779,22 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
         qDebug() << "Permissions of the root folder: " << _remotePerms[QLatin1String("")];
     }
 
-    // The map was used for merging trees, convert it to a list:
-    _syncedItems = _syncItemMap.values().toVector();
-
     // Adjust the paths for the renames.
-    for (SyncFileItemVector::iterator it = _syncedItems.begin();
-            it != _syncedItems.end(); ++it) {
-        it->_file = adjustRenamedPath(it->_file);
+    if (!_renamedFolders.isEmpty()) {
+        for (SyncFileItemVector::iterator it = _syncedItems.begin();
+                it != _syncedItems.end(); ++it) {
+            it->_file = adjustRenamedPath(it->_file);
+        }
     }
 
     // Sort items per destination
-    std::sort(_syncedItems.begin(), _syncedItems.end());
+    sortByDestination(&_syncedItems);
+    _syncItemIndex.clear();
+    _syncItemIndex.reserve(_syncedItems.size());
+    for (int i = _syncedItems.size() - 1; i >= 0; --i) {
+        // backwards, the first of the items with the same name wins
+        _syncItemIndex.insert(_syncedItems.at(i)._originalFile, i);
+    }
 
     // make sure everything is allowed
     checkForPermission();
@@ -752,8 +837,15 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     // do a database commit
     _journal->commit("post treewalk");
 
+    // Deleted in the thread it lives in
     _propagator = QSharedPointer<OwncloudPropagator>(
-        new OwncloudPropagator (_account, session, _localPath, _remoteUrl, _remotePath, _journal, &_thread));
+        new OwncloudPropagator (_account, session, _localPath, _remoteUrl, _remotePath, _journal, &_thread),
+        &QObject::deleteLater);
+    // The GUI thread stays responsive during the transfers, it only gets the
+    // queued (and coalesced) signals of the propagator
+    if (_account->createThreadNetworkAccessManager(&_propagationThread)) {
+        _propagator->moveToThread(&_propagationThread);
+    }
     connect(_propagator.data(), SIGNAL(completed(SyncFileItem)),
             this, SLOT(slotJobCompleted(SyncFileItem)));
     connect(_propagator.data(), SIGNAL(progress(SyncFileItem,quint64)),
@@ -764,16 +856,14 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     // apply the network limits to the propagator
     setNetworkLimits(_uploadLimit, _downloadLimit);
 
-    deleteStaleDownloadInfos();
-    deleteStaleUploadInfos();
-    deleteStaleErrorBlacklistEntries();
-    _journal->commit("post stale entry removal");
-
     // Emit the started signal only after the propagator has been set up.
     if (_needsUpdate)
         emit(started());
 
-    _propagator->start(_syncedItems);
+    _phaseTraceStart = SyncTracer::now();
+    _stopWatch.addLapTime(QLatin1String("Propagation Started"));
+    QMetaObject::invokeMethod(_propagator.data(), "start", Qt::QueuedConnection,
+                              Q_ARG(SyncFileItemVector, _syncedItems));
 }
 
 void SyncEngine::slotCleanPollsJobAborted(const QString &error)
@@ -787,6 +877,10 @@ void SyncEngine::setNetworkLimits(int upload, int download)
     _uploadLimit = upload;
     _downloadLimit = download;
 
+    // The limits are the same for all the folders, the scheduler shares them between the folders
+    BandwidthScheduler::instance()->setLimit(BandwidthScheduler::Upload, upload);
+    BandwidthScheduler::instance()->setLimit(BandwidthScheduler::Download, download);
+
     if( !_propagator ) return;
 
     _propagator->_uploadLimit = upload;
@@ -813,7 +907,7 @@ void SyncEngine::slotJobCompleted(const SyncFileItem &item)
     qDebug() << Q_FUNC_INFO << item._file << item._status << item._errorString;
 
     /* Update the _syncedItems vector */
-    int idx = _syncedItems.indexOf(item);
+    int idx = _syncItemIndex.value(item._originalFile, -1);
     if (idx >= 0) {
         _syncedItems[idx]._instruction = item._instruction;
         _syncedItems[idx]._errorString = item._errorString;
@@ -832,43 +926,98 @@ void SyncEngine::slotJobCompleted(const SyncFileItem &item)
         emit csyncError(item._errorString);
     }
 
-    emit transmissionProgress(_progressInfo);
+    // also carries the pending progress of the other transfers
+    slotPublishProgress();
     emit jobCompleted(item);
 }
 
 void SyncEngine::slotFinished()
 {
     _anotherSyncNeeded = _anotherSyncNeeded || _propagator->_anotherSyncNeeded;
+    _identicalConflictCount = _propagator->_identicalConflictCount;
+    _identicalConflictStreamedCount = _propagator->_identicalConflictStreamedCount;
+    if (_identicalConflictCount > 0) {
+        qDebug() << "Conflicts resolved as identical:" << _identicalConflictCount
+                 << "(" << _identicalConflictStreamedCount << "compared while downloading)";
+    }
+
+    SyncTracer::instance()->addAsyncSpan("sync", QLatin1String("propagation"), quintptr(this),
+                                         _phaseTraceStart, SyncTracer::now());
 
-    // emit the treewalk results.
-    if( ! _journal->postSyncCleanup( _seenFiles ) ) {
-        qDebug() << "Cleaning of synced ";
+    deleteStaleJournalEntries();
+
+    {
+        SyncTraceSpan span("journal", "postSyncCleanup");
+        // emit the treewalk results.
+        if( ! _journal->postSyncCleanup( _incompleteDiscoveryDirs ) ) {
+            qDebug() << "Cleaning of synced ";
+        }
     }
 
     _journal->commit("All Finished.", false);
+    _performanceReport.completed = !_propagator->_abortRequested.fetchAndAddRelaxed(0);
     emit treeWalkResult(_syncedItems);
     finalize();
 }
 
 void SyncEngine::finalize()
 {
+    _progressTimer.stop();
     _thread.quit();
     _thread.wait();
     csync_commit(_csync_ctx);
 
-    qDebug() << "CSync run took " << _stopWatch.addLapTime(QLatin1String("Sync Finished"));
+    csync_set_statedb_connection(_csync_ctx, 0);
+    _journal->releaseReadConnection(_csyncDb);
+    _csyncDb = 0;
+    _journal->dropTransferCache();
+
+    const qint64 total = _stopWatch.addLapTime(QLatin1String("Sync Finished"));
+    qDebug() << "CSync run took " << total;
     _stopWatch.stop();
 
+    const qint64 discovery = _stopWatch.durationOfLap(QLatin1String("Discovery Finished"));
+    const qint64 reconcile = _stopWatch.durationOfLap(QLatin1String("Reconcile Finished"));
+    const qint64 propagationStart = _stopWatch.durationOfLap(QLatin1String("Propagation Started"));
+    _performanceReport.totalDuration = total;
+    _performanceReport.discoveryDuration = discovery;
+    _performanceReport.reconcileDuration = reconcile ? reconcile - discovery : 0;
+    _performanceReport.propagationDuration = propagationStart ? total - propagationStart : 0;
+    _performanceReport.walkToPropagateDuration = propagationStart && reconcile ? propagationStart - reconcile : 0;
+    _performanceReport.syncItems = _syncedItems.size();
+    _performanceReport.peakMemory = Utility::peakMemoryUsage();
+    _performanceReport.journalQueries = uint(SqlQuery::execCount()) - uint(_journalQueriesAtStart);
+    SyncPerformanceRecorder::instance()->finishRun(&_performanceReport);
+    SyncTracer::instance()->finishRun();
+
     _syncRunning = false;
     emit finished();
 
     // Delete the propagator only after emitting the signal.
     _propagator.clear();
+    _account->releaseThreadNetworkAccessManager(&_propagationThread);
 }
 
 void SyncEngine::slotProgress(const SyncFileItem& item, quint64 current)
 {
     _progressInfo.setProgressItem(item, current);
+
+    // The transfers report their progress for every few KB. Coalesce the updates,
+    // the receivers redraw the whole progress for each of them.
+    if (!_progressTimer.isActive()) {
+        qint64 sinceLast = _lastProgressPublished.isValid()
+                ? _lastProgressPublished.elapsed() : progressPublishInterval;
+        _progressTimer.start(qMax(qint64(0), progressPublishInterval - sinceLast));
+    }
+}
+
+void SyncEngine::slotPublishProgress()
+{
+    _progressTimer.stop();
+    _lastProgressPublished.start();
+    // Progress::Info is not implicitly shared: a queued connection would copy it with
+    // all its current items. The receivers (Folder, cmd) live in this thread and get
+    // a reference, keep it that way.
     emit transmissionProgress(_progressInfo);
 }
 
@@ -1177,9 +1326,10 @@ void SyncEngine::abort()
     }
     // Sets a flag for the update phase
     csync_request_abort(_csync_ctx);
-    // For the propagator
+    // For the propagator, the flag right away, the jobs in its thread
     if(_propagator) {
-        _propagator->abort();
+        _propagator->_abortRequested.fetchAndStoreOrdered(true);
+        QMetaObject::invokeMethod(_propagator.data(), "abort", Qt::QueuedConnection);
     }
 }
 
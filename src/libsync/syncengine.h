@@ -25,6 +25,8 @@
 #include <QMap>
 #include <QStringList>
 #include <QSharedPointer>
+#include <QTimer>
+#include <QElapsedTimer>
 
 #include <csync.h>
 
@@ -37,6 +39,7 @@
 #include "syncfilestatus.h"
 #include "accountfwd.h"
 #include "discoveryphase.h"
+#include "syncperformancereport.h"
 
 class QProcess;
 
@@ -44,6 +47,7 @@ namespace OCC {
 
 class SyncJournalFileRecord;
 class SyncJournalDb;
+class SqlDatabase;
 class OwncloudPropagator;
 
 class OWNCLOUDSYNC_EXPORT SyncEngine : public QObject
@@ -69,6 +73,11 @@ public:
     /* Return true if we detected that another sync is needed to complete the sync */
     bool isAnotherSyncNeeded() { return _anotherSyncNeeded; }
 
+    /* Number of conflicts of the last sync that turned out to have identical content,
+     * and how many of them were detected while downloading */
+    int identicalConflictCount() const { return _identicalConflictCount; }
+    int identicalConflictStreamedCount() const { return _identicalConflictStreamedCount; }
+
     bool estimateState(QString fn, csync_ftw_type_e t, SyncFileStatus* s);
 
     /** Get the ms since a file was touched, or -1 if it wasn't.
@@ -80,6 +89,9 @@ public:
     AccountPtr account() const;
     SyncJournalDb *journal() const { return _journal; }
 
+    /** Statistics of the last sync, complete once finished() was emitted */
+    const SyncPerformanceReport &performanceReport() const { return _performanceReport; }
+
 signals:
     void csyncError( const QString& );
     void csyncUnavailable();
@@ -114,6 +126,7 @@ private slots:
     void slotJobCompleted(const SyncFileItem& item);
     void slotFinished();
     void slotProgress(const SyncFileItem& item, quint64 curent);
+    void slotPublishProgress();
     void slotAdjustTotalTransmissionSize(qint64 change);
     void slotDiscoveryJobFinished(int updateResult);
     void slotCleanPollsJobAborted(const QString &error);
@@ -126,26 +139,21 @@ private:
     int treewalkFile( TREE_WALK_FILE*, bool );
     bool checkErrorBlacklisting( SyncFileItem *item );
 
-    // Cleans up unnecessary downloadinfo entries in the journal as well
-    // as their temporary files.
-    void deleteStaleDownloadInfos();
-
-    // Removes stale uploadinfos from the journal.
-    void deleteStaleUploadInfos();
-
-    // Removes stale error blacklist entries from the journal.
-    void deleteStaleErrorBlacklistEntries();
+    // Removes the stale downloadinfo, uploadinfo and error blacklist entries
+    // from the journal, and the temporary files of the downloads.
+    void deleteStaleJournalEntries();
 
     // cleanup and emit the finished signal
     void finalize();
 
     static bool _syncRunning; //true when one sync is running somewhere (for debugging)
 
-    QMap<QString, SyncFileItem> _syncItemMap;
-
-    // should be called _syncItems (present tense). It's the items from the _syncItemMap but
-    // sorted and re-adjusted based on permissions.
+    // should be called _syncItems (present tense). The tree walks merge the items of both
+    // trees in there, then they are sorted and re-adjusted based on permissions.
     SyncFileItemVector _syncedItems;
+    // Index of the items in _syncedItems: by the merge key during the tree walks,
+    // by _originalFile once they are sorted (to update them when they complete).
+    QHash<QString, int> _syncItemIndex;
 
     AccountPtr _account;
     CSYNC *_csync_ctx;
@@ -155,13 +163,21 @@ private:
     QString _remotePath;
     QString _remoteRootEtag;
     SyncJournalDb *_journal;
+    SqlDatabase *_csyncDb; // read connection of the journal used by csync during the sync
     QPointer<DiscoveryMainThread> _discoveryMainThread;
     QSharedPointer <OwncloudPropagator> _propagator;
     QString _lastDeleted; // if the last item was a path and it has been deleted
-    QSet<QString> _seenFiles;
+    // directories whose content could not be discovered, see SyncJournalDb::postSyncCleanup
+    QSet<QString> _incompleteDiscoveryDirs;
     QThread _thread;
+    // The propagator and its jobs live there, unless the credentials need the GUI thread
+    QThread _propagationThread;
 
     Progress::Info _progressInfo;
+    // slotProgress only updates _progressInfo, the timer publishes it at most every
+    // progressPublishInterval msec, by reference. The completions are published right away.
+    QTimer _progressTimer;
+    QElapsedTimer _lastProgressPublished;
 
     Utility::StopWatch _stopWatch;
 
@@ -188,6 +204,14 @@ private:
     QStringList _selectiveSyncBlackList;
 
     bool _anotherSyncNeeded;
+
+    int _identicalConflictCount;
+    int _identicalConflictStreamedCount;
+
+    qint64 _phaseTraceStart; // start of the discovery or propagation, see SyncTracer
+
+    SyncPerformanceReport _performanceReport;
+    int _journalQueriesAtStart; // SqlQuery::execCount() when the sync started
 };
 
 }
@@ -19,6 +19,8 @@
 #include <QDateTime>
 #include <QMetaType>
 
+#include <algorithm>
+
 #include <csync.h>
 
 namespace OCC {
@@ -64,9 +66,10 @@ public:
 
     friend bool operator<(const SyncFileItem& item1, const SyncFileItem& item2) {
         // Sort by destination
-        auto d1 = item1.destination();
-        auto d2 = item2.destination();
+        return destinationLessThan(item1.destination(), item2.destination());
+    }
 
+    static bool destinationLessThan(const QString &d1, const QString &d2) {
         // But this we need to order it so the slash come first. It should be this order:
         //  "foo", "foo/bar", "foo-bar"
         // This is important since we assume that the contents of a folder directly follows
@@ -93,7 +96,7 @@ public:
         return data1[prefixL] < data2[prefixL];
     }
 
-    QString destination() const {
+    const QString &destination() const {
         if (!_renameTarget.isEmpty()) {
             return _renameTarget;
         }
@@ -161,9 +164,99 @@ public:
 };
 
 
+}
+
+// Only implicitly shared members, QVector can move the items with memcpy
+Q_DECLARE_TYPEINFO(OCC::SyncFileItem, Q_MOVABLE_TYPE);
+
+namespace OCC {
 
 typedef QVector<SyncFileItem> SyncFileItemVector;
 
+/**
+ * A sort key of the 8 characters of a destination from \a from on.
+ *
+ * For destinations that have the same first \a from characters: when their
+ * keys differ, they are in the order of SyncFileItem::destinationLessThan(),
+ * when they are equal the destinations must be compared. Each character is a
+ * byte: 0 past the end, 1 for '/', the code plus one for the ones below 0xFE.
+ * Any other character is 0xFF and ends the key, the ones after it could not
+ * be told apart anyway.
+ */
+inline quint64 destinationSortPrefix(const QString &destination, int from)
+{
+    quint64 key = 0;
+    const QChar *data = destination.constData() + from;
+    const int size = qBound(0, destination.size() - from, 8);
+    int i = 0;
+    for (; i < size; ++i) {
+        const ushort c = data[i].unicode();
+        quint64 byte;
+        if (c == '/') {
+            byte = 1;
+        } else if (c < 0xFE) {
+            byte = c + 1;
+        } else {
+            key = (key << 8) | 0xFF;
+            ++i;
+            break;
+        }
+        key = (key << 8) | byte;
+    }
+    return i > 0 ? key << (8 * (8 - i)) : 0; // shifting by 64 is undefined
+}
+
+/**
+ * Sorts the items by destination, like std::sort with operator< would.
+ *
+ * The sort key of each item is computed once and sorted with the index of the
+ * item, so most comparisons touch neither the items nor their strings. The keys
+ * start after the prefix common to all the destinations (the folders of a deep
+ * tree), see destinationSortPrefix(). Then each item is moved once to its place.
+ */
+inline void sortByDestination(SyncFileItemVector *items)
+{
+    struct SortKey {
+        quint64 prefix;
+        int index;
+    };
+    const SyncFileItemVector &constItems = *items;
+    if (constItems.isEmpty()) {
+        return;
+    }
+
+    const QString &first = constItems.first().destination();
+    int common = first.size();
+    for (int i = 1; i < constItems.size() && common > 0; ++i) {
+        const QString &destination = constItems.at(i).destination();
+        const int size = std::min(common, destination.size());
+        int j = 0;
+        while (j < size && destination.at(j) == first.at(j)) {
+            ++j;
+        }
+        common = j;
+    }
+
+    QVector<SortKey> keys(constItems.size());
+    for (int i = 0; i < keys.size(); ++i) {
+        keys[i].prefix = destinationSortPrefix(constItems.at(i).destination(), common);
+        keys[i].index = i;
+    }
+    std::sort(keys.begin(), keys.end(), [&constItems](const SortKey &a, const SortKey &b) {
+        if (a.prefix != b.prefix) {
+            return a.prefix < b.prefix;
+        }
+        return SyncFileItem::destinationLessThan(constItems.at(a.index).destination(),
+                                                 constItems.at(b.index).destination());
+    });
+
+    SyncFileItemVector sorted(keys.size());
+    for (int i = 0; i < keys.size(); ++i) {
+        std::swap(sorted[i], (*items)[keys.at(i).index]);
+    }
+    items->swap(sorted);
+}
+
 }
 
 Q_DECLARE_METATYPE(OCC::SyncFileItem)
@@ -15,6 +15,9 @@
 #include <QStringList>
 #include <QDebug>
 #include <QElapsedTimer>
+#include <QSet>
+#include <QThread>
+#include <QWaitCondition>
 #include "ownsql.h"
 
 #include <inttypes.h>
@@ -24,13 +27,164 @@
 #include "utility.h"
 #include "version.h"
 #include "filesystem.h"
+#include "pathhashset.h"
+#include "synctracer.h"
 
 #include "../../csync/src/std/c_jhash.h"
 
 namespace OCC {
 
+/* The writer thread commits a batch once it has that many writes... */
+static const int journalWriterBatchSize = 500;
+/* ...or once the oldest queued write waited that long (in ms). */
+static const int journalWriterLatencyBudget = 200;
+
+/*
+ * The writes that are queued and not yet in the database.
+ * Several writes to the same entry are merged, only the last one is written.
+ */
+struct SyncJournalPendingWrites
+{
+    QHash<QString, SyncJournalFileRecord> _fileRecords;
+    QSet<QString> _deletedFileRecords;
+    QSet<QString> _confirmedFileRecords;
+    QHash<QString, SyncJournalDb::DownloadInfo> _downloadInfos; // invalid info: delete the entry
+    QHash<QString, SyncJournalDb::UploadInfo> _uploadInfos; // invalid info: delete the entry
+    QHash<QString, SyncJournalErrorBlacklistRecord> _blacklist; // empty _file: delete the entry
+
+    int count() const {
+        return _fileRecords.count() + _deletedFileRecords.count() + _confirmedFileRecords.count()
+                + _downloadInfos.count() + _uploadInfos.count() + _blacklist.count();
+    }
+    bool isEmpty() const { return count() == 0; }
+    void clear() {
+        _fileRecords.clear();
+        _deletedFileRecords.clear();
+        _confirmedFileRecords.clear();
+        _downloadInfos.clear();
+        _uploadInfos.clear();
+        _blacklist.clear();
+    }
+};
+
+/*
+ * The download infos, upload infos and blacklist entries during a sync run. There are
+ * few of them, and the sync looks up all the files it discovers or transfers.
+ * The entries are only the valid ones: a missing entry is an invalid one.
+ */
+struct SyncJournalTransferCache
+{
+    QHash<QString, SyncJournalDb::DownloadInfo> _downloadInfos;
+    QHash<QString, SyncJournalDb::UploadInfo> _uploadInfos;
+    QHash<QString, SyncJournalErrorBlacklistRecord> _blacklist; // by blacklistKey()
+};
+
+// The blacklist is looked up case insensitively on case preserving file systems
+static QString blacklistKey(const QString &file)
+{
+    return Utility::fsCasePreserving() ? file.toLower() : file;
+}
+
+/*
+ * Thread that writes the queued writes of a SyncJournalDb, grouped in transactions
+ * of up to journalWriterBatchSize writes or journalWriterLatencyBudget ms.
+ *
+ * Everything is protected by _mutex. The writes being written by the thread are
+ * kept in _inFlight until they are in the database so lookups can still find them.
+ */
+class SyncJournalWriter : public QThread
+{
+public:
+    explicit SyncJournalWriter(SyncJournalDb *journal)
+        : _journal(journal), _queued(0), _written(0), _stop(false), _flushRequested(false)
+    {
+        setObjectName("SyncJournalWriter");
+        start();
+    }
+
+    ~SyncJournalWriter() {
+        {
+            QMutexLocker lock(&_mutex);
+            _stop = true;
+            _wakeUp.wakeAll();
+        }
+        wait();
+    }
+
+    /* Must be called with _mutex held, after a write was queued. */
+    void queued() {
+        ++_queued;
+        if (_pending.count() >= journalWriterBatchSize) {
+            _wakeUp.wakeAll();
+        } else if (_pending.count() == 1) {
+            // Starts the latency budget
+            _wakeUp.wakeAll();
+        }
+    }
+
+    void flush() {
+        QMutexLocker lock(&_mutex);
+        const quint64 target = _queued;
+        while (_written < target) {
+            _flushRequested = true;
+            _wakeUp.wakeAll();
+            _flushed.wait(&_mutex);
+        }
+    }
+
+    QMutex _mutex;
+    SyncJournalPendingWrites _pending;
+    SyncJournalPendingWrites _inFlight;
+
+protected:
+    void run() Q_DECL_OVERRIDE {
+        QMutexLocker lock(&_mutex);
+        forever {
+            while (!_stop && _pending.isEmpty()) {
+                _wakeUp.wait(&_mutex);
+            }
+            if (_pending.isEmpty()) {
+                break; // _stop
+            }
+
+            // Give more writes a chance to join this transaction
+            QElapsedTimer timer;
+            timer.start();
+            while (!_stop && !_flushRequested && _pending.count() < journalWriterBatchSize) {
+                qint64 remaining = journalWriterLatencyBudget - timer.elapsed();
+                if (remaining <= 0) {
+                    break;
+                }
+                _wakeUp.wait(&_mutex, remaining);
+            }
+
+            qSwap(_pending, _inFlight);
+            const quint64 batch = _queued;
+            _flushRequested = false;
+
+            lock.unlock();
+            _journal->writePendingWrites(_inFlight);
+            lock.relock();
+
+            _inFlight.clear();
+            _written = batch;
+            _flushed.wakeAll();
+        }
+    }
+
+private:
+    SyncJournalDb *_journal;
+    QWaitCondition _wakeUp;
+    QWaitCondition _flushed;
+    quint64 _queued; // number of writes queued so far
+    quint64 _written; // number of writes in the database so far
+    bool _stop;
+    bool _flushRequested;
+};
+
 SyncJournalDb::SyncJournalDb(const QString& path, QObject *parent) :
-    QObject(parent), _transaction(0), _possibleUpgradeFromMirall_1_5(false)
+    QObject(parent), _transaction(0), _possibleUpgradeFromMirall_1_5(false), _generation(0),
+    _readConnectionsInUse(0), _walKeptByReaders(false)
 {
 
     _dbFile = path;
@@ -39,7 +193,62 @@ SyncJournalDb::SyncJournalDb(const QString& path, QObject *parent) :
     }
     _dbFile.append(".csync_journal.db");
 
+    // Allow writing synchronously for debugging
+    static bool synchronousWrites = qgetenv("OWNCLOUD_JOURNAL_SYNCHRONOUS_WRITES").toInt();
+    if (!synchronousWrites) {
+        _writer.reset(new SyncJournalWriter(this));
+    }
+}
 
+void SyncJournalDb::flush()
+{
+    if (_writer) {
+        _writer->flush();
+    }
+}
+
+void SyncJournalDb::writePendingWrites(const SyncJournalPendingWrites &writes)
+{
+    QMutexLocker locker(&_mutex);
+
+    if( !checkConnect() ) {
+        qDebug() << "Failed to connect database, dropping" << writes.count() << "journal writes";
+        return;
+    }
+
+    SyncTraceSpan span("journal", "writePendingWrites");
+    span.setArg(QLatin1String("writes"), writes.count());
+
+    // All the writes go into one transaction
+    bool hadTransaction = _transaction == 1;
+    if (!hadTransaction) {
+        startTransaction();
+    }
+
+    foreach (const QString &file, writes._deletedFileRecords) {
+        deleteFileRecordInternal(file);
+    }
+    foreach (const SyncJournalFileRecord &record, writes._fileRecords) {
+        setFileRecordInternal(record);
+    }
+    foreach (const QString &file, writes._confirmedFileRecords) {
+        confirmFileRecordInternal(file);
+    }
+    for (auto it = writes._downloadInfos.constBegin(); it != writes._downloadInfos.constEnd(); ++it) {
+        setDownloadInfoInternal(it.key(), it.value());
+    }
+    for (auto it = writes._uploadInfos.constBegin(); it != writes._uploadInfos.constEnd(); ++it) {
+        setUploadInfoInternal(it.key(), it.value());
+    }
+    for (auto it = writes._blacklist.constBegin(); it != writes._blacklist.constEnd(); ++it) {
+        if (it.value()._file.isEmpty()) {
+            wipeErrorBlacklistEntryInternal(it.key());
+        } else {
+            updateErrorBlacklistEntryInternal(it.value());
+        }
+    }
+
+    commitInternal(QString("journal writer: %1 writes").arg(writes.count()), hadTransaction);
 }
 
 bool SyncJournalDb::exists()
@@ -86,6 +295,7 @@ void SyncJournalDb::startTransaction()
 void SyncJournalDb::commitTransaction()
 {
     if( _transaction == 1 ) {
+        SyncTraceSpan span("journal", "commit");
         if( ! _db.commit() ) {
             qDebug() << "ERROR committing to the database: " << _db.error();
             return;
@@ -106,6 +316,19 @@ bool SyncJournalDb::sqlFail( const QString& log, const SqlQuery& query )
     return false;
 }
 
+// Memory mapped I/O: the connections share the pages of the journal through the
+// OS page cache instead of each copying them into its own page cache.
+static const qint64 journalMmapSize = 256 * 1024 * 1024;
+
+static void enableMmap(SqlDatabase &db)
+{
+    SqlQuery pragma(db);
+    pragma.prepare(QString("PRAGMA mmap_size=%1;").arg(journalMmapSize));
+    if (!pragma.exec()) {
+        qDebug() << "Could not enable memory mapped I/O:" << pragma.error();
+    }
+}
+
 static QString defaultJournalMode(const QString & dbPath)
 {
 #ifdef Q_OS_WIN
@@ -135,8 +358,20 @@ bool SyncJournalDb::checkConnect()
 
     bool isNewDb = !QFile::exists(_dbFile);
 
+    // sqlite removes the -wal (or -journal) file when the database is closed properly.
+    // Only check the integrity if it is still there: the database was not closed
+    // properly, or is currently opened by another process. Our own read connections
+    // that were still in use when we closed the journal (the socket API) keep the -wal
+    // file as well, that does not mean anything went wrong.
+    bool checkIntegrity = !_walKeptByReaders
+            && (QFile::exists(_dbFile + "-wal") || QFile::exists(_dbFile + "-journal"));
+    if (checkIntegrity) {
+        qDebug() << "The journal was not closed properly, checking its integrity";
+    }
+    _walKeptByReaders = false;
+
     // The database file is created by this call (SQLITE_OPEN_CREATE)
-    if( !_db.openOrCreateReadWrite(_dbFile) ) {
+    if( !_db.openOrCreateReadWrite(_dbFile, checkIntegrity) ) {
         QString error = _db.error();
         qDebug() << "Error opening the db: " << error;
         return false;
@@ -170,6 +405,8 @@ bool SyncJournalDb::checkConnect()
         qDebug() << "sqlite3 journal_mode=" << pragma1.stringValue(0);
     }
 
+    enableMmap(_db);
+
     // For debugging purposes, allow temp_store to be set
     static QString env_temp_store = QString::fromLocal8Bit(qgetenv("OWNCLOUD_SQLITE_TEMP_STORE"));
     if (!env_temp_store.isEmpty()) {
@@ -323,8 +560,8 @@ bool SyncJournalDb::checkConnect()
 
     _setFileRecordQuery.reset(new SqlQuery(_db) );
     _setFileRecordQuery->prepare("INSERT OR REPLACE INTO metadata "
-                                 "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize) "
-                                 "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13);" );
+                                 "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, generation) "
+                                 "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13, ?14);" );
 
     _getDownloadInfoQuery.reset(new SqlQuery(_db) );
     _getDownloadInfoQuery->prepare( "SELECT tmpfile, etag, errorcount FROM "
@@ -355,7 +592,11 @@ bool SyncJournalDb::checkConnect()
     _deleteFileRecordPhash->prepare("DELETE FROM metadata WHERE phash=?1");
 
     _deleteFileRecordRecursively.reset(new SqlQuery(_db));
-    _deleteFileRecordRecursively->prepare("DELETE FROM metadata WHERE path LIKE(?||'/%')");
+    // Range on the metadata_path index: everything below "dir" sorts between "dir/" and "dir0"
+    _deleteFileRecordRecursively->prepare("DELETE FROM metadata WHERE path > (?1||'/') AND path < (?1||'0')");
+
+    _confirmFileRecordQuery.reset(new SqlQuery(_db));
+    _confirmFileRecordQuery->prepare("UPDATE metadata SET generation=?1 WHERE phash=?2 AND generation<?1");
 
     QString sql( "SELECT lastTryEtag, lastTryModtime, retrycount, errorstring, lastTryTime, ignoreDuration "
                  "FROM blacklist WHERE path=?1");
@@ -386,6 +627,8 @@ bool SyncJournalDb::checkConnect()
 
 void SyncJournalDb::close()
 {
+    dropTransferCache();
+    flush();
     QMutexLocker locker(&_mutex);
     qDebug() << Q_FUNC_INFO << _dbFile;
 
@@ -401,14 +644,61 @@ void SyncJournalDb::close()
     _deleteUploadInfoQuery.reset(0);
     _deleteFileRecordPhash.reset(0);
     _deleteFileRecordRecursively.reset(0);
+    _confirmFileRecordQuery.reset(0);
     _getErrorBlacklistQuery.reset(0);
     _setErrorBlacklistQuery.reset(0);
     _possibleUpgradeFromMirall_1_5 = false;
 
+    // The connections in use are closed when they are released
+    qDeleteAll(_readConnections);
+    _readConnections.clear();
+    _walKeptByReaders = _readConnectionsInUse > 0;
+
     _db.close();
     _avoidReadFromDbOnNextSyncFilter.clear();
 }
 
+SqlDatabase *SyncJournalDb::acquireReadConnection()
+{
+    QMutexLocker locker(&_mutex);
+
+    // Creates the database and checks its integrity if needed
+    if( !checkConnect() ) {
+        return 0;
+    }
+
+    if (!_readConnections.isEmpty()) {
+        ++_readConnectionsInUse;
+        return _readConnections.takeLast();
+    }
+
+    SqlDatabase *db = new SqlDatabase;
+    if (!db->openReadOnly(_dbFile, false)) {
+        qDebug() << "Could not open a read connection to" << _dbFile << db->error();
+        delete db;
+        return 0;
+    }
+    enableMmap(*db);
+    ++_readConnectionsInUse;
+    return db;
+}
+
+void SyncJournalDb::releaseReadConnection(SqlDatabase *db)
+{
+    if (!db) {
+        return;
+    }
+
+    QMutexLocker locker(&_mutex);
+    --_readConnectionsInUse;
+    if (_db.isOpen()) {
+        _readConnections.append(db);
+    } else {
+        // The journal was closed in the meantime
+        delete db;
+    }
+}
+
 
 bool SyncJournalDb::updateDatabaseStructure()
 {
@@ -486,6 +776,39 @@ bool SyncJournalDb::updateMetadataTableStructure()
         commitInternal("update database structure: add pathlen index");
 
     }
+
+    if( 1 ) {
+        // For the range scans of everything below a directory
+        SqlQuery query(_db);
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_path ON metadata(path);");
+        if( !query.exec()) {
+            sqlFail("updateMetadataTableStructure: create index path", query);
+            re = false;
+        }
+        commitInternal("update database structure: add path index");
+    }
+
+    if( columns.indexOf(QLatin1String("generation")) == -1 ) {
+        // The generation of the sync run that last confirmed or wrote the record,
+        // used to clean up the records of files that are gone.
+        SqlQuery query(_db);
+        query.prepare("ALTER TABLE metadata ADD COLUMN generation INTEGER(8) DEFAULT 0;");
+        if( !query.exec()) {
+            sqlFail("updateMetadataTableStructure: add column generation", query);
+            re = false;
+        }
+        commitInternal("update database structure: add generation col");
+    }
+
+    if( 1 ) {
+        SqlQuery query(_db);
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_generation ON metadata(generation);");
+        if( !query.exec()) {
+            sqlFail("updateMetadataTableStructure: create index generation", query);
+            re = false;
+        }
+        commitInternal("update database structure: add generation index");
+    }
     return re;
 }
 
@@ -558,10 +881,23 @@ qint64 SyncJournalDb::getPHash(const QString& file)
     return h;
 }
 
-bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& _record )
+bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& record )
 {
-    SyncJournalFileRecord record = _record;
+    if (_writer) {
+        QMutexLocker lock(&_writer->_mutex);
+        _writer->_pending._deletedFileRecords.remove(record._path);
+        _writer->_pending._fileRecords.insert(record._path, record);
+        _writer->queued();
+        return true;
+    }
+
     QMutexLocker locker(&_mutex);
+    return setFileRecordInternal(record);
+}
+
+bool SyncJournalDb::setFileRecordInternal( const SyncJournalFileRecord& _record )
+{
+    SyncJournalFileRecord record = _record;
 
     if (!_avoidReadFromDbOnNextSyncFilter.isEmpty()) {
         // If we are a directory that should not be read from db next time, don't write the etag
@@ -600,6 +936,7 @@ bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& _record )
         _setFileRecordQuery->bindValue(11, fileId );
         _setFileRecordQuery->bindValue(12, remotePerm );
         _setFileRecordQuery->bindValue(13, record._fileSize );
+        _setFileRecordQuery->bindValue(14, _generation );
 
         if( !_setFileRecordQuery->exec() ) {
             qWarning() << "Error SQL statement setFileRecord: " << _setFileRecordQuery->lastQuery() <<  " :"
@@ -622,24 +959,26 @@ bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& _record )
 
 bool SyncJournalDb::deleteFileRecord(const QString& filename, bool recursively)
 {
+    if (_writer) {
+        if (!recursively) {
+            QMutexLocker lock(&_writer->_mutex);
+            _writer->_pending._fileRecords.remove(filename);
+            _writer->_pending._deletedFileRecords.insert(filename);
+            _writer->queued();
+            return true;
+        }
+        // The records below the path may still be queued
+        flush();
+    }
+
     QMutexLocker locker(&_mutex);
 
     if( checkConnect() ) {
         // if (!recursively) {
         // always delete the actual file.
-
-        qlonglong phash = getPHash(filename);
-        _deleteFileRecordPhash->reset();
-        _deleteFileRecordPhash->bindValue( 1, QString::number(phash) );
-
-        if( !_deleteFileRecordPhash->exec() ) {
-            qWarning() << "Exec error of SQL statement: "
-                       << _deleteFileRecordPhash->lastQuery()
-                       <<  " : " << _deleteFileRecordPhash->error();
+        if( !deleteFileRecordInternal(filename) ) {
             return false;
         }
-        qDebug() <<  _deleteFileRecordPhash->lastQuery() << phash << filename;
-        _deleteFileRecordPhash->reset();
         if( recursively) {
             _deleteFileRecordRecursively->reset();
             _deleteFileRecordRecursively->bindValue(1, filename);
@@ -659,9 +998,92 @@ bool SyncJournalDb::deleteFileRecord(const QString& filename, bool recursively)
     }
 }
 
+bool SyncJournalDb::deleteFileRecordInternal(const QString& filename)
+{
+    qlonglong phash = getPHash(filename);
+    _deleteFileRecordPhash->reset();
+    _deleteFileRecordPhash->bindValue( 1, QString::number(phash) );
+
+    if( !_deleteFileRecordPhash->exec() ) {
+        qWarning() << "Exec error of SQL statement: "
+                   << _deleteFileRecordPhash->lastQuery()
+                   <<  " : " << _deleteFileRecordPhash->error();
+        return false;
+    }
+    qDebug() <<  _deleteFileRecordPhash->lastQuery() << phash << filename;
+    _deleteFileRecordPhash->reset();
+    return true;
+}
+
+void SyncJournalDb::startSyncGeneration()
+{
+    flush();
+    QMutexLocker locker(&_mutex);
+
+    if( !checkConnect() ) {
+        return;
+    }
+
+    // Uses the generation index, no need to look at the rows
+    SqlQuery query("SELECT MAX(generation) FROM metadata", _db);
+    qint64 last = 0;
+    if (query.next()) {
+        last = query.int64Value(0);
+    }
+    _generation = qMax(last, _generation) + 1;
+    qDebug() << Q_FUNC_INFO << _generation;
+}
+
+void SyncJournalDb::confirmFileRecord(const QString &file)
+{
+    if (_writer) {
+        QMutexLocker lock(&_writer->_mutex);
+        _writer->_pending._confirmedFileRecords.insert(file);
+        _writer->queued();
+        return;
+    }
+
+    QMutexLocker locker(&_mutex);
+    if( checkConnect() ) {
+        confirmFileRecordInternal(file);
+    }
+}
+
+void SyncJournalDb::confirmFileRecordInternal(const QString &filename)
+{
+    if (_generation == 0) {
+        return;
+    }
+    qlonglong phash = getPHash(filename);
+    _confirmFileRecordQuery->reset();
+    _confirmFileRecordQuery->bindValue(1, _generation);
+    _confirmFileRecordQuery->bindValue(2, QString::number(phash));
+    if( !_confirmFileRecordQuery->exec() ) {
+        qWarning() << "Exec error of SQL statement: "
+                   << _confirmFileRecordQuery->lastQuery()
+                   <<  " : " << _confirmFileRecordQuery->error();
+    }
+    _confirmFileRecordQuery->reset();
+}
+
 
 SyncJournalFileRecord SyncJournalDb::getFileRecord( const QString& filename )
 {
+    if (_writer) {
+        QMutexLocker lock(&_writer->_mutex);
+        // Look at the queued writes first, the newest ones first
+        const SyncJournalPendingWrites *queues[] = { &_writer->_pending, &_writer->_inFlight };
+        for (int i = 0; i < 2; ++i) {
+            if (queues[i]->_deletedFileRecords.contains(filename)) {
+                return SyncJournalFileRecord();
+            }
+            auto it = queues[i]->_fileRecords.constFind(filename);
+            if (it != queues[i]->_fileRecords.constEnd()) {
+                return *it;
+            }
+        }
+    }
+
     QMutexLocker locker(&_mutex);
 
     qlonglong phash = getPHash( filename );
@@ -698,44 +1120,41 @@ SyncJournalFileRecord SyncJournalDb::getFileRecord( const QString& filename )
     return rec;
 }
 
-bool SyncJournalDb::postSyncCleanup(const QSet<QString> &items )
+bool SyncJournalDb::postSyncCleanup(const QSet<QString> &incompleteDirs)
 {
+    flush();
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
         return false;
     }
 
-    SqlQuery query(_db);
-    query.prepare("SELECT phash, path FROM metadata order by path");
-
-    if (!query.exec()) {
-        QString err = query.error();
-        qDebug() << "Error creating prepared statement: " << query.lastQuery() << ", Error:" << err;;
+    if (_generation == 0) {
+        qDebug() << "No sync generation was started, not cleaning the journal";
         return false;
     }
 
-    QStringList superfluousItems;
-
-    while(query.next()) {
-        const QString file = query.stringValue(1);
-        bool contained = items.contains(file);
-        if( !contained ) {
-            superfluousItems.append(query.stringValue(0));
+    // The content of these directories was not fully discovered: keep what is below
+    foreach (const QString &dir, incompleteDirs) {
+        SqlQuery keepQuery(_db);
+        keepQuery.prepare("UPDATE metadata SET generation=?1 WHERE generation<?1 AND (path=?2 OR (path > (?2||'/') AND path < (?2||'0')))");
+        keepQuery.bindValue(1, _generation);
+        keepQuery.bindValue(2, dir);
+        if (!keepQuery.exec()) {
+            qDebug() << "Error keeping journal entries below" << dir << keepQuery.error();
+            return false;
         }
     }
 
-    if( superfluousItems.count() )  {
-        QString sql = "DELETE FROM metadata WHERE phash in ("+ superfluousItems.join(",")+")";
-        qDebug() << "Sync Journal cleanup: " << sql;
-        SqlQuery delQuery(_db);
-        delQuery.prepare(sql);
-        if( !delQuery.exec() ) {
-            QString err = delQuery.error();
-            qDebug() << "Error removing superfluous journal entries: " << delQuery.lastQuery() << ", Error:" << err;;
-            return false;
-        }
+    SqlQuery delQuery(_db);
+    delQuery.prepare("DELETE FROM metadata WHERE generation<?1");
+    delQuery.bindValue(1, _generation);
+    if( !delQuery.exec() ) {
+        QString err = delQuery.error();
+        qDebug() << "Error removing superfluous journal entries: " << delQuery.lastQuery() << ", Error:" << err;;
+        return false;
     }
+    qDebug() << "Sync Journal cleanup: removed the entries older than generation" << _generation;
 
     // Incoroporate results back into main DB
     walCheckpoint();
@@ -749,6 +1168,7 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString> &items )
 
 int SyncJournalDb::getFileRecordCount()
 {
+    flush();
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
@@ -805,6 +1225,24 @@ static bool deleteBatch(SqlQuery & query, const QStringList & entries, const QSt
 
 SyncJournalDb::DownloadInfo SyncJournalDb::getDownloadInfo(const QString& file)
 {
+    {
+        QMutexLocker lock(&_transferCacheMutex);
+        if (_transferCache) {
+            return _transferCache->_downloadInfos.value(file);
+        }
+    }
+
+    if (_writer) {
+        QMutexLocker lock(&_writer->_mutex);
+        const SyncJournalPendingWrites *queues[] = { &_writer->_pending, &_writer->_inFlight };
+        for (int i = 0; i < 2; ++i) {
+            auto it = queues[i]->_downloadInfos.constFind(file);
+            if (it != queues[i]->_downloadInfos.constEnd()) {
+                return *it;
+            }
+        }
+    }
+
     QMutexLocker locker(&_mutex);
 
     DownloadInfo res;
@@ -831,12 +1269,34 @@ SyncJournalDb::DownloadInfo SyncJournalDb::getDownloadInfo(const QString& file)
 
 void SyncJournalDb::setDownloadInfo(const QString& file, const SyncJournalDb::DownloadInfo& i)
 {
+    {
+        QMutexLocker lock(&_transferCacheMutex);
+        if (_transferCache) {
+            if (i._valid) {
+                _transferCache->_downloadInfos.insert(file, i);
+            } else {
+                _transferCache->_downloadInfos.remove(file);
+            }
+        }
+    }
+
+    if (_writer) {
+        QMutexLocker lock(&_writer->_mutex);
+        _writer->_pending._downloadInfos.insert(file, i);
+        _writer->queued();
+        return;
+    }
+
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
         return;
     }
+    setDownloadInfoInternal(file, i);
+}
 
+void SyncJournalDb::setDownloadInfoInternal(const QString& file, const SyncJournalDb::DownloadInfo& i)
+{
     if (i._valid) {
         _setDownloadInfoQuery->reset();
         _setDownloadInfoQuery->bindValue(1, file);
@@ -867,6 +1327,7 @@ void SyncJournalDb::setDownloadInfo(const QString& file, const SyncJournalDb::Do
 
 QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInfos(const QSet<QString>& keep)
 {
+    flush();
     QVector<SyncJournalDb::DownloadInfo> empty_result;
     QMutexLocker locker(&_mutex);
 
@@ -900,12 +1361,20 @@ QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInf
     if (!deleteBatch(*_deleteDownloadInfoQuery, superfluousPaths, "downloadinfo"))
         return empty_result;
 
+    QMutexLocker lock(&_transferCacheMutex);
+    if (_transferCache) {
+        foreach (const QString &file, superfluousPaths) {
+            _transferCache->_downloadInfos.remove(file);
+        }
+    }
+
     return deleted_entries;
 }
 
 int SyncJournalDb::downloadInfoCount()
 {
     int re = 0;
+    flush();
 
     QMutexLocker locker(&_mutex);
     if( checkConnect() ) {
@@ -923,6 +1392,24 @@ int SyncJournalDb::downloadInfoCount()
 
 SyncJournalDb::UploadInfo SyncJournalDb::getUploadInfo(const QString& file)
 {
+    {
+        QMutexLocker lock(&_transferCacheMutex);
+        if (_transferCache) {
+            return _transferCache->_uploadInfos.value(file);
+        }
+    }
+
+    if (_writer) {
+        QMutexLocker lock(&_writer->_mutex);
+        const SyncJournalPendingWrites *queues[] = { &_writer->_pending, &_writer->_inFlight };
+        for (int i = 0; i < 2; ++i) {
+            auto it = queues[i]->_uploadInfos.constFind(file);
+            if (it != queues[i]->_uploadInfos.constEnd()) {
+                return *it;
+            }
+        }
+    }
+
     QMutexLocker locker(&_mutex);
 
     UploadInfo res;
@@ -954,12 +1441,34 @@ SyncJournalDb::UploadInfo SyncJournalDb::getUploadInfo(const QString& file)
 
 void SyncJournalDb::setUploadInfo(const QString& file, const SyncJournalDb::UploadInfo& i)
 {
+    {
+        QMutexLocker lock(&_transferCacheMutex);
+        if (_transferCache) {
+            if (i._valid) {
+                _transferCache->_uploadInfos.insert(file, i);
+            } else {
+                _transferCache->_uploadInfos.remove(file);
+            }
+        }
+    }
+
+    if (_writer) {
+        QMutexLocker lock(&_writer->_mutex);
+        _writer->_pending._uploadInfos.insert(file, i);
+        _writer->queued();
+        return;
+    }
+
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
         return;
     }
+    setUploadInfoInternal(file, i);
+}
 
+void SyncJournalDb::setUploadInfoInternal(const QString& file, const SyncJournalDb::UploadInfo& i)
+{
     if (i._valid) {
         _setUploadInfoQuery->reset();
         _setUploadInfoQuery->bindValue(1, file);
@@ -989,41 +1498,36 @@ void SyncJournalDb::setUploadInfo(const QString& file, const SyncJournalDb::Uplo
     }
 }
 
-bool SyncJournalDb::deleteStaleUploadInfos(const QSet<QString> &keep)
+SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry( const QString& file )
 {
-    QMutexLocker locker(&_mutex);
-
-    if (!checkConnect()) {
-        return false;
-    }
+    SyncJournalErrorBlacklistRecord entry;
 
-    SqlQuery query(_db);
-    query.prepare("SELECT path FROM uploadinfo");
+    if( file.isEmpty() ) return entry;
 
-    if (!query.exec()) {
-        QString err = query.error();
-        qDebug() << "Error creating prepared statement: " << query.lastQuery() << ", Error:" << err;
-        return false;
+    {
+        QMutexLocker lock(&_transferCacheMutex);
+        if (_transferCache) {
+            auto it = _transferCache->_blacklist.constFind(blacklistKey(file));
+            if (it != _transferCache->_blacklist.constEnd()) {
+                entry = *it;
+                entry._file = file; // as found by the query
+            }
+            return entry;
+        }
     }
 
-    QStringList superfluousPaths;
-
-    while (query.next()) {
-        const QString file = query.stringValue(0);
-        if (!keep.contains(file)) {
-            superfluousPaths.append(file);
+    if (_writer) {
+        QMutexLocker lock(&_writer->_mutex);
+        const SyncJournalPendingWrites *queues[] = { &_writer->_pending, &_writer->_inFlight };
+        for (int i = 0; i < 2; ++i) {
+            auto it = queues[i]->_blacklist.constFind(file);
+            if (it != queues[i]->_blacklist.constEnd()) {
+                return *it; // a wiped entry has an empty _file, just like a missing one
+            }
         }
     }
 
-    return deleteBatch(*_deleteUploadInfoQuery, superfluousPaths, "uploadinfo");
-}
-
-SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry( const QString& file )
-{
     QMutexLocker locker(&_mutex);
-    SyncJournalErrorBlacklistRecord entry;
-
-    if( file.isEmpty() ) return entry;
 
     // SELECT lastTryEtag, lastTryModtime, retrycount, errorstring
 
@@ -1050,40 +1554,143 @@ SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry( const QStrin
     return entry;
 }
 
-bool SyncJournalDb::deleteStaleErrorBlacklistEntries(const QSet<QString> &keep)
+void SyncJournalDb::loadTransferCache()
 {
-    QMutexLocker locker(&_mutex);
+    flush();
+    QScopedPointer<SyncJournalTransferCache> cache(new SyncJournalTransferCache);
+    {
+        QMutexLocker locker(&_mutex);
+        if (!checkConnect()) {
+            return;
+        }
+        SyncTraceSpan span("journal", "loadTransferCache");
 
-    if (!checkConnect()) {
-        return false;
-    }
+        SqlQuery query(_db);
+        query.prepare("SELECT path, tmpfile, etag, errorcount FROM downloadinfo");
+        if (!query.exec()) {
+            qDebug() << "Error loading the downloadinfo entries:" << query.error();
+            return;
+        }
+        while (query.next()) {
+            DownloadInfo info;
+            info._tmpfile    = query.stringValue(1);
+            info._etag       = query.baValue(2);
+            info._errorCount = query.intValue(3);
+            info._valid      = true;
+            cache->_downloadInfos.insert(query.stringValue(0), info);
+        }
 
-    SqlQuery query(_db);
-    query.prepare("SELECT path FROM blacklist");
+        query.prepare("SELECT path, chunk, transferid, errorcount, size, modtime FROM uploadinfo");
+        if (!query.exec()) {
+            qDebug() << "Error loading the uploadinfo entries:" << query.error();
+            return;
+        }
+        while (query.next()) {
+            UploadInfo info;
+            info._chunk      = query.intValue(1);
+            info._transferid = query.intValue(2);
+            info._errorCount = query.intValue(3);
+            info._size       = query.int64Value(4);
+            info._modtime    = Utility::qDateTimeFromTime_t(query.int64Value(5));
+            info._valid      = true;
+            cache->_uploadInfos.insert(query.stringValue(0), info);
+        }
 
-    if (!query.exec()) {
-        QString err = query.error();
-        qDebug() << "Error creating prepared statement: " << query.lastQuery() << ", Error:" << err;
-        return false;
+        query.prepare("SELECT path, lastTryEtag, lastTryModtime, retrycount, errorstring, lastTryTime, "
+                      "ignoreDuration FROM blacklist");
+        if (!query.exec()) {
+            qDebug() << "Error loading the blacklist entries:" << query.error();
+            return;
+        }
+        while (query.next()) {
+            SyncJournalErrorBlacklistRecord entry;
+            entry._file           = query.stringValue(0);
+            entry._lastTryEtag    = query.baValue(1);
+            entry._lastTryModtime = query.int64Value(2);
+            entry._retryCount     = query.intValue(3);
+            entry._errorString    = query.stringValue(4);
+            entry._lastTryTime    = query.int64Value(5);
+            entry._ignoreDuration = query.int64Value(6);
+            cache->_blacklist.insert(blacklistKey(entry._file), entry);
+        }
+        span.setArg(QLatin1String("entries"), cache->_downloadInfos.count()
+                    + cache->_uploadInfos.count() + cache->_blacklist.count());
     }
 
-    QStringList superfluousPaths;
+    QMutexLocker lock(&_transferCacheMutex);
+    _transferCache.swap(cache);
+}
 
-    while (query.next()) {
-        const QString file = query.stringValue(0);
-        if (!keep.contains(file)) {
-            superfluousPaths.append(file);
+void SyncJournalDb::dropTransferCache()
+{
+    QMutexLocker lock(&_transferCacheMutex);
+    _transferCache.reset();
+}
+
+QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::deleteStaleEntries(const PathHashSet &downloads,
+                                                                       const PathHashSet &uploads,
+                                                                       const PathHashSet &blacklisted)
+{
+    // The entries are compared in memory, load them if the sync did not
+    bool temporaryCache = false;
+    {
+        QMutexLocker lock(&_transferCacheMutex);
+        temporaryCache = !_transferCache;
+    }
+    if (temporaryCache) {
+        loadTransferCache();
+    }
+
+    QStringList staleDownloads;
+    QStringList staleUploads;
+    QStringList staleBlacklist;
+    QVector<DownloadInfo> deletedDownloads;
+    {
+        QMutexLocker lock(&_transferCacheMutex);
+        if (_transferCache) {
+            for (auto it = _transferCache->_downloadInfos.constBegin(); it != _transferCache->_downloadInfos.constEnd(); ++it) {
+                if (!downloads.contains(it.key())) {
+                    staleDownloads.append(it.key());
+                    deletedDownloads.append(it.value());
+                }
+            }
+            for (auto it = _transferCache->_uploadInfos.constBegin(); it != _transferCache->_uploadInfos.constEnd(); ++it) {
+                if (!uploads.contains(it.key())) {
+                    staleUploads.append(it.key());
+                }
+            }
+            foreach (const SyncJournalErrorBlacklistRecord &entry, _transferCache->_blacklist) {
+                if (!blacklisted.contains(entry._file)) {
+                    staleBlacklist.append(entry._file);
+                }
+            }
         }
     }
 
-    SqlQuery delQuery(_db);
-    delQuery.prepare("DELETE FROM blacklist WHERE path = ?");
-    return deleteBatch(delQuery, superfluousPaths, "blacklist");
+    // Queued like the other writes, the setters update the cache
+    foreach (const QString &file, staleDownloads) {
+        setDownloadInfo(file, DownloadInfo());
+    }
+    foreach (const QString &file, staleUploads) {
+        setUploadInfo(file, UploadInfo());
+    }
+    foreach (const QString &file, staleBlacklist) {
+        wipeErrorBlacklistEntry(file);
+    }
+    if (!staleDownloads.isEmpty() || !staleUploads.isEmpty() || !staleBlacklist.isEmpty()) {
+        qDebug() << "Removing stale entries:" << staleDownloads.count() << "downloadinfo,"
+                 << staleUploads.count() << "uploadinfo," << staleBlacklist.count() << "blacklist";
+    }
+    if (temporaryCache) {
+        dropTransferCache();
+    }
+    return deletedDownloads;
 }
 
 int SyncJournalDb::errorBlackListEntryCount()
 {
     int re = 0;
+    flush();
 
     QMutexLocker locker(&_mutex);
     if( checkConnect() ) {
@@ -1101,6 +1708,13 @@ int SyncJournalDb::errorBlackListEntryCount()
 
 int SyncJournalDb::wipeErrorBlacklist()
 {
+    {
+        QMutexLocker lock(&_transferCacheMutex);
+        if (_transferCache) {
+            _transferCache->_blacklist.clear();
+        }
+    }
+    flush();
     QMutexLocker locker(&_mutex);
     if( checkConnect() ) {
         SqlQuery query(_db);
@@ -1122,26 +1736,67 @@ void SyncJournalDb::wipeErrorBlacklistEntry( const QString& file )
         return;
     }
 
+    {
+        QMutexLocker lock(&_transferCacheMutex);
+        if (_transferCache) {
+            auto it = _transferCache->_blacklist.find(blacklistKey(file));
+            // The entry is deleted by its exact path
+            if (it != _transferCache->_blacklist.end() && it->_file == file) {
+                _transferCache->_blacklist.erase(it);
+            }
+        }
+    }
+
+    if (_writer) {
+        QMutexLocker lock(&_writer->_mutex);
+        _writer->_pending._blacklist.insert(file, SyncJournalErrorBlacklistRecord());
+        _writer->queued();
+        return;
+    }
+
     QMutexLocker locker(&_mutex);
     if( checkConnect() ) {
-        SqlQuery query(_db);
+        wipeErrorBlacklistEntryInternal(file);
+    }
+}
 
-        query.prepare("DELETE FROM blacklist WHERE path=?1");
-        query.bindValue(1, file);
-        if( ! query.exec() ) {
-            sqlFail("Deletion of blacklist item failed.", query);
-        }
+void SyncJournalDb::wipeErrorBlacklistEntryInternal( const QString& file )
+{
+    SqlQuery query(_db);
+
+    query.prepare("DELETE FROM blacklist WHERE path=?1");
+    query.bindValue(1, file);
+    if( ! query.exec() ) {
+        sqlFail("Deletion of blacklist item failed.", query);
     }
 }
 
 void SyncJournalDb::updateErrorBlacklistEntry( const SyncJournalErrorBlacklistRecord& item )
 {
-    if( !checkConnect() ) {
+    {
+        QMutexLocker lock(&_transferCacheMutex);
+        if (_transferCache) {
+            _transferCache->_blacklist.insert(blacklistKey(item._file), item);
+        }
+    }
+
+    if (_writer) {
+        QMutexLocker lock(&_writer->_mutex);
+        _writer->_pending._blacklist.insert(item._file, item);
+        _writer->queued();
         return;
     }
 
     QMutexLocker locker(&_mutex);
 
+    if( !checkConnect() ) {
+        return;
+    }
+    updateErrorBlacklistEntryInternal(item);
+}
+
+void SyncJournalDb::updateErrorBlacklistEntryInternal( const SyncJournalErrorBlacklistRecord& item )
+{
     _setErrorBlacklistQuery->bindValue(1, item._file);
     _setErrorBlacklistQuery->bindValue(2, item._lastTryEtag);
     _setErrorBlacklistQuery->bindValue(3, QString::number(item._lastTryModtime));
@@ -1220,6 +1875,7 @@ void SyncJournalDb::setPollInfo(const SyncJournalDb::PollInfo& info)
 
 void SyncJournalDb::avoidRenamesOnNextSync(const QString& path)
 {
+    flush();
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
@@ -1227,9 +1883,8 @@ void SyncJournalDb::avoidRenamesOnNextSync(const QString& path)
     }
 
     SqlQuery query(_db);
-    query.prepare("UPDATE metadata SET fileid = '', inode = '0' WHERE path == ?1 OR path LIKE(?2||'/%')");
+    query.prepare("UPDATE metadata SET fileid = '', inode = '0' WHERE path == ?1 OR (path > (?1||'/') AND path < (?1||'0'))");
     query.bindValue(1, path);
-    query.bindValue(2, path);
     if( !query.exec() ) {
         qDebug() << Q_FUNC_INFO << "SQL error in avoidRenamesOnNextSync: "<< query.error();
     } else {
@@ -1248,6 +1903,7 @@ void SyncJournalDb::avoidReadFromDbOnNextSync(const QString& fileName)
     //get the info from the server
     // We achieve that by clearing the etag of the parents directory recursively
 
+    flush();
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
@@ -1270,12 +1926,21 @@ void SyncJournalDb::avoidReadFromDbOnNextSync(const QString& fileName)
 
 void SyncJournalDb::commit(const QString& context, bool startTrans)
 {
+    if (_writer && startTrans) {
+        QMutexLocker lock(&_writer->_mutex);
+        if (!_writer->_pending.isEmpty() || !_writer->_inFlight.isEmpty()) {
+            // The writer thread commits soon anyway, together with its queued writes
+            return;
+        }
+    }
+    flush();
     QMutexLocker lock(&_mutex);
     commitInternal(context, startTrans);
 }
 
 void SyncJournalDb::commitIfNeededAndStartNewTransaction(const QString &context)
 {
+    flush();
     QMutexLocker lock(&_mutex);
     if( _transaction == 1 ) {
         commitInternal(context, true);
@@ -1297,6 +1962,7 @@ void SyncJournalDb::commitInternal(const QString& context, bool startTrans )
 
 SyncJournalDb::~SyncJournalDb()
 {
+    _writer.reset(); // writes what is still queued
     close();
 }
 
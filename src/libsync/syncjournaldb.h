@@ -25,11 +25,24 @@
 namespace OCC {
 class SyncJournalFileRecord;
 class SyncJournalErrorBlacklistRecord;
+class SyncJournalWriter;
+class PathHashSet;
+struct SyncJournalPendingWrites;
+struct SyncJournalTransferCache;
 
 /**
  * Class that handle the sync database
  *
  * This class is thread safe. All public function are locking the mutex.
+ * It is used from the GUI thread, the csync thread and the propagation
+ * thread of the SyncEngine during a sync.
+ *
+ * The frequent small writes (file records, download/upload info and blacklist entries)
+ * are queued and written by a writer thread in grouped transactions. The getters
+ * look at the queued writes first, so they always see what was set.
+ *
+ * It owns all connections to the journal file: the read-write connection used by
+ * this class and a pool of read-only connections for csync and the status queries.
  */
 class OWNCLOUDSYNC_EXPORT SyncJournalDb : public QObject
 {
@@ -82,10 +95,25 @@ public:
 
     UploadInfo getUploadInfo(const QString &file);
     void setUploadInfo(const QString &file, const UploadInfo &i);
-    bool deleteStaleUploadInfos(const QSet<QString>& keep);
 
     SyncJournalErrorBlacklistRecord errorBlacklistEntry( const QString& );
-    bool deleteStaleErrorBlacklistEntries(const QSet<QString>& keep);
+
+    /**
+     * Load the download infos, upload infos and blacklist entries in memory for a sync
+     * run. Until dropTransferCache(), their getters look there instead of querying the
+     * database, and the setters update it and write through the writer as usual.
+     */
+    void loadTransferCache();
+    void dropTransferCache();
+
+    /**
+     * Remove the download infos, upload infos and blacklist entries of the files that
+     * are not in \a downloads, \a uploads and \a blacklisted respectively, in one go.
+     * Returns the removed download infos: their temporary files are to be deleted.
+     */
+    QVector<DownloadInfo> deleteStaleEntries(const PathHashSet &downloads,
+                                             const PathHashSet &uploads,
+                                             const PathHashSet &blacklisted);
 
     void avoidRenamesOnNextSync(const QString &path);
     void setPollInfo(const PollInfo &);
@@ -97,7 +125,22 @@ public:
      */
     void avoidReadFromDbOnNextSync(const QString& fileName);
 
-    bool postSyncCleanup( const QSet<QString>& items );
+    /**
+     * Start a new sync run generation. The records confirmed or written from now on
+     * are stamped with it.
+     */
+    void startSyncGeneration();
+
+    /**
+     * Mark the record of \a file as still valid in the current generation.
+     */
+    void confirmFileRecord(const QString &file);
+
+    /**
+     * Remove the records that were not confirmed or written in the current generation,
+     * except those below \a incompleteDirs whose content was not fully discovered.
+     */
+    bool postSyncCleanup(const QSet<QString> &incompleteDirs);
 
     /* Because sqlite transactions is really slow, we encapsulate everything in big transactions
      * Commit will actually commit the transaction and create a new one.
@@ -105,8 +148,23 @@ public:
     void commit(const QString &context, bool startTrans = true);
     void commitIfNeededAndStartNewTransaction(const QString &context);
 
+    /**
+     * Block until all queued writes are committed to the database.
+     * Must not be called with the mutex held.
+     */
+    void flush();
+
     void close();
 
+    /**
+     * Take a read-only connection to the journal from the pool, opening one if needed.
+     * It only sees committed data. It must be used by one thread at a time and be
+     * given back with releaseReadConnection(), as soon as it is idle: as long as it is
+     * open, the -wal file of the journal stays. Returns 0 on error.
+     */
+    SqlDatabase *acquireReadConnection();
+    void releaseReadConnection(SqlDatabase *db);
+
     /**
      * return true if everything is correct
      */
@@ -119,6 +177,15 @@ public:
     bool isUpdateFrom_1_5();
 
 private:
+    friend class SyncJournalWriter;
+    void writePendingWrites(const SyncJournalPendingWrites &writes);
+    bool setFileRecordInternal(const SyncJournalFileRecord &record);
+    bool deleteFileRecordInternal(const QString &filename);
+    void confirmFileRecordInternal(const QString &filename);
+    void setDownloadInfoInternal(const QString &file, const DownloadInfo &i);
+    void setUploadInfoInternal(const QString &file, const UploadInfo &i);
+    void updateErrorBlacklistEntryInternal(const SyncJournalErrorBlacklistRecord &item);
+    void wipeErrorBlacklistEntryInternal(const QString &file);
     bool updateDatabaseStructure();
     bool updateMetadataTableStructure();
     bool updateErrorBlacklistTableStructure();
@@ -134,6 +201,7 @@ private:
     QMutex _mutex; // Public functions are protected with the mutex.
     int _transaction;
     bool _possibleUpgradeFromMirall_1_5;
+    qint64 _generation; // generation of the current sync run, 0 if none was started
     QScopedPointer<SqlQuery> _getFileRecordQuery;
     QScopedPointer<SqlQuery> _setFileRecordQuery;
     QScopedPointer<SqlQuery> _getDownloadInfoQuery;
@@ -144,6 +212,7 @@ private:
     QScopedPointer<SqlQuery> _deleteUploadInfoQuery;
     QScopedPointer<SqlQuery> _deleteFileRecordPhash;
     QScopedPointer<SqlQuery> _deleteFileRecordRecursively;
+    QScopedPointer<SqlQuery> _confirmFileRecordQuery;
     QScopedPointer<SqlQuery> _getErrorBlacklistQuery;
     QScopedPointer<SqlQuery> _setErrorBlacklistQuery;
 
@@ -152,6 +221,19 @@ private:
      * that would write the etag and would void the purpose of avoidReadFromDbOnNextSync
      */
     QList<QString> _avoidReadFromDbOnNextSyncFilter;
+
+    /* Read-only connections that are not in use, see acquireReadConnection() */
+    QList<SqlDatabase *> _readConnections;
+    int _readConnectionsInUse;
+    /* The journal was closed while read connections were in use: they keep the -wal file */
+    bool _walKeptByReaders;
+
+    /* Writes the queued writes in the background. Null if writes are done synchronously. */
+    QScopedPointer<SyncJournalWriter> _writer;
+
+    /* The small tables in memory during a sync run, see loadTransferCache(). Null otherwise. */
+    QScopedPointer<SyncJournalTransferCache> _transferCache;
+    QMutex _transferCacheMutex; // protects _transferCache, can be locked with _mutex held but not the opposite
 };
 
 bool OWNCLOUDSYNC_EXPORT
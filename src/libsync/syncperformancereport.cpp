@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "syncperformancereport.h"
+#include "utility.h"
+
+#include <algorithm>
+
+namespace OCC {
+
+SyncPerformanceReport::SyncPerformanceReport()
+    : completed(false)
+    , totalDuration(0)
+    , discoveryDuration(0)
+    , reconcileDuration(0)
+    , propagationDuration(0)
+    , walkToPropagateDuration(0)
+    , localFiles(0)
+    , remoteFiles(0)
+    , remoteDirsFetched(0)
+    , remoteDirsFromDb(0)
+    , syncItems(0)
+    , peakMemory(0)
+    , journalQueries(0)
+    , csyncJournalQueries(0)
+    , bytesUploaded(0)
+    , bytesDownloaded(0)
+    , averageParallelRequests(0)
+    , maxParallelRequests(0)
+    , uploadLimitedDuration(0)
+    , downloadLimitedDuration(0)
+{
+}
+
+qint64 SyncPerformanceReport::percentile(const QVector<qint64> &sorted, int percent)
+{
+    if (sorted.isEmpty()) {
+        return 0;
+    }
+    int rank = (percent * sorted.size() + 99) / 100;
+    return sorted.at(qBound(0, rank - 1, sorted.size() - 1));
+}
+
+QByteArray SyncPerformanceReport::toJson() const
+{
+    QByteArray out = "{\n";
+    out += "  \"folder\": " + Utility::jsonString(folder) + ",\n";
+    out += "  \"startTime\": " + Utility::jsonString(startTime.toUTC().toString(Qt::ISODate)) + ",\n";
+    out += QByteArray("  \"completed\": ") + (completed ? "true" : "false") + ",\n";
+    out += "  \"durationsMsec\": {\"total\": " + QByteArray::number(totalDuration)
+            + ", \"discovery\": " + QByteArray::number(discoveryDuration)
+            + ", \"reconcile\": " + QByteArray::number(reconcileDuration)
+            + ", \"propagation\": " + QByteArray::number(propagationDuration)
+            + ", \"walkToPropagate\": " + QByteArray::number(walkToPropagateDuration) + "},\n";
+    out += "  \"discovery\": {\"localFiles\": " + QByteArray::number(localFiles)
+            + ", \"remoteFiles\": " + QByteArray::number(remoteFiles)
+            + ", \"remoteDirsFetched\": " + QByteArray::number(remoteDirsFetched)
+            + ", \"remoteDirsFromDb\": " + QByteArray::number(remoteDirsFromDb)
+            + ", \"syncItems\": " + QByteArray::number(syncItems) + "},\n";
+    out += "  \"peakMemoryBytes\": " + QByteArray::number(peakMemory) + ",\n";
+    out += "  \"journal\": {\"queries\": " + QByteArray::number(journalQueries)
+            + ", \"csyncQueries\": " + QByteArray::number(csyncJournalQueries) + "},\n";
+    out += "  \"transfer\": {\"bytesUploaded\": " + QByteArray::number(bytesUploaded)
+            + ", \"bytesDownloaded\": " + QByteArray::number(bytesDownloaded)
+            + ", \"uploadLimitedMsec\": " + QByteArray::number(uploadLimitedDuration)
+            + ", \"downloadLimitedMsec\": " + QByteArray::number(downloadLimitedDuration) + "},\n";
+    out += "  \"requestLatenciesMsec\": {";
+    for (QMap<QByteArray, RequestStats>::const_iterator it = requests.constBegin(); it != requests.constEnd(); ++it) {
+        if (it != requests.constBegin()) {
+            out += ',';
+        }
+        out += "\n    " + Utility::jsonString(QString::fromLatin1(it.key()))
+                + ": {\"count\": " + QByteArray::number(it->count)
+                + ", \"p50\": " + QByteArray::number(it->p50)
+                + ", \"p95\": " + QByteArray::number(it->p95)
+                + ", \"p99\": " + QByteArray::number(it->p99)
+                + ", \"max\": " + QByteArray::number(it->max) + "}";
+    }
+    out += requests.isEmpty() ? "},\n" : "\n  },\n";
+    out += "  \"parallelRequests\": {\"average\": " + QByteArray::number(averageParallelRequests, 'f', 2)
+            + ", \"max\": " + QByteArray::number(maxParallelRequests) + "}\n";
+    out += "}\n";
+    return out;
+}
+
+QByteArray SyncPerformanceReport::toPrometheus() const
+{
+    // Text exposition format, as read by the node exporter textfile collector
+    QByteArray out;
+    const QByteArray folderLabel = "folder=\"" + QByteArray(folder.toUtf8()).replace('\\', "\\\\").replace('"', "\\\"") + "\"";
+    QByteArray lastMetric;
+    auto metric = [&](const char *name, const char *type, const QByteArray &labels, double value) {
+        if (lastMetric != name) {
+            out += QByteArray("# TYPE ") + name + ' ' + type + '\n';
+            lastMetric = name;
+        }
+        out += QByteArray(name) + '{' + folderLabel + labels + "} " + QByteArray::number(value, 'g', 15) + '\n';
+    };
+
+    metric("owncloud_sync_completed", "gauge", QByteArray(), completed ? 1 : 0);
+    metric("owncloud_sync_start_timestamp_seconds", "gauge", QByteArray(), startTime.toMSecsSinceEpoch() / 1000.);
+    metric("owncloud_sync_duration_seconds", "gauge", ",phase=\"total\"", totalDuration / 1000.);
+    metric("owncloud_sync_duration_seconds", "gauge", ",phase=\"discovery\"", discoveryDuration / 1000.);
+    metric("owncloud_sync_duration_seconds", "gauge", ",phase=\"reconcile\"", reconcileDuration / 1000.);
+    metric("owncloud_sync_duration_seconds", "gauge", ",phase=\"propagation\"", propagationDuration / 1000.);
+    metric("owncloud_sync_duration_seconds", "gauge", ",phase=\"walk_to_propagate\"", walkToPropagateDuration / 1000.);
+    metric("owncloud_sync_files_discovered", "gauge", ",replica=\"local\"", localFiles);
+    metric("owncloud_sync_files_discovered", "gauge", ",replica=\"remote\"", remoteFiles);
+    metric("owncloud_sync_remote_dirs", "gauge", ",source=\"server\"", remoteDirsFetched);
+    metric("owncloud_sync_remote_dirs", "gauge", ",source=\"journal\"", remoteDirsFromDb);
+    metric("owncloud_sync_items", "gauge", QByteArray(), syncItems);
+    metric("owncloud_sync_peak_memory_bytes", "gauge", QByteArray(), peakMemory);
+    metric("owncloud_sync_journal_queries", "gauge", ",user=\"client\"", journalQueries);
+    metric("owncloud_sync_journal_queries", "gauge", ",user=\"csync\"", csyncJournalQueries);
+    metric("owncloud_sync_bytes", "gauge", ",direction=\"up\"", bytesUploaded);
+    metric("owncloud_sync_bytes", "gauge", ",direction=\"down\"", bytesDownloaded);
+    metric("owncloud_sync_bandwidth_limited_seconds", "gauge", ",direction=\"up\"", uploadLimitedDuration / 1000.);
+    metric("owncloud_sync_bandwidth_limited_seconds", "gauge", ",direction=\"down\"", downloadLimitedDuration / 1000.);
+    metric("owncloud_sync_parallel_requests", "gauge", ",stat=\"average\"", averageParallelRequests);
+    metric("owncloud_sync_parallel_requests", "gauge", ",stat=\"max\"", maxParallelRequests);
+    for (QMap<QByteArray, RequestStats>::const_iterator it = requests.constBegin(); it != requests.constEnd(); ++it) {
+        metric("owncloud_sync_requests", "gauge", ",verb=\"" + it.key() + "\"", it->count);
+    }
+    for (QMap<QByteArray, RequestStats>::const_iterator it = requests.constBegin(); it != requests.constEnd(); ++it) {
+        const QByteArray verb = ",verb=\"" + it.key() + "\"";
+        metric("owncloud_sync_request_latency_seconds", "gauge", verb + ",quantile=\"0.5\"", it->p50 / 1000.);
+        metric("owncloud_sync_request_latency_seconds", "gauge", verb + ",quantile=\"0.95\"", it->p95 / 1000.);
+        metric("owncloud_sync_request_latency_seconds", "gauge", verb + ",quantile=\"0.99\"", it->p99 / 1000.);
+        metric("owncloud_sync_request_latency_seconds", "gauge", verb + ",quantile=\"1\"", it->max / 1000.);
+    }
+    return out;
+}
+
+SyncPerformanceRecorder *SyncPerformanceRecorder::instance()
+{
+    static SyncPerformanceRecorder recorder;
+    return &recorder;
+}
+
+SyncPerformanceRecorder::SyncPerformanceRecorder()
+    : _running(false)
+    , _inFlight(0)
+    , _maxInFlight(0)
+    , _lastChange(0)
+    , _inFlightIntegral(0)
+    , _busyDuration(0)
+    , _uploadLimitedDuration(0)
+    , _downloadLimitedDuration(0)
+    , _bytesUploaded(0)
+    , _bytesDownloaded(0)
+{
+    _clock.start();
+}
+
+void SyncPerformanceRecorder::startRun()
+{
+    QMutexLocker lock(&_mutex);
+    _running = true;
+    _latencies.clear();
+    _maxInFlight = _inFlight;
+    _lastChange = _clock.elapsed();
+    _inFlightIntegral = 0;
+    _busyDuration = 0;
+    _uploadLimitedDuration = 0;
+    _downloadLimitedDuration = 0;
+    _bytesUploaded = 0;
+    _bytesDownloaded = 0;
+}
+
+void SyncPerformanceRecorder::finishRun(SyncPerformanceReport *report)
+{
+    QMutexLocker lock(&_mutex);
+    if (!_running) {
+        return;
+    }
+    updateParallelism(0);
+    _running = false;
+
+    for (QHash<QByteArray, QVector<qint64> >::iterator it = _latencies.begin(); it != _latencies.end(); ++it) {
+        QVector<qint64> &values = it.value();
+        std::sort(values.begin(), values.end());
+        SyncPerformanceReport::RequestStats stats;
+        stats.count = values.size();
+        stats.p50 = SyncPerformanceReport::percentile(values, 50);
+        stats.p95 = SyncPerformanceReport::percentile(values, 95);
+        stats.p99 = SyncPerformanceReport::percentile(values, 99);
+        stats.max = values.last();
+        report->requests.insert(it.key(), stats);
+    }
+    _latencies.clear();
+
+    // Only the time with requests in flight counts, the discovery of the local
+    // tree would otherwise lower the average
+    report->averageParallelRequests = _busyDuration > 0 ? double(_inFlightIntegral) / _busyDuration : 0;
+    report->maxParallelRequests = _maxInFlight;
+    report->uploadLimitedDuration = _uploadLimitedDuration;
+    report->downloadLimitedDuration = _downloadLimitedDuration;
+    report->bytesUploaded = _bytesUploaded;
+    report->bytesDownloaded = _bytesDownloaded;
+}
+
+void SyncPerformanceRecorder::requestStarted()
+{
+    QMutexLocker lock(&_mutex);
+    updateParallelism(1);
+}
+
+void SyncPerformanceRecorder::requestFinished(const QByteArray &verb, qint64 msecs)
+{
+    QMutexLocker lock(&_mutex);
+    updateParallelism(-1);
+    if (_running && !verb.isEmpty()) {
+        _latencies[verb].append(msecs);
+    }
+}
+
+void SyncPerformanceRecorder::addLimitedDuration(bool upload, qint64 msecs)
+{
+    QMutexLocker lock(&_mutex);
+    if (!_running) {
+        return;
+    }
+    if (upload) {
+        _uploadLimitedDuration += msecs;
+    } else {
+        _downloadLimitedDuration += msecs;
+    }
+}
+
+void SyncPerformanceRecorder::addTransferredBytes(bool upload, qint64 bytes)
+{
+    QMutexLocker lock(&_mutex);
+    if (!_running) {
+        return;
+    }
+    if (upload) {
+        _bytesUploaded += bytes;
+    } else {
+        _bytesDownloaded += bytes;
+    }
+}
+
+void SyncPerformanceRecorder::updateParallelism(int change)
+{
+    // The count is kept outside of runs too, jobs may still be running when a run starts
+    qint64 now = _clock.elapsed();
+    if (_running && _inFlight > 0) {
+        _inFlightIntegral += _inFlight * (now - _lastChange);
+        _busyDuration += now - _lastChange;
+    }
+    _lastChange = now;
+    _inFlight = qMax(0, _inFlight + change);
+    if (_running) {
+        _maxInFlight = qMax(_maxInFlight, _inFlight);
+    }
+}
+
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef SYNCPERFORMANCEREPORT_H
+#define SYNCPERFORMANCEREPORT_H
+
+#include "owncloudlib.h"
+#include <QByteArray>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+namespace OCC {
+
+/**
+ * @brief Statistics of one sync run, to compare runs with each other
+ *
+ * Filled by the SyncEngine at the end of the sync. Folder writes it next to
+ * the sync run log and owncloudcmd prints it with --perf-report.
+ */
+struct OWNCLOUDSYNC_EXPORT SyncPerformanceReport
+{
+    struct RequestStats {
+        RequestStats() : count(0), p50(0), p95(0), p99(0), max(0) {}
+        int count;
+        // latencies in milliseconds
+        qint64 p50;
+        qint64 p95;
+        qint64 p99;
+        qint64 max;
+    };
+
+    SyncPerformanceReport();
+
+    QString folder;
+    QDateTime startTime;
+    bool completed; // false if the sync failed or was aborted before the end of the propagation
+
+    // milliseconds
+    qint64 totalDuration;
+    qint64 discoveryDuration;
+    qint64 reconcileDuration;
+    qint64 propagationDuration;
+    qint64 walkToPropagateDuration; // from the tree walks to the start of the propagation
+
+    qint64 localFiles;
+    qint64 remoteFiles;
+    qint64 remoteDirsFetched; // PROPFIND sent for the directory
+    qint64 remoteDirsFromDb; // directory content read from the journal
+    qint64 syncItems; // items handed to the propagator, including those with nothing to do
+
+    qint64 peakMemory; // bytes, peak resident memory of the process at the end of the sync
+
+    qint64 journalQueries; // statements executed by the journal
+    qint64 csyncJournalQueries; // lookups done by csync during the discovery
+
+    // sent and received in the bodies of the PUT and GET requests, the retried and failed ones included
+    qint64 bytesUploaded;
+    qint64 bytesDownloaded;
+
+    QMap<QByteArray, RequestStats> requests; // by HTTP verb
+
+    double averageParallelRequests; // while the propagation was running
+    int maxParallelRequests;
+
+    qint64 uploadLimitedDuration; // time the transfers waited for the bandwidth limit
+    qint64 downloadLimitedDuration;
+
+    QByteArray toJson() const;
+    QByteArray toPrometheus() const;
+
+    /** The given percentile (0-100) of the sorted values, nearest-rank */
+    static qint64 percentile(const QVector<qint64> &sorted, int percent);
+};
+
+/**
+ * @brief Collects the statistics of the network requests of a sync run
+ *
+ * The requests, the bytes they transferred and the waits for the bandwidth
+ * limit are recorded while a run is active, i.e. between startRun() and finishRun().
+ *
+ * All the methods are thread-safe.
+ */
+class OWNCLOUDSYNC_EXPORT SyncPerformanceRecorder
+{
+public:
+    static SyncPerformanceRecorder *instance();
+
+    void startRun();
+    /** Stops the recording and adds what was collected to the report */
+    void finishRun(SyncPerformanceReport *report);
+
+    void requestStarted();
+    /** An empty verb ends a request that was deleted before it finished */
+    void requestFinished(const QByteArray &verb, qint64 msecs);
+
+    void addLimitedDuration(bool upload, qint64 msecs);
+    void addTransferredBytes(bool upload, qint64 bytes);
+
+private:
+    SyncPerformanceRecorder();
+
+    // Must be called with the mutex locked
+    void updateParallelism(int change);
+
+    QMutex _mutex;
+    bool _running;
+    QHash<QByteArray, QVector<qint64> > _latencies;
+    QElapsedTimer _clock;
+    int _inFlight;
+    int _maxInFlight;
+    qint64 _lastChange;
+    qint64 _inFlightIntegral; // sum of the requests in flight times the msecs they were
+    qint64 _busyDuration; // msecs with at least one request in flight
+    qint64 _uploadLimitedDuration;
+    qint64 _downloadLimitedDuration;
+    qint64 _bytesUploaded;
+    qint64 _bytesDownloaded;
+};
+
+}
+
+#endif // SYNCPERFORMANCEREPORT_H
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "synctracer.h"
+#include "utility.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QThread>
+
+namespace OCC {
+
+// A run of a big sync gives a few events per file, don't let a trace grow unbounded
+static const int maxEventsPerRun = 4 * 1000 * 1000;
+
+static QString traceDirectory()
+{
+    static QString dir = QString::fromLocal8Bit(qgetenv("OWNCLOUD_TRACE_DIR"));
+    return dir;
+}
+
+static QByteArray jsonValue(const QVariant &value)
+{
+    switch (value.type()) {
+    case QVariant::Bool:
+        return value.toBool() ? "true" : "false";
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::ULongLong:
+        return value.toByteArray();
+    case QVariant::Double:
+        return QByteArray::number(value.toDouble());
+    default:
+        return Utility::jsonString(value.toString());
+    }
+}
+
+static QByteArray jsonObject(const QVariantMap &map)
+{
+    QByteArray out = "{";
+    for (QVariantMap::const_iterator it = map.constBegin(); it != map.constEnd(); ++it) {
+        if (it != map.constBegin()) {
+            out += ',';
+        }
+        out += Utility::jsonString(it.key());
+        out += ':';
+        out += jsonValue(it.value());
+    }
+    out += '}';
+    return out;
+}
+
+SyncTracer *SyncTracer::instance()
+{
+    static SyncTracer tracer;
+    return &tracer;
+}
+
+SyncTracer::SyncTracer()
+    : _running(false)
+{
+}
+
+bool SyncTracer::isEnabled()
+{
+    static bool enabled = !traceDirectory().isEmpty();
+    return enabled;
+}
+
+qint64 SyncTracer::now()
+{
+    static QElapsedTimer clock;
+    static bool started = (clock.start(), true);
+    Q_UNUSED(started);
+    return clock.nsecsElapsed() / 1000;
+}
+
+QString SyncTracer::className(const QObject *object)
+{
+    QString name = QString::fromLatin1(object->metaObject()->className());
+    int pos = name.lastIndexOf(QLatin1String("::"));
+    return pos < 0 ? name : name.mid(pos + 2);
+}
+
+void SyncTracer::startRun(const QString &folder)
+{
+    if (!isEnabled()) {
+        return;
+    }
+    QMutexLocker lock(&_mutex);
+    _events.clear();
+    _folder = folder;
+    _running = true;
+}
+
+void SyncTracer::finishRun()
+{
+    if (!isEnabled()) {
+        return;
+    }
+    QMutexLocker lock(&_mutex);
+    if (!_running) {
+        return;
+    }
+    _running = false;
+
+    QDir dir(traceDirectory());
+    if (!dir.exists()) {
+        dir.mkpath(QLatin1String("."));
+    }
+    QString fileName = dir.absoluteFilePath(QLatin1String("sync-trace-")
+            + QDateTime::currentDateTime().toString(QLatin1String("yyyyMMdd-hhmmss-zzz")) + QLatin1String(".json"));
+    if (writeTrace(fileName)) {
+        qDebug() << "Sync trace with" << _events.count() << "events written to" << fileName;
+    }
+    _events.clear();
+    _events.squeeze();
+}
+
+void SyncTracer::addSpan(const char *category, const QString &name, qint64 start, qint64 end,
+                         const QVariantMap &args)
+{
+    if (!isEnabled()) {
+        return;
+    }
+    Event event;
+    event.phase = 'X';
+    event.category = category;
+    event.name = name;
+    event.timestamp = start;
+    event.duration = end - start;
+    event.id = 0;
+    event.args = args;
+    addEvent(event);
+}
+
+void SyncTracer::addAsyncSpan(const char *category, const QString &name, quintptr id, qint64 start, qint64 end,
+                              const QVariantMap &args)
+{
+    if (!isEnabled()) {
+        return;
+    }
+    Event event;
+    event.phase = 'b';
+    event.category = category;
+    event.name = name;
+    event.timestamp = start;
+    event.duration = end - start;
+    event.id = id;
+    event.args = args;
+    addEvent(event);
+}
+
+void SyncTracer::addCounter(const char *category, const QString &name, qint64 value)
+{
+    if (!isEnabled()) {
+        return;
+    }
+    Event event;
+    event.phase = 'C';
+    event.category = category;
+    event.name = name;
+    event.timestamp = now();
+    event.duration = 0;
+    event.id = 0;
+    event.args.insert(QLatin1String("value"), value);
+    addEvent(event);
+}
+
+void SyncTracer::addEvent(Event &event)
+{
+    QMutexLocker lock(&_mutex);
+    if (!_running || _events.size() >= maxEventsPerRun) {
+        return;
+    }
+    event.thread = currentThreadIndex();
+    _events.append(event);
+}
+
+// Must be called with the mutex locked
+int SyncTracer::currentThreadIndex()
+{
+    Qt::HANDLE handle = QThread::currentThreadId();
+    QHash<Qt::HANDLE, int>::const_iterator it = _threads.constFind(handle);
+    if (it != _threads.constEnd()) {
+        return it.value();
+    }
+    int index = _threadNames.size() + 1;
+    QThread *thread = QThread::currentThread();
+    QString name = thread->objectName();
+    if (QCoreApplication::instance() && thread == QCoreApplication::instance()->thread()) {
+        name = QLatin1String("main");
+    } else if (name.isEmpty()) {
+        name = QString::fromLatin1("thread %1").arg(index);
+    }
+    _threads.insert(handle, index);
+    _threadNames.append(name);
+    return index;
+}
+
+// Must be called with the mutex locked
+bool SyncTracer::writeTrace(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "Could not write the sync trace" << fileName << file.errorString();
+        return false;
+    }
+
+    const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    QByteArray buf;
+    buf.reserve(64 * 1024);
+    buf += "{\"otherData\":{\"folder\":" + Utility::jsonString(_folder) + "},\n\"traceEvents\":[\n";
+    buf += "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" + pid + ",\"args\":{\"name\":"
+            + Utility::jsonString(QCoreApplication::applicationName()) + "}}";
+    for (int i = 0; i < _threadNames.size(); ++i) {
+        buf += ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" + pid + ",\"tid\":"
+                + QByteArray::number(i + 1) + ",\"args\":{\"name\":" + Utility::jsonString(_threadNames.at(i)) + "}}";
+    }
+
+    foreach (const Event &event, _events) {
+        const QByteArray common = "\"cat\":\"" + QByteArray(event.category) + "\",\"name\":" + Utility::jsonString(event.name)
+                + ",\"pid\":" + pid + ",\"tid\":" + QByteArray::number(event.thread);
+        switch (event.phase) {
+        case 'X':
+            buf += ",\n{\"ph\":\"X\"," + common + ",\"ts\":" + QByteArray::number(event.timestamp)
+                    + ",\"dur\":" + QByteArray::number(event.duration) + ",\"args\":" + jsonObject(event.args) + "}";
+            break;
+        case 'b': {
+            // a begin and an end event of a nestable async span
+            const QByteArray id = ",\"id\":\"0x" + QByteArray::number(quint64(event.id), 16) + "\"";
+            buf += ",\n{\"ph\":\"b\"," + common + id + ",\"ts\":" + QByteArray::number(event.timestamp)
+                    + ",\"args\":" + jsonObject(event.args) + "}";
+            buf += ",\n{\"ph\":\"e\"," + common + id + ",\"ts\":" + QByteArray::number(event.timestamp + event.duration)
+                    + "}";
+            break;
+        }
+        case 'C':
+            buf += ",\n{\"ph\":\"C\"," + common + ",\"ts\":" + QByteArray::number(event.timestamp)
+                    + ",\"args\":" + jsonObject(event.args) + "}";
+            break;
+        }
+        if (buf.size() > 60 * 1024) {
+            file.write(buf);
+            buf.clear();
+        }
+    }
+    if (_events.size() >= maxEventsPerRun) {
+        qDebug() << "Sync trace truncated after" << maxEventsPerRun << "events";
+    }
+    buf += "\n]}\n";
+    file.write(buf);
+    return file.error() == QFile::NoError;
+}
+
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef SYNCTRACER_H
+#define SYNCTRACER_H
+
+#include "owncloudlib.h"
+#include <QString>
+#include <QVariantMap>
+#include <QVector>
+#include <QHash>
+#include <QStringList>
+#include <QMutex>
+#include <QElapsedTimer>
+
+class QObject;
+
+namespace OCC {
+
+/**
+ * @brief Records what a sync run spends its time on
+ *
+ * Disabled unless the OWNCLOUD_TRACE_DIR environment variable names a
+ * directory. Then the spans recorded between startRun() and finishRun()
+ * (csync phases, network jobs, propagator jobs, journal transactions,
+ * bandwidth limiting) are written to a sync-trace-<time>.json file in that
+ * directory, in the Chrome trace event format: it can be loaded in
+ * chrome://tracing or https://ui.perfetto.dev.
+ *
+ * All the methods are thread-safe.
+ */
+class OWNCLOUDSYNC_EXPORT SyncTracer
+{
+public:
+    static SyncTracer *instance();
+
+    /** Cheap, check it before collecting the arguments of an event */
+    static bool isEnabled();
+
+    /** Microseconds on the clock of the trace */
+    static qint64 now();
+
+    /** Class name of a job, without the namespace, to name its spans */
+    static QString className(const QObject *object);
+
+    void startRun(const QString &folder);
+    void finishRun();
+
+    /** A span on the current thread */
+    void addSpan(const char *category, const QString &name, qint64 start, qint64 end,
+                 const QVariantMap &args = QVariantMap());
+
+    /** A span that is not bound to a thread, e.g. a network request. Spans with
+     * the same category and id are shown in one row. */
+    void addAsyncSpan(const char *category, const QString &name, quintptr id, qint64 start, qint64 end,
+                      const QVariantMap &args = QVariantMap());
+
+    /** A value over time, e.g. a bandwidth quota */
+    void addCounter(const char *category, const QString &name, qint64 value);
+
+private:
+    SyncTracer();
+
+    struct Event {
+        char phase;
+        const char *category;
+        QString name;
+        qint64 timestamp;
+        qint64 duration;
+        int thread;
+        quintptr id;
+        QVariantMap args;
+    };
+
+    void addEvent(Event &event);
+    int currentThreadIndex();
+    bool writeTrace(const QString &fileName);
+
+    QMutex _mutex;
+    bool _running;
+    QString _folder;
+    QVector<Event> _events;
+    QHash<Qt::HANDLE, int> _threads;
+    QStringList _threadNames;
+};
+
+/**
+ * @brief Records a span on the current thread for its lifetime
+ */
+class OWNCLOUDSYNC_EXPORT SyncTraceSpan
+{
+public:
+    SyncTraceSpan(const char *category, const char *name)
+        : _category(category), _name(name), _start(SyncTracer::isEnabled() ? SyncTracer::now() : -1) {}
+    ~SyncTraceSpan()
+    {
+        if (_start >= 0) {
+            SyncTracer::instance()->addSpan(_category, QString::fromLatin1(_name), _start, SyncTracer::now(), _args);
+        }
+    }
+
+    void setArg(const QString &key, const QVariant &value)
+    {
+        if (_start >= 0) {
+            _args.insert(key, value);
+        }
+    }
+
+private:
+    Q_DISABLE_COPY(SyncTraceSpan)
+    const char *_category;
+    const char *_name;
+    qint64 _start;
+    QVariantMap _args;
+};
+
+}
+
+#endif // SYNCTRACER_H
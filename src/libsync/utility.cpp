@@ -37,6 +37,7 @@
 #ifdef Q_OS_UNIX
 #include <sys/statvfs.h>
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #endif
 
@@ -194,6 +195,23 @@ qint64 Utility::freeDiskSpace(const QString &path, bool *ok)
 #endif
 }
 
+qint64 Utility::peakMemoryUsage()
+{
+#if defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#if defined(Q_OS_MAC)
+    return usage.ru_maxrss; // in bytes
+#else
+    return qint64(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
 QString Utility::compactFormatDouble(double value, int prec, const QString& unit)
 {
     QLocale locale = QLocale::system();
@@ -245,6 +263,31 @@ QString Utility::escape(const QString &in)
 #endif
 }
 
+QByteArray Utility::jsonString(const QString &str)
+{
+    QByteArray out;
+    out.reserve(str.size() + 2);
+    out += '"';
+    foreach (char c, str.toUtf8()) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (uchar(c) < 0x20) {
+                out += "\\u00";
+                out += QByteArray::number(uchar(c), 16).rightJustified(2, '0');
+            } else {
+                out += c;
+            }
+        }
+    }
+    out += '"';
+    return out;
+}
+
 #if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
 // In Qt 4,  QThread::sleep functions are protected.
 // This is a hack to make them visible in this namespace.
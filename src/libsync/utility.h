@@ -37,6 +37,8 @@ namespace Utility
     OWNCLOUDSYNC_EXPORT bool hasLaunchOnStartup(const QString &appName);
     OWNCLOUDSYNC_EXPORT void setLaunchOnStartup(const QString &appName, const QString& guiName, bool launch);
     OWNCLOUDSYNC_EXPORT qint64 freeDiskSpace(const QString &path, bool *ok = 0);
+    /** Peak resident memory of the process in bytes, 0 where it is not known */
+    OWNCLOUDSYNC_EXPORT qint64 peakMemoryUsage();
     OWNCLOUDSYNC_EXPORT QString toCSyncScheme(const QString &urlStr);
     /** Like QLocale::toString(double, 'f', prec), but drops trailing zeros after the decimal point */
 
@@ -57,6 +59,9 @@ namespace Utility
     // porting methods
     OWNCLOUDSYNC_EXPORT QString escape(const QString&);
 
+    // A JSON string with its quotes, in UTF-8. Written by hand, QJsonDocument is not available with Qt4
+    OWNCLOUDSYNC_EXPORT QByteArray jsonString(const QString &str);
+
     // conversion function QDateTime <-> time_t   (because the ones builtin work on only unsigned 32bit)
     OWNCLOUDSYNC_EXPORT QDateTime qDateTimeFromTime_t(qint64 t);
     OWNCLOUDSYNC_EXPORT qint64 qDateTimeToTime_t(const QDateTime &t);
@@ -0,0 +1,589 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+/*
+ * Journal scale benchmark.
+ *
+ * Populates a SyncJournalDb with a synthetic tree of the given number of rows
+ * and times the operations a sync does on it, in the mixes of a sync where a
+ * few files changed: lookups, updates, the confirmation of the unchanged
+ * records followed by postSyncCleanup, the reads of csync for directories
+ * with an unchanged etag, avoidReadFromDbOnNextSync, recursive deletes and
+ * getFileRecordCount. It also looks at the WAL: its size before the
+ * checkpoint, the time the checkpoint takes and the lookups before and after,
+ * and at the memory of the paths kept by the cleanup of the stale entries.
+ *
+ * The journal is opened as by the client, so OWNCLOUD_SQLITE_JOURNAL_MODE and
+ * the other journal switches apply. The results are written as JSON.
+ */
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSet>
+#include <QTemporaryDir>
+#include <QVector>
+
+#include <algorithm>
+#include <iostream>
+
+#include "syncjournaldb.h"
+#include "syncjournalfilerecord.h"
+#include "syncperformancereport.h"
+#include "pathhashset.h"
+#include "utility.h"
+#include "ownsql.h"
+#include "csync_private.h"
+#include "csync_statedb.h"
+
+using namespace OCC;
+
+struct BenchmarkOptions {
+    int rows;
+    int operations; // per measured mix
+    QString output;
+    QString workDir;
+    bool verbose;
+};
+
+/*
+ * The synthetic tree: topDirs directories with subDirs sub directories each,
+ * with filesPerDir files in every sub directory.
+ */
+struct Layout {
+    enum { topDirs = 100, subDirs = 100 };
+    int filesPerDir;
+
+    int fileCount() const { return topDirs * subDirs * filesPerDir; }
+    int rowCount() const { return topDirs + topDirs * subDirs + fileCount(); }
+
+    static QString topDir(int t) { return QString("top%1").arg(t); }
+    static QString subDir(int t, int s) { return QString("top%1/sub%2").arg(t).arg(s); }
+    QString file(int index) const {
+        const int dir = index / filesPerDir;
+        return subDir(dir / subDirs, dir % subDirs) + QString("/file%1.txt").arg(index % filesPerDir);
+    }
+};
+
+/*
+ * The durations of the operations of one measurement
+ */
+class Timings
+{
+public:
+    void start() { _timer.start(); }
+    void stop() { _nsecs.append(_timer.nsecsElapsed()); }
+
+    QJsonObject toJson() const
+    {
+        QVector<qint64> sorted = _nsecs;
+        std::sort(sorted.begin(), sorted.end());
+        qint64 total = 0;
+        foreach (qint64 ns, sorted) {
+            total += ns;
+        }
+        QJsonObject result;
+        result.insert("count", sorted.size());
+        result.insert("totalMsec", total / 1e6);
+        result.insert("opsPerSecond", total > 0 ? sorted.size() * 1e9 / total : 0.);
+        result.insert("p50Usec", SyncPerformanceReport::percentile(sorted, 50) / 1e3);
+        result.insert("p95Usec", SyncPerformanceReport::percentile(sorted, 95) / 1e3);
+        result.insert("p99Usec", SyncPerformanceReport::percentile(sorted, 99) / 1e3);
+        result.insert("maxUsec", (sorted.isEmpty() ? 0 : sorted.last()) / 1e3);
+        return result;
+    }
+
+private:
+    QElapsedTimer _timer;
+    QVector<qint64> _nsecs;
+};
+
+static void help()
+{
+    std::cout << "benchmark_journal - times the journal operations of a sync at scale" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Usage: benchmark_journal [OPTION]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --rows [n]             Approximate number of rows of the journal (default 100000)" << std::endl;
+    std::cout << "  --operations [n]       Number of operations of each measured mix (default 10000)" << std::endl;
+    std::cout << "  --output [file]        Write the JSON results there instead of stdout" << std::endl;
+    std::cout << "  --workdir [dir]        Where to create the journal (default: temporary)" << std::endl;
+    std::cout << "  --verbose              Keep the debug output of the journal" << std::endl;
+    exit(1);
+}
+
+static void parseOptions(const QStringList &appArgs, BenchmarkOptions *options)
+{
+    QStringListIterator it(appArgs);
+    // skip file name;
+    if (it.hasNext()) it.next();
+
+    while (it.hasNext()) {
+        const QString option = it.next();
+        const bool hasValue = it.hasNext() && !it.peekNext().startsWith("-");
+
+        if (option == "--rows" && hasValue) {
+            options->rows = qMax(1, it.next().toInt());
+        } else if (option == "--operations" && hasValue) {
+            options->operations = qMax(1, it.next().toInt());
+        } else if (option == "--output" && hasValue) {
+            options->output = it.next();
+        } else if (option == "--workdir" && hasValue) {
+            options->workDir = it.next();
+        } else if (option == "--verbose") {
+            options->verbose = true;
+        } else {
+            help();
+        }
+    }
+}
+
+static void quietMessageHandler(QtMsgType type, const QMessageLogContext &, const QString &msg)
+{
+    if (type != QtDebugMsg) {
+        std::cerr << qPrintable(msg) << std::endl;
+    }
+    if (type == QtFatalMsg) {
+        abort();
+    }
+}
+
+static void progress(const char *step)
+{
+    std::cerr << step << std::endl;
+}
+
+// qrand() may only give 15 bits
+static int randomIndex(int count)
+{
+    return int(((quint32(qrand()) << 15) ^ quint32(qrand())) % quint32(count));
+}
+
+// The sync mix deletes the files whose index ends with 999
+static bool isDeletedBySyncMix(int index)
+{
+    return index % 1000 == 999;
+}
+
+static SyncJournalFileRecord makeRecord(const QString &path, int type, int version)
+{
+    SyncJournalFileRecord record;
+    record._path = path;
+    record._inode = qHash(path);
+    record._modtime = QDateTime::fromTime_t(1420070400 + version);
+    record._type = type;
+    record._etag = QByteArray::number(qHash(path) + version, 16);
+    record._fileId = QByteArray::number(qHash(path), 16).rightJustified(8, '0') + "ocbenchmark";
+    record._fileSize = type == CSYNC_FTW_TYPE_FILE ? 1024 : 0;
+    record._remotePerm = type == CSYNC_FTW_TYPE_FILE ? "WDNV" : "WDNVCK";
+    record._mode = 0;
+    return record;
+}
+
+static qint64 walSize(SyncJournalDb *journal)
+{
+    return QFileInfo(journal->databaseFilePath() + "-wal").size();
+}
+
+static QJsonObject populate(SyncJournalDb *journal, const Layout &layout)
+{
+    QElapsedTimer timer;
+    timer.start();
+    journal->startSyncGeneration();
+    for (int t = 0; t < Layout::topDirs; ++t) {
+        journal->setFileRecord(makeRecord(Layout::topDir(t), CSYNC_FTW_TYPE_DIR, 0));
+        for (int s = 0; s < Layout::subDirs; ++s) {
+            journal->setFileRecord(makeRecord(Layout::subDir(t, s), CSYNC_FTW_TYPE_DIR, 0));
+        }
+    }
+    for (int i = 0; i < layout.fileCount(); ++i) {
+        journal->setFileRecord(makeRecord(layout.file(i), CSYNC_FTW_TYPE_FILE, 0));
+    }
+    journal->flush();
+    const qint64 msecs = timer.elapsed();
+
+    QJsonObject result;
+    result.insert("rows", layout.rowCount());
+    result.insert("msec", msecs);
+    result.insert("rowsPerSecond", msecs > 0 ? layout.rowCount() * 1000. / msecs : 0.);
+    return result;
+}
+
+static QJsonObject benchGetFileRecord(SyncJournalDb *journal, const Layout &layout, int operations)
+{
+    Timings hits;
+    Timings misses;
+    for (int i = 0; i < operations; ++i) {
+        int index = randomIndex(layout.fileCount());
+        if (isDeletedBySyncMix(index)) {
+            --index;
+        }
+        const QString path = layout.file(index);
+        hits.start();
+        SyncJournalFileRecord record = journal->getFileRecord(path);
+        hits.stop();
+        if (!record.isValid()) {
+            qFatal("Record %s not found", qPrintable(path));
+        }
+    }
+    // one lookup in ten is for a new file
+    for (int i = 0; i < operations / 10; ++i) {
+        const QString path = layout.file(randomIndex(layout.fileCount())) + ".new";
+        misses.start();
+        journal->getFileRecord(path);
+        misses.stop();
+    }
+    QJsonObject result;
+    result.insert("existing", hits.toJson());
+    result.insert("missing", misses.toJson());
+    return result;
+}
+
+static QJsonObject benchSetFileRecord(SyncJournalDb *journal, const Layout &layout, int operations, int version)
+{
+    Timings queued;
+    Timings flush;
+    for (int i = 0; i < operations; ++i) {
+        const QString path = layout.file(randomIndex(layout.fileCount()));
+        queued.start();
+        journal->setFileRecord(makeRecord(path, CSYNC_FTW_TYPE_FILE, version));
+        queued.stop();
+    }
+    flush.start();
+    journal->flush();
+    flush.stop();
+
+    QJsonObject result;
+    result.insert("queued", queued.toJson());
+    result.insert("flush", flush.toJson());
+    return result;
+}
+
+/*
+ * A sync where 1% of the files changed and 0.1% were deleted: the changed
+ * records are written, the others confirmed, and postSyncCleanup removes the
+ * records of the deleted files.
+ */
+static QJsonObject benchSyncMix(SyncJournalDb *journal, const Layout &layout, int version)
+{
+    Timings generation;
+    Timings confirm;
+    Timings write;
+    Timings flush;
+    Timings cleanup;
+
+    generation.start();
+    journal->startSyncGeneration();
+    generation.stop();
+
+    for (int t = 0; t < Layout::topDirs; ++t) {
+        journal->confirmFileRecord(Layout::topDir(t));
+        for (int s = 0; s < Layout::subDirs; ++s) {
+            journal->confirmFileRecord(Layout::subDir(t, s));
+        }
+    }
+    int deleted = 0;
+    for (int i = 0; i < layout.fileCount(); ++i) {
+        const QString path = layout.file(i);
+        if (isDeletedBySyncMix(i)) {
+            ++deleted; // not confirmed
+        } else if (i % 100 == 0) {
+            write.start();
+            journal->setFileRecord(makeRecord(path, CSYNC_FTW_TYPE_FILE, version));
+            write.stop();
+        } else {
+            confirm.start();
+            journal->confirmFileRecord(path);
+            confirm.stop();
+        }
+    }
+    flush.start();
+    journal->flush();
+    flush.stop();
+
+    const qint64 walBefore = walSize(journal);
+    cleanup.start();
+    journal->postSyncCleanup(QSet<QString>());
+    cleanup.stop();
+
+    QJsonObject result;
+    result.insert("deletedFiles", deleted);
+    result.insert("startSyncGeneration", generation.toJson());
+    result.insert("confirmFileRecord", confirm.toJson());
+    result.insert("setFileRecord", write.toJson());
+    result.insert("flush", flush.toJson());
+    result.insert("postSyncCleanup", cleanup.toJson());
+    result.insert("walBytesBeforeCleanup", walBefore);
+    result.insert("walBytesAfterCleanup", walSize(journal));
+    return result;
+}
+
+/*
+ * What csync does for the directories with an unchanged etag, through a read
+ * connection of the journal like the SyncEngine
+ */
+static QJsonObject benchBelowPath(SyncJournalDb *journal, const QString &localPath, int operations)
+{
+    CSYNC *ctx = 0;
+    if (csync_create(&ctx, localPath.toUtf8().constData(), "owncloud://localhost/remote.php/webdav/") < 0
+            || csync_init(ctx) < 0) {
+        qFatal("Could not create the csync context");
+    }
+    SqlDatabase *db = journal->acquireReadConnection();
+    if (!db) {
+        qFatal("Could not open a read connection to the journal");
+    }
+
+    QJsonObject result;
+    for (int depth = 1; depth <= 2; ++depth) {
+        // fresh trees
+        csync_commit(ctx);
+        csync_set_statedb_connection(ctx, db->sqliteDb());
+        if (csync_statedb_load(ctx, journal->databaseFilePath().toUtf8().constData(), &ctx->statedb.db) < 0) {
+            qFatal("csync could not load the journal");
+        }
+
+        Timings timings;
+        const int count = depth == 1 ? Layout::topDirs : qMin(operations, Layout::topDirs * Layout::subDirs);
+        for (int i = 0; i < count; ++i) {
+            const QString dir = depth == 1 ? Layout::topDir(i) : Layout::subDir(i / Layout::subDirs, i % Layout::subDirs);
+            timings.start();
+            if (csync_statedb_get_below_path(ctx, dir.toUtf8().constData()) < 0) {
+                qFatal("csync_statedb_get_below_path failed");
+            }
+            timings.stop();
+        }
+        QJsonObject measurement = timings.toJson();
+        measurement.insert("rows", qint64(c_rbtree_size(ctx->remote.tree)));
+        result.insert(depth == 1 ? "topDirs" : "subDirs", measurement);
+    }
+
+    csync_commit(ctx);
+    csync_set_statedb_connection(ctx, 0);
+    journal->releaseReadConnection(db);
+    csync_destroy(ctx);
+    return result;
+}
+
+static QJsonObject benchAvoidReadFromDb(SyncJournalDb *journal, const Layout &layout, int operations)
+{
+    Timings timings;
+    // Each call scans the directories, keep it to a few
+    for (int i = 0; i < qMin(operations, 100); ++i) {
+        const QString path = layout.file(randomIndex(layout.fileCount()));
+        timings.start();
+        journal->avoidReadFromDbOnNextSync(path);
+        timings.stop();
+    }
+    return timings.toJson();
+}
+
+static QJsonObject benchDeleteRecursively(SyncJournalDb *journal, int operations)
+{
+    Timings timings;
+    // the sub directories of the last top level directories, from the end
+    const int count = qMin(operations, 10 * Layout::subDirs);
+    for (int i = 0; i < count; ++i) {
+        const int index = Layout::topDirs * Layout::subDirs - 1 - i;
+        timings.start();
+        journal->deleteFileRecord(Layout::subDir(index / Layout::subDirs, index % Layout::subDirs), true);
+        timings.stop();
+    }
+    return timings.toJson();
+}
+
+static QJsonObject benchGetFileRecordCount(SyncJournalDb *journal, int *count)
+{
+    Timings timings;
+    for (int i = 0; i < 10; ++i) {
+        timings.start();
+        *count = journal->getFileRecordCount();
+        timings.stop();
+    }
+    return timings.toJson();
+}
+
+/*
+ * Lookups with a big WAL, the checkpoint, and lookups after it
+ */
+static QJsonObject benchWal(SyncJournalDb *journal, const Layout &layout, int operations, int version)
+{
+    QJsonObject result;
+    result.insert("write", benchSetFileRecord(journal, layout, operations * 10, version));
+    result.insert("walBytesBeforeCheckpoint", walSize(journal));
+    result.insert("getFileRecordBeforeCheckpoint", benchGetFileRecord(journal, layout, operations).value("existing"));
+
+    Timings checkpoint;
+    checkpoint.start();
+    journal->walCheckpoint();
+    checkpoint.stop();
+    result.insert("checkpoint", checkpoint.toJson());
+    result.insert("walBytesAfterCheckpoint", walSize(journal));
+    result.insert("getFileRecordAfterCheckpoint", benchGetFileRecord(journal, layout, operations).value("existing"));
+    return result;
+}
+
+/*
+ * The paths kept by the cleanup of the stale transfer entries at the end of a
+ * sync, one per file, as a QSet<QString> and as a PathHashSet: the time to
+ * build them from the items, the lookups and the memory. Run first, so that
+ * the peak memory of the process only grew for the items until then. The
+ * bigger QSet is measured last, both grow the peak from the same baseline.
+ */
+static QJsonObject benchStaleEntrySets(const Layout &layout, int operations)
+{
+    SyncFileItemVector items(layout.fileCount());
+    for (int i = 0; i < items.count(); ++i) {
+        items[i]._file = layout.file(i);
+    }
+    // Half of the lookups are for paths that are not in the set
+    QStringList lookups;
+    for (int i = 0; i < operations; ++i) {
+        const QString path = layout.file(randomIndex(layout.fileCount()));
+        lookups.append(i % 2 ? path + ".new" : path);
+    }
+    const qint64 peakBefore = Utility::peakMemoryUsage();
+
+    QJsonObject hashed;
+    {
+        Timings build;
+        Timings lookup;
+        build.start();
+        PathHashSet set(items);
+        for (int i = 0; i < items.count(); ++i) {
+            set.insert(i);
+        }
+        set.squeeze();
+        build.stop();
+        int hits = 0;
+        foreach (const QString &path, lookups) {
+            lookup.start();
+            hits += set.contains(path);
+            lookup.stop();
+        }
+        hashed.insert("build", build.toJson());
+        hashed.insert("contains", lookup.toJson());
+        hashed.insert("hits", hits);
+        hashed.insert("bytes", set.memoryUsage());
+        hashed.insert("peakMemoryGrowthBytes", Utility::peakMemoryUsage() - peakBefore);
+    }
+
+    QJsonObject strings;
+    {
+        Timings build;
+        Timings lookup;
+        build.start();
+        QSet<QString> set;
+        foreach (const SyncFileItem &item, items) {
+            set.insert(item._file); // shares the path with the item
+        }
+        build.stop();
+        int hits = 0;
+        foreach (const QString &path, lookups) {
+            lookup.start();
+            hits += set.contains(path);
+            lookup.stop();
+        }
+        strings.insert("build", build.toJson());
+        strings.insert("contains", lookup.toJson());
+        strings.insert("hits", hits);
+        strings.insert("peakMemoryGrowthBytes", Utility::peakMemoryUsage() - peakBefore);
+    }
+
+    QJsonObject result;
+    result.insert("paths", items.count());
+    result.insert("pathHashSet", hashed);
+    result.insert("qset", strings);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    BenchmarkOptions options;
+    options.rows = 100000;
+    options.operations = 10000;
+    options.verbose = false;
+    parseOptions(app.arguments(), &options);
+
+    if (!options.verbose) {
+        qInstallMessageHandler(quietMessageHandler);
+    }
+    qsrand(42);
+
+    Layout layout;
+    layout.filesPerDir = qMax(1, (options.rows - Layout::topDirs - Layout::topDirs * Layout::subDirs)
+                                 / (Layout::topDirs * Layout::subDirs));
+
+    QTemporaryDir tempDir;
+    const QString workDir = options.workDir.isEmpty() ? tempDir.path() : options.workDir;
+    QDir().mkpath(workDir);
+    foreach (const QString &suffix, QStringList() << "" << "-wal" << "-shm") {
+        QFile::remove(workDir + "/.csync_journal.db" + suffix);
+    }
+
+    QJsonObject results;
+    progress("stale entry sets");
+    results.insert("staleEntrySets", benchStaleEntrySets(layout, options.operations));
+    {
+        SyncJournalDb journal(workDir);
+        int version = 0;
+
+        progress("populating the journal");
+        results.insert("populate", populate(&journal, layout));
+        progress("getFileRecord");
+        results.insert("getFileRecord", benchGetFileRecord(&journal, layout, options.operations));
+        progress("setFileRecord");
+        results.insert("setFileRecord", benchSetFileRecord(&journal, layout, options.operations, ++version));
+        progress("sync with 1% of the files changed");
+        results.insert("syncMix", benchSyncMix(&journal, layout, ++version));
+        progress("csync_statedb_get_below_path");
+        results.insert("csyncGetBelowPath", benchBelowPath(&journal, workDir, options.operations));
+        progress("WAL checkpoint");
+        results.insert("wal", benchWal(&journal, layout, options.operations, ++version));
+        progress("deleteFileRecord recursively");
+        results.insert("deleteFileRecordRecursively", benchDeleteRecursively(&journal, options.operations));
+        // Last, the filter it leaves would change the writes of the other measurements
+        progress("avoidReadFromDbOnNextSync");
+        results.insert("avoidReadFromDbOnNextSync", benchAvoidReadFromDb(&journal, layout, options.operations));
+        int count = 0;
+        results.insert("getFileRecordCount", benchGetFileRecordCount(&journal, &count));
+        results.insert("finalRows", count);
+    }
+    results.insert("journalBytes", QFileInfo(workDir + "/.csync_journal.db").size());
+
+    QJsonObject settings;
+    settings.insert("rows", layout.rowCount());
+    settings.insert("filesPerDir", layout.filesPerDir);
+    settings.insert("operations", options.operations);
+    const QByteArray journalMode = qgetenv("OWNCLOUD_SQLITE_JOURNAL_MODE");
+    settings.insert("journalMode", journalMode.isEmpty() ? QString("default") : QString::fromLatin1(journalMode));
+
+    QJsonObject root;
+    root.insert("benchmark", "journal");
+    root.insert("date", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    root.insert("settings", settings);
+    root.insert("results", results);
+    const QByteArray json = QJsonDocument(root).toJson();
+
+    if (options.output.isEmpty()) {
+        std::cout << json.constData();
+    } else {
+        QFile file(options.output);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qFatal("Could not write %s", qPrintable(options.output));
+        }
+        file.write(json);
+    }
+    return 0;
+}
@@ -0,0 +1,214 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+/*
+ * Propagator scheduling benchmark.
+ *
+ * Builds PropagateDirectory trees of jobs that do nothing and runs them the
+ * way the OwncloudPropagator does: scheduleNextJob() is called on the root
+ * until the maximum number of jobs are running, then the oldest running job
+ * finishes. Only the time spent in scheduleNextJob() is measured, so the
+ * results show how the scheduling scales with the size of the directories.
+ * The results are written as JSON.
+ */
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+
+#include <iostream>
+
+#include "account.h"
+#include "owncloudpropagator.h"
+
+using namespace OCC;
+
+struct BenchmarkOptions {
+    QStringList scenarios;
+    int files;
+    int parallel; // jobs running at the same time
+    QString output;
+};
+
+static void help()
+{
+    std::cout << "benchmark_scheduler - times the scheduling of the propagation jobs" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Usage: benchmark_scheduler [OPTION]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --scenario [name]      flat, flat-moves, nested or all (default)." << std::endl;
+    std::cout << "                         Can be given several times" << std::endl;
+    std::cout << "  --files [n]            Number of files of each scenario (default 100000)" << std::endl;
+    std::cout << "  --parallel [n]         Jobs running at the same time (default 3)" << std::endl;
+    std::cout << "  --output [file]        Write the JSON results there instead of stdout" << std::endl;
+    exit(1);
+}
+
+static void parseOptions(const QStringList &appArgs, BenchmarkOptions *options)
+{
+    QStringListIterator it(appArgs);
+    // skip file name;
+    if (it.hasNext()) it.next();
+
+    while (it.hasNext()) {
+        const QString option = it.next();
+        const bool hasValue = it.hasNext() && !it.peekNext().startsWith("-");
+
+        if (option == "--scenario" && hasValue) {
+            options->scenarios.append(it.next());
+        } else if (option == "--files" && hasValue) {
+            options->files = qMax(1, it.next().toInt());
+        } else if (option == "--parallel" && hasValue) {
+            options->parallel = qMax(1, it.next().toInt());
+        } else if (option == "--output" && hasValue) {
+            options->output = it.next();
+        } else {
+            help();
+        }
+    }
+
+    if (options->scenarios.isEmpty() || options->scenarios.contains("all")) {
+        options->scenarios = QStringList() << "flat" << "flat-moves" << "nested";
+    }
+}
+
+class BenchmarkJob;
+static QList<BenchmarkJob *> runningJobs; // in the order they started
+
+/* A job that runs until the benchmark finishes it */
+class BenchmarkJob : public PropagateItemJob
+{
+public:
+    BenchmarkJob(OwncloudPropagator *propagator, JobParallelism parallelism)
+        : PropagateItemJob(propagator, SyncFileItem()), _parallelism(parallelism) {}
+    JobParallelism parallelism() Q_DECL_OVERRIDE { return _parallelism; }
+    void start() Q_DECL_OVERRIDE { runningJobs.append(this); }
+    void finish() { done(SyncFileItem::Success); }
+private:
+    JobParallelism _parallelism;
+};
+
+static void appendFiles(PropagateDirectory *dir, OwncloudPropagator *propagator, int count, int moveEvery)
+{
+    for (int i = 0; i < count; ++i) {
+        // like a rename, these don't run in parallel with the other directories
+        const bool move = moveEvery > 0 && i % moveEvery == moveEvery - 1;
+        dir->append(new BenchmarkJob(propagator, move ? PropagatorJob::WaitForFinishedInParentDirectory
+                                                      : PropagatorJob::FullParallelism));
+    }
+}
+
+static QJsonObject runScenario(const QString &name, const BenchmarkOptions &options)
+{
+    OwncloudPropagator propagator(AccountPtr(), 0, QDir::tempPath(), QString(), QString(), 0, 0);
+    PropagateDirectory root(&propagator);
+    int directories = 1;
+    if (name == "flat") {
+        appendFiles(&root, &propagator, options.files, 0);
+    } else if (name == "flat-moves") {
+        appendFiles(&root, &propagator, options.files, 100);
+    } else if (name == "nested") {
+        // directories of 1000 files
+        for (int done = 0; done < options.files; done += 1000) {
+            PropagateDirectory *dir = new PropagateDirectory(&propagator);
+            appendFiles(dir, &propagator, qMin(1000, options.files - done), 0);
+            root.append(dir);
+            ++directories;
+        }
+    } else {
+        std::cerr << "Unknown scenario " << qPrintable(name) << std::endl;
+        help();
+    }
+
+    QElapsedTimer wall;
+    wall.start();
+    QElapsedTimer timer;
+    qint64 schedulingNsecs = 0;
+    qint64 maxSchedulingNsecs = 0;
+    int scheduleCalls = 0;
+    int stalls = 0;
+    while (root._state != PropagatorJob::Finished) {
+        bool scheduled = false;
+        while (runningJobs.size() < options.parallel) {
+            timer.start();
+            const bool started = root.scheduleNextJob();
+            const qint64 nsecs = timer.nsecsElapsed();
+            schedulingNsecs += nsecs;
+            maxSchedulingNsecs = qMax(maxSchedulingNsecs, nsecs);
+            ++scheduleCalls;
+            if (!started) {
+                break;
+            }
+            scheduled = true;
+        }
+        if (!runningJobs.isEmpty()) {
+            runningJobs.takeFirst()->finish();
+        } else if (!scheduled && ++stalls > 1000) {
+            qFatal("The scheduling of %s is stuck", qPrintable(name));
+        }
+        // deliver the finished() signals to the directories
+        QCoreApplication::processEvents();
+    }
+    const qint64 wallMsec = wall.elapsed();
+
+    std::cerr << qPrintable(name) << ": " << schedulingNsecs / 1000000 << " ms of scheduling, "
+              << wallMsec << " ms in total" << std::endl;
+
+    QJsonObject result;
+    result.insert("name", name);
+    result.insert("jobs", options.files);
+    result.insert("directories", directories);
+    result.insert("wallMsec", wallMsec);
+    result.insert("schedulingMsec", schedulingNsecs / 1e6);
+    result.insert("scheduleCalls", scheduleCalls);
+    result.insert("schedulingUsecPerJob", schedulingNsecs / 1e3 / options.files);
+    result.insert("maxScheduleNextJobUsec", maxSchedulingNsecs / 1e3);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    BenchmarkOptions options;
+    options.files = 100000;
+    options.parallel = 3;
+    parseOptions(app.arguments(), &options);
+
+    QJsonArray scenarios;
+    foreach (const QString &name, options.scenarios) {
+        scenarios.append(runScenario(name, options));
+    }
+
+    QJsonObject settings;
+    settings.insert("files", options.files);
+    settings.insert("parallel", options.parallel);
+
+    QJsonObject root;
+    root.insert("benchmark", "scheduler");
+    root.insert("date", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    root.insert("settings", settings);
+    root.insert("scenarios", scenarios);
+    const QByteArray json = QJsonDocument(root).toJson();
+
+    if (options.output.isEmpty()) {
+        std::cout << json.constData();
+    } else {
+        QFile file(options.output);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qFatal("Could not write %s", qPrintable(options.output));
+        }
+        file.write(json);
+    }
+    return 0;
+}
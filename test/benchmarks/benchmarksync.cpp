@@ -0,0 +1,432 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+/*
+ * End-to-end sync benchmark.
+ *
+ * Starts a FakeDavServer on localhost, generates synthetic trees and times an
+ * initial, a no-op and an incremental sync of each of them with the
+ * SyncEngine. The results, including the SyncPerformanceReport of every run,
+ * are written as JSON so that builds can be compared with each other.
+ */
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkProxy>
+#include <QTemporaryDir>
+
+#include <iostream>
+
+#include "account.h"
+#include "creds/dummycredentials.h"
+#include "networkconditioner.h"
+#include "syncengine.h"
+#include "syncjournaldb.h"
+#include "syncperformancereport.h"
+#include "fakedavserver.h"
+
+using namespace OCC;
+
+struct BenchmarkOptions {
+    QStringList scenarios;
+    int scale;
+    int latency; // msec
+    qint64 bandwidth; // bytes per second, 0 for unlimited
+    bool upload; // the initial sync uploads the tree instead of downloading it
+    int uploadLimit; // bytes per second given to SyncEngine::setNetworkLimits, 0 for unlimited
+    int downloadLimit;
+    QString network; // NetworkConditions applied by the client
+    QString durability; // OWNCLOUD_DOWNLOAD_DURABILITY
+    QString output;
+    QString workDir;
+    bool verbose;
+};
+
+struct Scenario {
+    QString name;
+    QStringList dirs;
+    QVector<QPair<QString, qint64> > files; // path and size
+};
+
+static BenchmarkOptions *opts = 0;
+
+static void help()
+{
+    std::cout << "benchmark_sync - times syncs against a local WebDAV server" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Usage: benchmark_sync [OPTION]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --scenario [name]      small, large, deep, wide or all (default)." << std::endl;
+    std::cout << "                         Can be given several times" << std::endl;
+    std::cout << "  --scale [n]            Multiply the size of the trees by n (default 1)" << std::endl;
+    std::cout << "  --latency [msec]       Delay every response of the server" << std::endl;
+    std::cout << "  --bandwidth [KiB/s]    Limit the speed of the bodies in both directions" << std::endl;
+    std::cout << "  --upload               The initial sync uploads the tree instead of downloading it" << std::endl;
+    std::cout << "  --limit-up [KiB/s]     Bandwidth limit of the client for the uploads" << std::endl;
+    std::cout << "  --limit-down [KiB/s]   Bandwidth limit of the client for the downloads" << std::endl;
+    std::cout << "  --network [conditions] Simulate a network on the client side, e.g." << std::endl;
+    std::cout << "                         rtt=100,jitter=20,down=1024,up=256,reset=0.01,error=0.05,slowstart" << std::endl;
+    std::cout << "  --durability [mode]    How the downloads are written to the disk:" << std::endl;
+    std::cout << "                         none, file or batched (default)" << std::endl;
+    std::cout << "  --output [file]        Write the JSON results there instead of stdout" << std::endl;
+    std::cout << "  --workdir [dir]        Where to create the local folders (default: temporary)" << std::endl;
+    std::cout << "  --verbose              Keep the debug output of the sync" << std::endl;
+    exit(1);
+}
+
+static void parseOptions(const QStringList &appArgs, BenchmarkOptions *options)
+{
+    QStringListIterator it(appArgs);
+    // skip file name;
+    if (it.hasNext()) it.next();
+
+    while (it.hasNext()) {
+        const QString option = it.next();
+        const bool hasValue = it.hasNext() && !it.peekNext().startsWith("-");
+
+        if (option == "--scenario" && hasValue) {
+            options->scenarios.append(it.next());
+        } else if (option == "--scale" && hasValue) {
+            options->scale = qMax(1, it.next().toInt());
+        } else if (option == "--latency" && hasValue) {
+            options->latency = it.next().toInt();
+        } else if (option == "--bandwidth" && hasValue) {
+            options->bandwidth = it.next().toLongLong() * 1024;
+        } else if (option == "--upload") {
+            options->upload = true;
+        } else if (option == "--limit-up" && hasValue) {
+            options->uploadLimit = it.next().toInt() * 1024;
+        } else if (option == "--limit-down" && hasValue) {
+            options->downloadLimit = it.next().toInt() * 1024;
+        } else if (option == "--network" && hasValue) {
+            options->network = it.next();
+        } else if (option == "--durability" && hasValue) {
+            options->durability = it.next();
+            if (options->durability != "none" && options->durability != "file"
+                    && options->durability != "batched") {
+                help();
+            }
+        } else if (option == "--output" && hasValue) {
+            options->output = it.next();
+        } else if (option == "--workdir" && hasValue) {
+            options->workDir = it.next();
+        } else if (option == "--verbose") {
+            options->verbose = true;
+        } else {
+            help();
+        }
+    }
+
+    if (options->scenarios.isEmpty() || options->scenarios.contains("all")) {
+        options->scenarios = QStringList() << "small" << "large" << "deep" << "wide";
+    }
+}
+
+static void quietMessageHandler(QtMsgType type, const QMessageLogContext &, const QString &msg)
+{
+    if (type != QtDebugMsg) {
+        std::cerr << qPrintable(msg) << std::endl;
+    }
+    if (type == QtFatalMsg) {
+        abort();
+    }
+}
+
+static Scenario makeScenario(const QString &name, int scale)
+{
+    Scenario s;
+    s.name = name;
+    if (name == "small") {
+        // many small files in a few directories
+        for (int d = 0; d < 50 * scale; ++d) {
+            const QString dir = QString("small/d%1").arg(d, 3, 10, QChar('0'));
+            s.dirs.append(dir);
+            for (int f = 0; f < 100; ++f) {
+                s.files.append(qMakePair(dir + QString("/f%1.txt").arg(f), qint64(1024 * (1 + (d + f) % 8))));
+            }
+        }
+    } else if (name == "large") {
+        // few huge files
+        s.dirs.append("large");
+        for (int f = 0; f < 4; ++f) {
+            s.files.append(qMakePair(QString("large/big%1.bin").arg(f), qint64(scale) * 32 * 1024 * 1024));
+        }
+    } else if (name == "deep") {
+        // deep nesting
+        for (int b = 0; b < scale; ++b) {
+            QString dir = QString("deep/b%1").arg(b);
+            for (int level = 0; level < 32; ++level) {
+                dir += QString("/l%1").arg(level);
+                s.dirs.append(dir);
+                for (int f = 0; f < 10; ++f) {
+                    s.files.append(qMakePair(dir + QString("/f%1.txt").arg(f), qint64(4096)));
+                }
+            }
+        }
+    } else if (name == "wide") {
+        // one wide directory
+        s.dirs.append("wide");
+        for (int f = 0; f < 10000 * scale; ++f) {
+            s.files.append(qMakePair(QString("wide/f%1.txt").arg(f, 6, 10, QChar('0')), qint64(1024)));
+        }
+    } else {
+        std::cerr << "Unknown scenario " << qPrintable(name) << std::endl;
+        help();
+    }
+    return s;
+}
+
+static void writeLocalFile(const QString &path, qint64 size, char fill)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qFatal("Could not write %s", qPrintable(path));
+    }
+    const QByteArray block(int(qMin(size, qint64(64 * 1024))), fill);
+    for (qint64 written = 0; written < size; written += block.size()) {
+        file.write(block.constData(), qMin(qint64(block.size()), size - written));
+    }
+}
+
+static void appendLocalFile(const QString &path)
+{
+    QFile file(path);
+    if (file.open(QIODevice::Append)) {
+        file.write("changed\n");
+    }
+}
+
+static int countLocalFiles(const QString &localPath)
+{
+    int count = 0;
+    QDirIterator it(localPath, QDir::Files | QDir::Hidden | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        if (!it.fileName().startsWith(".csync_journal.db")) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+static QJsonObject runSync(AccountPtr account, const QString &localPath, SyncJournalDb *journal,
+                           FakeDavServer *server, const QString &phase)
+{
+    QString remoteUrl = account->davUrl().toString();
+    remoteUrl.replace(0, 4, "owncloud");
+
+    CSYNC *ctx;
+    if (csync_create(&ctx, localPath.toUtf8(), remoteUrl.toUtf8()) < 0) {
+        qFatal("Unable to create csync-context!");
+    }
+    csync_set_log_level(opts->verbose ? 11 : 0);
+    account->credentials()->syncContextPreInit(ctx);
+    if (csync_init(ctx) < 0) {
+        qFatal("Could not initialize csync!");
+    }
+    csync_set_module_property(ctx, "csync_context", ctx);
+    csync_set_module_property(ctx, "proxy_type", (void*) "NoProxy");
+
+    QJsonObject result;
+    result.insert("phase", phase);
+    {
+        SyncEngine engine(account, ctx, localPath, account->davUrl().path(), QString(), journal);
+        engine.setNetworkLimits(opts->uploadLimit, opts->downloadLimit);
+        QEventLoop loop;
+        QObject::connect(&engine, SIGNAL(finished()), &loop, SLOT(quit()));
+        QStringList errors;
+        QObject::connect(&engine, &SyncEngine::csyncError, [&errors](const QString &error) {
+            errors.append(error);
+        });
+
+        QElapsedTimer timer;
+        timer.start();
+        QMetaObject::invokeMethod(&engine, "startSync", Qt::QueuedConnection);
+        loop.exec();
+        const qint64 wall = timer.elapsed();
+
+        const int localFiles = countLocalFiles(localPath);
+        const int remoteFiles = server->files().count();
+        result.insert("wallMsec", wall);
+        result.insert("anotherSyncNeeded", engine.isAnotherSyncNeeded());
+        result.insert("errors", QJsonArray::fromStringList(errors));
+        result.insert("localFiles", localFiles);
+        result.insert("remoteFiles", remoteFiles);
+        const SyncPerformanceReport report = engine.performanceReport();
+        result.insert("report", QJsonDocument::fromJson(report.toJson()).object());
+        // How close the transfers came to the limits: 1 is the limit, above is too fast
+        if (report.propagationDuration > 0) {
+            if (opts->uploadLimit > 0 && report.bytesUploaded > 0) {
+                result.insert("uploadLimitAdherence",
+                              report.bytesUploaded * 1000. / report.propagationDuration / opts->uploadLimit);
+            }
+            if (opts->downloadLimit > 0 && report.bytesDownloaded > 0) {
+                result.insert("downloadLimitAdherence",
+                              report.bytesDownloaded * 1000. / report.propagationDuration / opts->downloadLimit);
+            }
+        }
+        std::cerr << "  " << qPrintable(phase) << ": " << wall << " ms"
+                  << (localFiles == remoteFiles && errors.isEmpty() ? "" : " (NOT IN SYNC)") << std::endl;
+    }
+    csync_destroy(ctx);
+    return result;
+}
+
+static QJsonObject runScenario(AccountPtr account, FakeDavServer *server, const Scenario &scenario,
+                               const QString &workDir)
+{
+    const QString localPath = QDir(workDir).absoluteFilePath(scenario.name) + QLatin1Char('/');
+    QDir(localPath).removeRecursively();
+    QDir().mkpath(localPath);
+
+    qint64 totalSize = 0;
+    for (int i = 0; i < scenario.files.size(); ++i) {
+        totalSize += scenario.files.at(i).second;
+    }
+    std::cerr << qPrintable(scenario.name) << ": " << scenario.files.size() << " files, "
+              << totalSize / 1024 << " KiB" << std::endl;
+
+    // The tree is on one side only, the initial sync copies it
+    const time_t now = time(0);
+    foreach (const QString &dir, scenario.dirs) {
+        if (opts->upload) {
+            QDir(localPath).mkpath(dir);
+        } else {
+            server->mkdir(dir);
+        }
+    }
+    for (int i = 0; i < scenario.files.size(); ++i) {
+        const QPair<QString, qint64> &file = scenario.files.at(i);
+        if (opts->upload) {
+            writeLocalFile(localPath + file.first, file.second, char('a' + i % 26));
+        } else {
+            server->putFile(file.first, file.second, now - 3600);
+        }
+    }
+
+    QJsonArray runs;
+    {
+        SyncJournalDb journal(localPath);
+        runs.append(runSync(account, localPath, &journal, server, "initial"));
+        runs.append(runSync(account, localPath, &journal, server, "noop"));
+
+        // Change one file in a hundred on each side, and add as many
+        const int step = 100;
+        int changed = 0;
+        for (int i = 0; i < scenario.files.size(); i += step) {
+            appendLocalFile(localPath + scenario.files.at(i).first);
+            ++changed;
+        }
+        for (int i = step / 2; i < scenario.files.size(); i += step) {
+            server->modifyFile(scenario.files.at(i).first, now);
+        }
+        const QString firstDir = scenario.dirs.first();
+        for (int i = 0; i < qMax(1, changed); ++i) {
+            writeLocalFile(localPath + firstDir + QString("/new-local-%1.txt").arg(i), 2048, 'l');
+            server->putFile(firstDir + QString("/new-remote-%1.txt").arg(i), 2048, now);
+        }
+        runs.append(runSync(account, localPath, &journal, server, "incremental"));
+        journal.close();
+    }
+
+    QJsonObject result;
+    result.insert("name", scenario.name);
+    result.insert("files", scenario.files.size());
+    result.insert("directories", scenario.dirs.size());
+    result.insert("bytes", totalSize);
+    result.insert("runs", runs);
+
+    QDir(localPath).removeRecursively();
+    server->remove(scenario.name); // all the paths of a scenario start with its name
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    BenchmarkOptions options;
+    options.scale = 1;
+    options.latency = 0;
+    options.bandwidth = 0;
+    options.upload = false;
+    options.uploadLimit = 0;
+    options.downloadLimit = 0;
+    options.verbose = false;
+    options.durability = "batched";
+    opts = &options;
+    parseOptions(app.arguments(), &options);
+    // Read once by the propagator
+    qputenv("OWNCLOUD_DOWNLOAD_DURABILITY", options.durability.toLatin1());
+
+    if (!options.verbose) {
+        qInstallMessageHandler(quietMessageHandler);
+    }
+    QNetworkProxy::setApplicationProxy(QNetworkProxy::NoProxy);
+    if (!options.network.isEmpty()) {
+        bool ok = false;
+        NetworkConditioner::instance()->setConditions(NetworkConditions::parse(options.network, &ok));
+        if (!ok) {
+            help();
+        }
+    }
+
+    FakeDavServer server;
+    server.setLatency(options.latency);
+    server.setBandwidth(options.bandwidth);
+    if (!server.start()) {
+        qFatal("Could not start the WebDAV server");
+    }
+
+    AccountPtr account = Account::create();
+    account->setUrl(server.url());
+    account->setCredentials(new DummyCredentials);
+
+    QTemporaryDir tempDir;
+    const QString workDir = options.workDir.isEmpty() ? tempDir.path() : options.workDir;
+
+    QJsonArray scenarios;
+    foreach (const QString &name, options.scenarios) {
+        scenarios.append(runScenario(account, &server, makeScenario(name, options.scale), workDir));
+    }
+
+    QJsonObject settings;
+    settings.insert("scale", options.scale);
+    settings.insert("latencyMsec", options.latency);
+    settings.insert("network", options.network);
+    settings.insert("bandwidthBytesPerSecond", options.bandwidth);
+    settings.insert("initialDirection", options.upload ? "up" : "down");
+    settings.insert("uploadLimitBytesPerSecond", options.uploadLimit);
+    settings.insert("downloadLimitBytesPerSecond", options.downloadLimit);
+    settings.insert("durability", options.durability);
+
+    QJsonObject root;
+    root.insert("benchmark", "sync");
+    root.insert("date", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    root.insert("settings", settings);
+    root.insert("scenarios", scenarios);
+    const QByteArray json = QJsonDocument(root).toJson();
+
+    if (options.output.isEmpty()) {
+        std::cout << json.constData();
+    } else {
+        QFile file(options.output);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qFatal("Could not write %s", qPrintable(options.output));
+        }
+        file.write(json);
+    }
+    return 0;
+}
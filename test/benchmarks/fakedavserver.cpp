@@ -0,0 +1,670 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+#include "fakedavserver.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QLocale>
+#include <QRegExp>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+namespace OCC {
+
+static const char davPrefixC[] = "/remote.php/webdav";
+
+static QString parentPath(const QString &path)
+{
+    int slash = path.lastIndexOf(QLatin1Char('/'));
+    return slash < 0 ? QString() : path.left(slash);
+}
+
+static QString fileName(const QString &path)
+{
+    return path.mid(path.lastIndexOf(QLatin1Char('/')) + 1);
+}
+
+static QString childPath(const QString &dir, const QString &name)
+{
+    return dir.isEmpty() ? name : dir + QLatin1Char('/') + name;
+}
+
+static QByteArray httpDate(time_t t)
+{
+    return QLocale::c().toString(QDateTime::fromTime_t(t).toUTC(),
+                                 QLatin1String("ddd, dd MMM yyyy hh:mm:ss 'GMT'")).toLatin1();
+}
+
+// Cheap content that differs between the seeds
+static void fillContent(char *data, quint32 seed, qint64 offset, qint64 size)
+{
+    for (qint64 i = 0; i < size; ++i) {
+        data[i] = char(((offset + i) * 131 + seed) >> 3);
+    }
+}
+
+FakeDavServer::FakeDavServer(QObject *parent)
+    : QObject(parent)
+    , _lastEtag(0)
+    , _lastFileId(0)
+    , _lastSeed(0)
+    , _latency(0)
+    , _bandwidth(0)
+    , _listener(0)
+    , _port(0)
+{
+    Entry root;
+    root.isDirectory = true;
+    root.mtime = time(0);
+    root.etag = newEtag();
+    root.fileId = newFileId();
+    _entries.insert(QString(), root);
+    _thread.setObjectName(QLatin1String("FakeDavServer"));
+}
+
+FakeDavServer::~FakeDavServer()
+{
+    _thread.quit();
+    _thread.wait();
+}
+
+bool FakeDavServer::start()
+{
+    FakeDavListener *listener = new FakeDavListener(this);
+    listener->moveToThread(&_thread);
+    connect(&_thread, SIGNAL(finished()), listener, SLOT(deleteLater()));
+    _listener = listener;
+    _thread.start();
+    QMetaObject::invokeMethod(listener, "listen", Qt::BlockingQueuedConnection, Q_RETURN_ARG(quint16, _port));
+    return _port != 0;
+}
+
+QUrl FakeDavServer::url() const
+{
+    return QUrl(QString::fromLatin1("http://127.0.0.1:%1/").arg(_port));
+}
+
+void FakeDavServer::setLatency(int msecs)
+{
+    QMutexLocker lock(&_mutex);
+    _latency = msecs;
+}
+
+int FakeDavServer::latency() const
+{
+    QMutexLocker lock(&_mutex);
+    return _latency;
+}
+
+void FakeDavServer::setBandwidth(qint64 bytesPerSecond)
+{
+    QMutexLocker lock(&_mutex);
+    _bandwidth = bytesPerSecond;
+}
+
+qint64 FakeDavServer::bandwidth() const
+{
+    QMutexLocker lock(&_mutex);
+    return _bandwidth;
+}
+
+void FakeDavServer::mkdir(const QString &path)
+{
+    QMutexLocker lock(&_mutex);
+    mkdirLocked(path);
+}
+
+void FakeDavServer::putFile(const QString &path, qint64 size, time_t mtime)
+{
+    QMutexLocker lock(&_mutex);
+    putFileLocked(path, size, mtime, ++_lastSeed);
+}
+
+void FakeDavServer::modifyFile(const QString &path, time_t mtime)
+{
+    QMutexLocker lock(&_mutex);
+    QHash<QString, Entry>::iterator it = _entries.find(path);
+    if (it == _entries.end() || it->isDirectory) {
+        return;
+    }
+    it->seed = ++_lastSeed;
+    it->mtime = mtime;
+    touchLocked(path);
+}
+
+void FakeDavServer::remove(const QString &path)
+{
+    QMutexLocker lock(&_mutex);
+    if (path.isEmpty() || !_entries.contains(path)) {
+        return;
+    }
+    removeLocked(path);
+    touchLocked(parentPath(path));
+}
+
+QStringList FakeDavServer::files() const
+{
+    QMutexLocker lock(&_mutex);
+    QStringList result;
+    for (QHash<QString, Entry>::const_iterator it = _entries.constBegin(); it != _entries.constEnd(); ++it) {
+        if (!it->isDirectory) {
+            result.append(it.key());
+        }
+    }
+    return result;
+}
+
+void FakeDavServer::mkdirLocked(const QString &path)
+{
+    if (path.isEmpty() || _entries.contains(path)) {
+        return;
+    }
+    const QString parent = parentPath(path);
+    mkdirLocked(parent);
+    Entry entry;
+    entry.isDirectory = true;
+    entry.mtime = time(0);
+    entry.fileId = newFileId();
+    _entries.insert(path, entry);
+    _entries[parent].children.insert(fileName(path));
+    touchLocked(path);
+}
+
+void FakeDavServer::putFileLocked(const QString &path, qint64 size, time_t mtime, quint32 seed)
+{
+    const QString parent = parentPath(path);
+    mkdirLocked(parent);
+    Entry &entry = _entries[path];
+    if (entry.fileId.isEmpty()) {
+        entry.fileId = newFileId();
+        _entries[parent].children.insert(fileName(path));
+    }
+    entry.size = size;
+    entry.mtime = mtime;
+    entry.seed = seed;
+    touchLocked(path);
+}
+
+void FakeDavServer::removeLocked(const QString &path)
+{
+    Entry entry = _entries.take(path);
+    foreach (const QString &name, entry.children) {
+        removeLocked(childPath(path, name));
+    }
+    QHash<QString, Entry>::iterator parent = _entries.find(parentPath(path));
+    if (parent != _entries.end()) {
+        parent->children.remove(fileName(path));
+    }
+}
+
+// Like the server, a change gives a new etag to the entry and all its parents
+void FakeDavServer::touchLocked(const QString &path)
+{
+    QString p = path;
+    forever {
+        QHash<QString, Entry>::iterator it = _entries.find(p);
+        if (it != _entries.end()) {
+            it->etag = newEtag();
+        }
+        if (p.isEmpty()) {
+            break;
+        }
+        p = parentPath(p);
+    }
+}
+
+QByteArray FakeDavServer::newEtag()
+{
+    return QByteArray::number(++_lastEtag, 16).rightJustified(12, '0');
+}
+
+QByteArray FakeDavServer::newFileId()
+{
+    return QByteArray::number(++_lastFileId).rightJustified(8, '0') + "ocbench";
+}
+
+int FakeDavServer::propfind(const QString &path, int depth, QByteArray *body)
+{
+    QMutexLocker lock(&_mutex);
+    QHash<QString, Entry>::const_iterator it = _entries.constFind(path);
+    if (it == _entries.constEnd()) {
+        return 404;
+    }
+    QStringList paths(path);
+    if (depth > 0) {
+        foreach (const QString &name, it->children) {
+            paths.append(childPath(path, name));
+        }
+    }
+
+    QByteArray &xml = *body;
+    xml = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+          "<d:multistatus xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">\n";
+    foreach (const QString &p, paths) {
+        const Entry &entry = _entries[p];
+        QByteArray href = davPrefixC + QUrl::toPercentEncoding(QLatin1Char('/') + p, "/");
+        if (entry.isDirectory && !href.endsWith('/')) {
+            href += '/';
+        }
+        xml += "<d:response><d:href>" + href + "</d:href><d:propstat><d:prop>";
+        if (entry.isDirectory) {
+            xml += "<d:resourcetype><d:collection/></d:resourcetype>";
+        } else {
+            xml += "<d:resourcetype/><d:getcontentlength>" + QByteArray::number(entry.size) + "</d:getcontentlength>";
+        }
+        xml += "<d:getlastmodified>" + httpDate(entry.mtime) + "</d:getlastmodified>"
+                "<d:getetag>\"" + entry.etag + "\"</d:getetag>"
+                "<oc:id>" + entry.fileId + "</oc:id>"
+                "<oc:permissions>" + (entry.isDirectory ? "RDNVCK" : "RDNVW") + "</oc:permissions>"
+                "</d:prop><d:status>HTTP/1.1 200 OK</d:status></d:propstat></d:response>\n";
+    }
+    xml += "</d:multistatus>\n";
+    return 207;
+}
+
+int FakeDavServer::lookupFile(const QString &path, Entry *entry)
+{
+    QMutexLocker lock(&_mutex);
+    QHash<QString, Entry>::const_iterator it = _entries.constFind(path);
+    if (it == _entries.constEnd()) {
+        return 404;
+    }
+    if (it->isDirectory) {
+        return 405;
+    }
+    *entry = *it;
+    return 200;
+}
+
+int FakeDavServer::put(const QString &requestPath, const QHash<QByteArray, QByteArray> &headers,
+                       qint64 size, Entry *entry)
+{
+    QMutexLocker lock(&_mutex);
+    QString path = requestPath;
+
+    if (headers.contains("oc-chunked")) {
+        // <file>-chunking-<transfer id>-<chunk count>-<chunk index>
+        QRegExp chunkRx(QLatin1String("^(.*)-chunking-(\\d+)-(\\d+)-(\\d+)$"));
+        if (!chunkRx.exactMatch(requestPath)) {
+            return 400;
+        }
+        path = chunkRx.cap(1);
+        const QString key = path + QLatin1Char('#') + chunkRx.cap(2);
+        ChunkedUpload &upload = _chunkedUploads[key];
+        upload.count = chunkRx.cap(3).toInt();
+        upload.received.insert(chunkRx.cap(4).toInt());
+        if (upload.received.size() < upload.count) {
+            return 201;
+        }
+        _chunkedUploads.remove(key);
+        size = headers.value("oc-total-length").toLongLong();
+    }
+
+    QHash<QString, Entry>::const_iterator parent = _entries.constFind(parentPath(path));
+    if (path.isEmpty() || parent == _entries.constEnd() || !parent->isDirectory) {
+        return 409;
+    }
+    QHash<QString, Entry>::const_iterator existing = _entries.constFind(path);
+    if (existing != _entries.constEnd() && existing->isDirectory) {
+        return 409;
+    }
+    const bool isNew = existing == _entries.constEnd();
+    const QByteArray mtime = headers.value("x-oc-mtime");
+    putFileLocked(path, size, mtime.isEmpty() ? time(0) : time_t(mtime.toLongLong()), ++_lastSeed);
+    *entry = _entries.value(path);
+    return isNew ? 201 : 204;
+}
+
+int FakeDavServer::mkcol(const QString &path, Entry *entry)
+{
+    QMutexLocker lock(&_mutex);
+    if (_entries.contains(path)) {
+        return 405;
+    }
+    QHash<QString, Entry>::const_iterator parent = _entries.constFind(parentPath(path));
+    if (parent == _entries.constEnd() || !parent->isDirectory) {
+        return 409;
+    }
+    mkdirLocked(path);
+    *entry = _entries.value(path);
+    return 201;
+}
+
+int FakeDavServer::move(const QString &from, const QString &to)
+{
+    QMutexLocker lock(&_mutex);
+    if (from.isEmpty() || to.isEmpty() || !_entries.contains(from)) {
+        return from.isEmpty() || to.isEmpty() ? 403 : 404;
+    }
+    if (to == from || to.startsWith(from + QLatin1Char('/'))) {
+        return 409;
+    }
+    QHash<QString, Entry>::const_iterator parent = _entries.constFind(parentPath(to));
+    if (parent == _entries.constEnd() || !parent->isDirectory) {
+        return 409;
+    }
+    const bool overwrite = _entries.contains(to);
+    if (overwrite) {
+        removeLocked(to);
+    }
+
+    // Move the subtree, the entries keep their file id
+    QStringList pending(from);
+    while (!pending.isEmpty()) {
+        const QString oldPath = pending.takeFirst();
+        const QString newPath = to + oldPath.mid(from.size());
+        Entry entry = _entries.take(oldPath);
+        foreach (const QString &name, entry.children) {
+            pending.append(childPath(oldPath, name));
+        }
+        _entries.insert(newPath, entry);
+    }
+    _entries[parentPath(from)].children.remove(fileName(from));
+    _entries[parentPath(to)].children.insert(fileName(to));
+    touchLocked(parentPath(from));
+    touchLocked(to);
+    return overwrite ? 204 : 201;
+}
+
+int FakeDavServer::del(const QString &path)
+{
+    QMutexLocker lock(&_mutex);
+    if (path.isEmpty()) {
+        return 403;
+    }
+    if (!_entries.contains(path)) {
+        return 404;
+    }
+    removeLocked(path);
+    touchLocked(parentPath(path));
+    return 204;
+}
+
+/*********************************************************************************************/
+
+FakeDavListener::FakeDavListener(FakeDavServer *server)
+    : _server(server)
+    , _tcpServer(0)
+{
+}
+
+quint16 FakeDavListener::listen()
+{
+    _tcpServer = new QTcpServer(this);
+    connect(_tcpServer, SIGNAL(newConnection()), this, SLOT(slotNewConnection()));
+    if (!_tcpServer->listen(QHostAddress::LocalHost, 0)) {
+        qWarning() << "Could not listen:" << _tcpServer->errorString();
+        return 0;
+    }
+    return _tcpServer->serverPort();
+}
+
+void FakeDavListener::slotNewConnection()
+{
+    while (QTcpSocket *socket = _tcpServer->nextPendingConnection()) {
+        FakeDavConnection *connection = new FakeDavConnection(socket, _server);
+        connection->setParent(this);
+    }
+}
+
+/*********************************************************************************************/
+
+FakeDavConnection::FakeDavConnection(QTcpSocket *socket, FakeDavServer *server)
+    : _socket(socket)
+    , _server(server)
+    , _haveHeaders(false)
+    , _bodySize(0)
+    , _bodyRemaining(0)
+    , _busy(false)
+    , _streamSeed(0)
+    , _streamOffset(0)
+    , _streamRemaining(0)
+    , _paceSent(0)
+{
+    _socket->setParent(this);
+    _paceTimer.setSingleShot(true);
+    _paceTimer.setInterval(10);
+    connect(&_paceTimer, SIGNAL(timeout()), this, SLOT(slotWriteBody()));
+    connect(_socket, SIGNAL(readyRead()), this, SLOT(slotReadyRead()));
+    connect(_socket, SIGNAL(bytesWritten(qint64)), this, SLOT(slotWriteBody()));
+    connect(_socket, SIGNAL(disconnected()), this, SLOT(deleteLater()));
+}
+
+void FakeDavConnection::slotReadyRead()
+{
+    _buffer += _socket->readAll();
+    processBuffer();
+}
+
+void FakeDavConnection::processBuffer()
+{
+    // The client does not pipeline, the requests are answered one after the other
+    while (!_busy) {
+        if (!_haveHeaders) {
+            int end = _buffer.indexOf("\r\n\r\n");
+            if (end < 0) {
+                return;
+            }
+            QList<QByteArray> lines = _buffer.left(end).split('\n');
+            _buffer.remove(0, end + 4);
+            QList<QByteArray> requestLine = lines.takeFirst().trimmed().split(' ');
+            if (requestLine.size() < 2) {
+                _socket->disconnectFromHost();
+                return;
+            }
+            _verb = requestLine.at(0);
+            _path = requestPath(requestLine.at(1));
+            _headers.clear();
+            foreach (const QByteArray &line, lines) {
+                int colon = line.indexOf(':');
+                if (colon > 0) {
+                    _headers.insert(line.left(colon).trimmed().toLower(), line.mid(colon + 1).trimmed());
+                }
+            }
+            _bodySize = _headers.value("content-length").toLongLong();
+            _bodyRemaining = _bodySize;
+            _body.clear();
+            _haveHeaders = true;
+            _requestTimer.start();
+        }
+        if (_bodyRemaining > 0) {
+            qint64 n = qMin(_bodyRemaining, qint64(_buffer.size()));
+            if (_verb != "PUT") {
+                _body += _buffer.left(n);
+            }
+            _buffer.remove(0, n);
+            _bodyRemaining -= n;
+            if (_bodyRemaining > 0) {
+                return;
+            }
+        }
+        _haveHeaders = false;
+        handleRequest();
+    }
+}
+
+QString FakeDavConnection::requestPath(const QByteArray &target) const
+{
+    QString path = QUrl::fromPercentEncoding(target.split('?').first());
+    if (!path.startsWith(QLatin1String(davPrefixC))) {
+        return QString();
+    }
+    path.remove(0, qstrlen(davPrefixC));
+    while (path.startsWith(QLatin1Char('/'))) {
+        path.remove(0, 1);
+    }
+    while (path.endsWith(QLatin1Char('/'))) {
+        path.chop(1);
+    }
+    return path;
+}
+
+static QByteArray entryHeaders(const QByteArray &etag, const QByteArray &fileId)
+{
+    return "ETag: \"" + etag + "\"\r\nOC-ETag: \"" + etag + "\"\r\nOC-FileId: " + fileId + "\r\n";
+}
+
+void FakeDavConnection::handleRequest()
+{
+    if (_path.isNull()) {
+        respond(404, QByteArray());
+        return;
+    }
+
+    FakeDavServer::Entry entry;
+    if (_verb == "PROPFIND") {
+        QByteArray body;
+        int code = _server->propfind(_path, _headers.value("depth") == "0" ? 0 : 1, &body);
+        respond(code, code == 207 ? QByteArray("Content-Type: application/xml; charset=utf-8\r\n") : QByteArray(), body);
+    } else if (_verb == "GET" || _verb == "HEAD") {
+        int code = _server->lookupFile(_path, &entry);
+        if (code != 200) {
+            respond(code, QByteArray());
+            return;
+        }
+        qint64 start = 0;
+        const QByteArray range = _headers.value("range");
+        if (range.startsWith("bytes=")) {
+            start = range.mid(6, range.indexOf('-') - 6).toLongLong();
+            if (start > entry.size) {
+                respond(416, QByteArray());
+                return;
+            }
+        }
+        QByteArray headers = entryHeaders(entry.etag, entry.fileId)
+                + "Last-Modified: " + httpDate(entry.mtime) + "\r\n"
+                + "Content-Type: application/octet-stream\r\n";
+        if (start > 0) {
+            code = 206;
+            headers += "Content-Range: bytes " + QByteArray::number(start) + '-' + QByteArray::number(entry.size - 1)
+                    + '/' + QByteArray::number(entry.size) + "\r\n";
+        }
+        if (_verb == "GET") {
+            _streamSeed = entry.seed;
+            _streamOffset = start;
+            _streamRemaining = entry.size - start;
+        }
+        respond(code, headers);
+    } else if (_verb == "PUT") {
+        int code = _server->put(_path, _headers, _bodySize, &entry);
+        QByteArray headers;
+        if ((code == 201 || code == 204) && !entry.etag.isEmpty()) {
+            headers = entryHeaders(entry.etag, entry.fileId) + "X-OC-MTime: accepted\r\n";
+        }
+        respond(code, headers);
+    } else if (_verb == "MKCOL") {
+        int code = _server->mkcol(_path, &entry);
+        respond(code, code == 201 ? entryHeaders(entry.etag, entry.fileId) : QByteArray());
+    } else if (_verb == "MOVE") {
+        QByteArray destination = _headers.value("destination");
+        if (destination.startsWith("http")) {
+            destination = QUrl::fromEncoded(destination).path(QUrl::FullyEncoded).toLatin1();
+        }
+        const QString to = requestPath(destination);
+        respond(to.isNull() ? 400 : _server->move(_path, to), QByteArray());
+    } else if (_verb == "DELETE") {
+        respond(_server->del(_path), QByteArray());
+    } else {
+        respond(501, QByteArray());
+    }
+}
+
+static QByteArray reasonPhrase(int code)
+{
+    switch (code) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 207: return "Multi-Status";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 409: return "Conflict";
+    case 416: return "Requested Range Not Satisfiable";
+    default: return "Not Implemented";
+    }
+}
+
+void FakeDavConnection::respond(int code, const QByteArray &headers, const QByteArray &body)
+{
+    _responseHead = "HTTP/1.1 " + QByteArray::number(code) + ' ' + reasonPhrase(code) + "\r\n"
+            + "Date: " + httpDate(time(0)) + "\r\n"
+            + "Content-Length: " + QByteArray::number(body.size() + _streamRemaining) + "\r\n"
+            + headers + "\r\n";
+    _responseBody = body;
+    _busy = true;
+
+    qint64 delay = _server->latency();
+    const qint64 bandwidth = _server->bandwidth();
+    if (bandwidth > 0 && _bodySize > 0) {
+        // The request body could not have been received faster than the bandwidth
+        delay += qMax(qint64(0), _bodySize * 1000 / bandwidth - _requestTimer.elapsed());
+    }
+    if (delay > 0) {
+        QTimer::singleShot(delay, this, SLOT(slotSendResponse()));
+    } else {
+        slotSendResponse();
+    }
+}
+
+void FakeDavConnection::slotSendResponse()
+{
+    _socket->write(_responseHead);
+    if (!_responseBody.isEmpty()) {
+        _socket->write(_responseBody);
+    }
+    _responseHead.clear();
+    _responseBody.clear();
+    if (_streamRemaining > 0) {
+        _paceClock.start();
+        _paceSent = 0;
+        slotWriteBody();
+    } else {
+        finishResponse();
+    }
+}
+
+void FakeDavConnection::slotWriteBody()
+{
+    if (_streamRemaining <= 0 || !_responseHead.isEmpty()) {
+        return;
+    }
+    const qint64 pieceSize = 64 * 1024;
+    const qint64 bandwidth = _server->bandwidth();
+    // Don't queue more than a few pieces, bytesWritten() asks for more
+    while (_streamRemaining > 0 && _socket->bytesToWrite() < 4 * pieceSize) {
+        qint64 n = qMin(pieceSize, _streamRemaining);
+        if (bandwidth > 0) {
+            const qint64 allowed = bandwidth * _paceClock.elapsed() / 1000 - _paceSent;
+            if (allowed <= 0) {
+                _paceTimer.start();
+                return;
+            }
+            n = qMin(n, allowed);
+        }
+        QByteArray piece(int(n), Qt::Uninitialized);
+        fillContent(piece.data(), _streamSeed, _streamOffset, n);
+        _socket->write(piece);
+        _streamOffset += n;
+        _streamRemaining -= n;
+        _paceSent += n;
+    }
+    if (_streamRemaining == 0) {
+        finishResponse();
+    }
+}
+
+void FakeDavConnection::finishResponse()
+{
+    _busy = false;
+    _streamRemaining = 0;
+    processBuffer();
+}
+
+}
@@ -0,0 +1,187 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+#ifndef FAKEDAVSERVER_H
+#define FAKEDAVSERVER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QSet>
+#include <QStringList>
+#include <QThread>
+#include <QTimer>
+#include <QUrl>
+
+#include <ctime>
+
+class QTcpServer;
+class QTcpSocket;
+
+namespace OCC {
+
+/**
+ * @brief A WebDAV server on localhost for the sync benchmarks
+ *
+ * Implements the part of the ownCloud WebDAV API the sync engine uses:
+ * PROPFIND, GET (with ranges), PUT (with chunking), MKCOL, MOVE and DELETE
+ * below /remote.php/webdav/. The files are kept in memory as a size and a
+ * seed for their content, so big trees and big files take little memory.
+ *
+ * The server runs in its own thread. Every response is delayed by the
+ * latency and the bodies are sent or accepted at most at the bandwidth.
+ *
+ * The methods changing the tree are thread-safe.
+ */
+class FakeDavServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FakeDavServer(QObject *parent = 0);
+    ~FakeDavServer();
+
+    /** Starts listening on a free port of 127.0.0.1 */
+    bool start();
+    /** The url of the server, without the dav path */
+    QUrl url() const;
+
+    void setLatency(int msecs);
+    int latency() const;
+    void setBandwidth(qint64 bytesPerSecond); // 0 for unlimited
+    qint64 bandwidth() const;
+
+    /** Creates the directory and its parents */
+    void mkdir(const QString &path);
+    /** Creates or replaces a file, creating its parents */
+    void putFile(const QString &path, qint64 size, time_t mtime);
+    /** Changes the content of a file, as if it was edited on the server */
+    void modifyFile(const QString &path, time_t mtime);
+    void remove(const QString &path);
+    QStringList files() const;
+
+private:
+    friend class FakeDavConnection;
+
+    struct Entry {
+        Entry() : isDirectory(false), size(0), mtime(0), seed(0) {}
+        bool isDirectory;
+        qint64 size;
+        time_t mtime;
+        quint32 seed; // the content of a file is generated from it
+        QByteArray etag;
+        QByteArray fileId;
+        QSet<QString> children; // names of the entries of a directory
+    };
+
+    struct ChunkedUpload {
+        ChunkedUpload() : count(0) {}
+        int count;
+        QSet<int> received;
+    };
+
+    // All of these must be called with the mutex locked
+    void mkdirLocked(const QString &path);
+    void putFileLocked(const QString &path, qint64 size, time_t mtime, quint32 seed);
+    void removeLocked(const QString &path);
+    void touchLocked(const QString &path);
+    QByteArray newEtag();
+    QByteArray newFileId();
+
+    // Used by the connections, return the HTTP status code
+    int propfind(const QString &path, int depth, QByteArray *body);
+    int lookupFile(const QString &path, Entry *entry);
+    int put(const QString &path, const QHash<QByteArray, QByteArray> &headers, qint64 size, Entry *entry);
+    int mkcol(const QString &path, Entry *entry);
+    int move(const QString &from, const QString &to);
+    int del(const QString &path);
+
+    mutable QMutex _mutex;
+    QHash<QString, Entry> _entries; // by path, without leading slash. The root is ""
+    QHash<QString, ChunkedUpload> _chunkedUploads; // by target path and transfer id
+    quint64 _lastEtag;
+    quint64 _lastFileId;
+    quint32 _lastSeed;
+    int _latency;
+    qint64 _bandwidth;
+
+    QThread _thread;
+    QObject *_listener;
+    quint16 _port;
+};
+
+/**
+ * @brief Accepts the connections, lives in the thread of the server
+ */
+class FakeDavListener : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FakeDavListener(FakeDavServer *server);
+
+public slots:
+    quint16 listen();
+
+private slots:
+    void slotNewConnection();
+
+private:
+    FakeDavServer *_server;
+    QTcpServer *_tcpServer;
+};
+
+/**
+ * @brief One keep-alive HTTP connection to the server
+ */
+class FakeDavConnection : public QObject
+{
+    Q_OBJECT
+public:
+    FakeDavConnection(QTcpSocket *socket, FakeDavServer *server);
+
+private slots:
+    void slotReadyRead();
+    void slotSendResponse();
+    void slotWriteBody();
+
+private:
+    void processBuffer();
+    void handleRequest();
+    void respond(int code, const QByteArray &headers, const QByteArray &body = QByteArray());
+    void finishResponse();
+    QString requestPath(const QByteArray &target) const;
+
+    QTcpSocket *_socket;
+    FakeDavServer *_server;
+    QByteArray _buffer;
+
+    // The request being received
+    bool _haveHeaders;
+    QByteArray _verb;
+    QString _path;
+    QHash<QByteArray, QByteArray> _headers; // lower case names
+    qint64 _bodySize;
+    qint64 _bodyRemaining;
+    QByteArray _body; // only kept when it is small
+    QElapsedTimer _requestTimer;
+
+    // The response, sent once the latency is over
+    bool _busy;
+    QByteArray _responseHead;
+    QByteArray _responseBody;
+    quint32 _streamSeed; // a generated body
+    qint64 _streamOffset;
+    qint64 _streamRemaining;
+    QElapsedTimer _paceClock;
+    qint64 _paceSent;
+    QTimer _paceTimer;
+};
+
+}
+
+#endif // FAKEDAVSERVER_H
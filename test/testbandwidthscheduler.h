@@ -0,0 +1,197 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+#ifndef MIRALL_TESTBANDWIDTHSCHEDULER_H
+#define MIRALL_TESTBANDWIDTHSCHEDULER_H
+
+#include <QtTest>
+
+#include "bandwidthscheduler.h"
+
+using namespace OCC;
+
+class TestBandwidthScheduler : public QObject
+{
+    Q_OBJECT
+
+    QList<int> _groups;
+    qint64 _now;
+
+    int addGroup() {
+        const int group = BandwidthScheduler::instance()->addGroup();
+        _groups.append(group);
+        return group;
+    }
+
+    // Lets the transfers read for msecs, each as much as the scheduler grants. The transfers
+    // that are waiting for the server (idle) don't ask. Returns the bytes each transfer got.
+    QList<qint64> run(const QList<int> &transfers, qint64 msecs, const QList<int> &idle = QList<int>()) {
+        BandwidthScheduler *scheduler = BandwidthScheduler::instance();
+        QList<qint64> got;
+        QList<qint64> wakeUp;
+        for (int i = 0; i < transfers.size(); ++i) {
+            got.append(0);
+            wakeUp.append(_now);
+        }
+        const qint64 end = _now + msecs;
+        for (; _now < end; ++_now) {
+            for (int i = 0; i < transfers.size(); ++i) {
+                if (idle.contains(transfers[i]) || _now < wakeUp[i]) {
+                    continue;
+                }
+                int waitMsec = -1;
+                const qint64 granted = scheduler->acquire(transfers[i], 16 * 1024, &waitMsec, _now);
+                if (granted == 0) {
+                    if (waitMsec < 1 || waitMsec > 100) {
+                        qWarning() << "Unexpected wait" << waitMsec;
+                        return QList<qint64>();
+                    }
+                    wakeUp[i] = _now + waitMsec;
+                }
+                got[i] += granted;
+            }
+        }
+        return got;
+    }
+
+    // Within 5% of the expected bytes
+    static bool around(qint64 bytes, qint64 expected) {
+        return qAbs(bytes - expected) <= expected / 20;
+    }
+
+private slots:
+    void initTestCase() {
+        _now = 0;
+    }
+
+    void init() {
+        // Every test starts later than the previous one ended
+        _now += 1000000;
+    }
+
+    void cleanup() {
+        BandwidthScheduler *scheduler = BandwidthScheduler::instance();
+        foreach (int group, _groups) {
+            scheduler->removeGroup(group);
+        }
+        _groups.clear();
+        scheduler->setLimit(BandwidthScheduler::Upload, 0);
+        scheduler->setLimit(BandwidthScheduler::Download, 0);
+        QVERIFY(!scheduler->isLimited(BandwidthScheduler::Upload));
+    }
+
+    void testUnlimited() {
+        BandwidthScheduler *scheduler = BandwidthScheduler::instance();
+        QVERIFY(!scheduler->isLimited(BandwidthScheduler::Download));
+        const int transfer = scheduler->addTransfer(addGroup(), BandwidthScheduler::Download);
+        int waitMsec = -1;
+        QCOMPARE(scheduler->acquire(transfer, 1 << 20, &waitMsec, _now), qint64(1 << 20));
+        QCOMPARE(waitMsec, 0);
+        QCOMPARE(scheduler->transferRate(transfer, _now), qint64(-1));
+        // not registered
+        QCOMPARE(scheduler->acquire(12345678, 100, &waitMsec, _now), qint64(100));
+    }
+
+    void testAbsoluteLimit() {
+        BandwidthScheduler *scheduler = BandwidthScheduler::instance();
+        scheduler->setLimit(BandwidthScheduler::Upload, 100 * 1000);
+        QVERIFY(scheduler->isLimited(BandwidthScheduler::Upload));
+        QVERIFY(!scheduler->isLimited(BandwidthScheduler::Download));
+        const int transfer = scheduler->addTransfer(addGroup(), BandwidthScheduler::Upload);
+        QCOMPARE(scheduler->transferRate(transfer, _now), qint64(100 * 1000));
+
+        QList<qint64> got = run(QList<int>() << transfer, 10000);
+        QCOMPARE(got.size(), 1);
+        QVERIFY2(around(got[0], 1000 * 1000), QByteArray::number(got[0]).constData());
+
+        // A new limit applies right away
+        scheduler->setLimit(BandwidthScheduler::Upload, 20 * 1000);
+        got = run(QList<int>() << transfer, 10000);
+        QVERIFY2(around(got[0], 200 * 1000), QByteArray::number(got[0]).constData());
+    }
+
+    void testFairSharing() {
+        BandwidthScheduler *scheduler = BandwidthScheduler::instance();
+        scheduler->setLimit(BandwidthScheduler::Download, 120 * 1000);
+        const int folder1 = addGroup();
+        const int folder2 = addGroup();
+        const int a = scheduler->addTransfer(folder1, BandwidthScheduler::Download);
+        const int b = scheduler->addTransfer(folder1, BandwidthScheduler::Download);
+        const int c = scheduler->addTransfer(folder2, BandwidthScheduler::Download);
+        // an upload does not take from the downloads
+        scheduler->addTransfer(folder2, BandwidthScheduler::Upload);
+
+        // half for each folder, then half for each transfer of the folder
+        QCOMPARE(scheduler->transferRate(a, _now), qint64(30 * 1000));
+        QCOMPARE(scheduler->transferRate(c, _now), qint64(60 * 1000));
+
+        // the tokens banked by the levels before go to whoever asks first
+        run(QList<int>() << a << b << c, 1000);
+        const QList<qint64> got = run(QList<int>() << a << b << c, 10000);
+        QCOMPARE(got.size(), 3);
+        QVERIFY2(around(got[0], 300 * 1000), QByteArray::number(got[0]).constData());
+        QVERIFY2(around(got[1], 300 * 1000), QByteArray::number(got[1]).constData());
+        QVERIFY2(around(got[2], 600 * 1000), QByteArray::number(got[2]).constData());
+
+        scheduler->removeTransfer(c);
+        QCOMPARE(scheduler->transferRate(a, _now), qint64(60 * 1000));
+    }
+
+    void testWorkConserving() {
+        BandwidthScheduler *scheduler = BandwidthScheduler::instance();
+        scheduler->setLimit(BandwidthScheduler::Upload, 100 * 1000);
+        const int folder1 = addGroup();
+        const int a = scheduler->addTransfer(folder1, BandwidthScheduler::Upload);
+        const int b = scheduler->addTransfer(folder1, BandwidthScheduler::Upload);
+        const int c = scheduler->addTransfer(addGroup(), BandwidthScheduler::Upload);
+
+        // b and c wait for the server, a gets the whole limit
+        const QList<qint64> got = run(QList<int>() << a << b << c, 10000, QList<int>() << b << c);
+        QCOMPARE(got.size(), 3);
+        QVERIFY2(around(got[0], 1000 * 1000), QByteArray::number(got[0]).constData());
+        QCOMPARE(got[1], qint64(0));
+    }
+
+    void testGroupLimit() {
+        BandwidthScheduler *scheduler = BandwidthScheduler::instance();
+        scheduler->setLimit(BandwidthScheduler::Upload, 100 * 1000);
+        const int folder1 = addGroup();
+        const int folder2 = addGroup();
+        scheduler->setGroupLimit(folder2, BandwidthScheduler::Upload, 20 * 1000);
+        const int a = scheduler->addTransfer(folder1, BandwidthScheduler::Upload);
+        const int b = scheduler->addTransfer(folder2, BandwidthScheduler::Upload);
+
+        // folder2 keeps to its limit, folder1 gets the rest
+        const QList<qint64> got = run(QList<int>() << a << b, 10000);
+        QCOMPARE(got.size(), 2);
+        QVERIFY2(around(got[0], 800 * 1000), QByteArray::number(got[0]).constData());
+        QVERIFY2(around(got[1], 200 * 1000), QByteArray::number(got[1]).constData());
+    }
+
+    void testRelativeLimit() {
+        BandwidthScheduler *scheduler = BandwidthScheduler::instance();
+        scheduler->setLimit(BandwidthScheduler::Upload, -50);
+        const int transfer = scheduler->addTransfer(addGroup(), BandwidthScheduler::Upload);
+
+        // Unlimited while measuring, the link does 200 bytes per msec
+        QCOMPARE(scheduler->transferRate(transfer, _now), qint64(-1));
+        int waitMsec;
+        for (int i = 0; i < 2000; ++i, ++_now) {
+            QCOMPARE(scheduler->acquire(transfer, 200, &waitMsec, _now), qint64(200));
+        }
+        QCOMPARE(scheduler->transferRate(transfer, _now), qint64(100 * 1000));
+
+        const QList<qint64> got = run(QList<int>() << transfer, 10000);
+        QCOMPARE(got.size(), 1);
+        QVERIFY2(around(got[0], 1000 * 1000), QByteArray::number(got[0]).constData());
+
+        // measured again later
+        _now += 20000;
+        QCOMPARE(scheduler->transferRate(transfer, _now), qint64(-1));
+    }
+};
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+#ifndef MIRALL_TESTNETWORKCONDITIONER_H
+#define MIRALL_TESTNETWORKCONDITIONER_H
+
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include "accessmanager.h"
+#include "networkconditioner.h"
+
+using namespace OCC;
+
+/* Answers every connection with a body of the given size */
+class TestHttpServer : public QTcpServer
+{
+    Q_OBJECT
+public:
+    explicit TestHttpServer(int bodySize) : _body(bodySize, 'x') {
+        connect(this, SIGNAL(newConnection()), SLOT(slotNewConnection()));
+        listen(QHostAddress::LocalHost);
+    }
+    QUrl url() const { return QUrl(QString("http://127.0.0.1:%1/file").arg(serverPort())); }
+
+private slots:
+    void slotNewConnection() {
+        QTcpSocket *socket = nextPendingConnection();
+        connect(socket, SIGNAL(readyRead()), SLOT(slotReadyRead()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    }
+    void slotReadyRead() {
+        QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+        if (!socket->readAll().contains("\r\n\r\n")) {
+            return;
+        }
+        socket->write("HTTP/1.1 200 OK\r\nContent-Length: " + QByteArray::number(_body.size())
+                      + "\r\nConnection: close\r\n\r\n" + _body);
+        socket->disconnectFromHost();
+    }
+
+private:
+    QByteArray _body;
+};
+
+class TestNetworkConditioner : public QObject
+{
+    Q_OBJECT
+
+    QNetworkReply *waitForReply(QNetworkReply *reply) {
+        QSignalSpy spy(reply, SIGNAL(finished()));
+        spy.wait(10000);
+        return reply;
+    }
+
+private slots:
+    void cleanup() {
+        NetworkConditioner::instance()->clear();
+    }
+
+    void testParse() {
+        bool ok = false;
+        NetworkConditions c = NetworkConditions::parse(
+            "rtt=100,jitter=20,down=1024,up=256,reset=0.01,error=0.05,errorcode=500,storm=60/10,slowstart", &ok);
+        QVERIFY(ok);
+        QCOMPARE(c.rtt, 100);
+        QCOMPARE(c.jitter, 20);
+        QCOMPARE(c.downloadBandwidth, qint64(1024 * 1024));
+        QCOMPARE(c.uploadBandwidth, qint64(256 * 1024));
+        QCOMPARE(c.resetProbability, 0.01);
+        QCOMPARE(c.errorProbability, 0.05);
+        QCOMPARE(c.errorCode, 500);
+        QCOMPARE(c.stormPeriod, 60);
+        QCOMPARE(c.stormDuration, 10);
+        QVERIFY(c.slowStart);
+        QVERIFY(c.isActive());
+
+        QVERIFY(!NetworkConditions().isActive());
+        QCOMPARE(NetworkConditions().errorCode, 503);
+
+        NetworkConditions::parse("rtt=100,latency=3", &ok);
+        QVERIFY(!ok);
+        NetworkConditions::parse("storm=10/20", &ok);
+        QVERIFY(!ok);
+    }
+
+    void testConditionsByHost() {
+        NetworkConditioner *conditioner = NetworkConditioner::instance();
+        QVERIFY(!NetworkConditioner::isEnabled());
+
+        conditioner->setConditions(NetworkConditions::parse("rtt=50"));
+        conditioner->setConditions(NetworkConditions::parse("rtt=300"), "slow.example.com");
+        QVERIFY(NetworkConditioner::isEnabled());
+        QCOMPARE(conditioner->conditions("example.com").rtt, 50);
+        QCOMPARE(conditioner->conditions("slow.example.com").rtt, 300);
+
+        conditioner->clear();
+        QVERIFY(!NetworkConditioner::isEnabled());
+        QCOMPARE(conditioner->conditions("example.com").rtt, 0);
+    }
+
+    void testRepeatableDecisions() {
+        NetworkConditioner *conditioner = NetworkConditioner::instance();
+        conditioner->setConditions(NetworkConditions::parse("rtt=100,jitter=50,reset=0.5,error=0.2"));
+
+        QList<int> first;
+        QList<int> second;
+        foreach (QList<int> *decisions, QList<QList<int> *>() << &first << &second) {
+            conditioner->setSeed(7);
+            for (int i = 0; i < 20; ++i) {
+                NetworkConditioner::Decision d = conditioner->startRequest("example.com", 0);
+                conditioner->finishRequest("example.com");
+                QVERIFY(d.delay >= 50 && d.delay <= 150);
+                decisions->append(d.delay);
+                decisions->append(d.errorCode);
+                decisions->append(d.reset);
+            }
+        }
+        QCOMPARE(first, second);
+    }
+
+    void testSharedBandwidth() {
+        NetworkConditioner *conditioner = NetworkConditioner::instance();
+        conditioner->setConditions(NetworkConditions::parse("down=100,up=50"));
+
+        // two downloads to the same host share the bandwidth
+        qint64 first = conditioner->reserveDownload("example.com", 100 * 1024);
+        qint64 second = conditioner->reserveDownload("example.com", 100 * 1024);
+        QVERIFY(first > 900 && first <= 1000);
+        QVERIFY(second > 1900 && second <= 2000);
+        QVERIFY(conditioner->reserveDownload("other.example.com", 100 * 1024) <= 1000);
+
+        // the upload time delays the request
+        NetworkConditioner::Decision d = conditioner->startRequest("example.com", 50 * 1024);
+        conditioner->finishRequest("example.com");
+        QVERIFY(d.delay > 900 && d.delay <= 1000);
+    }
+
+    void testSlowStart() {
+        NetworkConditioner *conditioner = NetworkConditioner::instance();
+        conditioner->setConditions(NetworkConditions::parse("rtt=100,slowstart"));
+
+        conditioner->startRequest("example.com", 0);
+        // ten segments in the first round trip
+        qint64 delay = conditioner->reserveDownload("example.com", 14600);
+        QVERIFY(delay >= 90 && delay <= 100);
+        conditioner->finishRequest("example.com");
+    }
+
+    void testInjectedError() {
+        NetworkConditioner::instance()->setConditions(NetworkConditions::parse("rtt=100,error=1"));
+        AccessManager am;
+        QElapsedTimer timer;
+        timer.start();
+        // nothing listens there, the request must not be sent
+        QNetworkReply *reply = waitForReply(am.get(QNetworkRequest(QUrl("http://127.0.0.1:1/"))));
+        QVERIFY(reply->isFinished());
+        QVERIFY(timer.elapsed() >= 90);
+        QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 503);
+        QCOMPARE(reply->error(), QNetworkReply::ServiceUnavailableError);
+        delete reply;
+    }
+
+    void testPacedDownload() {
+        TestHttpServer server(32 * 1024);
+        NetworkConditioner::instance()->setConditions(NetworkConditions::parse("down=64"));
+        AccessManager am;
+        QElapsedTimer timer;
+        timer.start();
+        QNetworkReply *reply = waitForReply(am.get(QNetworkRequest(server.url())));
+        QVERIFY(reply->isFinished());
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 200);
+        QCOMPARE(reply->readAll(), QByteArray(32 * 1024, 'x'));
+        QVERIFY(timer.elapsed() >= 450);
+        delete reply;
+    }
+
+    void testConnectionReset() {
+        TestHttpServer server(32 * 1024);
+        NetworkConditioner::instance()->setConditions(NetworkConditions::parse("reset=1"));
+        AccessManager am;
+        QNetworkReply *reply = waitForReply(am.get(QNetworkRequest(server.url())));
+        QVERIFY(reply->isFinished());
+        QCOMPARE(reply->error(), QNetworkReply::RemoteHostClosedError);
+        QVERIFY(reply->readAll().size() < 32 * 1024);
+        delete reply;
+    }
+};
+
+#endif
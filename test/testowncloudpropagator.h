@@ -8,6 +8,230 @@
 #define MIRALL_TESTOWNCLOUDPROPAGATOR_H
 
 #include <QtTest>
+#include <QTemporaryDir>
+
+#include <QElapsedTimer>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+
+#include "account.h"
+#include "creds/dummycredentials.h"
+#include "owncloudpropagator.h"
+#include "propagatedownload.h"
+#include "propagatorjobs.h"
+#include "syncjournaldb.h"
+
+#ifndef Q_OS_WIN
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace OCC;
+
+static void writeFile(const QString &path, const QByteArray &content = "data")
+{
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(content);
+}
+
+static QByteArray readFile(const QString &path)
+{
+    QFile file(path);
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+/* A job that finishes when told to */
+class FakePropagateJob : public PropagateItemJob
+{
+    Q_OBJECT
+public:
+    FakePropagateJob(OwncloudPropagator *propagator, JobParallelism parallelism)
+        : PropagateItemJob(propagator, SyncFileItem()), _parallelism(parallelism) {}
+    JobParallelism parallelism() Q_DECL_OVERRIDE { return _parallelism; }
+    void start() Q_DECL_OVERRIDE {}
+    void finish() { done(SyncFileItem::Success); }
+private:
+    JobParallelism _parallelism;
+};
+
+/* A reply that is never answered */
+class PendingReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    PendingReply(QNetworkAccessManager::Operation operation, const QNetworkRequest &request, QObject *parent)
+        : QNetworkReply(parent)
+    {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(operation);
+        open(QIODevice::ReadOnly);
+    }
+    void abort() Q_DECL_OVERRIDE {}
+protected:
+    qint64 readData(char *, qint64) Q_DECL_OVERRIDE { return 0; }
+};
+
+/* Records when each MKCOL is sent */
+class MkcolRecorder : public QNetworkAccessManager
+{
+    Q_OBJECT
+public:
+    MkcolRecorder() { clock.start(); }
+    QElapsedTimer clock;
+    QList<qint64> mkcolTimes; // msec
+protected:
+    QNetworkReply *createRequest(Operation operation, const QNetworkRequest &request,
+                                 QIODevice *) Q_DECL_OVERRIDE {
+        if (request.attribute(QNetworkRequest::CustomVerbAttribute).toByteArray() == "MKCOL") {
+            mkcolTimes.append(clock.elapsed());
+        }
+        return new PendingReply(operation, request, this);
+    }
+};
+
+class MkcolRecorderCredentials : public DummyCredentials
+{
+    Q_OBJECT
+public:
+    QNetworkAccessManager *getQNAM() const Q_DECL_OVERRIDE { return new MkcolRecorder; }
+};
+
+/* Answers a GET with the body of the server, or its tail for a Range request */
+class FakeGetReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    FakeGetReply(QNetworkAccessManager::Operation operation, const QNetworkRequest &request,
+                 const QByteArray &body, QObject *parent)
+        : QNetworkReply(parent), _offset(0)
+    {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(operation);
+        open(QIODevice::ReadOnly);
+
+        qint64 start = 0;
+        const QByteArray range = request.rawHeader("Range");
+        if (range.startsWith("bytes=")) {
+            start = range.mid(6, range.indexOf('-') - 6).toLongLong();
+            setRawHeader("Content-Range", "bytes " + QByteArray::number(start) + '-'
+                         + QByteArray::number(body.size() - 1) + '/' + QByteArray::number(body.size()));
+        }
+        _body = body.mid(start);
+        setRawHeader("ETag", "\"etag1\"");
+        setRawHeader("Content-Length", QByteArray::number(_body.size()));
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, start > 0 ? 206 : 200);
+        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+    }
+    void abort() Q_DECL_OVERRIDE {}
+    qint64 bytesAvailable() const Q_DECL_OVERRIDE {
+        return _body.size() - _offset + QIODevice::bytesAvailable();
+    }
+protected:
+    qint64 readData(char *data, qint64 maxlen) Q_DECL_OVERRIDE {
+        const qint64 len = qMin(maxlen, qint64(_body.size()) - _offset);
+        memcpy(data, _body.constData() + _offset, len);
+        _offset += len;
+        return len;
+    }
+private slots:
+    void respond() {
+        emit metaDataChanged();
+        emit readyRead();
+        setFinished(true);
+        emit finished();
+    }
+private:
+    QByteArray _body;
+    qint64 _offset;
+};
+
+class GetServer : public QNetworkAccessManager
+{
+    Q_OBJECT
+public:
+    QByteArray body;
+protected:
+    QNetworkReply *createRequest(Operation operation, const QNetworkRequest &request,
+                                 QIODevice *) Q_DECL_OVERRIDE {
+        return new FakeGetReply(operation, request, body, this);
+    }
+};
+
+class GetServerCredentials : public DummyCredentials
+{
+    Q_OBJECT
+public:
+    QNetworkAccessManager *getQNAM() const Q_DECL_OVERRIDE { return new GetServer; }
+};
+
+/* Records the comparison of a GETFileJob, which deletes itself once finished */
+class CompareResultReceiver : public QObject
+{
+    Q_OBJECT
+public:
+    CompareResultReceiver() : finished(false), result(GETFileJob::NotCompared) {}
+    bool finished;
+    GETFileJob::CompareResult result;
+public slots:
+    void slotGetFinished() {
+        finished = true;
+        result = qobject_cast<GETFileJob *>(sender())->compareResult();
+    }
+};
+
+class JobFinishedReceiver : public QObject
+{
+    Q_OBJECT
+public:
+    JobFinishedReceiver() : finished(false), status(SyncFileItem::NoStatus) {}
+    bool finished;
+    SyncFileItem::Status status;
+public slots:
+    void slotFinished(SyncFileItem::Status s) {
+        finished = true;
+        status = s;
+    }
+};
+
+/* A local job that records the threads its work runs in */
+class FakeLocalJob : public PropagateLocalJob
+{
+    Q_OBJECT
+public:
+    explicit FakeLocalJob(OwncloudPropagator *propagator)
+        : PropagateLocalJob(propagator, SyncFileItem()), workThread(0), doneThread(0) {}
+    void start() Q_DECL_OVERRIDE { runLocalWork(); }
+
+    QThread *workThread;
+    QThread *doneThread;
+    QString error;
+
+protected:
+    QString localWork() Q_DECL_OVERRIDE {
+        workThread = QThread::currentThread();
+        return QLatin1String("failed");
+    }
+    void localWorkDone(const QString &e) Q_DECL_OVERRIDE {
+        doneThread = QThread::currentThread();
+        error = e;
+        done(SyncFileItem::SoftError, e);
+    }
+};
+
+/* Records what a DiskSyncBatch tells */
+class FileSyncedReceiver : public QObject
+{
+    Q_OBJECT
+public:
+    QStringList errors;
+public slots:
+    void slotFileSynced(const QString &error) { errors.append(error); }
+};
 
 
 class TestOwncloudPropagator : public QObject
@@ -20,6 +244,409 @@ private slots:
 //        OwncloudPropagator propagator( NULL, QLatin1String("test1"), QLatin1String("test2"), new ProgressDatabase);
         QVERIFY( true );
     }
+
+    void testDirectoryParallelism()
+    {
+        OwncloudPropagator propagator(AccountPtr(), 0, QDir::tempPath(), QString(), QString(), 0, 0);
+        PropagateDirectory root(&propagator);
+        PropagateDirectory *sub = new PropagateDirectory(&propagator);
+        FakePropagateJob *move = new FakePropagateJob(&propagator, PropagatorJob::WaitForFinishedInParentDirectory);
+        FakePropagateJob *file = new FakePropagateJob(&propagator, PropagatorJob::FullParallelism);
+        FakePropagateJob *other = new FakePropagateJob(&propagator, PropagatorJob::FullParallelism);
+        sub->append(move);
+        sub->append(file);
+        root.append(sub);
+        root.append(other);
+
+        // the move blocks the directory and so the root
+        QCOMPARE(sub->parallelism(), PropagatorJob::WaitForFinished);
+        QCOMPARE(root.parallelism(), PropagatorJob::WaitForFinished);
+
+        // the move and the file of the directory run, the root waits for the directory
+        QVERIFY(root.scheduleNextJob());
+        QCOMPARE(move->_state, PropagatorJob::Running);
+        QVERIFY(root.scheduleNextJob());
+        QCOMPARE(file->_state, PropagatorJob::Running);
+        QVERIFY(!root.scheduleNextJob());
+        QCOMPARE(other->_state, PropagatorJob::NotYetStarted);
+
+        // once the move is done, the directory is parallel again
+        move->finish();
+        QCoreApplication::processEvents();
+        QCOMPARE(sub->parallelism(), PropagatorJob::FullParallelism);
+        QCOMPARE(root.parallelism(), PropagatorJob::FullParallelism);
+        QVERIFY(root.scheduleNextJob());
+        QCOMPARE(other->_state, PropagatorJob::Running);
+
+        file->finish();
+        other->finish();
+        QTRY_COMPARE(sub->_state, PropagatorJob::Finished);
+        QTRY_COMPARE(root._state, PropagatorJob::Finished);
+    }
+
+    void testSiblingDirectoriesInParallel()
+    {
+        AccountPtr account = Account::create();
+        account->setUrl(QUrl("http://localhost/"));
+        account->setCredentials(new MkcolRecorderCredentials);
+        MkcolRecorder *recorder = qobject_cast<MkcolRecorder *>(account->networkAccessManager());
+        QVERIFY(recorder);
+
+        OwncloudPropagator propagator(account, 0, QDir::tempPath(), QString(), QString(), 0, 0);
+        SyncFileItemVector items;
+        foreach (const QString &name, QStringList() << "a" << "b") {
+            SyncFileItem item;
+            item._file = name;
+            item._isDirectory = true;
+            item._instruction = CSYNC_INSTRUCTION_NEW;
+            item._direction = SyncFileItem::Up;
+            items.append(item);
+        }
+        propagator.start(items);
+
+        // The first MKCOL tells it is ready for more, so the second one does not
+        // wait for the 100 ms timer of the propagator
+        QTRY_COMPARE(recorder->mkcolTimes.count(), 2);
+        QVERIFY2(recorder->mkcolTimes.at(1) - recorder->mkcolTimes.at(0) < 100,
+                 qPrintable(QString("%1 ms between the MKCOLs").arg(recorder->mkcolTimes.at(1) - recorder->mkcolTimes.at(0))));
+        QCOMPARE(propagator._activeJobs, 2);
+    }
+
+    void testDirectoryContentAfterFirstJob()
+    {
+        OwncloudPropagator propagator(AccountPtr(), 0, QDir::tempPath(), QString(), QString(), 0, 0);
+        PropagateDirectory root(&propagator);
+        QList<FakePropagateJob *> mkdirs;
+        QList<FakePropagateJob *> files;
+        for (int i = 0; i < 2; ++i) {
+            PropagateDirectory *sub = new PropagateDirectory(&propagator);
+            FakePropagateJob *mkdir = new FakePropagateJob(&propagator, PropagatorJob::FullParallelism);
+            FakePropagateJob *file = new FakePropagateJob(&propagator, PropagatorJob::FullParallelism);
+            sub->_firstJob.reset(mkdir);
+            sub->append(file);
+            root.append(sub);
+            mkdirs.append(mkdir);
+            files.append(file);
+        }
+
+        // the second directory is created while the first one is, its content waits
+        QVERIFY(root.scheduleNextJob());
+        QVERIFY(root.scheduleNextJob());
+        QCOMPARE(mkdirs[0]->_state, PropagatorJob::Running);
+        QCOMPARE(mkdirs[1]->_state, PropagatorJob::Running);
+        QVERIFY(!root.scheduleNextJob());
+        QCOMPARE(files[0]->_state, PropagatorJob::NotYetStarted);
+
+        // the content of a directory starts as soon as the directory exists
+        mkdirs[1]->finish();
+        QCoreApplication::processEvents();
+        QVERIFY(root.scheduleNextJob());
+        QCOMPARE(files[1]->_state, PropagatorJob::Running);
+        QCOMPARE(files[0]->_state, PropagatorJob::NotYetStarted);
+
+        mkdirs[0]->finish();
+        QCoreApplication::processEvents();
+        QVERIFY(root.scheduleNextJob());
+        QCOMPARE(files[0]->_state, PropagatorJob::Running);
+
+        files[0]->finish();
+        files[1]->finish();
+        QTRY_COMPARE(root._state, PropagatorJob::Finished);
+    }
+
+    void testLocalWorkInPool()
+    {
+        OwncloudPropagator propagator(AccountPtr(), 0, QDir::tempPath(), QString(), QString(), 0, 0);
+        FakeLocalJob job(&propagator);
+        QSignalSpy ready(&job, SIGNAL(ready()));
+
+        // the job counts as active while its work runs, and the next jobs can start
+        QVERIFY(job.scheduleNextJob());
+        QCOMPARE(propagator._activeJobs, 1);
+        QCOMPARE(ready.count(), 1);
+
+        // the result is handled in the thread of the job, by its event loop
+        QCOMPARE(job._state, PropagatorJob::Running);
+        QTRY_COMPARE(job._state, PropagatorJob::Finished);
+        QVERIFY(job.workThread != 0);
+        QVERIFY(job.workThread != QThread::currentThread());
+        QCOMPARE(job.doneThread, QThread::currentThread());
+        QCOMPARE(job.error, QString("failed"));
+        QCOMPARE(job._item._status, SyncFileItem::SoftError);
+        QCOMPARE(propagator._activeJobs, 0);
+    }
+
+    void testLocalRemoveDirectory()
+    {
+        QTemporaryDir dir;
+        QTemporaryDir outside;
+        SyncJournalDb journal(dir.path());
+        OwncloudPropagator propagator(AccountPtr(), 0, dir.path(), QString(), QString(), &journal, 0);
+        QDir root(dir.path());
+        QVERIFY(root.mkpath("tree/a/b/c/d/e"));
+        QVERIFY(root.mkpath("tree/empty"));
+        writeFile(dir.path() + "/tree/file");
+        writeFile(dir.path() + "/tree/a/.hidden");
+        writeFile(dir.path() + "/tree/a/b/c/d/e/file");
+        writeFile(outside.path() + "/keep");
+        QVERIFY(QFile::link(outside.path(), dir.path() + "/tree/a/dirlink"));
+        QVERIFY(QFile::link(outside.path() + "/keep", dir.path() + "/tree/a/b/filelink"));
+
+        SyncFileItem item;
+        item._file = "tree";
+        item._isDirectory = true;
+        PropagateLocalRemove job(&propagator, item);
+        QVERIFY(job.scheduleNextJob());
+        QTRY_COMPARE(job._state, PropagatorJob::Finished);
+        QCOMPARE(job._item._status, SyncFileItem::Success);
+        QVERIFY(!root.exists("tree"));
+
+        // the symlinks are removed, not followed
+        QVERIFY(QFile::exists(outside.path() + "/keep"));
+    }
+
+    void testLocalRemovePartialFailure()
+    {
+#ifndef Q_OS_WIN
+        QTemporaryDir dir;
+        SyncJournalDb journal(dir.path());
+        OwncloudPropagator propagator(AccountPtr(), 0, dir.path(), QString(), QString(), &journal, 0);
+        QDir root(dir.path());
+        QVERIFY(root.mkpath("tree/locked"));
+        QVERIFY(root.mkpath("tree/other"));
+        writeFile(dir.path() + "/tree/locked/file");
+        writeFile(dir.path() + "/tree/other/file");
+        writeFile(dir.path() + "/tree/file");
+        const QByteArray locked = QFile::encodeName(dir.path() + "/tree/locked");
+        QCOMPARE(chmod(locked.constData(), 0500), 0);
+        if (access(locked.constData(), W_OK) == 0) {
+            chmod(locked.constData(), 0700);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+            QSKIP("The permissions do not keep this user from removing the files");
+#else
+            QSKIP("The permissions do not keep this user from removing the files", SkipAll);
+#endif
+        }
+
+        SyncFileItem item;
+        item._file = "tree";
+        item._isDirectory = true;
+        PropagateLocalRemove job(&propagator, item);
+        QVERIFY(job.scheduleNextJob());
+        QTRY_COMPARE(job._state, PropagatorJob::Finished);
+        chmod(locked.constData(), 0700);
+
+        // what could be removed is, the error names what could not
+        QCOMPARE(job._item._status, SyncFileItem::NormalError);
+        QVERIFY(job._item._errorString.contains("file"));
+        QVERIFY(root.exists("tree/locked/file"));
+        QVERIFY(!root.exists("tree/other"));
+        QVERIFY(!root.exists("tree/file"));
+#endif
+    }
+
+    void testIsDirectoryEntry()
+    {
+#ifndef Q_OS_WIN
+        QTemporaryDir dir;
+        QVERIFY(QDir(dir.path()).mkdir("sub"));
+        writeFile(dir.path() + "/file");
+        QVERIFY(QFile::link(dir.path() + "/sub", dir.path() + "/link"));
+        const int fd = open(QFile::encodeName(dir.path()).constData(), O_RDONLY | O_DIRECTORY);
+        QVERIFY(fd >= 0);
+
+        // as when the filesystem does not fill d_type
+        QVERIFY(isDirectoryEntry(fd, "sub", DT_UNKNOWN));
+        QVERIFY(!isDirectoryEntry(fd, "file", DT_UNKNOWN));
+        QVERIFY(!isDirectoryEntry(fd, "link", DT_UNKNOWN));
+        QVERIFY(!isDirectoryEntry(fd, "missing", DT_UNKNOWN));
+
+        QVERIFY(isDirectoryEntry(fd, "sub", DT_DIR));
+        QVERIFY(!isDirectoryEntry(fd, "link", DT_LNK));
+        QVERIFY(!isDirectoryEntry(fd, "file", DT_REG));
+        close(fd);
+#endif
+    }
+
+    void testDiskSyncBatch()
+    {
+        QTemporaryDir dir;
+        OwncloudPropagator propagator(AccountPtr(), 0, dir.path(), QString(), QString(), 0, 0);
+        FileSyncedReceiver receivers[3];
+        for (int i = 0; i < 3; ++i) {
+            QFile file(dir.path() + QString("/file%1").arg(i));
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            file.write("data");
+            file.close();
+            propagator._diskSyncBatch.add(file.fileName(), &receivers[i], "slotFileSynced");
+        }
+        // the files are synced together, later
+        QCOMPARE(receivers[0].errors.count(), 0);
+        for (int i = 0; i < 3; ++i) {
+            QTRY_COMPARE(receivers[i].errors, QStringList() << QString());
+        }
+
+        // the receivers that are gone are not told
+        {
+            FileSyncedReceiver gone;
+            propagator._diskSyncBatch.add(dir.path() + "/file0", &gone, "slotFileSynced");
+        }
+        propagator._diskSyncBatch.add(dir.path() + "/file1", &receivers[1], "slotFileSynced");
+        QTRY_COMPARE(receivers[1].errors.count(), 2);
+        QCOMPARE(receivers[0].errors.count(), 1);
+    }
+
+    void testGetFileJobCompare_data()
+    {
+        QTest::addColumn<QByteArray>("local");
+        QTest::addColumn<int>("result");
+
+        QTest::newRow("equal") << QByteArray("content") << int(GETFileJob::ContentEqual);
+        QTest::newRow("different") << QByteArray("CONTENT") << int(GETFileJob::ContentDiffers);
+        QTest::newRow("shorter") << QByteArray("cont") << int(GETFileJob::ContentDiffers);
+        QTest::newRow("longer") << QByteArray("content and more") << int(GETFileJob::ContentDiffers);
+        QTest::newRow("empty") << QByteArray() << int(GETFileJob::ContentDiffers);
+    }
+
+    void testGetFileJobCompare()
+    {
+        QFETCH(QByteArray, local);
+        QFETCH(int, result);
+
+        QTemporaryDir dir;
+        AccountPtr account = Account::create();
+        account->setUrl(QUrl("http://localhost/"));
+        account->setCredentials(new GetServerCredentials);
+        GetServer *server = qobject_cast<GetServer *>(account->networkAccessManager());
+        QVERIFY(server);
+        server->body = "content";
+
+        writeFile(dir.path() + "/local", local);
+        QFile localFile(dir.path() + "/local");
+        QVERIFY(localFile.open(QIODevice::ReadOnly));
+        QFile tmpFile(dir.path() + "/tmp");
+        QVERIFY(tmpFile.open(QIODevice::WriteOnly));
+
+        CompareResultReceiver receiver;
+        GETFileJob *job = new GETFileJob(account, "file", &tmpFile, QMap<QByteArray, QByteArray>(), QByteArray(), 0);
+        job->setCompareDevice(&localFile);
+        QObject::connect(job, SIGNAL(finishedSignal()), &receiver, SLOT(slotGetFinished()));
+        job->start();
+        QTRY_VERIFY(receiver.finished);
+        QCOMPARE(int(receiver.result), result);
+
+        // the download itself is not affected
+        tmpFile.close();
+        QCOMPARE(readFile(tmpFile.fileName()), QByteArray("content"));
+    }
+
+    void testGetFileJobCompareResumed()
+    {
+        QTemporaryDir dir;
+        AccountPtr account = Account::create();
+        account->setUrl(QUrl("http://localhost/"));
+        account->setCredentials(new GetServerCredentials);
+        qobject_cast<GetServer *>(account->networkAccessManager())->body = "content";
+
+        writeFile(dir.path() + "/local", "content");
+        QFile localFile(dir.path() + "/local");
+        QVERIFY(localFile.open(QIODevice::ReadOnly));
+        writeFile(dir.path() + "/tmp", "cont");
+        QFile tmpFile(dir.path() + "/tmp");
+        QVERIFY(tmpFile.open(QIODevice::Append));
+
+        // only the tail is received, it can not be compared
+        CompareResultReceiver receiver;
+        GETFileJob *job = new GETFileJob(account, "file", &tmpFile, QMap<QByteArray, QByteArray>(), "etag1", 4);
+        job->setCompareDevice(&localFile);
+        QObject::connect(job, SIGNAL(finishedSignal()), &receiver, SLOT(slotGetFinished()));
+        job->start();
+        QTRY_VERIFY(receiver.finished);
+        QCOMPARE(int(receiver.result), int(GETFileJob::NotCompared));
+        tmpFile.close();
+        QCOMPARE(readFile(tmpFile.fileName()), QByteArray("content"));
+    }
+
+    void testDownloadConflict_data()
+    {
+        QTest::addColumn<QByteArray>("local");
+        QTest::addColumn<QByteArray>("partial"); // already downloaded, for a resumed download
+        QTest::addColumn<int>("status");
+        QTest::addColumn<int>("identicalCount");
+        QTest::addColumn<int>("streamedCount");
+
+        // compared while downloading
+        QTest::newRow("equal") << QByteArray("content") << QByteArray()
+                               << int(SyncFileItem::Success) << 1 << 1;
+        QTest::newRow("different") << QByteArray("CONTENT") << QByteArray()
+                                   << int(SyncFileItem::Conflict) << 0 << 0;
+        // the sizes differ, FileSystem::fileEquals() decides
+        QTest::newRow("shorter") << QByteArray("cont") << QByteArray()
+                                 << int(SyncFileItem::Conflict) << 0 << 0;
+        QTest::newRow("longer") << QByteArray("content and more") << QByteArray()
+                                << int(SyncFileItem::Conflict) << 0 << 0;
+        // only the tail is downloaded, FileSystem::fileEquals() decides
+        QTest::newRow("resumed equal") << QByteArray("content") << QByteArray("cont")
+                                       << int(SyncFileItem::Success) << 1 << 0;
+        QTest::newRow("resumed different") << QByteArray("CONTENT") << QByteArray("cont")
+                                           << int(SyncFileItem::Conflict) << 0 << 0;
+    }
+
+    void testDownloadConflict()
+    {
+        QFETCH(QByteArray, local);
+        QFETCH(QByteArray, partial);
+        QFETCH(int, status);
+        QFETCH(int, identicalCount);
+        QFETCH(int, streamedCount);
+
+        QTemporaryDir dir;
+        AccountPtr account = Account::create();
+        account->setUrl(QUrl("http://localhost/"));
+        account->setCredentials(new GetServerCredentials);
+        qobject_cast<GetServer *>(account->networkAccessManager())->body = "content";
+        SyncJournalDb journal(dir.path());
+        OwncloudPropagator propagator(account, 0, dir.path(), QString(), QString(), &journal, 0);
+
+        writeFile(dir.path() + "/file", local);
+        if (!partial.isEmpty()) {
+            writeFile(dir.path() + "/.file.~partial", partial);
+            SyncJournalDb::DownloadInfo info;
+            info._tmpfile = ".file.~partial";
+            info._etag = "etag1";
+            info._valid = true;
+            journal.setDownloadInfo("file", info);
+        }
+
+        SyncFileItem item;
+        item._file = "file";
+        item._instruction = CSYNC_INSTRUCTION_CONFLICT;
+        item._direction = SyncFileItem::Down;
+        item._size = 7;
+        item._etag = "etag1";
+        item._modtime = Utility::qDateTimeToTime_t(QDateTime::currentDateTime());
+
+        JobFinishedReceiver receiver;
+        PropagateDownloadFileQNAM *job = new PropagateDownloadFileQNAM(&propagator, item);
+        QObject::connect(job, SIGNAL(finished(SyncFileItem::Status)), &receiver, SLOT(slotFinished(SyncFileItem::Status)));
+        job->start();
+        QTRY_VERIFY(receiver.finished);
+
+        QCOMPARE(int(receiver.status), status);
+        QCOMPARE(propagator._identicalConflictCount, identicalCount);
+        QCOMPARE(propagator._identicalConflictStreamedCount, streamedCount);
+        QCOMPARE(readFile(dir.path() + "/file"), QByteArray("content"));
+        const QStringList conflicts = QDir(dir.path()).entryList(QStringList("file_conflict-*"), QDir::Files);
+        if (status == SyncFileItem::Conflict) {
+            QCOMPARE(conflicts.count(), 1);
+            QCOMPARE(readFile(dir.path() + "/" + conflicts.first()), local);
+        } else {
+            QVERIFY(conflicts.isEmpty());
+        }
+        // no temporary file is left over
+        QCOMPARE(QDir(dir.path()).entryList(QStringList(".file.~*"), QDir::Files | QDir::Hidden), QStringList());
+        delete job;
+    }
 };
 
 #endif
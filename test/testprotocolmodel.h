@@ -0,0 +1,218 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+#ifndef MIRALL_TESTPROTOCOLMODEL_H
+#define MIRALL_TESTPROTOCOLMODEL_H
+
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "protocolmodel.h"
+#include "syncrunfilelog.h"
+
+using namespace OCC;
+
+class TestProtocolModel : public QObject
+{
+    Q_OBJECT
+
+    static SyncFileItem item(const QString &file, SyncFileItem::Status status = SyncFileItem::Success) {
+        SyncFileItem item;
+        item._file = file;
+        item._instruction = CSYNC_INSTRUCTION_NEW;
+        item._direction = SyncFileItem::Down;
+        item._status = status;
+        return item;
+    }
+
+    static QString file(const ProtocolModel &model, int row) {
+        return model.index(row, ProtocolModel::FileColumn).data().toString();
+    }
+
+    // A run in the format of SyncRunFileLog
+    static QByteArray logRun(const QDateTime &end, const QStringList &files) {
+        QByteArray run = "#=#=#=# Syncrun started " + end.addSecs(-60).toString(Qt::ISODate).toLatin1()
+                + " until " + end.toString(Qt::ISODate).toLatin1() + " (60000 msec)\n";
+        foreach (const QString &f, files) {
+            const QByteArray status = f.startsWith("ignored") ? "6" : "4";
+            run += "12:00:00|10|" + f.toLocal8Bit() + "|INST_NEW|Down|0|etag|2048|id|" + status
+                    + "||200|0|0|||INST_NONE|\n";
+        }
+        return run;
+    }
+
+    static QByteArray logNote() {
+        return "# timestamp | duration | file | instruction | dir | modtime | etag | size | fileId | "
+                "status | errorString | http result code | other size | other modtime | other etag | "
+                "other fileId | other instruction\n";
+    }
+
+    // A run with its end line, appended to the content of a log written by writeLog
+    static void appendIndexedRun(QByteArray *content, const QDateTime &end, const QStringList &files) {
+        const int start = logNote().size() + content->size();
+        *content += logRun(end, files) + "#=#=#=# Syncrun ended " + end.toString(Qt::ISODate).toLatin1()
+                + " started at " + QByteArray::number(start) + "\n";
+    }
+
+    static void writeLog(const QString &fileName, const QByteArray &content) {
+        QFile f(fileName);
+        QVERIFY(f.open(QIODevice::WriteOnly));
+        f.write(logNote());
+        f.write(content);
+    }
+
+    static void fetchAll(ProtocolModel *model) {
+        while (model->canFetchMore(QModelIndex())) {
+            model->fetchMore(QModelIndex());
+        }
+    }
+
+private slots:
+    void testRetention() {
+        ProtocolModel model(3);
+        QCOMPARE(model.columnCount(), int(ProtocolModel::ColumnCount));
+        for (int i = 1; i <= 5; ++i) {
+            model.addItem("folder", item(QString("f%1").arg(i)));
+        }
+        QCOMPARE(model.rowCount(), 3);
+        QCOMPARE(file(model, 0), QString("f5"));
+        QCOMPARE(file(model, 2), QString("f3"));
+        QCOMPARE(model.index(0, ProtocolModel::FolderColumn).data().toString(), QString("folder"));
+        QCOMPARE(model.index(0, ProtocolModel::ActionColumn).data().toString(), QString("Downloaded"));
+    }
+
+    void testRemoveIgnoredItems() {
+        ProtocolModel model(4);
+        model.addItem("a", item("ignored1", SyncFileItem::FileIgnored));
+        model.addItem("b", item("ignored2", SyncFileItem::FileIgnored));
+        model.addItem("a", item("f1"));
+        QVERIFY(model.index(1, 0).data(ProtocolModel::IgnoredIndicatorRole).toBool());
+
+        model.removeIgnoredItems("a");
+        QCOMPARE(model.rowCount(), 2);
+        QCOMPARE(file(model, 0), QString("f1"));
+        QCOMPARE(file(model, 1), QString("ignored2"));
+
+        // the ring keeps working after the compaction
+        model.addItem("a", item("f2"));
+        model.addItem("a", item("f3"));
+        model.addItem("a", item("f4"));
+        QCOMPARE(model.rowCount(), 4);
+        QCOMPARE(file(model, 0), QString("f4"));
+        QCOMPARE(file(model, 3), QString("f1"));
+    }
+
+    void testHistory() {
+        QTemporaryDir dir;
+        const QString path = dir.path() + "/";
+        const QDateTime hourAgo = QDateTime::currentDateTime().addSecs(-3600);
+
+        QStringList bigRun;
+        for (int i = 0; i < 250; ++i) {
+            bigRun << QString("big%1").arg(i);
+        }
+        writeLog(path + ".owncloudsync.log.1", logRun(hourAgo.addDays(-2), QStringList() << "oldest"));
+        writeLog(path + ".owncloudsync.log",
+                 logRun(hourAgo.addDays(-1), bigRun)
+                 + logRun(hourAgo, QStringList() << "a|b" << "ignored" << "c")
+                 // still in the ring
+                 + logRun(QDateTime::currentDateTime().addSecs(60), QStringList() << "recent"));
+
+        ProtocolModel model(10);
+        model.addItem("folder", item("recent"));
+        QHash<QString, QString> paths;
+        paths.insert("folder", path);
+        model.setFolderPaths(paths);
+
+        QVERIFY(model.canFetchMore(QModelIndex()));
+        model.fetchMore(QModelIndex());
+        QCOMPARE(model.rowCount(), 1 + 200);
+        QCOMPARE(file(model, 0), QString("recent"));
+        QCOMPARE(file(model, 1), QString("c"));
+        QCOMPARE(file(model, 2), QString("a|b"));
+        QCOMPARE(file(model, 3), QString("big249"));
+        QCOMPARE(model.index(1, ProtocolModel::FolderColumn).data().toString(), QString("folder"));
+        QCOMPARE(model.index(1, ProtocolModel::ActionColumn).data().toString(), QString("Downloaded"));
+        QVERIFY(!model.index(1, ProtocolModel::SizeColumn).data().toString().isEmpty());
+
+        fetchAll(&model);
+        QCOMPARE(model.rowCount(), 1 + 2 + 250 + 1);
+        QCOMPARE(file(model, 252), QString("big0"));
+        QCOMPARE(file(model, 253), QString("oldest"));
+
+        model.resetHistory();
+        QCOMPARE(model.rowCount(), 1);
+        QVERIFY(model.canFetchMore(QModelIndex()));
+        fetchAll(&model);
+        QCOMPARE(model.rowCount(), 254);
+    }
+
+    void testIndexedHistory() {
+        QTemporaryDir dir;
+        const QString path = dir.path() + "/";
+        const QDateTime hourAgo = QDateTime::currentDateTime().addSecs(-3600);
+
+        QStringList bigRun;
+        for (int i = 0; i < 5000; ++i) {
+            bigRun << QString("recent%1").arg(i);
+        }
+        // the runs logged before the end lines come first
+        QByteArray content = logRun(hourAgo.addDays(-1), QStringList() << "unindexed");
+        appendIndexedRun(&content, hourAgo, QStringList() << "a" << "b");
+        // still in the ring, skipped from its end line
+        appendIndexedRun(&content, QDateTime::currentDateTime().addSecs(60), bigRun);
+        writeLog(path + ".owncloudsync.log", content);
+
+        ProtocolModel model(10);
+        model.addItem("folder", item("recent"));
+        QHash<QString, QString> paths;
+        paths.insert("folder", path);
+        model.setFolderPaths(paths);
+
+        fetchAll(&model);
+        QCOMPARE(model.rowCount(), 1 + 2 + 1);
+        QCOMPARE(file(model, 1), QString("b"));
+        QCOMPARE(file(model, 2), QString("a"));
+        QCOMPARE(file(model, 3), QString("unindexed"));
+    }
+
+    void testLogRoundTrip() {
+        QTemporaryDir dir;
+        const QString path = dir.path() + "/";
+        for (int run = 0; run < 2; ++run) {
+            Utility::StopWatch stopWatch;
+            stopWatch.start();
+            stopWatch.addLapTime(QLatin1String("Sync Finished"));
+            SyncRunFileLog log;
+            log.start(path, stopWatch);
+            for (int i = 0; i < 2; ++i) {
+                SyncFileItem logged = item(QString("run%1-%2").arg(run).arg(i));
+                logged.log._instruction = CSYNC_INSTRUCTION_NEW;
+                logged.log._other_instruction = CSYNC_INSTRUCTION_NONE;
+                log.logItem(logged);
+            }
+            log.close();
+        }
+
+        // the newest first, with the end of their run
+        SyncRunFileLogReader reader(path, QDateTime::currentDateTime().addSecs(3600));
+        SyncFileItem read;
+        QDateTime runEnd;
+        QStringList files;
+        while (reader.readItem(&read, &runEnd)) {
+            QVERIFY(runEnd.isValid());
+            QCOMPARE(read._status, SyncFileItem::Success);
+            files << read._file;
+        }
+        QCOMPARE(files, QStringList() << "run1-1" << "run1-0" << "run0-1" << "run0-0");
+
+        // the runs that ended since are skipped
+        SyncRunFileLogReader skipping(path, QDateTime::currentDateTime().addSecs(-3600));
+        QVERIFY(!skipping.readItem(&read, &runEnd));
+    }
+};
+
+#endif
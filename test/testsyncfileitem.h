@@ -66,6 +66,55 @@ private slots:
         QVERIFY(!(b < b));
         QVERIFY(!(c < c));
     }
+
+    void testSortByDestination() {
+        SyncFileItemVector items;
+        items << createItem("client-build") << createItem("test/t2") << createItem("client/build")
+              << createItem("ABCD") << createItem("test") << createItem("client") << createItem("test/t1");
+        items[1]._renameTarget = "client/build/x";
+
+        SyncFileItemVector expected = items;
+        std::sort(expected.begin(), expected.end());
+        sortByDestination(&items);
+        QCOMPARE(items.size(), expected.size());
+        for (int i = 0; i < items.size(); ++i) {
+            QCOMPARE(items.at(i)._file, expected.at(i)._file);
+        }
+        QCOMPARE(items.at(3)._renameTarget, QString("client/build/x"));
+    }
+
+    void testSortByDestinationKeys_data() {
+        QTest::addColumn<QStringList>("files");
+
+        // The sort keys start after the prefix of all the paths and hold 8 characters
+        QTest::newRow("common prefix") << (QStringList() << "deep/tree/of/folders/b" << "deep/tree/of/folders/a/x"
+            << "deep/tree/of/folders" << "deep/tree/of/folders-a" << "deep/tree/of/folders/a");
+        QTest::newRow("long names") << (QStringList() << "averyveryverylongname2" << "averyveryverylongname1"
+            << "averyveryverylongname/1" << "averyveryverylongname" << "averyveryverylongnam");
+        QTest::newRow("non ascii") << (QStringList() << QString::fromUtf8("dir/\xc3\xa9t\xc3\xa9") << "dir/ete"
+            << QString::fromUtf8("dir/\xe6\x97\xa5\xe6\x9c\xac") << QString::fromUtf8("dir/\xe6\x97\xa5")
+            << QString::fromUtf8("dir/\xf0\x9f\x98\x80/a") << QString::fromUtf8("dir/\xef\xbf\xbd") << "dir/~");
+        QTest::newRow("empty") << (QStringList() << "b" << "" << "a/b" << "" << "a");
+        QTest::newRow("same") << (QStringList() << "same" << "same" << "same");
+        QTest::newRow("one") << (QStringList() << "one");
+        QTest::newRow("none") << QStringList();
+    }
+
+    void testSortByDestinationKeys() {
+        QFETCH(QStringList, files);
+
+        SyncFileItemVector items;
+        foreach (const QString &file, files) {
+            items << createItem(file);
+        }
+        SyncFileItemVector expected = items;
+        std::stable_sort(expected.begin(), expected.end());
+        sortByDestination(&items);
+        QCOMPARE(items.size(), expected.size());
+        for (int i = 0; i < items.size(); ++i) {
+            QCOMPARE(items.at(i)._file, expected.at(i)._file);
+        }
+    }
 };
 
 #endif
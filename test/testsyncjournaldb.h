@@ -13,6 +13,7 @@
 
 #include "libsync/syncjournaldb.h"
 #include "libsync/syncjournalfilerecord.h"
+#include "libsync/pathhashset.h"
 
 using namespace OCC;
 
@@ -112,6 +113,179 @@ private slots:
         QVERIFY(!wipedRecord._valid);
     }
 
+    void testQueuedWrites()
+    {
+        SyncJournalFileRecord record;
+        record._path = "queued";
+        record._modtime = dropMsecs(QDateTime::currentDateTime());
+        record._etag = "abc";
+        QVERIFY(_db.setFileRecord(record));
+
+        // Visible before it is written...
+        QVERIFY(_db.getFileRecord("queued") == record);
+        // ...and after
+        _db.flush();
+        QVERIFY(_db.getFileRecord("queued") == record);
+
+        QVERIFY(_db.deleteFileRecord("queued"));
+        QVERIFY(!_db.getFileRecord("queued").isValid());
+        _db.flush();
+        QVERIFY(!_db.getFileRecord("queued").isValid());
+
+        // A later write wins over an earlier one
+        record._etag = "def";
+        QVERIFY(_db.setFileRecord(record));
+        record._etag = "ghi";
+        QVERIFY(_db.setFileRecord(record));
+        _db.commit("testQueuedWrites");
+        QCOMPARE(_db.getFileRecord("queued")._etag, QByteArray("ghi"));
+        _db.flush();
+        QCOMPARE(_db.getFileRecord("queued")._etag, QByteArray("ghi"));
+        QVERIFY(_db.deleteFileRecord("queued"));
+    }
+
+    void testGenerationCleanup()
+    {
+        _db.startSyncGeneration();
+        SyncJournalFileRecord record;
+        record._modtime = dropMsecs(QDateTime::currentDateTime());
+        foreach (const QString &path, QStringList() << "seen" << "gone" << "keep" << "keep/sub") {
+            record._path = path;
+            QVERIFY(_db.setFileRecord(record));
+        }
+
+        // Next sync: only "seen" is confirmed, "keep" was not fully discovered
+        _db.startSyncGeneration();
+        _db.confirmFileRecord("seen");
+        QVERIFY(_db.postSyncCleanup(QSet<QString>() << "keep"));
+
+        QVERIFY(_db.getFileRecord("seen").isValid());
+        QVERIFY(!_db.getFileRecord("gone").isValid());
+        QVERIFY(_db.getFileRecord("keep").isValid());
+        QVERIFY(_db.getFileRecord("keep/sub").isValid());
+
+        // A record written during the sync is kept as well
+        _db.startSyncGeneration();
+        record._path = "new";
+        QVERIFY(_db.setFileRecord(record));
+        QVERIFY(_db.postSyncCleanup(QSet<QString>()));
+        QVERIFY(_db.getFileRecord("new").isValid());
+        QVERIFY(!_db.getFileRecord("seen").isValid());
+        QVERIFY(!_db.getFileRecord("keep/sub").isValid());
+        QVERIFY(_db.deleteFileRecord("new"));
+    }
+
+    void testReadConnection()
+    {
+        SyncJournalFileRecord record;
+        record._path = "committed";
+        record._modtime = dropMsecs(QDateTime::currentDateTime());
+        QVERIFY(_db.setFileRecord(record));
+        _db.commit("testReadConnection");
+
+        SqlDatabase *conn = _db.acquireReadConnection();
+        QVERIFY(conn);
+        {
+            SqlQuery query("SELECT path FROM metadata WHERE phash=?1", *conn);
+            query.bindValue(1, SyncJournalDb::getPHash("committed"));
+            QVERIFY(query.next());
+            QCOMPARE(query.stringValue(0), QString("committed"));
+        }
+        _db.releaseReadConnection(conn);
+
+        // Connections are reused
+        QCOMPARE(_db.acquireReadConnection(), conn);
+        _db.releaseReadConnection(conn);
+        QVERIFY(_db.deleteFileRecord("committed"));
+    }
+
+    void testTransferCache()
+    {
+        SyncJournalDb::DownloadInfo download;
+        download._tmpfile = ".stale.~1";
+        download._etag = "abc";
+        download._valid = true;
+        _db.setDownloadInfo("stale", download);
+        _db.setDownloadInfo("kept", download);
+        SyncJournalDb::UploadInfo upload;
+        upload._chunk = 3;
+        upload._modtime = dropMsecs(QDateTime::currentDateTime());
+        upload._valid = true;
+        _db.setUploadInfo("stale", upload);
+        _db.setUploadInfo("kept", upload);
+        SyncJournalErrorBlacklistRecord entry;
+        entry._file = "kept";
+        entry._lastTryEtag = "abc";
+        entry._lastTryTime = 10;
+        entry._ignoreDuration = 60;
+        _db.updateErrorBlacklistEntry(entry);
+        entry._file = "stale";
+        _db.updateErrorBlacklistEntry(entry);
+
+        _db.loadTransferCache();
+        QVERIFY(_db.getDownloadInfo("kept") == download);
+        QVERIFY(_db.getUploadInfo("kept") == upload);
+        QCOMPARE(_db.errorBlacklistEntry("kept")._lastTryEtag, QByteArray("abc"));
+        QVERIFY(!_db.getDownloadInfo("nonexistant")._valid);
+
+        // The writes go to the cache and the database
+        _db.setDownloadInfo("new", download);
+        QVERIFY(_db.getDownloadInfo("new")._valid);
+        _db.setDownloadInfo("new", SyncJournalDb::DownloadInfo());
+        QVERIFY(!_db.getDownloadInfo("new")._valid);
+        _db.wipeErrorBlacklistEntry("kept");
+        QVERIFY(!_db.errorBlacklistEntry("kept").isValid());
+        _db.updateErrorBlacklistEntry(entry);
+
+        SyncFileItemVector items(1);
+        items[0]._file = "kept";
+        PathHashSet keep(items);
+        keep.insert(0);
+        keep.squeeze();
+        const QVector<SyncJournalDb::DownloadInfo> deleted = _db.deleteStaleEntries(keep, keep, keep);
+        QCOMPARE(deleted.count(), 1);
+        QCOMPARE(deleted.first()._tmpfile, QString(".stale.~1"));
+        QVERIFY(!_db.getDownloadInfo("stale")._valid);
+        QVERIFY(!_db.getUploadInfo("stale")._valid);
+        QVERIFY(!_db.errorBlacklistEntry("stale").isValid());
+
+        // The database has the same content
+        _db.dropTransferCache();
+        QVERIFY(_db.getDownloadInfo("kept") == download);
+        QVERIFY(!_db.getDownloadInfo("stale")._valid);
+        QVERIFY(!_db.getUploadInfo("stale")._valid);
+        QVERIFY(!_db.errorBlacklistEntry("kept").isValid());
+        QVERIFY(!_db.errorBlacklistEntry("stale").isValid());
+        QCOMPARE(_db.downloadInfoCount(), 1);
+        _db.setDownloadInfo("kept", SyncJournalDb::DownloadInfo());
+        _db.setUploadInfo("kept", SyncJournalDb::UploadInfo());
+    }
+
+    void testPathHashSet()
+    {
+        SyncFileItemVector items(4);
+        items[0]._file = "A/a.txt";
+        items[1]._file = "A/b.txt";
+        items[2]._file = "A";
+        items[3]._file = "A/a.txt"; // twice in the items
+        PathHashSet set(items);
+        set.insert(0);
+        set.insert(1);
+        set.insert(3);
+        set.squeeze();
+        QCOMPARE(set.count(), 3);
+        QVERIFY(set.contains("A/a.txt"));
+        QVERIFY(set.contains("A/b.txt"));
+        QVERIFY(!set.contains("A"));
+        QVERIFY(!set.contains("a/a.txt"));
+        QVERIFY(!set.contains(QString()));
+        QVERIFY(set.memoryUsage() < 100);
+
+        PathHashSet empty(items);
+        empty.squeeze();
+        QVERIFY(!empty.contains("A/a.txt"));
+    }
+
 private:
     SyncJournalDb _db;
 };
@@ -0,0 +1,112 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+#ifndef MIRALL_TESTSYNCPERFORMANCEREPORT_H
+#define MIRALL_TESTSYNCPERFORMANCEREPORT_H
+
+#include <QtTest>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "syncperformancereport.h"
+
+using namespace OCC;
+
+class TestSyncPerformanceReport : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testPercentile() {
+        QVector<qint64> values;
+        QCOMPARE(SyncPerformanceReport::percentile(values, 50), qint64(0));
+        for (int i = 1; i <= 100; ++i) {
+            values.append(i);
+        }
+        QCOMPARE(SyncPerformanceReport::percentile(values, 50), qint64(50));
+        QCOMPARE(SyncPerformanceReport::percentile(values, 95), qint64(95));
+        QCOMPARE(SyncPerformanceReport::percentile(values, 99), qint64(99));
+        QCOMPARE(SyncPerformanceReport::percentile(values, 100), qint64(100));
+
+        values.resize(1);
+        QCOMPARE(SyncPerformanceReport::percentile(values, 99), qint64(1));
+    }
+
+    void testRecorder() {
+        SyncPerformanceRecorder *recorder = SyncPerformanceRecorder::instance();
+        // outside of a run nothing is recorded
+        recorder->requestStarted();
+        recorder->requestFinished("GET", 1000);
+        recorder->addTransferredBytes(false, 1000);
+
+        recorder->startRun();
+        recorder->requestStarted();
+        recorder->requestStarted();
+        for (int i = 1; i <= 20; ++i) {
+            recorder->requestFinished("PROPFIND", i);
+            recorder->requestStarted();
+        }
+        recorder->requestFinished("PUT", 7);
+        recorder->requestFinished(QByteArray(), 0); // deleted before it finished
+        recorder->addLimitedDuration(true, 30);
+        recorder->addLimitedDuration(false, 5);
+        recorder->addTransferredBytes(true, 100);
+        recorder->addTransferredBytes(true, 20);
+        recorder->addTransferredBytes(false, 3);
+
+        SyncPerformanceReport report;
+        recorder->finishRun(&report);
+        QCOMPARE(report.requests.count(), 2);
+        QVERIFY(!report.requests.contains("GET"));
+        QCOMPARE(report.requests.value("PROPFIND").count, 20);
+        QCOMPARE(report.requests.value("PROPFIND").p50, qint64(10));
+        QCOMPARE(report.requests.value("PROPFIND").p95, qint64(19));
+        QCOMPARE(report.requests.value("PROPFIND").max, qint64(20));
+        QCOMPARE(report.requests.value("PUT").p99, qint64(7));
+        QCOMPARE(report.maxParallelRequests, 2);
+        QCOMPARE(report.uploadLimitedDuration, qint64(30));
+        QCOMPARE(report.downloadLimitedDuration, qint64(5));
+        QCOMPARE(report.bytesUploaded, qint64(120));
+        QCOMPARE(report.bytesDownloaded, qint64(3));
+    }
+
+    void testSerialization() {
+        SyncPerformanceReport report;
+        report.folder = QLatin1String("/tmp/a \"quoted\" folder");
+        report.startTime = QDateTime::currentDateTime();
+        report.completed = true;
+        report.localFiles = 12;
+        report.remoteDirsFetched = 3;
+        report.bytesDownloaded = 1 << 20;
+        report.syncItems = 1000000;
+        report.peakMemory = qint64(3) << 30;
+        SyncPerformanceReport::RequestStats stats;
+        stats.count = 4;
+        stats.p50 = 120;
+        report.requests.insert("MKCOL", stats);
+
+        QJsonParseError error;
+        QJsonDocument doc = QJsonDocument::fromJson(report.toJson(), &error);
+        QCOMPARE(error.error, QJsonParseError::NoError);
+        QJsonObject root = doc.object();
+        QCOMPARE(root.value("folder").toString(), report.folder);
+        QCOMPARE(root.value("completed").toBool(), true);
+        QCOMPARE(root.value("discovery").toObject().value("localFiles").toInt(), 12);
+        QCOMPARE(root.value("discovery").toObject().value("remoteDirsFetched").toInt(), 3);
+        QCOMPARE(root.value("transfer").toObject().value("bytesDownloaded").toInt(), 1 << 20);
+        QCOMPARE(root.value("discovery").toObject().value("syncItems").toInt(), 1000000);
+        QCOMPARE(qint64(root.value("peakMemoryBytes").toDouble()), qint64(3) << 30);
+        QCOMPARE(root.value("requestLatenciesMsec").toObject().value("MKCOL").toObject().value("p50").toInt(), 120);
+
+        QString prometheus = QString::fromUtf8(report.toPrometheus());
+        QVERIFY(prometheus.contains("owncloud_sync_bytes{folder=\"/tmp/a \\\"quoted\\\" folder\",direction=\"down\"} 1048576\n"));
+        QVERIFY(prometheus.contains("owncloud_sync_request_latency_seconds{folder=\"/tmp/a \\\"quoted\\\" folder\",verb=\"MKCOL\",quantile=\"0.5\"} 0.12\n"));
+        QCOMPARE(prometheus.count("# TYPE owncloud_sync_bytes gauge"), 1);
+        QVERIFY(prometheus.contains("owncloud_sync_items{folder=\"/tmp/a \\\"quoted\\\" folder\"} 1000000\n"));
+    }
+};
+
+#endif
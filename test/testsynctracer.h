@@ -0,0 +1,155 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+#ifndef MIRALL_TESTSYNCTRACER_H
+#define MIRALL_TESTSYNCTRACER_H
+
+#include <QtTest>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QJsonObject>
+
+#include "synctracer.h"
+#include "bandwidthscheduler.h"
+
+using namespace OCC;
+
+namespace {
+
+const char traceDirC[] = "/tmp/testsynctracer";
+}
+
+class TestSyncTracer : public QObject
+{
+    Q_OBJECT
+
+    QStringList traceFiles() {
+        return QDir(traceDirC).entryList(QStringList("sync-trace-*.json"), QDir::Files);
+    }
+
+    // The events of the only trace, by phase and name
+    QHash<QString, QJsonObject> readEvents(QJsonDocument *doc) {
+        QHash<QString, QJsonObject> events;
+        QStringList files = traceFiles();
+        if (files.count() != 1) {
+            return events;
+        }
+        QFile file(QDir(traceDirC).absoluteFilePath(files.first()));
+        if (!file.open(QIODevice::ReadOnly)) {
+            return events;
+        }
+        QJsonParseError error;
+        *doc = QJsonDocument::fromJson(file.readAll(), &error);
+        if (error.error != QJsonParseError::NoError) {
+            return events;
+        }
+        foreach (const QJsonValue &value, doc->object().value("traceEvents").toArray()) {
+            QJsonObject event = value.toObject();
+            events.insert(event.value("ph").toString() + event.value("name").toString(), event);
+        }
+        return events;
+    }
+
+private slots:
+    void initTestCase() {
+        QDir(traceDirC).removeRecursively();
+        // read once by the tracer
+        qputenv("OWNCLOUD_TRACE_DIR", traceDirC);
+        QVERIFY(SyncTracer::isEnabled());
+    }
+
+    void cleanupTestCase() {
+        QDir(traceDirC).removeRecursively();
+    }
+
+    void testNoRun() {
+        // events outside of a run are dropped and nothing is written
+        SyncTracer::instance()->addCounter("test", "outside", 1);
+        SyncTracer::instance()->finishRun();
+        QVERIFY(traceFiles().isEmpty());
+    }
+
+    void testTrace() {
+        SyncTracer *tracer = SyncTracer::instance();
+        tracer->startRun("/tmp/folder \"with quotes\"");
+        {
+            SyncTraceSpan span("csync", "csync_update");
+            span.setArg("items", 42);
+        }
+        QVariantMap args;
+        args.insert("file", "a/b.txt");
+        args.insert("http_status", 201);
+        tracer->addAsyncSpan("job", "PropagateUploadFileQNAM", 1234, 10, 20, args);
+        tracer->addCounter("bandwidth", "upload quota per device", 4096);
+        tracer->finishRun();
+
+        QCOMPARE(traceFiles().count(), 1);
+        QJsonDocument doc;
+        QHash<QString, QJsonObject> events = readEvents(&doc);
+        QCOMPARE(doc.object().value("otherData").toObject().value("folder").toString(),
+                 QString("/tmp/folder \"with quotes\""));
+        QVERIFY(events.contains("Mthread_name"));
+        QVERIFY(!events.contains("Coutside"));
+
+        QJsonObject update = events.value("Xcsync_update");
+        QCOMPARE(update.value("cat").toString(), QString("csync"));
+        QVERIFY(update.value("dur").toDouble() >= 0);
+        QCOMPARE(update.value("args").toObject().value("items").toInt(), 42);
+
+        QJsonObject begin = events.value("bPropagateUploadFileQNAM");
+        QJsonObject end = events.value("ePropagateUploadFileQNAM");
+        QCOMPARE(begin.value("ts").toDouble(), 10.);
+        QCOMPARE(end.value("ts").toDouble(), 20.);
+        QCOMPARE(begin.value("id").toString(), end.value("id").toString());
+        QCOMPARE(begin.value("args").toObject().value("file").toString(), QString("a/b.txt"));
+        QCOMPARE(begin.value("args").toObject().value("http_status").toInt(), 201);
+
+        QCOMPARE(events.value("Cupload quota per device").value("args").toObject().value("value").toInt(), 4096);
+    }
+
+    void testBandwidthScheduler() {
+        foreach (const QString &name, traceFiles()) {
+            QFile::remove(QDir(traceDirC).absoluteFilePath(name));
+        }
+        SyncTracer::instance()->startRun("/tmp/folder");
+
+        BandwidthScheduler *scheduler = BandwidthScheduler::instance();
+        const int group = scheduler->addGroup();
+        int waitMsec = 0;
+
+        // Nothing elapsed for the 1000 bytes per second of the group yet
+        scheduler->setGroupLimit(group, BandwidthScheduler::Upload, 1000);
+        const int upload = scheduler->addTransfer(group, BandwidthScheduler::Upload);
+        QCOMPARE(scheduler->acquire(upload, 100000, &waitMsec, 0), qint64(0));
+        const int uploadWaitMsec = waitMsec;
+        QVERIFY(uploadWaitMsec > 0);
+
+        // 50% of what runs through while probing, 100000 bytes in 2 seconds
+        scheduler->setGroupLimit(group, BandwidthScheduler::Download, -50);
+        const int download = scheduler->addTransfer(group, BandwidthScheduler::Download);
+        QCOMPARE(scheduler->acquire(download, 100000, &waitMsec, 0), qint64(100000));
+        scheduler->acquire(download, 1, &waitMsec, 2000);
+
+        scheduler->removeGroup(group);
+        SyncTracer::instance()->finishRun();
+
+        QJsonDocument doc;
+        QHash<QString, QJsonObject> events = readEvents(&doc);
+        QJsonObject wait = events.value("bupload limit wait");
+        QCOMPARE(wait.value("cat").toString(), QString("bandwidth"));
+        QCOMPARE(wait.value("id").toString(), events.value("eupload limit wait").value("id").toString());
+        QCOMPARE(events.value("eupload limit wait").value("ts").toDouble() - wait.value("ts").toDouble(),
+                 uploadWaitMsec * 1000.);
+        QVERIFY(events.contains("brelative download limit probe"));
+        QJsonObject probeEnd = events.value("erelative download limit probe");
+        QCOMPARE(probeEnd.value("ts").toDouble() - events.value("brelative download limit probe").value("ts").toDouble(),
+                 2000000.);
+        QCOMPARE(events.value("Cdownload measured rate").value("args").toObject().value("value").toInt(), 50000);
+        QVERIFY(!events.contains("brelative upload limit probe"));
+    }
+};
+
+#endif
@@ -68,6 +68,14 @@ private slots:
         QVERIFY(hasLaunchOnStartup(appName) == false);
     }
 
+    void testJsonString()
+    {
+        QCOMPARE(jsonString(QString()), QByteArray("\"\""));
+        QCOMPARE(jsonString("a \"b\" \\c"), QByteArray("\"a \\\"b\\\" \\\\c\""));
+        QCOMPARE(jsonString("1\n2\t3\r\x01"), QByteArray("\"1\\n2\\t3\\r\\u0001\""));
+        QCOMPARE(jsonString(QString::fromUtf8("\xc3\xa9")), QByteArray("\"\xc3\xa9\""));
+    }
+
     void testToCSyncScheme()
     {
         QVERIFY(toCSyncScheme("http://example.com/owncloud/") ==